@@ -0,0 +1,46 @@
+import argparse
+import os
+
+from bench_common import run_bench, start, stop
+
+def cpu_seconds(pid):
+  """Returns user + system CPU time consumed so far by a process."""
+  with open("/proc/%d/stat" % pid) as f:
+    fields = f.read().rsplit(")", 1)[1].split()
+  return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+def run_scenario(args, delay_us):
+  """Runs one fan-out round where every subscription uses the given batching delay."""
+  server = start(["./server", str(args.port)])
+  try:
+    command = ["./fanout_bench", "127.0.0.1", str(args.port), str(args.subscribers), str(args.messages),
+               str(args.rate)]
+    if delay_us > 0:
+      command += ["delay_us=%d" % delay_us, "batch_bytes=%d" % args.batch_bytes]
+    cpu_before = cpu_seconds(server.pid)
+    result = run_bench(command)
+    result["cpu"] = cpu_seconds(server.pid) - cpu_before
+    return result
+  finally:
+    stop(server)
+
+def main():
+  parser = argparse.ArgumentParser(description="Packets and server CPU per message against the batching window")
+  parser.add_argument("--port", type=int, default=12502)
+  parser.add_argument("--subscribers", type=int, default=10)
+  parser.add_argument("--messages", type=int, default=10000)
+  parser.add_argument("--rate", type=int, default=5000, help="publish rate in msg/s")
+  parser.add_argument("--batch-bytes", type=int, default=65536)
+  parser.add_argument("--delays", default="0,100,1000,5000", help="comma separated delay_us; 0 = immediate")
+  args = parser.parse_args()
+
+  print("%-10s %12s %14s %16s" % ("delay_us", "delivered", "recvs/msg", "server cpu us/msg"))
+  for delay_us in [int(d) for d in args.delays.split(",")]:
+    result = run_scenario(args, delay_us)
+    delivered = int(result["delivered"])
+    per_msg = float(result["recv_calls"]) / delivered if delivered else 0.0
+    cpu_per_msg = result["cpu"] * 1e6 / delivered if delivered else 0.0
+    print("%-10s %12d %14.3f %16.2f" % (delay_us if delay_us > 0 else "immediate", delivered, per_msg, cpu_per_msg))
+
+if __name__ == "__main__":
+  main()
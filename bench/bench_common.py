@@ -0,0 +1,25 @@
+import subprocess
+import time
+
+from subprocess import Popen, PIPE, DEVNULL
+
+def parse_result(line):
+  """Parses a key=value summary line, as printed by the C++ benches."""
+  return dict(field.split("=", 1) for field in line.split())
+
+def start(command):
+  """Starts a server or subscriber that is driven through stdin and gives it time to listen."""
+  process = Popen(command, stdin=PIPE, stdout=DEVNULL, stderr=DEVNULL, universal_newlines=True)
+  time.sleep(0.5)
+  return process
+
+def stop(process):
+  """Asks a process started with start() to exit and waits for it."""
+  process.stdin.write("exit\n")
+  process.stdin.flush()
+  process.wait(timeout=10)
+
+def run_bench(command):
+  """Runs a C++ bench to completion and returns its final summary line."""
+  bench = subprocess.run(command, stdout=PIPE, universal_newlines=True, timeout=600)
+  return parse_result(bench.stdout.strip().splitlines()[-1])
@@ -0,0 +1,333 @@
+import argparse
+import glob
+import os
+import re
+import shutil
+import signal
+import subprocess
+import threading
+import time
+
+from subprocess import Popen, PIPE, DEVNULL, STDOUT
+
+# Alternative brokers kept in the tree. "sf" says how the variant's subscriber
+# takes the store-and-forward flag: None = it cannot request SF at all,
+# "optional" = subscribe <topic> [0|1], "required" = subscribe <topic> <0|1>.
+VARIANTS = [
+  {"name": "current", "server": None, "subscriber": None, "include": [], "sf": "optional"},
+  {"name": "aaaa", "server": ["aaaa/src/server.cpp", "aaaa/lib/*.cpp"],
+   "subscriber": ["aaaa/src/subscriber.cpp", "aaaa/lib/*.cpp"], "include": ["aaaa/include"], "sf": None},
+  {"name": "iaurt", "server": ["iaurt/server.cpp"], "subscriber": ["iaurt/subscriber.cpp"], "include": [], "sf": None},
+  {"name": "vibes-claude-3.7", "server": ["Vibes/Claude 3.7 Thinking/server.cpp"],
+   "subscriber": ["Vibes/Claude 3.7 Thinking/subscriber.cpp"], "include": [], "sf": "required"},
+  {"name": "vibes-gemini-2.5", "server": ["Vibes/Gemini 2.5 Pro/server.cpp"],
+   "subscriber": ["Vibes/Gemini 2.5 Pro/subscriber.cpp"], "include": [], "sf": "required"},
+  {"name": "vibes-gpt-4o", "server": ["Vibes/GPT 4o/server.cpp"], "subscriber": ["Vibes/GPT 4o/subscriber.cpp"],
+   "include": [], "sf": "required"},
+]
+
+SCENARIOS = ["fanout", "wildcard", "sf_replay", "slow_consumer"]
+
+# Matches the printable header written by loadgen --stamp.
+STAMP = re.compile(r"LTS:([0-9a-f]{8}):([0-9a-f]{16}):([0-9a-f]{16})")
+
+class Unsupported(Exception):
+  """Raised when a variant cannot run a scenario."""
+
+class Subscriber:
+  """A variant's own subscriber, with a thread timestamping every stamped line it prints."""
+
+  def __init__(self, variant, client_id, port):
+    command = ["./subscriber", client_id, "127.0.0.1", str(port)]
+    if shutil.which("stdbuf"):
+      command = ["stdbuf", "-oL"] + command
+    self.process = Popen(command, cwd=variant["dir"], stdin=PIPE, stdout=PIPE, stderr=DEVNULL,
+                         universal_newlines=True, bufsize=1)
+    self.received = 0
+    self.latencies = []
+    self.last_arrival = None
+    self.reader = threading.Thread(target=self.read, daemon=True)
+    self.reader.start()
+
+  def read(self):
+    """Records the latency of every stamped message until the subscriber exits."""
+    for line in self.process.stdout:
+      arrival = time.monotonic_ns()
+      match = STAMP.search(line)
+      if match:
+        self.received += 1
+        self.latencies.append(arrival - int(match.group(3), 16))
+        self.last_arrival = arrival
+
+  def send(self, line):
+    """Types one command into the subscriber. The subscribers read stdin with
+    fgets after poll(), so lines that arrive together would sit in the stdio
+    buffer; a short pause lets each one be read on its own wakeup."""
+    self.process.stdin.write(line + "\n")
+    self.process.stdin.flush()
+    time.sleep(0.01)
+
+  def stop(self):
+    """Resumes the subscriber if it was paused, then asks it to exit."""
+    self.process.send_signal(signal.SIGCONT)
+    try:
+      self.send("exit")
+      self.process.wait(timeout=5)
+    except (BrokenPipeError, subprocess.TimeoutExpired):
+      self.process.kill()
+      self.process.wait()
+    self.reader.join(timeout=5)
+
+class Server:
+  """A variant's server, with its peak RSS and CPU time read from procfs."""
+
+  def __init__(self, variant, port):
+    self.process = Popen(["./server", str(port)], cwd=variant["dir"], stdin=PIPE, stdout=DEVNULL, stderr=DEVNULL,
+                         universal_newlines=True)
+    time.sleep(0.5)
+
+  def usage(self):
+    """Returns (peak RSS in MiB, user + system CPU seconds)."""
+    rss = 0.0
+    with open("/proc/%d/status" % self.process.pid) as f:
+      for line in f:
+        if line.startswith("VmHWM:"):
+          rss = int(line.split()[1]) / 1024.0
+    with open("/proc/%d/stat" % self.process.pid) as f:
+      fields = f.read().rsplit(")", 1)[1].split()
+    return rss, (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+  def stop(self):
+    """Sends exit on stdin and kills the server if it does not go away."""
+    try:
+      self.process.stdin.write("exit\n")
+      self.process.stdin.flush()
+      self.process.wait(timeout=5)
+    except (BrokenPipeError, subprocess.TimeoutExpired):
+      self.process.kill()
+      self.process.wait()
+
+def build_variant(args, variant):
+  """Builds a variant into its own directory; returns None or the reason it failed."""
+  directory = os.path.join(args.build_dir, variant["name"])
+  os.makedirs(directory, exist_ok=True)
+  variant["dir"] = directory
+  link = os.path.join(directory, "pcom_hw2_udp_client")
+  if not os.path.exists(link):
+    os.symlink(os.path.abspath("pcom_hw2_udp_client"), link)
+
+  if variant["server"] is None:
+    for binary in ["server", "subscriber"]:
+      shutil.copy(binary, os.path.join(directory, binary))
+    return None
+
+  with open(os.path.join(directory, "build.log"), "w") as log:
+    for binary in ["server", "subscriber"]:
+      sources = []
+      for pattern in variant[binary]:
+        sources += sorted(glob.glob(pattern))
+      if not sources or any(os.path.getsize(source) == 0 for source in sources):
+        return "empty sources"
+      command = ["g++"] + args.cxxflags.split() + ["-I" + include for include in variant["include"]]
+      command += sources + ["-o", os.path.join(directory, binary), "-lm", "-pthread"]
+      if subprocess.run(command, stdout=log, stderr=STDOUT).returncode != 0:
+        return "build failed, see %s" % os.path.join(directory, "build.log")
+  return None
+
+def subscribe_command(variant, topic, sf=False):
+  """Spells a subscribe command the way the variant's subscriber expects it."""
+  if sf:
+    if variant["sf"] is None:
+      raise Unsupported("subscriber cannot request SF")
+    return "subscribe %s 1" % topic
+  return "subscribe %s 0" % topic if variant["sf"] == "required" else "subscribe %s" % topic
+
+def start_subscribers(variant, port, names):
+  """Starts subscribers and gives the server time to read their IDs."""
+  subscribers = [Subscriber(variant, name, port) for name in names]
+  time.sleep(0.5)
+  return subscribers
+
+def publish(args, port, prefix, topics, rate, string_len=0):
+  """Runs loadgen with stamped messages and returns how many it sent."""
+  command = [os.path.abspath("loadgen"), "127.0.0.1", str(port), "--stamp", "--rate", str(rate),
+             "--duration", str(args.duration), "--topics", str(topics), "--prefix", prefix, "--batch", "1"]
+  if string_len > 0:
+    command += ["--string-len", str(string_len)]
+  result = subprocess.run(command, stdout=PIPE, universal_newlines=True, timeout=600)
+  fields = dict(field.split("=", 1) for field in result.stdout.split())
+  return int(fields["sent"])
+
+def wait_for_delivery(subscribers, expected, idle_s):
+  """Waits until every expected message arrived or nothing arrived for idle_s."""
+  last_total = -1
+  last_change = time.monotonic()
+  while True:
+    total = sum(subscriber.received for subscriber in subscribers)
+    if total >= expected:
+      return
+    if total != last_total:
+      last_total = total
+      last_change = time.monotonic()
+    elif time.monotonic() - last_change > idle_s:
+      return
+    time.sleep(0.05)
+
+def summarize(subscribers, expected, start_ns, server, min_elapsed=0.0, latency=True):
+  """Builds one result row from the subscribers that were measured. The rate
+  counts from start_ns to the last delivery, but never over less than
+  min_elapsed, so a broker that stalls early is not credited for it."""
+  delivered = sum(subscriber.received for subscriber in subscribers)
+  arrivals = [subscriber.last_arrival for subscriber in subscribers if subscriber.last_arrival]
+  elapsed = max((max(arrivals) - start_ns) / 1e9 if arrivals else 0.0, min_elapsed)
+  samples = sorted(sample for subscriber in subscribers for sample in subscriber.latencies) if latency else []
+  rss, cpu = server.usage()
+  row = {"delivered": delivered, "expected": expected, "rate": delivered / elapsed if elapsed > 0 else 0.0,
+         "rss": rss, "cpu": cpu}
+  if samples:
+    row["p50"] = samples[len(samples) // 2] / 1e6
+    row["p99"] = samples[len(samples) * 99 // 100] / 1e6
+    row["p999"] = samples[len(samples) * 999 // 1000] / 1e6
+  return row
+
+def scenario_fanout(args, variant, server):
+  """Every subscriber takes every topic through one + pattern."""
+  subscribers = start_subscribers(variant, args.port, ["F%d" % i for i in range(args.subscribers)])
+  try:
+    for subscriber in subscribers:
+      subscriber.send(subscribe_command(variant, "cmp/+"))
+    time.sleep(0.5)
+    start = time.monotonic_ns()
+    sent = publish(args, args.port, "cmp/", args.topics, args.rate)
+    wait_for_delivery(subscribers, sent * len(subscribers), args.idle)
+    return summarize(subscribers, sent * len(subscribers), start, server, args.duration)
+  finally:
+    for subscriber in subscribers:
+      subscriber.stop()
+
+def scenario_wildcard(args, variant, server):
+  """Each subscriber holds many patterns: one + pattern per topic, an overlapping
+  * pattern (a message must still arrive once) and patterns that never match."""
+  subscribers = start_subscribers(variant, args.port, ["W%d" % i for i in range(args.subscribers)])
+  try:
+    patterns = ["cmp/+/%d" % i for i in range(args.topics)] + ["cmp/*"]
+    patterns += ["nomatch/%d/*" % i for i in range(args.patterns)]
+    for subscriber in subscribers:
+      for pattern in patterns:
+        subscriber.send(subscribe_command(variant, pattern))
+    time.sleep(1.0)
+    start = time.monotonic_ns()
+    sent = publish(args, args.port, "cmp/w/", args.topics, args.rate)
+    wait_for_delivery(subscribers, sent * len(subscribers), args.idle)
+    return summarize(subscribers, sent * len(subscribers), start, server, args.duration)
+  finally:
+    for subscriber in subscribers:
+      subscriber.stop()
+
+def scenario_sf_replay(args, variant, server):
+  """An SF subscriber is away while messages are published, then reconnects;
+  the rate is how fast the stored messages are replayed."""
+  command = subscribe_command(variant, "cmp/+", sf=True)
+  away = start_subscribers(variant, args.port, ["SF0"])[0]
+  away.send(command)
+  time.sleep(0.5)
+  away.stop()
+  time.sleep(0.5)
+  sent = publish(args, args.port, "cmp/", args.topics, args.rate)
+  start = time.monotonic_ns()
+  back = Subscriber(variant, "SF0", args.port)
+  try:
+    wait_for_delivery([back], sent, args.idle)
+    return summarize([back], sent, start, server, latency=False)
+  finally:
+    back.stop()
+
+def scenario_slow_consumer(args, variant, server):
+  """One subscriber stops reading (SIGSTOP) while large messages flow; only the
+  healthy subscribers are measured."""
+  names = ["S%d" % i for i in range(args.subscribers)] + ["SLOW"]
+  subscribers = start_subscribers(variant, args.port, names)
+  healthy = subscribers[:-1]
+  try:
+    for subscriber in subscribers:
+      subscriber.send(subscribe_command(variant, "cmp/+"))
+    time.sleep(0.5)
+    subscribers[-1].process.send_signal(signal.SIGSTOP)
+    start = time.monotonic_ns()
+    sent = publish(args, args.port, "cmp/", args.topics, args.slow_rate, args.slow_string_len)
+    wait_for_delivery(healthy, sent * len(healthy), args.idle)
+    return summarize(healthy, sent * len(healthy), start, server, args.duration)
+  finally:
+    for subscriber in subscribers:
+      subscriber.stop()
+
+def run_scenario(args, variant, name):
+  """Runs one scenario against a fresh server of the variant."""
+  server = Server(variant, args.port)
+  try:
+    if server.process.poll() is not None:
+      return {"error": "server did not start"}
+    return globals()["scenario_" + name](args, variant, server)
+  except Unsupported as e:
+    return {"error": str(e)}
+  finally:
+    server.stop()
+
+def run_conformance(variant):
+  """Runs test.py in the variant's directory; returns (passed, total)."""
+  result = subprocess.run(["python3", os.path.abspath("test.py")], cwd=variant["dir"], stdout=PIPE, stderr=STDOUT,
+                          universal_newlines=True, timeout=900)
+  statuses = re.findall(r"\.\.\.\.(passed|failed|not executed|not_executed)", result.stdout)
+  return statuses.count("passed"), len(statuses)
+
+def print_table(results, conformance):
+  """Prints every variant and scenario in one table."""
+  header = "%-18s %-14s %-10s %15s %11s %9s %9s %9s %8s %7s" % (
+    "variant", "conformance", "scenario", "delivered", "msg/s", "p50 ms", "p99 ms", "p99.9 ms", "RSS MiB", "CPU s")
+  print(header)
+  print("-" * len(header))
+  for variant, rows in results:
+    for scenario, row in rows:
+      if "error" in row:
+        print("%-18s %-14s %-10s %s" % (variant, conformance.get(variant, "-"), scenario, row["error"]))
+        continue
+      print("%-18s %-14s %-10s %15s %11.0f %9s %9s %9s %8.1f %7.2f" % (
+        variant, conformance.get(variant, "-"), scenario, "%d/%d" % (row["delivered"], row["expected"]), row["rate"],
+        "%.2f" % row["p50"] if "p50" in row else "-", "%.2f" % row["p99"] if "p99" in row else "-",
+        "%.2f" % row["p999"] if "p999" in row else "-", row["rss"], row["cpu"]))
+
+def main():
+  parser = argparse.ArgumentParser(description="Runs the same scenarios against every broker variant in the tree")
+  parser.add_argument("--port", type=int, default=12504)
+  parser.add_argument("--build-dir", default="compare_build")
+  parser.add_argument("--cxxflags", default="-g -std=c++17 -pthread", help="flags for building the variants")
+  parser.add_argument("--variants", default=",".join(v["name"] for v in VARIANTS))
+  parser.add_argument("--scenarios", default=",".join(SCENARIOS))
+  parser.add_argument("--subscribers", type=int, default=4)
+  parser.add_argument("--topics", type=int, default=8)
+  parser.add_argument("--patterns", type=int, default=32, help="non-matching patterns per wildcard subscriber")
+  parser.add_argument("--rate", type=int, default=2000, help="publish rate in msg/s")
+  parser.add_argument("--duration", type=float, default=2.0)
+  parser.add_argument("--slow-rate", type=int, default=10000, help="publish rate of the slow consumer scenario")
+  parser.add_argument("--slow-string-len", type=int, default=1400)
+  parser.add_argument("--idle", type=float, default=2.0, help="seconds without deliveries that end a scenario")
+  parser.add_argument("--no-conformance", action="store_true", help="skip running test.py against each variant")
+  args = parser.parse_args()
+
+  wanted = args.variants.split(",")
+  results = []
+  conformance = {}
+  for variant in [v for v in VARIANTS if v["name"] in wanted]:
+    failure = build_variant(args, variant)
+    if failure:
+      results.append((variant["name"], [("build", {"error": failure})]))
+      continue
+    if not args.no_conformance:
+      passed, total = run_conformance(variant)
+      conformance[variant["name"]] = "%d/%d" % (passed, total)
+    rows = [(scenario, run_scenario(args, variant, scenario)) for scenario in args.scenarios.split(",")]
+    results.append((variant["name"], rows))
+  print_table(results, conformance)
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,326 @@
+#include "broker_core.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define CORE_GROUPS 8
+#define CORE_FIRST_SOCKET 1000
+#define CORE_WARMUP_MESSAGES 1000
+
+using Clock = std::chrono::steady_clock;
+
+// Stands in for the subscriber sockets: every write is taken whole and only
+// counted, so the measured time is the broker's own work.
+class MemoryTransport : public BrokerTransport
+{
+public:
+    std::vector<uint64_t> bytes;
+    std::vector<uint64_t> writes;
+
+    explicit MemoryTransport(size_t connections) : bytes(connections), writes(connections) {}
+
+    ssize_t send(int connection, const char *, size_t len) override
+    {
+        bytes[connection - CORE_FIRST_SOCKET] += len;
+        writes[connection - CORE_FIRST_SOCKET]++;
+        return static_cast<ssize_t>(len);
+    }
+};
+
+struct CoreConfig
+{
+    uint64_t messages = 20000;
+    size_t subscribers = 100;
+    size_t topics = 256;
+    size_t delay_us = 0;
+    size_t turn = 1;
+    size_t batch_frames = 0;
+    size_t dictionary = 0;
+    size_t shared_patterns = 0;
+    size_t overlap = 0;
+    std::string where;
+};
+
+static bool parse_arguments(int argc, char *argv[], CoreConfig &config);
+static std::string topic_name(size_t index);
+static std::vector<std::string> subscribe_commands(size_t subscriber, const CoreConfig &config);
+static std::vector<std::string> make_datagrams(const CoreConfig &config);
+static uint64_t cycle_counter();
+
+int main(int argc, char *argv[])
+{
+    CoreConfig config;
+    if (!parse_arguments(argc, argv, config))
+    {
+        return 1;
+    }
+
+    ServerConfig server_config;
+    ServerContext ctx(server_config);
+    MemoryTransport transport(config.subscribers);
+    ctx.transport = &transport;
+
+    for (size_t i = 0; i < config.subscribers; ++i)
+    {
+        connect_subscriber(ctx, "C" + std::to_string(i), static_cast<int>(CORE_FIRST_SOCKET + i));
+    }
+    // Subscriptions go through the same command parser the TCP clients use;
+    // the heap they take is what the subscribers' pattern tables cost.
+    size_t heap_before = mallinfo2().uordblks;
+    size_t subscriptions = 0;
+    size_t covered = 0;
+    for (size_t i = 0; i < config.subscribers; ++i)
+    {
+        Subscriber &sub = ctx.subscribers["C" + std::to_string(i)];
+        for (const std::string &command : subscribe_commands(i, config))
+        {
+            sub.command_buffer.write(command.data(), command.size());
+            process_commands_from_buffer(ctx, sub);
+        }
+        subscriptions += sub.topics.size();
+        covered += sub.topics.covered_count();
+    }
+    size_t subscription_bytes = mallinfo2().uordblks - heap_before;
+
+    std::vector<std::string> datagrams = make_datagrams(config);
+    struct sockaddr_in sender_addr;
+    memset(&sender_addr, 0, sizeof(sender_addr));
+    sender_addr.sin_family = AF_INET;
+    sender_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sender_addr.sin_port = htons(40000);
+
+    for (uint64_t i = 0; i < CORE_WARMUP_MESSAGES; ++i)
+    {
+        const std::string &datagram = datagrams[i % datagrams.size()];
+        process_datagram(ctx, datagram.data(), static_cast<int>(datagram.size()), sender_addr);
+        if ((i + 1) % config.turn == 0)
+        {
+            flush_turn_batches(ctx);
+            run_flush_timers(ctx);
+        }
+    }
+    uint64_t warmup_matched = ctx.stats.get(STAT_MESSAGES_MATCHED);
+    uint64_t warmup_filtered = ctx.stats.get(STAT_MESSAGES_FILTERED);
+    uint64_t warmup_bytes = ctx.stats.get(STAT_BYTES_SENT);
+    transport.writes.assign(config.subscribers, 0);
+    LatencyReport warmup_latency;
+    ctx.latency.accumulate_into(warmup_latency);
+
+    auto start = Clock::now();
+    uint64_t start_cycles = cycle_counter();
+    for (uint64_t i = 0; i < config.messages; ++i)
+    {
+        const std::string &datagram = datagrams[i % datagrams.size()];
+        process_datagram(ctx, datagram.data(), static_cast<int>(datagram.size()), sender_addr);
+        if ((i + 1) % config.turn == 0)
+        {
+            flush_turn_batches(ctx);
+            run_flush_timers(ctx);
+        }
+    }
+    flush_turn_batches(ctx);
+    uint64_t cycles = cycle_counter() - start_cycles;
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    uint64_t deliveries = ctx.stats.get(STAT_MESSAGES_MATCHED) - warmup_matched;
+    uint64_t filtered = ctx.stats.get(STAT_MESSAGES_FILTERED) - warmup_filtered;
+    uint64_t bytes = ctx.stats.get(STAT_BYTES_SENT) - warmup_bytes;
+    LatencyReport latency;
+    ctx.latency.accumulate_into(latency);
+    latency.subtract(warmup_latency);
+    const HistogramSnapshot &match = latency.stages[STAGE_MATCH];
+    uint64_t writes = 0;
+    for (uint64_t count : transport.writes)
+    {
+        writes += count;
+    }
+
+    printf("messages: %llu\n", (unsigned long long)config.messages);
+    printf("subscribers: %zu\n", config.subscribers);
+    printf("topics: %zu\n", config.topics);
+    printf("subscriptions: %zu (%.1f heap bytes each, %zu covered)\n", subscriptions,
+           subscriptions > 0 ? (double)subscription_bytes / subscriptions : 0.0, covered);
+    printf("deliveries: %llu (fan-out %.2f)\n", (unsigned long long)deliveries, (double)deliveries / config.messages);
+    printf("filtered: %llu\n", (unsigned long long)filtered);
+    printf("bytes: %llu (%.1f per delivery)\n", (unsigned long long)bytes, deliveries > 0 ? (double)bytes / deliveries : 0.0);
+    printf("transport_writes: %llu\n", (unsigned long long)writes);
+    printf("elapsed_s: %.3f\n", elapsed);
+    printf("ns_per_message: %.1f\n", elapsed * 1e9 / config.messages);
+    printf("ns_per_delivery: %.1f\n", deliveries > 0 ? elapsed * 1e9 / deliveries : 0.0);
+    // Without STAGE_LATENCY there is no match stage to report.
+    if (match.total > 0)
+    {
+        printf("match_ns_per_message: %.1f\n", (double)match.sum * tsc_ns_per_tick() / match.total);
+    }
+    if (cycles > 0)
+    {
+        printf("cycles_per_message: %.0f\n", (double)cycles / config.messages);
+    }
+    printf("messages_per_s: %.0f\n", config.messages / elapsed);
+    return 0;
+}
+
+static bool parse_arguments(int argc, char *argv[], CoreConfig &config)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Usage: " << argv[0] << " [--messages N] [--subscribers N] [--topics N] [--delay-us US]"
+                      << " [--turn MESSAGES] [--batch-frames 0|1] [--dictionary 0|1] [--shared-patterns N] [--overlap N]"
+                      << " [--where PREDICATE]" << std::endl;
+            return false;
+        }
+        if (option == "--where")
+        {
+            config.where = argv[++i];
+            continue;
+        }
+        size_t value;
+        if (!parse_size_value(argv[++i], value))
+        {
+            std::cerr << "ERROR: Invalid value for option " << option << "." << std::endl;
+            return false;
+        }
+        if (option == "--messages")
+        {
+            config.messages = value;
+        }
+        else if (option == "--subscribers")
+        {
+            config.subscribers = value;
+        }
+        else if (option == "--topics")
+        {
+            config.topics = value;
+        }
+        else if (option == "--delay-us")
+        {
+            config.delay_us = value;
+        }
+        else if (option == "--turn")
+        {
+            config.turn = value;
+        }
+        else if (option == "--batch-frames")
+        {
+            config.batch_frames = value;
+        }
+        else if (option == "--dictionary")
+        {
+            config.dictionary = value;
+        }
+        else if (option == "--shared-patterns")
+        {
+            config.shared_patterns = value;
+        }
+        else if (option == "--overlap")
+        {
+            config.overlap = value;
+        }
+        else
+        {
+            std::cerr << "ERROR: Unknown option " << option << "." << std::endl;
+            return false;
+        }
+    }
+    if (config.messages == 0 || config.subscribers == 0 || config.turn == 0 || config.topics < CORE_GROUPS ||
+        config.delay_us > MAX_BATCH_DELAY_US || config.batch_frames > 1 || config.dictionary > 1)
+    {
+        std::cerr << "ERROR: Need messages, subscribers and turn > 0, at least " << CORE_GROUPS << " topics, a delay up to "
+                  << MAX_BATCH_DELAY_US << " us and --batch-frames/--dictionary 0 or 1." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static std::string topic_name(size_t index)
+{
+    return "bench/g" + std::to_string(index % CORE_GROUPS) + "/sensor" + std::to_string(index) + "/value";
+}
+
+// Each subscriber picks its frame encoding, then holds one exact topic, a +
+// pattern over its group (an eighth of the topics, narrowed by --where) and
+// two patterns that never match, the way a client of the test scenarios
+// mixes exact and wildcard subscriptions. --shared-patterns adds the same N
+// non-matching patterns to every subscriber. --overlap N adds what a
+// dashboard over the group also asks for: its whole subtree with SF and N
+// single sensors and wildcards inside it, all covered by the subtree.
+static std::vector<std::string> subscribe_commands(size_t subscriber, const CoreConfig &config)
+{
+    std::string group = "g" + std::to_string(subscriber % CORE_GROUPS);
+    std::string window = config.delay_us > 0 ? " delay_us=" + std::to_string(config.delay_us) : "";
+    std::string where = config.where.empty() ? "" : " where=" + config.where;
+    std::vector<std::string> commands = {
+        std::string("frames ") + (config.batch_frames ? "batch" : "single") + (config.dictionary ? " dict" : "") + "\n",
+        "subscribe " + topic_name(subscriber * 7 % config.topics) + " 0" + window + "\n",
+        "subscribe bench/" + group + "/+/value 0" + window + where + "\n",
+        "subscribe bench/" + group + "/*/alarm 0\n",
+        "subscribe other/" + std::to_string(subscriber) + "/* 0\n",
+    };
+    for (size_t i = 0; i < config.shared_patterns; ++i)
+    {
+        commands.push_back("subscribe shared/" + std::to_string(i) + "/+/value 0\n");
+    }
+    if (config.overlap > 0)
+    {
+        commands.push_back("subscribe bench/" + group + "/* 1\n");
+        commands.push_back("subscribe bench/" + group + "/+/alarm 0\n");
+    }
+    for (size_t i = 0; i < config.overlap; ++i)
+    {
+        size_t topic = (subscriber % CORE_GROUPS + CORE_GROUPS * (subscriber + i)) % config.topics;
+        commands.push_back("subscribe " + topic_name(topic) + " " + std::to_string(i % 2) + "\n");
+    }
+    return commands;
+}
+
+// Cycles through the four payload types of the UDP client; the INT reading of
+// a topic is its index, so a predicate can keep any share of them.
+static std::vector<std::string> make_datagrams(const CoreConfig &config)
+{
+    std::vector<std::string> datagrams;
+    for (size_t i = 0; i < config.topics; ++i)
+    {
+        std::string datagram(TOPIC_SIZE, '\0');
+        std::string topic = topic_name(i);
+        memcpy(&datagram[0], topic.data(), std::min(topic.size(), (size_t)TOPIC_SIZE));
+        uint8_t type = i % 4;
+        datagram.push_back(static_cast<char>(type));
+        if (type == 0)
+        {
+            uint32_t net_value = htonl(static_cast<uint32_t>(i));
+            datagram.push_back('\0');
+            datagram.append(reinterpret_cast<const char *>(&net_value), sizeof(net_value));
+        }
+        else if (type == 1)
+        {
+            datagram += std::string("\x09\x01", 2);
+        }
+        else if (type == 2)
+        {
+            datagram += std::string("\x00\x00\x12\xd6\x87\x04", 6);
+        }
+        else
+        {
+            datagram += "Lecture: Network Protocols";
+        }
+        datagrams.push_back(datagram);
+    }
+    return datagrams;
+}
+
+static uint64_t cycle_counter()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,97 @@
+import argparse
+import subprocess
+import time
+
+from subprocess import Popen, PIPE, DEVNULL
+
+def parse_result(line):
+  """Parses one key=value line of the subscriber --measure summary."""
+  return dict(field.split("=", 1) for field in line.split())
+
+def server_address(args, kind):
+  """Address of the server's stream or datagram side for the chosen transport."""
+  if getattr(args, "transport", "loopback") == "unix":
+    return "unix:%s.%s" % (args.unix_path, kind)
+  return "127.0.0.1"
+
+def start_subscriber(args, index):
+  """Connects a measuring subscriber."""
+  return Popen(["./subscriber", "E2E%d" % index, server_address(args, "sock"), str(args.port), "--measure"],
+               stdin=PIPE, stdout=PIPE, stderr=DEVNULL, universal_newlines=True)
+
+def subscribe(args, subscriber):
+  """Subscribes a connected subscriber to every load topic."""
+  subscriber.stdin.write("subscribe %s+\n" % args.prefix)
+  subscriber.stdin.flush()
+
+def stop_subscriber(subscriber):
+  """Asks a subscriber to exit and returns its per-topic results."""
+  output, _ = subscriber.communicate("exit\n", timeout=30)
+  return [parse_result(line) for line in output.splitlines() if line.startswith("topic=")]
+
+def print_row(label, result):
+  """Prints one summary row."""
+  print("%-16s %10s %8s %10s %9s %9s %10s %10s" % (label, result["received"], result["lost"], result["reordered"],
+                                                   result.get("p50_us", "-"), result.get("p99_us", "-"),
+                                                   result.get("p999_us", "-"), result.get("max_us", "-")))
+
+def run_scenario(args):
+  """Starts a server, measuring subscribers and loadgen; returns the loadgen summary and per-subscriber results."""
+  server_args = args.server_args.split()
+  if getattr(args, "transport", "loopback") == "unix":
+    server_args += ["--unix", args.unix_path + ".sock", "--unix-dgram", args.unix_path + ".dgram"]
+  server = Popen(["./server", str(args.port)] + server_args, stdin=PIPE, stdout=DEVNULL,
+                 stderr=DEVNULL, universal_newlines=True)
+  time.sleep(0.5)
+  try:
+    subscribers = [start_subscriber(args, i) for i in range(args.subscribers)]
+    # The server reads the client ID on its own, so give it time to do that
+    # before the subscribe command follows on the same connection.
+    time.sleep(0.5)
+    for subscriber in subscribers:
+      subscribe(args, subscriber)
+    time.sleep(0.5)
+    load = subprocess.run(["./loadgen", server_address(args, "dgram"), str(args.port), "--stamp", "--rate",
+                           str(args.rate), "--duration", str(args.duration), "--topics", str(args.topics),
+                           "--batch", str(args.batch), "--prefix", args.prefix],
+                          stdout=PIPE, universal_newlines=True, timeout=600)
+    sent = parse_result(load.stdout.strip().splitlines()[-1])
+    time.sleep(1.0)
+    results = [stop_subscriber(subscriber) for subscriber in subscribers]
+  finally:
+    server.stdin.write("exit\n")
+    server.stdin.flush()
+    server.wait(timeout=5)
+  return sent, results
+
+def main():
+  parser = argparse.ArgumentParser(description="Publish-to-delivery latency with stamped loadgen traffic")
+  parser.add_argument("--port", type=int, default=12503)
+  parser.add_argument("--subscribers", type=int, default=2)
+  parser.add_argument("--topics", type=int, default=8)
+  parser.add_argument("--rate", type=int, default=20000, help="total publish rate in msg/s")
+  parser.add_argument("--duration", type=float, default=3.0)
+  parser.add_argument("--batch", type=int, default=1, help="datagrams per sendmmsg call")
+  parser.add_argument("--prefix", default="e2e/")
+  parser.add_argument("--server-args", default="", help="extra server options, e.g. \"--pipeline 2\"")
+  parser.add_argument("--transport", choices=["loopback", "unix"], default="loopback",
+                      help="clients reach the server over TCP/UDP loopback or its Unix sockets")
+  parser.add_argument("--unix-path", default="/tmp/e2e_bench", help="prefix of the Unix socket paths")
+  args = parser.parse_args()
+
+  sent, results = run_scenario(args)
+
+  print("published %s messages at %s msg/s to %d topics, %d subscribers" % (sent["sent"], sent["rate"], args.topics,
+                                                                             args.subscribers))
+  print("%-16s %10s %8s %10s %9s %9s %10s %10s" % ("topic", "received", "lost", "reordered", "p50 us", "p99 us",
+                                                   "p99.9 us", "max us"))
+  for result in results[0]:
+    if result["topic"] != "ALL":
+      print_row(result["topic"], result)
+  for index, subscriber_results in enumerate(results):
+    totals = [result for result in subscriber_results if result["topic"] == "ALL"]
+    if totals:
+      print_row("ALL (E2E%d)" % index, totals[0])
+
+if __name__ == "__main__":
+  main()
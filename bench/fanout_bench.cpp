@@ -0,0 +1,224 @@
+#include "common.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#define FANOUT_TOPIC "bench/fanout"
+#define FANOUT_IDLE_TIMEOUT_MS 2000
+#define FANOUT_SETTLE_MS 300
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchConnection
+{
+    int socket = -1;
+    std::vector<char> pending;
+    uint64_t frames = 0;
+};
+
+static int connect_subscriber(const struct sockaddr_in &server_addr, size_t index);
+static void publish(const struct sockaddr_in &server_addr, uint64_t messages, uint64_t rate);
+static size_t consume_frames(BenchConnection &conn, const char *data, size_t len);
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5)
+    {
+        std::cerr << "Usage: " << argv[0] << " <IP_SERVER> <PORT_SERVER> <SUBSCRIBERS> <MESSAGES> [RATE] [--subscribe-port PORT] [SUBSCRIBE_OPTIONS...]" << std::endl;
+        return 1;
+    }
+    size_t subscribers = strtoull(argv[3], NULL, 10);
+    uint64_t messages = strtoull(argv[4], NULL, 10);
+    uint64_t rate = argc > 5 ? strtoull(argv[5], NULL, 10) : 0;
+    if (subscribers == 0 || messages == 0)
+    {
+        std::cerr << "ERROR: Invalid subscriber or message count." << std::endl;
+        return 1;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(atoi(argv[2]));
+    if (inet_pton(AF_INET, argv[1], &server_addr.sin_addr) <= 0)
+    {
+        error("ERROR invalid server IP address");
+    }
+    raise_fd_limit();
+
+    // --subscribe-port points the subscribers at an edge relay on the same
+    // host while the messages are still published to the broker.
+    struct sockaddr_in subscribe_addr = server_addr;
+    std::string options;
+    for (int i = 6; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--subscribe-port" && i + 1 < argc)
+        {
+            subscribe_addr.sin_port = htons(atoi(argv[++i]));
+        }
+        else
+        {
+            options += std::string(" ") + argv[i];
+        }
+    }
+
+    std::vector<BenchConnection> conns(subscribers);
+    std::vector<struct pollfd> poll_fds(subscribers);
+    for (size_t i = 0; i < subscribers; ++i)
+    {
+        conns[i].socket = connect_subscriber(subscribe_addr, i);
+        poll_fds[i] = {conns[i].socket, POLLIN, 0};
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(FANOUT_SETTLE_MS));
+    std::string cmd = std::string("subscribe ") + FANOUT_TOPIC + " 0" + options + "\n";
+    for (BenchConnection &conn : conns)
+    {
+        if (send_all(conn.socket, cmd.c_str(), cmd.size(), 0) < 0)
+        {
+            error("ERROR sending subscribe");
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(FANOUT_SETTLE_MS));
+
+    std::atomic<bool> published(false);
+    auto start = Clock::now();
+    std::thread publisher([&]()
+                          {
+        publish(server_addr, messages, rate);
+        published.store(true); });
+
+    uint64_t expected = messages * subscribers;
+    uint64_t delivered = 0;
+    uint64_t recv_calls = 0;
+    auto last_progress = Clock::now();
+    auto last_delivery = start;
+    char buffer[64 * 1024];
+    while (delivered < expected)
+    {
+        int ready = poll(poll_fds.data(), poll_fds.size(), 100);
+        if (ready < 0 && errno != EINTR)
+        {
+            error("ERROR on poll");
+        }
+        for (size_t i = 0; ready > 0 && i < poll_fds.size(); ++i)
+        {
+            if (!(poll_fds[i].revents & POLLIN))
+            {
+                continue;
+            }
+            ssize_t n = recv(poll_fds[i].fd, buffer, sizeof(buffer), 0);
+            if (n <= 0)
+            {
+                poll_fds[i].fd = -1;
+                continue;
+            }
+            recv_calls++;
+            size_t frames = consume_frames(conns[i], buffer, n);
+            if (frames > 0)
+            {
+                delivered += frames;
+                last_progress = Clock::now();
+                last_delivery = last_progress;
+            }
+        }
+        if (published.load() && Clock::now() - last_progress > std::chrono::milliseconds(FANOUT_IDLE_TIMEOUT_MS))
+        {
+            break;
+        }
+        if (!published.load())
+        {
+            last_progress = Clock::now();
+        }
+    }
+    publisher.join();
+
+    double seconds = std::chrono::duration<double>(last_delivery - start).count();
+    printf("subscribers=%zu messages=%llu delivered=%llu expected=%llu elapsed=%.3f deliveries_per_sec=%.0f recv_calls=%llu\n",
+           subscribers, (unsigned long long)messages, (unsigned long long)delivered,
+           (unsigned long long)expected, seconds, seconds > 0 ? delivered / seconds : 0.0,
+           (unsigned long long)recv_calls);
+
+    for (BenchConnection &conn : conns)
+    {
+        close(conn.socket);
+    }
+    return 0;
+}
+
+static int connect_subscriber(const struct sockaddr_in &server_addr, size_t index)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        error("ERROR opening socket");
+    }
+    int flag = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(int));
+    if (connect(sock, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        error("ERROR connecting to server");
+    }
+    std::string id = "B" + std::to_string(index);
+    if (send_all(sock, id.c_str(), id.size() + 1, 0) < 0)
+    {
+        error("ERROR sending client ID");
+    }
+    return sock;
+}
+
+static void publish(const struct sockaddr_in &server_addr, uint64_t messages, uint64_t rate)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+    {
+        error("ERROR opening UDP socket");
+    }
+    char datagram[TOPIC_SIZE + 1 + 5];
+    memset(datagram, 0, sizeof(datagram));
+    memcpy(datagram, FANOUT_TOPIC, strlen(FANOUT_TOPIC));
+    datagram[TOPIC_SIZE] = 0;
+
+    auto start = Clock::now();
+    for (uint64_t i = 0; i < messages; ++i)
+    {
+        uint32_t net_val = htonl(static_cast<uint32_t>(i));
+        memcpy(datagram + TOPIC_SIZE + 2, &net_val, sizeof(net_val));
+        if (sendto(sock, datagram, sizeof(datagram), 0, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+        {
+            perror("WARN: sendto failed");
+        }
+        if (rate > 0)
+        {
+            auto due = start + std::chrono::nanoseconds((i + 1) * 1000000000ULL / rate);
+            while (Clock::now() < due)
+            {
+            }
+        }
+    }
+    close(sock);
+}
+
+static size_t consume_frames(BenchConnection &conn, const char *data, size_t len)
+{
+    conn.pending.insert(conn.pending.end(), data, data + len);
+    size_t offset = 0;
+    size_t frames = 0;
+    while (conn.pending.size() - offset >= sizeof(uint32_t))
+    {
+        uint32_t net_len;
+        memcpy(&net_len, conn.pending.data() + offset, sizeof(net_len));
+        size_t frame_len = sizeof(uint32_t) + ntohl(net_len);
+        if (conn.pending.size() - offset < frame_len)
+        {
+            break;
+        }
+        offset += frame_len;
+        frames++;
+    }
+    conn.pending.erase(conn.pending.begin(), conn.pending.begin() + offset);
+    conn.frames += frames;
+    return frames;
+}
@@ -0,0 +1,282 @@
+#include "common.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GROUP_TOPIC_PREFIX "bench/group/t"
+#define GROUP_PATTERN "bench/group/+"
+#define GROUP_NAME "workers"
+#define GROUP_IDLE_TIMEOUT_MS 3000
+#define GROUP_SETTLE_MS 300
+
+using Clock = std::chrono::steady_clock;
+
+// One worker of the pool. Every frame costs it `work_us` of waiting, the way
+// a consumer that writes each message somewhere else would spend it.
+struct Consumer
+{
+    int socket = -1;
+    std::vector<char> pending;
+    uint64_t processed = 0;
+    std::set<std::string> topics;
+};
+
+struct BenchState
+{
+    std::atomic<uint64_t> processed{0};
+    std::atomic<int64_t> last_frame_ns{0};
+    Clock::time_point start;
+    uint64_t work_us = 0;
+};
+
+static int connect_consumer(const struct sockaddr_in &server_addr, size_t index);
+static void run_consumer(Consumer &consumer, BenchState &state);
+static size_t consume_frames(Consumer &consumer, BenchState &state);
+static void publish(const struct sockaddr_in &server_addr, uint64_t messages, uint64_t rate, size_t topics);
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5)
+    {
+        std::cerr << "Usage: " << argv[0] << " <IP_SERVER> <PORT_SERVER> <MEMBERS> <MESSAGES> [--mode broadcast|rr|least|hash]"
+                  << " [--work-us US] [--rate R] [--topics K]" << std::endl;
+        return 1;
+    }
+    size_t members = strtoull(argv[3], NULL, 10);
+    uint64_t messages = strtoull(argv[4], NULL, 10);
+    std::string mode = "rr";
+    uint64_t work_us = 200;
+    uint64_t rate = 20000;
+    size_t topics = 16;
+    for (int i = 5; i + 1 < argc; i += 2)
+    {
+        std::string option = argv[i];
+        if (option == "--mode")
+        {
+            mode = argv[i + 1];
+        }
+        else if (option == "--work-us")
+        {
+            work_us = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (option == "--rate")
+        {
+            rate = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (option == "--topics")
+        {
+            topics = strtoull(argv[i + 1], NULL, 10);
+        }
+        else
+        {
+            std::cerr << "ERROR: Unknown option " << option << "." << std::endl;
+            return 1;
+        }
+    }
+    if (members == 0 || messages == 0 || topics == 0 ||
+        (mode != "broadcast" && mode != "rr" && mode != "least" && mode != "hash"))
+    {
+        std::cerr << "ERROR: Invalid member count, message count, topic count or mode." << std::endl;
+        return 1;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(atoi(argv[2]));
+    if (inet_pton(AF_INET, argv[1], &server_addr.sin_addr) <= 0)
+    {
+        error("ERROR invalid server IP address");
+    }
+    raise_fd_limit();
+
+    // SF keeps the broker from shedding while the pool is behind: the
+    // comparison is about how fast the pool drains, not what it drops.
+    std::string cmd = std::string("subscribe ") + GROUP_PATTERN + " 1";
+    if (mode != "broadcast")
+    {
+        cmd += std::string(" group=") + GROUP_NAME + " policy=" + mode;
+    }
+    cmd += "\n";
+    std::vector<Consumer> consumers(members);
+    for (size_t i = 0; i < members; ++i)
+    {
+        consumers[i].socket = connect_consumer(server_addr, i);
+        if (send_all(consumers[i].socket, cmd.c_str(), cmd.size(), 0) < 0)
+        {
+            error("ERROR sending subscribe");
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(GROUP_SETTLE_MS));
+
+    BenchState state;
+    state.work_us = work_us;
+    state.start = Clock::now();
+    std::vector<std::thread> threads;
+    for (Consumer &consumer : consumers)
+    {
+        threads.emplace_back(run_consumer, std::ref(consumer), std::ref(state));
+    }
+    publish(server_addr, messages, rate, topics);
+
+    uint64_t expected = mode == "broadcast" ? messages * members : messages;
+    uint64_t seen = 0;
+    auto last_progress = Clock::now();
+    while (state.processed.load() < expected &&
+           Clock::now() - last_progress < std::chrono::milliseconds(GROUP_IDLE_TIMEOUT_MS))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        if (state.processed.load() != seen)
+        {
+            seen = state.processed.load();
+            last_progress = Clock::now();
+        }
+    }
+    for (Consumer &consumer : consumers)
+    {
+        shutdown(consumer.socket, SHUT_RDWR);
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    uint64_t processed = state.processed.load();
+    double seconds = state.last_frame_ns.load() / 1e9;
+    uint64_t min_share = UINT64_MAX;
+    uint64_t max_share = 0;
+    std::vector<size_t> topic_members(topics, 0);
+    for (Consumer &consumer : consumers)
+    {
+        min_share = std::min(min_share, consumer.processed);
+        max_share = std::max(max_share, consumer.processed);
+        for (const std::string &topic : consumer.topics)
+        {
+            size_t index = strtoull(topic.c_str() + strlen(GROUP_TOPIC_PREFIX), NULL, 10);
+            if (index < topics)
+            {
+                topic_members[index]++;
+            }
+        }
+        close(consumer.socket);
+    }
+    size_t topics_split = std::count_if(topic_members.begin(), topic_members.end(), [](size_t n)
+                                        { return n > 1; });
+    // A message counts as handled once: in broadcast mode that is when the
+    // slowest member is through with it.
+    printf("members=%zu mode=%s messages=%llu processed=%llu expected=%llu elapsed=%.3f msgs_per_sec=%.0f "
+           "min_share=%llu max_share=%llu topics_split=%zu\n",
+           members, mode.c_str(), (unsigned long long)messages, (unsigned long long)processed,
+           (unsigned long long)expected, seconds, seconds > 0 ? messages / seconds : 0.0,
+           (unsigned long long)min_share, (unsigned long long)max_share, topics_split);
+    return 0;
+}
+
+static int connect_consumer(const struct sockaddr_in &server_addr, size_t index)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        error("ERROR opening socket");
+    }
+    int flag = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(int));
+    if (connect(sock, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        error("ERROR connecting to server");
+    }
+    std::string id = "G" + std::to_string(index);
+    if (send_all(sock, id.c_str(), id.size() + 1, 0) < 0)
+    {
+        error("ERROR sending client ID");
+    }
+    return sock;
+}
+
+static void run_consumer(Consumer &consumer, BenchState &state)
+{
+    char buffer[64 * 1024];
+    while (true)
+    {
+        ssize_t n = recv(consumer.socket, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+        {
+            return;
+        }
+        consumer.pending.insert(consumer.pending.end(), buffer, buffer + n);
+        consume_frames(consumer, state);
+    }
+}
+
+// Frames are plain: [u32 len][ip4][port2][tlen u8][topic][type u8][u16 clen][content].
+static size_t consume_frames(Consumer &consumer, BenchState &state)
+{
+    size_t offset = 0;
+    size_t frames = 0;
+    while (consumer.pending.size() - offset >= sizeof(uint32_t))
+    {
+        uint32_t net_len;
+        memcpy(&net_len, consumer.pending.data() + offset, sizeof(net_len));
+        size_t frame_len = sizeof(uint32_t) + ntohl(net_len);
+        if (consumer.pending.size() - offset < frame_len)
+        {
+            break;
+        }
+        const char *frame = consumer.pending.data() + offset + sizeof(uint32_t);
+        size_t topic_len = static_cast<uint8_t>(frame[6]);
+        consumer.topics.emplace(frame + 7, topic_len);
+        if (state.work_us > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(state.work_us));
+        }
+        offset += frame_len;
+        frames++;
+        consumer.processed++;
+        state.processed.fetch_add(1);
+        int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - state.start).count();
+        int64_t last = state.last_frame_ns.load();
+        while (now_ns > last && !state.last_frame_ns.compare_exchange_weak(last, now_ns))
+        {
+        }
+    }
+    consumer.pending.erase(consumer.pending.begin(), consumer.pending.begin() + offset);
+    return frames;
+}
+
+// Paced in small bursts with sleeps, so the publisher does not take a CPU
+// away from the workers it is measuring.
+static void publish(const struct sockaddr_in &server_addr, uint64_t messages, uint64_t rate, size_t topics)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+    {
+        error("ERROR opening UDP socket");
+    }
+    char datagram[TOPIC_SIZE + 1 + 5];
+    auto start = Clock::now();
+    for (uint64_t i = 0; i < messages; ++i)
+    {
+        memset(datagram, 0, sizeof(datagram));
+        // Scrambled so that the topic sequence does not line up with a
+        // round-robin over the members.
+        std::string topic = GROUP_TOPIC_PREFIX + std::to_string(((i * 2654435761ULL) >> 16) % topics);
+        memcpy(datagram, topic.c_str(), topic.size());
+        uint32_t net_val = htonl(static_cast<uint32_t>(i));
+        memcpy(datagram + TOPIC_SIZE + 2, &net_val, sizeof(net_val));
+        if (sendto(sock, datagram, sizeof(datagram), 0, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+        {
+            perror("WARN: sendto failed");
+        }
+        if (rate > 0 && i % 64 == 63)
+        {
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds((i + 1) * 1000000000ULL / rate));
+        }
+    }
+    close(sock);
+}
@@ -0,0 +1,36 @@
+import argparse
+
+from bench_common import run_bench, start, stop
+
+def run_scenario(args, mode, members):
+  """Runs one worker pool of the given size against a fresh server."""
+  server = start(["./server", str(args.port)])
+  try:
+    return run_bench(["./group_bench", "127.0.0.1", str(args.port), str(members), str(args.messages),
+                      "--mode", mode, "--work-us", str(args.work_us), "--rate", str(args.rate),
+                      "--topics", str(args.topics)])
+  finally:
+    stop(server)
+
+def main():
+  parser = argparse.ArgumentParser(description="Worker pool throughput with shared subscriptions against broadcast")
+  parser.add_argument("--port", type=int, default=12508)
+  parser.add_argument("--members", default="1,2,4,8,16", help="comma separated pool sizes")
+  parser.add_argument("--modes", default="broadcast,rr,least,hash")
+  parser.add_argument("--messages", type=int, default=10000)
+  parser.add_argument("--work-us", type=int, default=200, help="time each worker spends on a message")
+  parser.add_argument("--rate", type=int, default=20000, help="publish rate in msg/s")
+  parser.add_argument("--topics", type=int, default=16)
+  args = parser.parse_args()
+
+  print("%-10s %-8s %10s %10s %10s %10s %10s %13s" % ("mode", "members", "processed", "elapsed", "msgs/s",
+                                                      "min share", "max share", "topics split"))
+  for mode in args.modes.split(","):
+    for members in [int(count) for count in args.members.split(",")]:
+      result = run_scenario(args, mode, members)
+      print("%-10s %-8d %10s %10s %10s %10s %10s %13s" % (mode, members, result["processed"], result["elapsed"],
+                                                          result["msgs_per_sec"], result["min_share"],
+                                                          result["max_share"], result["topics_split"]))
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,191 @@
+#include "subscription_index.h"
+#include "topic_match.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CHURN_SUBSCRIBERS 1000
+#define CHURN_TOPICS 64
+#define CHURN_RATE 10000
+#define CHURN_MATCH_RATE 1000000
+#define CHURN_SECONDS 3
+#define CHURN_PUBLISH_INTERVAL_US 1000
+#define CHURN_LATENCY_SAMPLE 64
+
+using Clock = std::chrono::steady_clock;
+
+struct ReaderResult
+{
+    uint64_t matched = 0;
+    uint64_t deliveries = 0;
+    std::vector<uint64_t> samples;
+};
+
+static std::string topic_name(size_t index);
+static std::string pattern_for(size_t subscriber, size_t serial);
+static void run_reader(SubscriptionIndex &index, const std::vector<std::vector<std::string>> &topics,
+                       uint64_t rate, const std::atomic<bool> &stop, ReaderResult &result);
+
+int main(int argc, char *argv[])
+{
+    uint64_t churn_rate = argc > 1 ? strtoull(argv[1], NULL, 10) : CHURN_RATE;
+    uint64_t match_rate = argc > 2 ? strtoull(argv[2], NULL, 10) : CHURN_MATCH_RATE;
+    size_t readers = argc > 3 ? strtoull(argv[3], NULL, 10) : 1;
+    uint64_t seconds = argc > 4 ? strtoull(argv[4], NULL, 10) : CHURN_SECONDS;
+    size_t subscribers = argc > 5 ? strtoull(argv[5], NULL, 10) : CHURN_SUBSCRIBERS;
+    if (churn_rate == 0 || readers == 0 || readers >= MAX_INDEX_READERS || seconds == 0 || subscribers == 0)
+    {
+        std::cerr << "Usage: " << argv[0] << " [CHURN_PER_SEC] [MATCH_PER_SEC (0 = unpaced)] [READERS] [SECONDS] [SUBSCRIBERS]" << std::endl;
+        return 1;
+    }
+
+    SubscriptionIndex index;
+    for (size_t i = 0; i < subscribers; ++i)
+    {
+        std::string id = "C" + std::to_string(i);
+        index.set_connection(id, (int)i, i + 1);
+        index.subscribe(id, pattern_for(i, 0), i % 2 == 0, ContentFilter());
+    }
+    index.publish();
+
+    std::vector<std::vector<std::string>> topics;
+    for (size_t i = 0; i < CHURN_TOPICS; ++i)
+    {
+        topics.push_back(split_topic(topic_name(i)));
+    }
+
+    std::atomic<bool> stop(false);
+    std::vector<ReaderResult> results(readers);
+    std::vector<std::thread> threads;
+    for (size_t r = 0; r < readers; ++r)
+    {
+        threads.emplace_back(run_reader, std::ref(index), std::cref(topics), match_rate / readers,
+                             std::cref(stop), std::ref(results[r]));
+    }
+
+    // The writer plays the event loop: it alternates subscribe and unsubscribe
+    // at the requested rate and publishes a snapshot every interval.
+    uint64_t operations = 0;
+    size_t serial = 1;
+    auto start = Clock::now();
+    auto end = start + std::chrono::seconds(seconds);
+    auto next_publish = start;
+    while (Clock::now() < end)
+    {
+        auto due = start + std::chrono::nanoseconds(operations * 1000000000ULL / churn_rate);
+        std::this_thread::sleep_until(due);
+        size_t subscriber = operations / 2 % subscribers;
+        std::string id = "C" + std::to_string(subscriber);
+        if (operations % 2 == 0)
+        {
+            index.subscribe(id, pattern_for(subscriber, serial), false, ContentFilter());
+        }
+        else
+        {
+            index.unsubscribe(id, pattern_for(subscriber, serial++));
+        }
+        operations++;
+        if (Clock::now() >= next_publish)
+        {
+            index.publish();
+            next_publish = Clock::now() + std::chrono::microseconds(CHURN_PUBLISH_INTERVAL_US);
+        }
+    }
+    index.publish();
+    stop.store(true);
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    uint64_t matched = 0;
+    uint64_t deliveries = 0;
+    std::vector<uint64_t> samples;
+    for (ReaderResult &result : results)
+    {
+        matched += result.matched;
+        deliveries += result.deliveries;
+        samples.insert(samples.end(), result.samples.begin(), result.samples.end());
+    }
+    std::sort(samples.begin(), samples.end());
+
+    printf("subscribers: %zu\n", subscribers);
+    printf("churn: %.0f ops/s, %llu snapshots published, %llu reclaimed, %zu pending\n",
+           operations / elapsed, (unsigned long long)index.versions(),
+           (unsigned long long)index.reclaimed(), index.retired_count());
+    printf("match: %.0f msgs/s across %zu reader(s), %.1f deliveries/msg\n",
+           matched / elapsed, readers, matched > 0 ? (double)deliveries / matched : 0.0);
+    if (!samples.empty())
+    {
+        printf("match latency: p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n",
+               (unsigned long long)samples[samples.size() / 2],
+               (unsigned long long)samples[samples.size() * 99 / 100],
+               (unsigned long long)samples[samples.size() * 999 / 1000],
+               (unsigned long long)samples.back());
+    }
+    return 0;
+}
+
+static std::string topic_name(size_t index)
+{
+    return "site" + std::to_string(index % 8) + "/room" + std::to_string(index / 8) + "/temperature";
+}
+
+// A mix of exact, '+' and '*' patterns so matching is not a pure string compare.
+static std::string pattern_for(size_t subscriber, size_t serial)
+{
+    size_t topic = (subscriber + serial) % CHURN_TOPICS;
+    switch ((subscriber + serial) % 3)
+    {
+    case 0:
+        return topic_name(topic);
+    case 1:
+        return "site" + std::to_string(topic % 8) + "/+/temperature";
+    default:
+        return "site" + std::to_string(topic % 8) + "/*";
+    }
+}
+
+static void run_reader(SubscriptionIndex &index, const std::vector<std::vector<std::string>> &topics,
+                       uint64_t rate, const std::atomic<bool> &stop, ReaderResult &result)
+{
+    int slot = index.register_reader();
+    std::vector<IndexMatch> matches;
+    // No subscription carries a predicate, so the payload is never looked at.
+    UdpMessage message;
+    memset(&message, 0, sizeof(message));
+    auto start = Clock::now();
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        if (rate > 0)
+        {
+            auto due = start + std::chrono::nanoseconds(result.matched * 1000000000ULL / rate);
+            if (Clock::now() < due)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+        }
+        bool sample = result.matched % CHURN_LATENCY_SAMPLE == 0;
+        auto begin = sample ? Clock::now() : Clock::time_point();
+        matches.clear();
+        const SubscriptionSnapshot *snapshot = index.read_lock(slot);
+        snapshot->match(topics[result.matched % topics.size()], message, matches);
+        index.read_unlock(slot);
+        if (sample)
+        {
+            result.samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count());
+        }
+        result.deliveries += matches.size();
+        result.matched++;
+    }
+    index.unregister_reader(slot);
+}
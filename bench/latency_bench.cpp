@@ -0,0 +1,203 @@
+#include "common.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#define LATENCY_TOPIC "bench/latency"
+#define LATENCY_IDLE_TIMEOUT_MS 2000
+#define LATENCY_SETTLE_MS 300
+#define LATENCY_WARMUP 100
+
+using Clock = std::chrono::steady_clock;
+
+static int connect_subscriber(const struct sockaddr_in &server_addr);
+static void publish(const struct sockaddr_in &server_addr, uint64_t messages, uint64_t rate);
+static bool read_timestamp(const std::vector<char> &frame, int64_t &sent_ns);
+static int64_t now_ns();
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5)
+    {
+        std::cerr << "Usage: " << argv[0] << " <IP_SERVER> <PORT_SERVER> <MESSAGES> <RATE>" << std::endl;
+        return 1;
+    }
+    uint64_t messages = strtoull(argv[3], NULL, 10);
+    uint64_t rate = strtoull(argv[4], NULL, 10);
+    if (messages <= LATENCY_WARMUP || rate == 0)
+    {
+        std::cerr << "ERROR: Need more than " << LATENCY_WARMUP << " messages and a non-zero rate." << std::endl;
+        return 1;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(atoi(argv[2]));
+    if (inet_pton(AF_INET, argv[1], &server_addr.sin_addr) <= 0)
+    {
+        error("ERROR invalid server IP address");
+    }
+
+    int sock = connect_subscriber(server_addr);
+    std::this_thread::sleep_for(std::chrono::milliseconds(LATENCY_SETTLE_MS));
+
+    std::atomic<bool> published(false);
+    std::thread publisher([&]()
+                          {
+        publish(server_addr, messages, rate);
+        published.store(true); });
+
+    // The receiving side blocks in recv() in both server modes, so the
+    // difference between runs is the server's own wakeup cost.
+    std::vector<int64_t> samples;
+    samples.reserve(messages);
+    std::vector<char> pending;
+    uint64_t received = 0;
+    char buffer[64 * 1024];
+    struct pollfd pfd = {sock, POLLIN, 0};
+    auto last_progress = Clock::now();
+    while (received < messages)
+    {
+        int ready = poll(&pfd, 1, 100);
+        if (ready < 0 && errno != EINTR)
+        {
+            error("ERROR on poll");
+        }
+        if (ready > 0)
+        {
+            ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+            if (n <= 0)
+            {
+                break;
+            }
+            int64_t arrival = now_ns();
+            pending.insert(pending.end(), buffer, buffer + n);
+            size_t offset = 0;
+            while (pending.size() - offset >= sizeof(uint32_t))
+            {
+                uint32_t net_len;
+                memcpy(&net_len, pending.data() + offset, sizeof(net_len));
+                size_t frame_len = sizeof(uint32_t) + ntohl(net_len);
+                if (pending.size() - offset < frame_len)
+                {
+                    break;
+                }
+                std::vector<char> frame(pending.begin() + offset + sizeof(uint32_t), pending.begin() + offset + frame_len);
+                int64_t sent_ns;
+                if (read_timestamp(frame, sent_ns) && received >= LATENCY_WARMUP)
+                {
+                    samples.push_back(arrival - sent_ns);
+                }
+                received++;
+                offset += frame_len;
+            }
+            pending.erase(pending.begin(), pending.begin() + offset);
+            last_progress = Clock::now();
+        }
+        if (!published.load())
+        {
+            last_progress = Clock::now();
+        }
+        else if (Clock::now() - last_progress > std::chrono::milliseconds(LATENCY_IDLE_TIMEOUT_MS))
+        {
+            break;
+        }
+    }
+    publisher.join();
+    close(sock);
+
+    if (samples.empty())
+    {
+        std::cerr << "ERROR: No messages received." << std::endl;
+        return 1;
+    }
+    std::sort(samples.begin(), samples.end());
+    printf("messages=%llu received=%llu rate=%llu p50_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f\n",
+           (unsigned long long)messages, (unsigned long long)received, (unsigned long long)rate,
+           samples[samples.size() / 2] / 1000.0, samples[samples.size() * 99 / 100] / 1000.0,
+           samples[samples.size() * 999 / 1000] / 1000.0, samples.back() / 1000.0);
+    return 0;
+}
+
+static int connect_subscriber(const struct sockaddr_in &server_addr)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        error("ERROR opening socket");
+    }
+    int flag = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(int));
+    if (connect(sock, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        error("ERROR connecting to server");
+    }
+    const char id[] = "LAT0";
+    if (send_all(sock, id, sizeof(id), 0) < 0)
+    {
+        error("ERROR sending client ID");
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(LATENCY_SETTLE_MS));
+    std::string cmd = std::string("subscribe ") + LATENCY_TOPIC + " 0\n";
+    if (send_all(sock, cmd.c_str(), cmd.size(), 0) < 0)
+    {
+        error("ERROR sending subscribe");
+    }
+    return sock;
+}
+
+// Each datagram is a STRING message whose content is the send time in
+// nanoseconds, so the subscriber side needs no shared state with the sender.
+static void publish(const struct sockaddr_in &server_addr, uint64_t messages, uint64_t rate)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+    {
+        error("ERROR opening UDP socket");
+    }
+    char datagram[TOPIC_SIZE + 1 + sizeof(int64_t)];
+    memset(datagram, 0, sizeof(datagram));
+    memcpy(datagram, LATENCY_TOPIC, strlen(LATENCY_TOPIC));
+    datagram[TOPIC_SIZE] = 3;
+
+    auto start = Clock::now();
+    for (uint64_t i = 0; i < messages; ++i)
+    {
+        auto due = start + std::chrono::nanoseconds(i * 1000000000ULL / rate);
+        std::this_thread::sleep_until(due);
+        int64_t sent_ns = now_ns();
+        memcpy(datagram + TOPIC_SIZE + 1, &sent_ns, sizeof(sent_ns));
+        if (sendto(sock, datagram, sizeof(datagram), 0, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+        {
+            perror("WARN: sendto failed");
+        }
+    }
+    close(sock);
+}
+
+static bool read_timestamp(const std::vector<char> &frame, int64_t &sent_ns)
+{
+    size_t offset = sizeof(uint32_t) + sizeof(uint16_t);
+    if (frame.size() < offset + 1)
+    {
+        return false;
+    }
+    offset += 1 + (uint8_t)frame[offset];
+    offset += 1 + sizeof(uint16_t);
+    if (frame.size() < offset + sizeof(sent_ns))
+    {
+        return false;
+    }
+    memcpy(&sent_ns, frame.data() + offset, sizeof(sent_ns));
+    return true;
+}
+
+static int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,549 @@
+#include "common.h"
+#include "latency_stamp.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+#define LOADGEN_MAX_BATCH 1024
+#define LOADGEN_DEFAULT_BATCH 32
+#define LOADGEN_DEFAULT_TOPICS 100
+#define LOADGEN_DEFAULT_DURATION_S 5.0
+#define LOADGEN_DEFAULT_STRING_LEN 32
+#define LOADGEN_SPIN_NS 50000
+
+// Payload types of the UDP protocol, as produced by udp_client.py.
+enum PayloadType
+{
+    PAYLOAD_INT = 0,
+    PAYLOAD_SHORT_REAL = 1,
+    PAYLOAD_FLOAT = 2,
+    PAYLOAD_STRING = 3,
+    PAYLOAD_MIXED = 4
+};
+
+struct LoadConfig
+{
+    struct sockaddr_in server_addr;
+    bool unix_socket = false; // unix:PATH, the server's --unix-dgram socket
+    struct sockaddr_un unix_addr;
+    uint64_t rate = 0;
+    uint64_t count = 0;
+    double duration = LOADGEN_DEFAULT_DURATION_S;
+    size_t threads = 1;
+    size_t ports = 1;
+    size_t batch = LOADGEN_DEFAULT_BATCH;
+    size_t topics = LOADGEN_DEFAULT_TOPICS;
+    double zipf = 0.0;
+    std::string prefix = "load/";
+    int type = PAYLOAD_MIXED;
+    size_t string_len = LOADGEN_DEFAULT_STRING_LEN;
+    std::string payload_file;
+    bool stamp = false;
+};
+
+struct SenderResult
+{
+    uint64_t sent = 0;
+    uint64_t errors = 0;
+};
+
+using Clock = std::chrono::steady_clock;
+
+static bool parse_arguments(int argc, char *argv[], LoadConfig &config);
+static bool parse_type(const std::string &value, int &type);
+static bool load_payload_file(const std::string &path, std::vector<std::string> &datagrams);
+static bool base64_decode(const std::string &in, std::string &out);
+static std::string encode_datagram(const std::string &topic, int type, uint64_t &rng, size_t string_len);
+static std::vector<double> zipf_cdf(size_t n, double exponent);
+static void run_sender(const LoadConfig &config, const std::vector<std::string> &datagrams, const std::vector<double> &cdf,
+                       size_t index, SenderResult &result);
+static size_t pick_datagram(const std::vector<double> &cdf, size_t n, uint64_t &rng);
+static uint64_t next_random(uint64_t &state);
+static void pace_until(Clock::time_point due);
+
+int main(int argc, char *argv[])
+{
+    LoadConfig config;
+    if (!parse_arguments(argc, argv, config))
+    {
+        return 1;
+    }
+
+    if (config.stamp)
+    {
+        config.type = PAYLOAD_STRING;
+        config.string_len = std::max<size_t>(config.string_len, LATENCY_STAMP_SIZE);
+    }
+
+    std::vector<std::string> datagrams;
+    if (!config.payload_file.empty())
+    {
+        if (!load_payload_file(config.payload_file, datagrams))
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        uint64_t rng = 0x9e3779b97f4a7c15ULL;
+        for (size_t i = 0; i < config.topics; ++i)
+        {
+            int type = config.type == PAYLOAD_MIXED ? static_cast<int>(i % PAYLOAD_MIXED) : config.type;
+            datagrams.push_back(encode_datagram(config.prefix + std::to_string(i), type, rng, config.string_len));
+        }
+    }
+    std::vector<double> cdf = config.zipf > 0 ? zipf_cdf(datagrams.size(), config.zipf) : std::vector<double>();
+
+    std::vector<SenderResult> results(config.threads);
+    std::vector<std::thread> senders;
+    auto start = Clock::now();
+    for (size_t i = 0; i < config.threads; ++i)
+    {
+        senders.emplace_back(run_sender, std::cref(config), std::cref(datagrams), std::cref(cdf), i, std::ref(results[i]));
+    }
+    for (std::thread &sender : senders)
+    {
+        sender.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    SenderResult total;
+    for (const SenderResult &result : results)
+    {
+        total.sent += result.sent;
+        total.errors += result.errors;
+    }
+    printf("threads=%zu ports=%zu batch=%zu payloads=%zu target_rate=%llu sent=%llu errors=%llu elapsed=%.3f rate=%.0f\n",
+           config.threads, config.ports, config.batch, datagrams.size(), (unsigned long long)config.rate,
+           (unsigned long long)total.sent, (unsigned long long)total.errors, elapsed, elapsed > 0 ? total.sent / elapsed : 0.0);
+    return 0;
+}
+
+static bool parse_arguments(int argc, char *argv[], LoadConfig &config)
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <IP_SERVER|unix:PATH> <PORT_SERVER> [--rate MSG_PER_SEC] [--duration SEC] [--count N]"
+                  << " [--threads N] [--ports PER_THREAD] [--batch N] [--topics N] [--zipf S] [--prefix P]"
+                  << " [--type INT|SHORT_REAL|FLOAT|STRING|MIXED] [--string-len N] [--payloads FILE] [--stamp]" << std::endl;
+        return false;
+    }
+    memset(&config.server_addr, 0, sizeof(config.server_addr));
+    config.server_addr.sin_family = AF_INET;
+    config.server_addr.sin_port = htons(atoi(argv[2]));
+    std::string address = argv[1];
+    config.unix_socket = address.compare(0, strlen(UNIX_ADDRESS_PREFIX), UNIX_ADDRESS_PREFIX) == 0;
+    if (config.unix_socket)
+    {
+        if (!make_unix_address(address.substr(strlen(UNIX_ADDRESS_PREFIX)), config.unix_addr))
+        {
+            std::cerr << "ERROR: Invalid Unix socket path." << std::endl;
+            return false;
+        }
+    }
+    else if (inet_pton(AF_INET, argv[1], &config.server_addr.sin_addr) <= 0)
+    {
+        std::cerr << "ERROR: Invalid server IP address." << std::endl;
+        return false;
+    }
+
+    for (int i = 3; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if (option == "--stamp")
+        {
+            config.stamp = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "ERROR: Missing value for option " << option << "." << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (option == "--rate")
+        {
+            config.rate = strtoull(value.c_str(), NULL, 10);
+        }
+        else if (option == "--duration")
+        {
+            config.duration = atof(value.c_str());
+        }
+        else if (option == "--count")
+        {
+            config.count = strtoull(value.c_str(), NULL, 10);
+        }
+        else if (option == "--threads")
+        {
+            config.threads = strtoull(value.c_str(), NULL, 10);
+        }
+        else if (option == "--ports")
+        {
+            config.ports = strtoull(value.c_str(), NULL, 10);
+        }
+        else if (option == "--batch")
+        {
+            config.batch = strtoull(value.c_str(), NULL, 10);
+        }
+        else if (option == "--topics")
+        {
+            config.topics = strtoull(value.c_str(), NULL, 10);
+        }
+        else if (option == "--zipf")
+        {
+            config.zipf = atof(value.c_str());
+        }
+        else if (option == "--prefix")
+        {
+            config.prefix = value;
+        }
+        else if (option == "--type")
+        {
+            if (!parse_type(value, config.type))
+            {
+                std::cerr << "ERROR: Unknown payload type " << value << "." << std::endl;
+                return false;
+            }
+        }
+        else if (option == "--string-len")
+        {
+            config.string_len = strtoull(value.c_str(), NULL, 10);
+        }
+        else if (option == "--payloads")
+        {
+            config.payload_file = value;
+        }
+        else
+        {
+            std::cerr << "ERROR: Unknown option " << option << "." << std::endl;
+            return false;
+        }
+    }
+
+    if (config.threads == 0 || config.ports == 0 || config.topics == 0)
+    {
+        std::cerr << "ERROR: --threads, --ports and --topics must be positive." << std::endl;
+        return false;
+    }
+    if (config.batch == 0 || config.batch > LOADGEN_MAX_BATCH)
+    {
+        std::cerr << "ERROR: --batch must be between 1 and " << LOADGEN_MAX_BATCH << "." << std::endl;
+        return false;
+    }
+    if (config.count == 0 && config.duration <= 0)
+    {
+        std::cerr << "ERROR: Either --count or a positive --duration is required." << std::endl;
+        return false;
+    }
+    if (config.string_len > MAX_CONTENT_SIZE)
+    {
+        std::cerr << "ERROR: --string-len is limited to " << MAX_CONTENT_SIZE << " bytes." << std::endl;
+        return false;
+    }
+    if (config.stamp && !config.payload_file.empty())
+    {
+        std::cerr << "ERROR: --stamp builds its own STRING payloads and cannot be used with --payloads." << std::endl;
+        return false;
+    }
+    if (config.prefix.size() + std::to_string(config.topics - 1).size() > TOPIC_SIZE)
+    {
+        std::cerr << "ERROR: Topic prefix too long for " << config.topics << " topics." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool parse_type(const std::string &value, int &type)
+{
+    static const char *const names[] = {"INT", "SHORT_REAL", "FLOAT", "STRING", "MIXED"};
+    for (int i = 0; i <= PAYLOAD_MIXED; ++i)
+    {
+        if (value == names[i])
+        {
+            type = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Pulls every "payload_base64" string out of a udp_client.py input file. The
+// files are flat arrays of objects, so a scan is enough.
+static bool load_payload_file(const std::string &path, std::vector<std::string> &datagrams)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cerr << "ERROR: Cannot open payload file " << path << "." << std::endl;
+        return false;
+    }
+    std::string json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const std::string key = "\"payload_base64\"";
+    size_t pos = 0;
+    while ((pos = json.find(key, pos)) != std::string::npos)
+    {
+        size_t open = json.find('"', json.find(':', pos + key.size()));
+        size_t close = json.find('"', open + 1);
+        if (open == std::string::npos || close == std::string::npos)
+        {
+            break;
+        }
+        std::string datagram;
+        if (!base64_decode(json.substr(open + 1, close - open - 1), datagram) || datagram.size() <= TOPIC_SIZE)
+        {
+            std::cerr << "ERROR: Invalid payload in " << path << "." << std::endl;
+            return false;
+        }
+        datagrams.push_back(datagram);
+        pos = close + 1;
+    }
+    if (datagrams.empty())
+    {
+        std::cerr << "ERROR: No payloads found in " << path << "." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool base64_decode(const std::string &in, std::string &out)
+{
+    uint32_t bits = 0;
+    int pending = 0;
+    for (char c : in)
+    {
+        int value;
+        if (c >= 'A' && c <= 'Z')
+        {
+            value = c - 'A';
+        }
+        else if (c >= 'a' && c <= 'z')
+        {
+            value = c - 'a' + 26;
+        }
+        else if (c >= '0' && c <= '9')
+        {
+            value = c - '0' + 52;
+        }
+        else if (c == '+')
+        {
+            value = 62;
+        }
+        else if (c == '/')
+        {
+            value = 63;
+        }
+        else if (c == '=')
+        {
+            break;
+        }
+        else
+        {
+            return false;
+        }
+        bits = (bits << 6) | value;
+        pending += 6;
+        if (pending >= 8)
+        {
+            pending -= 8;
+            out.push_back(static_cast<char>((bits >> pending) & 0xFF));
+        }
+    }
+    return true;
+}
+
+// Builds a datagram laid out like udp_client.py's: 50-byte topic, type byte,
+// then the type's content encoding.
+static std::string encode_datagram(const std::string &topic, int type, uint64_t &rng, size_t string_len)
+{
+    std::string datagram(TOPIC_SIZE, '\0');
+    memcpy(&datagram[0], topic.data(), std::min(topic.size(), (size_t)TOPIC_SIZE));
+    datagram.push_back(static_cast<char>(type));
+
+    uint32_t value = static_cast<uint32_t>(next_random(rng) % 1000000);
+    uint32_t net_value = htonl(value);
+    if (type == PAYLOAD_INT)
+    {
+        datagram.push_back(static_cast<char>(next_random(rng) & 1));
+        datagram.append(reinterpret_cast<const char *>(&net_value), sizeof(net_value));
+    }
+    else if (type == PAYLOAD_SHORT_REAL)
+    {
+        uint16_t net_short = htons(static_cast<uint16_t>(value % 65536));
+        datagram.append(reinterpret_cast<const char *>(&net_short), sizeof(net_short));
+    }
+    else if (type == PAYLOAD_FLOAT)
+    {
+        datagram.push_back(static_cast<char>(next_random(rng) & 1));
+        datagram.append(reinterpret_cast<const char *>(&net_value), sizeof(net_value));
+        datagram.push_back(static_cast<char>(next_random(rng) % 5));
+    }
+    else
+    {
+        for (size_t i = 0; i < string_len; ++i)
+        {
+            datagram.push_back(static_cast<char>('a' + next_random(rng) % 26));
+        }
+    }
+    return datagram;
+}
+
+// Cumulative Zipf distribution: item k (0-based) has weight 1 / (k + 1)^s.
+static std::vector<double> zipf_cdf(size_t n, double exponent)
+{
+    std::vector<double> cdf(n);
+    double sum = 0;
+    for (size_t k = 0; k < n; ++k)
+    {
+        sum += 1.0 / pow(static_cast<double>(k + 1), exponent);
+        cdf[k] = sum;
+    }
+    for (double &value : cdf)
+    {
+        value /= sum;
+    }
+    return cdf;
+}
+
+static void run_sender(const LoadConfig &config, const std::vector<std::string> &datagrams, const std::vector<double> &cdf,
+                       size_t index, SenderResult &result)
+{
+    // Each socket is its own source port; batches rotate over them. Unix
+    // datagram sockets have no port, but a full server queue blocks them
+    // instead of dropping.
+    std::vector<int> sockets;
+    for (size_t i = 0; i < config.ports; ++i)
+    {
+        int sock = socket(config.unix_socket ? AF_UNIX : AF_INET, SOCK_DGRAM, 0);
+        if (sock < 0)
+        {
+            error("ERROR opening UDP socket");
+        }
+        const struct sockaddr *addr = config.unix_socket ? (const struct sockaddr *)&config.unix_addr
+                                                         : (const struct sockaddr *)&config.server_addr;
+        socklen_t addr_len = config.unix_socket ? sizeof(config.unix_addr) : sizeof(config.server_addr);
+        if (connect(sock, addr, addr_len) < 0)
+        {
+            error("ERROR connecting UDP socket");
+        }
+        sockets.push_back(sock);
+    }
+
+    uint64_t quota = 0;
+    if (config.count > 0)
+    {
+        quota = config.count / config.threads + (index < config.count % config.threads ? 1 : 0);
+    }
+    double rate = config.rate > 0 ? static_cast<double>(config.rate) / config.threads : 0;
+    uint64_t rng = 0x2545f4914f6cdd1dULL * (index + 1);
+    struct mmsghdr msgs[LOADGEN_MAX_BATCH];
+    struct iovec iovecs[LOADGEN_MAX_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    // Stamped messages are copied into per-batch slots so each one can carry
+    // its own sequence number and send time; sequences count per topic.
+    std::vector<std::string> slots(config.stamp ? config.batch : 0);
+    std::vector<size_t> slot_topics(slots.size());
+    std::vector<uint64_t> sequences(config.stamp ? datagrams.size() : 0);
+
+    auto start = Clock::now();
+    auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(config.duration));
+    size_t next_socket = 0;
+    while (quota == 0 || result.sent < quota)
+    {
+        size_t n = config.batch;
+        if (quota > 0)
+        {
+            n = std::min<uint64_t>(n, quota - result.sent);
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            size_t topic = pick_datagram(cdf, datagrams.size(), rng);
+            const std::string *datagram = &datagrams[topic];
+            if (config.stamp)
+            {
+                slots[i] = *datagram;
+                slot_topics[i] = topic;
+                datagram = &slots[i];
+            }
+            iovecs[i].iov_base = const_cast<char *>(datagram->data());
+            iovecs[i].iov_len = datagram->size();
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        auto now = Clock::now();
+        if (quota == 0 && now >= end)
+        {
+            break;
+        }
+        if (rate > 0)
+        {
+            pace_until(start + std::chrono::nanoseconds(static_cast<uint64_t>(result.sent * 1e9 / rate)));
+        }
+        if (config.stamp)
+        {
+            int64_t sent_ns = latency_clock_ns();
+            for (size_t i = 0; i < n; ++i)
+            {
+                write_latency_stamp(&slots[i][TOPIC_SIZE + 1], static_cast<uint32_t>(index), sequences[slot_topics[i]]++, sent_ns);
+            }
+        }
+
+        int sent = sendmmsg(sockets[next_socket], msgs, n, 0);
+        next_socket = (next_socket + 1) % sockets.size();
+        if (sent < 0)
+        {
+            if (errno != EINTR)
+            {
+                result.errors++;
+            }
+            continue;
+        }
+        result.sent += sent;
+        result.errors += n - sent;
+    }
+
+    for (int sock : sockets)
+    {
+        close(sock);
+    }
+}
+
+static size_t pick_datagram(const std::vector<double> &cdf, size_t n, uint64_t &rng)
+{
+    uint64_t random = next_random(rng);
+    if (cdf.empty())
+    {
+        return random % n;
+    }
+    double u = (random >> 11) * (1.0 / 9007199254740992.0);
+    return std::min<size_t>(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), n - 1);
+}
+
+// xorshift64*: cheap enough to call per datagram at millions per second.
+static uint64_t next_random(uint64_t &state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
+
+// Sleeps until shortly before `due`, then spins, so pacing does not depend
+// on timer slack.
+static void pace_until(Clock::time_point due)
+{
+    auto now = Clock::now();
+    if (due - now > std::chrono::nanoseconds(LOADGEN_SPIN_NS))
+    {
+        std::this_thread::sleep_until(due - std::chrono::nanoseconds(LOADGEN_SPIN_NS));
+    }
+    while (Clock::now() < due)
+    {
+    }
+}
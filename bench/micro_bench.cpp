@@ -0,0 +1,335 @@
+#include "circular_buffer.h"
+#include "received_message.h"
+#include "topic_match.h"
+#include "udp_message.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#define MICRO_REPEATS 5
+#define MICRO_DEFAULT_MIN_TIME_S 0.5
+#define MICRO_CALIBRATE_START 16
+
+using Clock = std::chrono::steady_clock;
+
+struct MicroResult
+{
+    std::string name;
+    uint64_t iterations;
+    double median_ns;
+    double min_ns;
+};
+
+// Swallows everything written to it, so printing costs only the formatting.
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+};
+
+template <typename T>
+static inline void keep(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+static std::string make_datagram(const std::string &topic, uint8_t type, const std::string &content);
+static std::string int_content(uint8_t sign, uint32_t value);
+static std::string short_real_content(uint16_t value);
+static std::string float_content(uint8_t sign, uint32_t value, uint8_t power);
+static std::vector<char> forward_frame(const std::string &datagram);
+static double time_iterations(const std::function<void()> &body, uint64_t iterations);
+static void run_benchmark(std::vector<MicroResult> &results, const std::string &filter, double min_time,
+                          const std::string &name, const std::function<void()> &body);
+static void print_json(const std::vector<MicroResult> &results, double min_time);
+
+int main(int argc, char *argv[])
+{
+    std::string filter;
+    double min_time = MICRO_DEFAULT_MIN_TIME_S;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if (option == "--filter" && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else if (option == "--min-time" && i + 1 < argc)
+        {
+            min_time = atof(argv[++i]);
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--filter SUBSTRING] [--min-time SEC]" << std::endl;
+            return 1;
+        }
+    }
+    if (min_time <= 0)
+    {
+        std::cerr << "ERROR: --min-time must be positive." << std::endl;
+        return 1;
+    }
+
+    // Inputs follow the sample payloads of the UDP client.
+    const std::string int_datagram = make_datagram("upb/precis/elevator/1/people", 0, int_content(1, 13));
+    const std::string short_real_datagram = make_datagram("upb/precis/100/temperature", 1, short_real_content(2305));
+    const std::string float_datagram = make_datagram("upb/ec/100/pressure", 2, float_content(0, 1234567, 4));
+    const std::string string_datagram = make_datagram("upb/precis/100/schedule/monday/8", 3, "Lecture: Network Protocols");
+    const std::string huge_datagram = make_datagram("huge_string", 3, std::string(MAX_CONTENT_SIZE, 'x'));
+    const std::vector<std::string> topics = {
+        "upb/precis/elevator/1/people", "upb/precis/elevator/2/floor", "upb/precis/100/temperature",
+        "upb/ec/100/humidity", "upb/ec/100/pressure", "upb/precis/100/schedule/monday/8",
+        "upb/ec/100/schedule/tuesday/12", "a_non_negative_int"};
+    const std::vector<std::string> patterns = {
+        "upb/precis/elevator/1/people", "upb/+/100/temperature", "upb/precis/elevator/+/floor",
+        "upb/*/humidity", "upb/ec/*", "*/schedule/*", "upb/+/100/*/monday/+", "*"};
+
+    std::vector<MicroResult> results;
+    auto bench = [&](const std::string &name, const std::function<void()> &body)
+    {
+        run_benchmark(results, filter, min_time, name, body);
+    };
+
+    bench("topic_matches/exact", [&]()
+          { keep(topic_matches(topics[2], patterns[0])); });
+    bench("topic_matches/plus", [&]()
+          { keep(topic_matches(topics[2], patterns[1])); });
+    bench("topic_matches/star_miss", [&]()
+          { keep(topic_matches(topics[0], patterns[5])); });
+    bench("topic_matches/sample_cross_product", [&]()
+          {
+        for (const std::string &topic : topics)
+        {
+            for (const std::string &pattern : patterns)
+            {
+                keep(topic_matches(topic, pattern));
+            }
+        } });
+
+    UdpMessage msg;
+    struct
+    {
+        const char *name;
+        const std::string *datagram;
+    } datagrams[] = {{"int", &int_datagram}, {"short_real", &short_real_datagram}, {"float", &float_datagram},
+                     {"string", &string_datagram}, {"string_1500", &huge_datagram}};
+    for (const auto &input : datagrams)
+    {
+        const std::string &datagram = *input.datagram;
+        bench(std::string("parse_udp_datagram/") + input.name, [&]()
+              {
+            parse_udp_datagram(datagram.data(), static_cast<int>(datagram.size()), msg);
+            keep(msg); });
+    }
+    for (const auto &input : datagrams)
+    {
+        UdpMessage parsed;
+        parse_udp_datagram(input.datagram->data(), static_cast<int>(input.datagram->size()), parsed);
+        parsed.sender_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        parsed.sender_addr.sin_port = htons(40000);
+        bench(std::string("serialize_forward_message/") + input.name, [&parsed]()
+              {
+            std::vector<char> frame = serialize_forward_message(parsed);
+            keep(frame.data()); });
+    }
+
+    // The buffers start half full and are refilled as they drain, so the
+    // operations also cover the wrap-around case.
+    CircularBuffer<char> commands(CIRCULAR_BUFFER_SIZE);
+    const std::string command = "subscribe upb/precis/+/temperature 1\n";
+    while (commands.space_available() > CIRCULAR_BUFFER_SIZE / 2)
+    {
+        commands.write(command.data(), command.size());
+    }
+    bench("circular_buffer/find", [&]()
+          { keep(commands.find('\n')); });
+    bench("circular_buffer/find_consume_write", [&]()
+          {
+        ssize_t offset = commands.find('\n');
+        commands.consume(offset + 1);
+        commands.write(command.data(), command.size()); });
+    bench("circular_buffer/peek_header", [&]()
+          {
+        uint32_t header;
+        keep(commands.peek(reinterpret_cast<char *>(&header), 0, sizeof(header)));
+        keep(header); });
+    std::vector<char> frame = forward_frame(string_datagram);
+    std::vector<char> read_buffer(frame.size());
+    bench("circular_buffer/write_read_frame", [&]()
+          {
+        commands.write(frame.data(), frame.size());
+        keep(commands.read(read_buffer.data(), read_buffer.size())); });
+
+    NullBuffer null_buffer;
+    std::ostream null_out(&null_buffer);
+    CircularBuffer<char> received(CIRCULAR_BUFFER_SIZE);
+    WireDictionaryTable received_dictionary;
+    for (const auto &input : datagrams)
+    {
+        std::vector<char> input_frame = forward_frame(*input.datagram);
+        bench(std::string("deserialize_and_process_message/") + input.name, [&, input_frame]()
+              {
+            received.write(input_frame.data(), input_frame.size());
+            deserialize_and_process_message(received, null_out, nullptr, received_dictionary); });
+    }
+
+    // The same 16 INT readings as plain frames and as one batch frame; both
+    // benchmarks decode all 16 per operation.
+    std::vector<char> single_frames;
+    for (int i = 0; i < 16; ++i)
+    {
+        std::vector<char> int_frame = forward_frame(int_datagram);
+        single_frames.insert(single_frames.end(), int_frame.begin(), int_frame.end());
+    }
+    std::vector<char> batch_frame;
+    pack_batch_frames(single_frames.data(), single_frames.size(), batch_frame, nullptr);
+    bench("pack_batch_frames/16_int", [&]()
+          {
+        std::vector<char> packed;
+        keep(pack_batch_frames(single_frames.data(), single_frames.size(), packed, nullptr));
+        keep(packed.data()); });
+    bench("deserialize_and_process_message/16_int_single_frames", [&]()
+          {
+        received.write(single_frames.data(), single_frames.size());
+        deserialize_and_process_message(received, null_out, nullptr, received_dictionary); });
+    bench("deserialize_and_process_message/16_int_batch_frame", [&]()
+          {
+        received.write(batch_frame.data(), batch_frame.size());
+        deserialize_and_process_message(received, null_out, nullptr, received_dictionary); });
+
+    // Dictionary mode once sender and topic are defined: the frame names them
+    // by one-byte IDs instead of carrying them.
+    WireDictionary dictionary;
+    dictionary.enabled = true;
+    std::vector<char> dictionary_frame;
+    pack_batch_frames(single_frames.data(), single_frames.size(), dictionary_frame, &dictionary);
+    received.write(dictionary_frame.data(), dictionary_frame.size());
+    deserialize_and_process_message(received, null_out, nullptr, received_dictionary);
+    dictionary_frame.clear();
+    pack_batch_frames(single_frames.data(), single_frames.size(), dictionary_frame, &dictionary);
+    bench("pack_batch_frames/16_int_dict", [&]()
+          {
+        std::vector<char> packed;
+        keep(pack_batch_frames(single_frames.data(), single_frames.size(), packed, &dictionary));
+        keep(packed.data()); });
+    bench("deserialize_and_process_message/16_int_dict_frame", [&]()
+          {
+        received.write(dictionary_frame.data(), dictionary_frame.size());
+        deserialize_and_process_message(received, null_out, nullptr, received_dictionary); });
+
+    struct
+    {
+        const char *name;
+        uint8_t type;
+        std::string content;
+    } contents[] = {{"int", 0, int_content(1, 13)}, {"short_real", 1, short_real_content(2305)},
+                    {"float", 2, float_content(0, 1234567, 4)}, {"string", 3, "Lecture: Network Protocols"}};
+    const std::string sender_ip = "127.0.0.1";
+    const std::string topic = "upb/precis/100/temperature";
+    for (const auto &input : contents)
+    {
+        const auto *entry = &input;
+        bench(std::string("format_received_message/") + input.name, [&, entry]()
+              {
+            std::string line = format_received_message(sender_ip, 40000, topic, entry->type, entry->content.data(),
+                                                        static_cast<uint16_t>(entry->content.size()));
+            keep(line.data()); });
+    }
+
+    print_json(results, min_time);
+    return 0;
+}
+
+static std::string make_datagram(const std::string &topic, uint8_t type, const std::string &content)
+{
+    std::string datagram(TOPIC_SIZE, '\0');
+    memcpy(&datagram[0], topic.data(), std::min(topic.size(), (size_t)TOPIC_SIZE));
+    datagram.push_back(static_cast<char>(type));
+    datagram += content;
+    return datagram;
+}
+
+static std::string int_content(uint8_t sign, uint32_t value)
+{
+    uint32_t net_value = htonl(value);
+    std::string content(1, static_cast<char>(sign));
+    content.append(reinterpret_cast<const char *>(&net_value), sizeof(net_value));
+    return content;
+}
+
+static std::string short_real_content(uint16_t value)
+{
+    uint16_t net_value = htons(value);
+    return std::string(reinterpret_cast<const char *>(&net_value), sizeof(net_value));
+}
+
+static std::string float_content(uint8_t sign, uint32_t value, uint8_t power)
+{
+    std::string content = int_content(sign, value);
+    content.push_back(static_cast<char>(power));
+    return content;
+}
+
+static std::vector<char> forward_frame(const std::string &datagram)
+{
+    UdpMessage msg;
+    parse_udp_datagram(datagram.data(), static_cast<int>(datagram.size()), msg);
+    msg.sender_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    msg.sender_addr.sin_port = htons(40000);
+    return serialize_forward_message(msg);
+}
+
+static double time_iterations(const std::function<void()> &body, uint64_t iterations)
+{
+    auto start = Clock::now();
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        body();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+// Doubles the iteration count until one run takes a repeat's share of
+// `min_time`, then times MICRO_REPEATS runs of that length.
+static void run_benchmark(std::vector<MicroResult> &results, const std::string &filter, double min_time,
+                          const std::string &name, const std::function<void()> &body)
+{
+    if (!filter.empty() && name.find(filter) == std::string::npos)
+    {
+        return;
+    }
+    double target_ns = min_time * 1e9 / MICRO_REPEATS;
+    uint64_t iterations = MICRO_CALIBRATE_START;
+    while (time_iterations(body, iterations) < target_ns / 2)
+    {
+        iterations *= 2;
+    }
+
+    std::vector<double> per_op;
+    for (int i = 0; i < MICRO_REPEATS; ++i)
+    {
+        per_op.push_back(time_iterations(body, iterations) / iterations);
+    }
+    std::sort(per_op.begin(), per_op.end());
+    results.push_back({name, iterations, per_op[per_op.size() / 2], per_op.front()});
+}
+
+static void print_json(const std::vector<MicroResult> &results, double min_time)
+{
+    printf("{\n  \"unit\": \"ns/op\",\n  \"repeats\": %d,\n  \"min_time_s\": %.3f,\n  \"benchmarks\": [\n",
+           MICRO_REPEATS, min_time);
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const MicroResult &result = results[i];
+        printf("    {\"name\": \"%s\", \"iterations\": %llu, \"median_ns\": %.2f, \"min_ns\": %.2f}%s\n",
+               result.name.c_str(), (unsigned long long)result.iterations, result.median_ns, result.min_ns,
+               i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
@@ -0,0 +1,243 @@
+#include "ring_queue.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define QUEUE_BENCH_CAPACITY 4096
+#define QUEUE_BENCH_OPS 20000000ULL
+#define QUEUE_BENCH_BATCH 32
+#define QUEUE_BENCH_PINGS 200000
+#define SPIN_BEFORE_YIELD 64
+
+using Clock = std::chrono::steady_clock;
+
+static void pin_to_cpu(int cpu);
+static void backoff(unsigned &spins);
+static void bench_spsc(uint64_t ops, size_t batch);
+static void bench_mpsc(uint64_t ops, size_t producers, size_t batch);
+static void bench_ping_pong(size_t pings);
+static void report(const std::string &name, uint64_t ops, Clock::duration elapsed);
+
+int main(int argc, char *argv[])
+{
+    uint64_t ops = QUEUE_BENCH_OPS;
+    if (argc > 1)
+    {
+        ops = strtoull(argv[1], NULL, 10);
+        if (ops == 0)
+        {
+            std::cerr << "Usage: " << argv[0] << " [OPS]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+    bench_spsc(ops, 1);
+    bench_spsc(ops, QUEUE_BENCH_BATCH);
+    for (size_t producers : {1, 2, 4})
+    {
+        bench_mpsc(ops, producers, 1);
+        bench_mpsc(ops, producers, QUEUE_BENCH_BATCH);
+    }
+    bench_ping_pong(QUEUE_BENCH_PINGS);
+    return 0;
+}
+
+static void pin_to_cpu(int cpu)
+{
+    unsigned cpus = std::thread::hardware_concurrency();
+    if (cpus == 0)
+    {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % cpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Spin briefly, then yield, so the benchmark still makes progress when both
+// ends share a single core.
+static void backoff(unsigned &spins)
+{
+    if (++spins > SPIN_BEFORE_YIELD)
+    {
+        std::this_thread::yield();
+        spins = 0;
+    }
+}
+
+static void bench_spsc(uint64_t ops, size_t batch)
+{
+    SpscQueue<uint64_t> queue(QUEUE_BENCH_CAPACITY);
+    uint64_t checksum = 0;
+
+    auto start = Clock::now();
+    std::thread consumer([&]()
+                         {
+        pin_to_cpu(1);
+        std::vector<uint64_t> items(batch);
+        uint64_t received = 0;
+        unsigned spins = 0;
+        while (received < ops)
+        {
+            size_t n = queue.pop_batch(items.data(), batch);
+            if (n == 0)
+            {
+                backoff(spins);
+                continue;
+            }
+            for (size_t i = 0; i < n; ++i)
+            {
+                checksum += items[i];
+            }
+            received += n;
+        } });
+
+    pin_to_cpu(0);
+    std::vector<uint64_t> items(batch);
+    uint64_t sent = 0;
+    unsigned spins = 0;
+    while (sent < ops)
+    {
+        size_t want = std::min<uint64_t>(batch, ops - sent);
+        for (size_t i = 0; i < want; ++i)
+        {
+            items[i] = sent + i;
+        }
+        size_t pushed = 0;
+        while (pushed < want)
+        {
+            size_t n = queue.push_batch(items.data() + pushed, want - pushed);
+            if (n == 0)
+            {
+                backoff(spins);
+            }
+            pushed += n;
+        }
+        sent += want;
+    }
+    consumer.join();
+    auto elapsed = Clock::now() - start;
+
+    if (checksum != ops * (ops - 1) / 2)
+    {
+        std::cerr << "ERROR: SPSC checksum mismatch" << std::endl;
+    }
+    report("spsc batch=" + std::to_string(batch), ops, elapsed);
+}
+
+static void bench_mpsc(uint64_t ops, size_t producers, size_t batch)
+{
+    MpscQueue<uint64_t> queue(QUEUE_BENCH_CAPACITY);
+    uint64_t per_producer = ops / producers;
+    uint64_t total = per_producer * producers;
+
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&, p]()
+                             {
+            pin_to_cpu(1 + p);
+            std::vector<uint64_t> items(batch, 1);
+            uint64_t sent = 0;
+            unsigned spins = 0;
+            while (sent < per_producer)
+            {
+                size_t want = std::min<uint64_t>(batch, per_producer - sent);
+                size_t n = queue.push_batch(items.data(), want);
+                if (n == 0)
+                {
+                    backoff(spins);
+                }
+                sent += n;
+            } });
+    }
+
+    pin_to_cpu(0);
+    std::vector<uint64_t> items(batch);
+    uint64_t received = 0;
+    unsigned spins = 0;
+    while (received < total)
+    {
+        size_t n = queue.pop_batch(items.data(), batch);
+        if (n == 0)
+        {
+            backoff(spins);
+        }
+        received += n;
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    auto elapsed = Clock::now() - start;
+
+    report("mpsc producers=" + std::to_string(producers) + " batch=" + std::to_string(batch), total, elapsed);
+}
+
+// One-way cross-core latency, measured as half of a ping-pong round trip
+// through a pair of SPSC queues.
+static void bench_ping_pong(size_t pings)
+{
+    SpscQueue<uint64_t> ping(QUEUE_BENCH_CAPACITY);
+    SpscQueue<uint64_t> pong(QUEUE_BENCH_CAPACITY);
+
+    std::thread echo([&]()
+                     {
+        pin_to_cpu(1);
+        unsigned spins = 0;
+        for (size_t i = 0; i < pings; ++i)
+        {
+            uint64_t value;
+            while (!ping.pop(value))
+            {
+                backoff(spins);
+            }
+            while (!pong.push(std::move(value)))
+            {
+                backoff(spins);
+            }
+        } });
+
+    pin_to_cpu(0);
+    std::vector<uint64_t> samples;
+    samples.reserve(pings);
+    unsigned spins = 0;
+    for (size_t i = 0; i < pings; ++i)
+    {
+        auto sent_at = Clock::now();
+        uint64_t value = i;
+        while (!ping.push(std::move(value)))
+        {
+            backoff(spins);
+        }
+        while (!pong.pop(value))
+        {
+            backoff(spins);
+        }
+        samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent_at).count() / 2);
+    }
+    echo.join();
+
+    std::sort(samples.begin(), samples.end());
+    std::cout << "spsc one-way latency: p50 " << samples[samples.size() / 2]
+              << " ns, p99 " << samples[samples.size() * 99 / 100]
+              << " ns, max " << samples.back() << " ns" << std::endl;
+}
+
+static void report(const std::string &name, uint64_t ops, Clock::duration elapsed)
+{
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    printf("%-32s %12.0f ops/s  (%.2f ns/op)\n", name.c_str(), ops / seconds, seconds * 1e9 / ops);
+}
@@ -0,0 +1,33 @@
+import argparse
+
+from bench_common import run_bench, start, stop
+
+def run_scenario(args, reactors):
+  """Starts a server with the given number of reactors and runs one fan-out round."""
+  command = ["./server", str(args.port)]
+  if reactors > 0:
+    command += ["--reactors", str(reactors)]
+  server = start(command)
+  try:
+    return run_bench(["./fanout_bench", "127.0.0.1", str(args.port), str(args.subscribers),
+                      str(args.messages), str(args.rate)])
+  finally:
+    stop(server)
+
+def main():
+  parser = argparse.ArgumentParser(description="Fan-out throughput for 1-16 reactor threads")
+  parser.add_argument("--port", type=int, default=12500)
+  parser.add_argument("--subscribers", type=int, default=1000)
+  parser.add_argument("--messages", type=int, default=2000)
+  parser.add_argument("--rate", type=int, default=0, help="publish rate in msg/s (0 = unpaced)")
+  parser.add_argument("--reactors", default="0,1,2,4,8,16", help="comma separated; 0 = single event loop")
+  args = parser.parse_args()
+
+  print("%-10s %12s %12s %10s %16s" % ("reactors", "delivered", "expected", "elapsed", "deliveries/s"))
+  for reactors in [int(r) for r in args.reactors.split(",")]:
+    result = run_scenario(args, reactors)
+    print("%-10s %12s %12s %10s %16s" % (reactors if reactors > 0 else "single", result["delivered"],
+                                         result["expected"], result["elapsed"], result["deliveries_per_sec"]))
+
+if __name__ == "__main__":
+  main()
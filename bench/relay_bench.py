@@ -0,0 +1,53 @@
+import argparse
+import urllib.request
+
+from bench_common import run_bench, start, stop
+
+def broker_bytes_sent(metrics_port):
+  """Reads broker_bytes_sent_total from the server's metrics endpoint."""
+  with urllib.request.urlopen("http://127.0.0.1:%d/metrics" % metrics_port, timeout=5) as response:
+    for line in response.read().decode().splitlines():
+      if line.startswith("broker_bytes_sent_total "):
+        return int(line.split()[1])
+  return 0
+
+def run_scenario(args, subscribers, through_relay):
+  """Runs one fan-out round with the subscribers on the broker or behind one relay."""
+  server = start(["./server", str(args.port), "--metrics", str(args.metrics_port)])
+  relay = None
+  try:
+    command = ["./fanout_bench", "127.0.0.1", str(args.port), str(subscribers), str(args.messages), str(args.rate)]
+    if through_relay:
+      relay = start(["./subscriber", "R", "127.0.0.1", str(args.port), "--relay", str(args.relay_port),
+                     "--batch-frames", "--dictionary"])
+      command += ["--subscribe-port", str(args.relay_port)]
+    result = run_bench(command)
+    result["egress"] = broker_bytes_sent(args.metrics_port)
+    return result
+  finally:
+    if relay:
+      stop(relay)
+    stop(server)
+
+def main():
+  parser = argparse.ArgumentParser(description="Broker egress with local subscribers direct versus behind an edge relay")
+  parser.add_argument("--port", type=int, default=12505)
+  parser.add_argument("--metrics-port", type=int, default=12506)
+  parser.add_argument("--relay-port", type=int, default=12507)
+  parser.add_argument("--subscribers", default="1,4,16,64", help="comma separated subscriber counts")
+  parser.add_argument("--messages", type=int, default=20000)
+  parser.add_argument("--rate", type=int, default=20000, help="publish rate in msg/s")
+  args = parser.parse_args()
+
+  print("%-12s %-7s %12s %14s %16s %16s" % ("subscribers", "path", "delivered", "broker bytes", "bytes/delivery",
+                                            "deliveries/s"))
+  for subscribers in [int(count) for count in args.subscribers.split(",")]:
+    for through_relay in [False, True]:
+      result = run_scenario(args, subscribers, through_relay)
+      delivered = int(result["delivered"])
+      print("%-12d %-7s %12d %14d %16.1f %16s" % (subscribers, "relay" if through_relay else "direct", delivered,
+                                                  result["egress"], result["egress"] / float(max(delivered, 1)),
+                                                  result["deliveries_per_sec"]))
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,212 @@
+#include "common.h"
+#include "shm_ring.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <vector>
+
+#define SHM_BENCH_FRAME_SIZE 64
+#define SHM_BENCH_MAX_CONSUMERS 64
+
+using Clock = std::chrono::steady_clock;
+
+struct FanoutResult
+{
+    double elapsed = 0;  // until every consumer had all frames
+    double producer = 0; // the producer's own publishing loop
+    bool complete = true;
+};
+
+static std::vector<char> make_frame();
+static FanoutResult run_shm(size_t consumers, uint64_t messages, const std::vector<char> &frame);
+static FanoutResult run_sockets(size_t consumers, uint64_t messages, const std::vector<char> &frame);
+static void consume_ring(const std::string &path, size_t index, uint64_t messages);
+static void consume_socket(int sock, uint64_t bytes);
+static bool wait_consumers(const std::vector<pid_t> &children);
+
+// Same-host fan-out of one frame stream to 1..64 forked consumers: the
+// shared-memory ring publishes each frame once, the baseline writes it to
+// every consumer's Unix socket the way the broker writes TCP connections.
+int main(int argc, char *argv[])
+{
+    uint64_t messages = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000;
+    uint64_t ring_bytes = (messages * (SHM_RECORD_HEADER_SIZE + SHM_BENCH_FRAME_SIZE));
+    if (messages == 0 || ring_bytes + SHM_REWRITE_MARGIN > SHM_RING_MAX_BYTES)
+    {
+        std::cerr << "Usage: " << argv[0] << " [MESSAGES]  (all of them must fit in one ring)" << std::endl;
+        return 1;
+    }
+    raise_fd_limit();
+
+    std::vector<char> frame = make_frame();
+    printf("%-10s %-10s %12s %14s %14s\n", "consumers", "transport", "elapsed_ms", "producer_ns", "deliveries/s");
+    for (size_t consumers = 1; consumers <= SHM_BENCH_MAX_CONSUMERS; consumers *= 2)
+    {
+        FanoutResult shm = run_shm(consumers, messages, frame);
+        FanoutResult sockets = run_sockets(consumers, messages, frame);
+        const FanoutResult *results[] = {&shm, &sockets};
+        const char *names[] = {"shm", "socketpair"};
+        for (int i = 0; i < 2; ++i)
+        {
+            printf("%-10zu %-10s %12.1f %14.1f %14.0f%s\n", consumers, names[i], results[i]->elapsed * 1e3,
+                   results[i]->producer * 1e9 / messages, consumers * messages / results[i]->elapsed,
+                   results[i]->complete ? "" : "  (incomplete)");
+        }
+    }
+    return 0;
+}
+
+// A plain forwarded frame of SHM_BENCH_FRAME_SIZE bytes, the size of a short
+// STRING message with a one-segment topic.
+static std::vector<char> make_frame()
+{
+    std::vector<char> frame(SHM_BENCH_FRAME_SIZE, 'x');
+    uint32_t net_len = htonl(SHM_BENCH_FRAME_SIZE - sizeof(net_len));
+    memcpy(frame.data(), &net_len, sizeof(net_len));
+    return frame;
+}
+
+static FanoutResult run_shm(size_t consumers, uint64_t messages, const std::vector<char> &frame)
+{
+    FanoutResult result;
+    std::string path = "/dev/shm/shm_bench." + std::to_string(getpid());
+    size_t capacity = SHM_RING_MIN_BYTES;
+    while (capacity < messages * (SHM_RECORD_HEADER_SIZE + frame.size()) + SHM_REWRITE_MARGIN)
+    {
+        capacity *= 2;
+    }
+    ShmRing ring;
+    if (!ring.create(path, capacity))
+    {
+        error("ERROR creating the shared-memory ring");
+    }
+    uint64_t mask = 0;
+    for (size_t i = 0; i < consumers; ++i)
+    {
+        mask |= uint64_t(1) << ring.assign_slot("R" + std::to_string(i));
+    }
+
+    std::vector<pid_t> children;
+    for (size_t i = 0; i < consumers; ++i)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            consume_ring(path, i, messages);
+        }
+        children.push_back(pid);
+    }
+
+    auto start = Clock::now();
+    for (uint64_t i = 0; i < messages; ++i)
+    {
+        ring.publish(frame.data(), frame.size(), mask);
+    }
+    result.producer = std::chrono::duration<double>(Clock::now() - start).count();
+    result.complete = wait_consumers(children);
+    result.elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    return result;
+}
+
+static FanoutResult run_sockets(size_t consumers, uint64_t messages, const std::vector<char> &frame)
+{
+    FanoutResult result;
+    std::vector<int> sockets;
+    std::vector<pid_t> children;
+    for (size_t i = 0; i < consumers; ++i)
+    {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0)
+        {
+            error("ERROR creating socketpair");
+        }
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(pair[0]);
+            consume_socket(pair[1], messages * frame.size());
+        }
+        close(pair[1]);
+        sockets.push_back(pair[0]);
+        children.push_back(pid);
+    }
+
+    auto start = Clock::now();
+    for (uint64_t i = 0; i < messages; ++i)
+    {
+        for (int sock : sockets)
+        {
+            if (send_all(sock, frame.data(), frame.size(), 0) < 0)
+            {
+                error("ERROR writing to a consumer");
+            }
+        }
+    }
+    result.producer = std::chrono::duration<double>(Clock::now() - start).count();
+    result.complete = wait_consumers(children);
+    result.elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    for (int sock : sockets)
+    {
+        close(sock);
+    }
+    return result;
+}
+
+// Child side; exits non-zero when frames went missing.
+static void consume_ring(const std::string &path, size_t index, uint64_t messages)
+{
+    ShmRing ring;
+    if (!ring.attach(path) || !ring.wait_for_slot("R" + std::to_string(index), SHM_ATTACH_TIMEOUT_MS))
+    {
+        _exit(2);
+    }
+    std::vector<char> frames;
+    uint64_t received = 0;
+    int idle_rounds = 0;
+    while (received < messages && ring.overruns() == 0)
+    {
+        frames.clear();
+        size_t taken = ring.read(frames);
+        received += taken;
+        if (taken > 0)
+        {
+            idle_rounds = 0;
+        }
+        else if (++idle_rounds >= SHM_SPIN_ROUNDS)
+        {
+            ring.wait(SHM_WAIT_MS);
+        }
+    }
+    _exit(received == messages ? 0 : 1);
+}
+
+static void consume_socket(int sock, uint64_t bytes)
+{
+    char buffer[BUFFER_SIZE];
+    uint64_t received = 0;
+    while (received < bytes)
+    {
+        ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+        {
+            _exit(1);
+        }
+        received += n;
+    }
+    _exit(0);
+}
+
+static bool wait_consumers(const std::vector<pid_t> &children)
+{
+    bool complete = true;
+    for (pid_t pid : children)
+    {
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            complete = false;
+        }
+    }
+    return complete;
+}
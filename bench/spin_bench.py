@@ -0,0 +1,36 @@
+import argparse
+
+from bench_common import run_bench, start, stop
+
+def run_scenario(args, extra_args, rate):
+  """Starts a server with the given event loop options and measures one rate."""
+  command = ["./server", str(args.port)] + extra_args
+  server = start(command)
+  try:
+    return run_bench(["./latency_bench", "127.0.0.1", str(args.port), str(args.messages), str(rate)])
+  finally:
+    stop(server)
+
+def main():
+  parser = argparse.ArgumentParser(description="End-to-end latency, blocking vs adaptive-spin event loop")
+  parser.add_argument("--port", type=int, default=12501)
+  parser.add_argument("--messages", type=int, default=5000)
+  parser.add_argument("--rates", default="1000,20000", help="comma separated publish rates in msg/s")
+  parser.add_argument("--spin-us", type=int, default=100)
+  parser.add_argument("--pin-cpu", type=int, default=-1)
+  args = parser.parse_args()
+
+  spin_args = ["--spin-us", str(args.spin_us)]
+  if args.pin_cpu >= 0:
+    spin_args += ["--pin-cpu", str(args.pin_cpu)]
+  modes = [("blocking", []), ("spin %dus" % args.spin_us, spin_args)]
+
+  print("%-14s %8s %10s %10s %10s %10s %10s" % ("mode", "rate", "received", "p50 us", "p99 us", "p99.9 us", "max us"))
+  for rate in [int(r) for r in args.rates.split(",")]:
+    for name, extra_args in modes:
+      result = run_scenario(args, extra_args, rate)
+      print("%-14s %8d %10s %10s %10s %10s %10s" % (name, rate, result["received"], result["p50_us"],
+                                                   result["p99_us"], result["p999_us"], result["max_us"]))
+
+if __name__ == "__main__":
+  main()
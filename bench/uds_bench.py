@@ -0,0 +1,39 @@
+import argparse
+
+from e2e_bench import run_scenario
+
+def main():
+  parser = argparse.ArgumentParser(description="Loopback TCP/UDP versus Unix sockets for clients on the broker host")
+  parser.add_argument("--port", type=int, default=12504)
+  parser.add_argument("--subscribers", type=int, default=4)
+  parser.add_argument("--topics", type=int, default=8)
+  parser.add_argument("--rates", default="20000,50000,100000,0",
+                      help="comma separated publish rates in msg/s, 0 publishes as fast as loadgen can")
+  parser.add_argument("--duration", type=float, default=3.0)
+  parser.add_argument("--batch", type=int, default=32, help="datagrams per sendmmsg call")
+  parser.add_argument("--prefix", default="uds/")
+  parser.add_argument("--server-args", default="", help="extra server options, e.g. \"--pipeline 2\"")
+  parser.add_argument("--unix-path", default="/tmp/uds_bench", help="prefix of the server's Unix socket paths")
+  args = parser.parse_args()
+
+  print("%d subscribers on %d topics, %.1f s per run" % (args.subscribers, args.topics, args.duration))
+  print("%-9s %8s %10s %12s %9s %9s %9s %10s" % ("transport", "rate", "sent/s", "delivered/s", "lost %",
+                                                 "p50 us", "p99 us", "p99.9 us"))
+  for rate in [int(rate) for rate in args.rates.split(",")]:
+    for transport in ["loopback", "unix"]:
+      args.rate = rate
+      args.transport = transport
+      sent, results = run_scenario(args)
+      totals = [result for subscriber in results for result in subscriber if result["topic"] == "ALL"]
+      received = sum(int(total["received"]) for total in totals)
+      expected = int(sent["sent"]) * args.subscribers
+      # Percentiles are those of the first subscriber; they all see the same stream.
+      first = totals[0] if totals else {}
+      print("%-9s %8s %10s %12.0f %9.2f %9s %9s %10s" % (transport, rate if rate > 0 else "max", sent["rate"],
+                                                         received / float(sent["elapsed"]),
+                                                         100.0 * (expected - received) / max(expected, 1),
+                                                         first.get("p50_us", "-"), first.get("p99_us", "-"),
+                                                         first.get("p999_us", "-")))
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,51 @@
+#ifndef BROKER_CORE_H
+#define BROKER_CORE_H
+
+#include "server.h"
+
+// Where the core hands the bytes meant for a subscriber connection. It keeps
+// the contract of a non-blocking send(): the number of bytes taken, or -1 with
+// errno set (EAGAIN when the connection cannot take more right now).
+class BrokerTransport
+{
+public:
+    virtual ~BrokerTransport() = default;
+    virtual ssize_t send(int connection, const char *data, size_t len) = 0;
+};
+
+// Socket-free part of the broker: a received datagram is parsed, serialized,
+// matched against the subscriptions and written, batched, backlogged or
+// stored for its subscribers. The event loop only does the socket calls
+// around it. With `ctx.transport` left null every write goes to the real
+// subscriber sockets.
+void process_datagram(ServerContext &ctx, const char *buffer, int bytes_received, const struct sockaddr_in &sender_addr);
+void distribute_udp_message(ServerContext &ctx, const UdpMessage &msg, const std::vector<char> &serialized_packet, PipelineMessage *shared);
+
+// Marks `client_id` connected on `client_socket` and replays its stored SF
+// messages. The caller has already added the socket to the poll set.
+Subscriber &connect_subscriber(ServerContext &ctx, const std::string &client_id, int client_socket);
+bool process_commands_from_buffer(ServerContext &ctx, Subscriber &sub);
+
+// Writes plain frames to one subscriber, re-encoded against its connection
+// dictionary when it negotiated one.
+// `sf` marks an SF frame: kept with the backlog entry if the socket does not
+// take it right away, so a dropped connection does not lose it.
+bool send_to_subscriber(ServerContext &ctx, Subscriber &sub, const std::vector<char> &packet, PipelineMessage *shared, bool sf);
+void store_for_later(ServerContext &ctx, Subscriber &sub, const std::vector<char> &packet);
+// Called when the connection goes: the SF frames still in the outbound batch
+// or the backlog are put in front of the stored messages, and the newest
+// value an SF rate limit held back goes after them.
+void keep_unsent_sf(ServerContext &ctx, Subscriber &sub);
+bool drain_backlog(ServerContext &ctx, Subscriber &sub, struct pollfd &pfd);
+void update_lag_state(ServerContext &ctx, Subscriber &sub);
+int next_timer_timeout(const ServerContext &ctx, int poll_timeout);
+void run_flush_timers(ServerContext &ctx);
+// Sends what subscribers with batch frames collected during this loop turn.
+void flush_turn_batches(ServerContext &ctx);
+
+void enqueue_send(Pipeline &pipeline, SendKind kind, int client_socket, uint64_t connection, PipelineMessage *message);
+void release_pipeline_message(PipelineMessage *message);
+
+bool parse_size_value(const std::string &value, size_t &out);
+
+#endif // BROKER_CORE_H
@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <poll.h>
@@ -22,8 +23,37 @@
 #define MAX_CONTENT_SIZE 1500
 #define MAX_ID_SIZE 10
 
+// An address of this form names a Unix domain socket instead of an IP.
+#define UNIX_ADDRESS_PREFIX "unix:"
+
+// A length prefix with this bit set announces a batch frame: a run of
+// forwarded messages, each behind a 2-byte length and a flags byte that says
+// which fields repeat the previous entry and were left out.
+#define BATCH_FRAME_FLAG 0x80000000u
+#define MAX_BATCH_FRAME_SIZE (2 * BUFFER_SIZE)
+#define BATCH_SAME_SENDER 0x01
+#define BATCH_SAME_TOPIC 0x02
+
+// Dictionary mode ("frames ... dict"): a sender or topic carried in full with
+// its DEFINE flag gets the next ID of its per-connection table, and later
+// entries name it with the _ID flag and a varint instead.
+#define BATCH_SENDER_ID 0x04
+#define BATCH_TOPIC_ID 0x08
+#define BATCH_DEFINE_SENDER 0x10
+#define BATCH_DEFINE_TOPIC 0x20
+#define MAX_DICTIONARY_ENTRIES 16384
+
 void error(const char *msg);
 
 ssize_t send_all(int sockfd, const void *buf, size_t len, int flags);
 
+void raise_fd_limit();
+
+// False when `path` is empty or does not fit in sun_path.
+bool make_unix_address(const std::string &path, struct sockaddr_un &addr);
+// Binds `sock` to the Unix socket `path`, first removing a socket file left
+// behind by an earlier run. False with errno set on failure (ENAMETOOLONG
+// when the path does not fit).
+bool bind_unix_socket(int sock, const std::string &path);
+
 #endif // COMMON_H
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef CONTENT_FILTER_H
+#define CONTENT_FILTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum FilterOp
+{
+    FILTER_ALL,    // no predicate: every message passes
+    FILTER_TYPE,   // only the payload type is checked
+    FILTER_EQ,
+    FILTER_NE,
+    FILTER_LT,
+    FILTER_LE,
+    FILTER_GT,
+    FILTER_GE,
+    FILTER_PREFIX, // STRING only
+};
+
+// Predicate of one subscription ("where=FLOAT>25.5"), compiled once when the
+// subscribe command is parsed. INT, SHORT_REAL and FLOAT values compare as
+// doubles; STRING supports ==, != and the ^= prefix test.
+struct ContentFilter
+{
+    FilterOp op = FILTER_ALL;
+    uint8_t type = 0;
+    double number = 0;
+    std::string text;
+};
+
+// Accepts "TYPE" or "TYPE<op>VALUE". Fails on an unknown type, an operator the
+// type does not support or a value that is not a number.
+bool parse_content_filter(const std::string &spec, ContentFilter &filter);
+
+// Evaluates the predicate on the UDP payload (type and content bytes). A
+// message of another type or with a malformed value does not pass.
+bool content_filter_accepts(const ContentFilter &filter, uint8_t type, const char *content, size_t content_len);
+
+#endif // CONTENT_FILTER_H
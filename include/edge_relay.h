@@ -0,0 +1,89 @@
+#ifndef EDGE_RELAY_H
+#define EDGE_RELAY_H
+
+#include "circular_buffer.h"
+#include "common.h"
+#include "received_message.h"
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define RELAY_LISTEN_BACKLOG 128
+#define RELAY_MAX_BACKLOG_BYTES (16 << 20)
+#define RELAY_ROUTE_CACHE_SIZE 65536
+
+// A subscriber connected to the relay. Until its ID arrives `id` is empty.
+struct RelayClient
+{
+    std::string id;
+    CircularBuffer<char> commands;
+    std::set<std::string> patterns;
+    std::vector<char> outbound; // frames the socket has not taken yet
+
+    RelayClient() : commands(CIRCULAR_BUFFER_SIZE) {}
+};
+
+struct RelayStats
+{
+    uint64_t messages = 0;   // received from the broker
+    uint64_t deliveries = 0; // copies queued for local subscribers
+    uint64_t bytes_out = 0;
+    uint64_t dropped_clients = 0;
+};
+
+// Edge relay: one upstream connection to the broker carries the union of the
+// patterns of every local subscriber, each held upstream while at least one
+// of them wants it, and the fan-out to the local subscribers happens here.
+// Local subscribers speak the broker's protocol; they get plain frames, and
+// a subscribe with an SF flag or options is refused.
+class EdgeRelay : public ReceivedMessageHandler
+{
+private:
+    int upstream;
+    int listener = -1;
+    bool listener_tcp = false;
+    std::string unix_path; // unlinked on exit
+    CircularBuffer<char> upstream_buffer;
+    WireDictionaryTable dictionary;
+    std::map<int, RelayClient> clients; // by socket
+    std::set<std::string> connected_ids;
+    std::map<std::string, size_t> upstream_refs;
+    // Sockets each topic seen so far goes to; dropped on every change.
+    std::unordered_map<std::string, std::vector<int>> routes;
+    std::set<int> flush_pending;
+    std::string console_input;
+    bool running = true;
+    RelayStats stats;
+
+    void accept_client();
+    bool read_client(int sock, RelayClient &client);
+    void execute_command(RelayClient &client, const std::string &line);
+    void subscribe(RelayClient &client, const std::string &pattern);
+    void unsubscribe(RelayClient &client, const std::string &pattern);
+    void send_upstream(const std::string &command);
+    void read_upstream();
+    const std::vector<int> &route(const std::string &topic);
+    bool flush_client(int sock, RelayClient &client);
+    void remove_client(int sock);
+    void handle_console();
+
+public:
+    explicit EdgeRelay(int upstream_socket);
+    ~EdgeRelay();
+
+    EdgeRelay(const EdgeRelay &) = delete;
+    EdgeRelay &operator=(const EdgeRelay &) = delete;
+
+    // `address` is a TCP port or unix:PATH.
+    bool listen_on(const std::string &address);
+    // Serves until "exit" on stdin or until the broker closes the connection.
+    void run();
+    void handle(const char *sender_ip, uint16_t sender_port, const std::string &topic, uint8_t udp_type,
+                const char *content_data, uint16_t content_len) override;
+    const RelayStats &get_stats() const { return stats; }
+    size_t upstream_patterns() const { return upstream_refs.size(); }
+};
+
+#endif // EDGE_RELAY_H
@@ -0,0 +1,61 @@
+#ifndef LATENCY_STAMP_H
+#define LATENCY_STAMP_H
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define LATENCY_STAMP_PREFIX "LTS:"
+#define LATENCY_STAMP_SIZE 46
+
+// Header that `loadgen --stamp` writes at the start of a STRING message, as
+// "LTS:<stream>:<sequence>:<sent_ns>" in fixed-width hex (8, 16 and 16
+// digits). It is printable, so any subscriber that prints STRING content
+// passes it through unchanged. The send time is steady_clock nanoseconds,
+// so publisher and subscriber have to run on the same host.
+struct LatencyStamp
+{
+    uint32_t stream;
+    uint64_t sequence;
+    int64_t sent_ns;
+};
+
+int64_t latency_clock_ns();
+void write_latency_stamp(char *content, uint32_t stream, uint64_t sequence, int64_t sent_ns);
+bool read_latency_stamp(const char *content, size_t content_len, LatencyStamp &stamp);
+
+// Per-topic latency, loss and reordering of stamped messages, as seen by one
+// subscriber. Sequences are numbered per (topic, stream), starting wherever
+// the subscriber joins; a message below the highest sequence already seen on
+// its stream counts as reordered, and gaps that never fill count as lost.
+class LatencyTracker
+{
+private:
+    struct StreamState
+    {
+        uint64_t first = 0;
+        uint64_t highest = 0;
+        uint64_t received = 0;
+    };
+
+    struct TopicState
+    {
+        std::vector<int64_t> samples;
+        std::unordered_map<uint32_t, StreamState> streams;
+        uint64_t reordered = 0;
+        uint64_t unstamped = 0;
+    };
+
+    std::map<std::string, TopicState> topics;
+
+public:
+    void record(const std::string &topic, const char *content, size_t content_len, int64_t arrival_ns);
+
+    // One key=value line per topic, then the totals under topic=ALL.
+    void print_summary(std::ostream &out);
+};
+
+#endif // LATENCY_STAMP_H
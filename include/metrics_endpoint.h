@@ -0,0 +1,64 @@
+#ifndef METRICS_ENDPOINT_H
+#define METRICS_ENDPOINT_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <poll.h>
+
+#define MAX_METRICS_CONNECTIONS 16
+#define MAX_METRICS_REQUEST 8192
+#define METRICS_CONNECTION_TIMEOUT_MS 5000
+
+// Minimal HTTP/1.0 responder for metric scrapes, driven by the event loop
+// that owns it. Every socket is non-blocking: the request is collected as it
+// arrives, the body is rendered once when the request is complete, and a
+// large response goes out over as many POLLOUT wakeups as the socket needs.
+// A request must arrive within METRICS_CONNECTION_TIMEOUT_MS of the accept,
+// so clients that never finish one cannot hold every slot; while the
+// response goes out, the deadline moves on with every write that progresses.
+class MetricsEndpoint
+{
+private:
+    struct Connection
+    {
+        int socket = -1;
+        std::string request;
+        std::string response;
+        size_t sent = 0;
+        bool done = false;
+        int64_t deadline_ms = 0;
+    };
+
+    int listener = -1;
+    std::string unix_path;
+    std::vector<Connection> connections;
+    size_t poll_base = 0;
+
+    void accept_connections();
+    void read_request(Connection &conn, const std::function<std::string()> &render);
+    void write_response(Connection &conn);
+
+public:
+    MetricsEndpoint() = default;
+    ~MetricsEndpoint();
+
+    MetricsEndpoint(const MetricsEndpoint &) = delete;
+    MetricsEndpoint &operator=(const MetricsEndpoint &) = delete;
+
+    // `address` is a loopback TCP port or unix:PATH.
+    static bool valid_address(const std::string &address);
+    bool open(const std::string &address);
+    bool is_open() const { return listener >= 0; }
+
+    // Appends the endpoint's descriptors after the caller's own; after poll()
+    // the caller hands the same array to handle_events and trims it back.
+    void add_poll_fds(std::vector<struct pollfd> &fds);
+    // Shortens the caller's poll timeout so that a connection past its
+    // deadline is closed even when nothing else wakes the loop.
+    int next_timeout(int poll_timeout) const;
+    void handle_events(const std::vector<struct pollfd> &fds, const std::function<std::string()> &render);
+};
+
+#endif // METRICS_ENDPOINT_H
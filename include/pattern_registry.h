@@ -0,0 +1,91 @@
+#ifndef PATTERN_REGISTRY_H
+#define PATTERN_REGISTRY_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#define PATTERN_NONE UINT32_MAX
+
+typedef uint32_t PatternId;
+
+// Distinct subscription patterns of one broker context, each held once with
+// its segments already split and a count of the subscriptions naming it.
+// Patterns without wildcards are compared as whole strings. Within one
+// message every pattern is tested against the topic at most once; the
+// subscribers sharing it read the cached result.
+class PatternRegistry
+{
+private:
+    struct Entry
+    {
+        std::string text;
+        std::vector<std::string> segments; // left empty for literal patterns
+        size_t refs = 0;
+        uint64_t serial = 0; // message the cached result belongs to
+        bool literal = false; // no wildcards and no empty segments
+        bool matched = false;
+    };
+
+    // A deque keeps every entry in place, so the index can key on views of
+    // the entries' own text instead of a second copy.
+    std::deque<Entry> entries;
+    std::vector<PatternId> free_ids;
+    std::unordered_map<std::string_view, PatternId> ids;
+    std::string topic;
+    bool topic_literal = false;
+    std::vector<std::string> topic_segments; // split on the first wildcard test
+    bool topic_split = false;
+    uint64_t message_serial = 0;
+    uint64_t evaluation_count = 0;
+
+public:
+    // Takes one reference to `pattern`, interning it on first use.
+    PatternId acquire(const std::string &pattern);
+    // Drops one reference; the ID is reused once none are left.
+    void release(PatternId id);
+    PatternId find(const std::string &pattern) const;
+    const std::string &text(PatternId id) const { return entries[id].text; }
+
+    // Starts a new message: matches() tests `topic` from here on.
+    void begin_message(const std::string &message_topic);
+    bool matches(PatternId id);
+
+    size_t size() const { return ids.size(); }
+    uint64_t evaluations() const { return evaluation_count; }
+};
+
+struct PatternSubscription
+{
+    PatternId id;
+    bool sf;
+    bool covered; // another pattern of the subscriber takes its messages
+};
+
+// One subscriber's patterns by ID, kept in the order of their text so that
+// the first match is the one a std::map<std::string, bool> would find.
+class SubscriptionList
+{
+private:
+    std::vector<PatternSubscription> items;
+
+    size_t lower_bound(const PatternRegistry &registry, const std::string &pattern) const;
+
+public:
+    // Adds `pattern` or changes its SF flag.
+    void set(PatternRegistry &registry, const std::string &pattern, bool sf);
+    bool erase(PatternRegistry &registry, const std::string &pattern);
+    const PatternSubscription *find(const PatternRegistry &registry, const std::string &pattern) const;
+    void set_covered(size_t index, bool covered) { items[index].covered = covered; }
+    size_t covered_count() const;
+
+    std::vector<PatternSubscription>::const_iterator begin() const { return items.begin(); }
+    std::vector<PatternSubscription>::const_iterator end() const { return items.end(); }
+    size_t size() const { return items.size(); }
+    bool empty() const { return items.empty(); }
+};
+
+#endif // PATTERN_REGISTRY_H
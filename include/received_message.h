@@ -0,0 +1,50 @@
+#ifndef RECEIVED_MESSAGE_H
+#define RECEIVED_MESSAGE_H
+
+#include "circular_buffer.h"
+#include "common.h"
+#include "latency_stamp.h"
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Renders one forwarded message the way the checker expects to see it.
+std::string format_received_message(const std::string &sender_ip, uint16_t sender_port,
+                                    const std::string &topic, uint8_t udp_type,
+                                    const char *content_data, uint16_t content_len);
+
+// Senders and topics the server defined on this connection in dictionary
+// mode, indexed by ID. Every connection starts with empty tables.
+struct WireDictionaryTable
+{
+    std::vector<std::pair<std::string, uint16_t>> senders;
+    std::vector<std::string> topics;
+};
+
+// Gets the decoded messages instead of them being printed, e.g. to pass them
+// on to other connections. `sender_ip` is in dotted form.
+class ReceivedMessageHandler
+{
+public:
+    virtual ~ReceivedMessageHandler() = default;
+    virtual void handle(const char *sender_ip, uint16_t sender_port, const std::string &topic, uint8_t udp_type,
+                        const char *content_data, uint16_t content_len) = 0;
+};
+
+// Takes every complete frame, plain or batch, out of `data_buffer` and prints
+// its messages to `out`, or hands them to `tracker` instead when one is given.
+// Batch entries that define or name dictionary IDs use `dictionary`.
+void deserialize_and_process_message(CircularBuffer<char> &data_buffer, std::ostream &out, LatencyTracker *tracker,
+                                     WireDictionaryTable &dictionary);
+
+// Same, with every message going to `handler`.
+void deserialize_and_process_message(CircularBuffer<char> &data_buffer, ReceivedMessageHandler &handler,
+                                     WireDictionaryTable &dictionary);
+
+// Same for frames already laid out back to back in memory, such as the ones
+// taken from the shared-memory ring.
+void process_forward_frames(const char *data, size_t len, std::ostream &out, LatencyTracker *tracker,
+                            WireDictionaryTable &dictionary);
+
+#endif // RECEIVED_MESSAGE_H
@@ -0,0 +1,272 @@
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#define CACHE_LINE_SIZE 64
+
+// Typed, bounded, lock-free queues used to hand work between threads. Capacity
+// is rounded up to a power of two so positions wrap with a mask. Indices are
+// free-running counters, each kept on its own cache line together with the
+// cached copy of the opposite index, so producer and consumer only share a line
+// when the cached value runs out.
+//
+// Unlike CircularBuffer (a byte ring owned by a single thread) the element type
+// is arbitrary, so the definitions live here rather than in a .cpp.
+
+template <typename T>
+class SpscQueue
+{
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;
+    size_t cached_tail;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;
+    size_t cached_head;
+    alignas(CACHE_LINE_SIZE) std::unique_ptr<T[]> slots;
+    size_t mask;
+
+public:
+    explicit SpscQueue(size_t cap);
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    bool push(T &&item);
+    size_t push_batch(T *items, size_t len);
+    bool pop(T &item);
+    size_t pop_batch(T *items, size_t len);
+
+    size_t size_approx() const;
+    bool empty() const;
+    size_t capacity() const { return mask + 1; }
+};
+
+// Multiple producers, one consumer. Every slot carries a sequence number
+// (Vyukov's bounded queue), so producers claim positions with a single CAS on
+// `head` and the consumer never touches a shared counter.
+template <typename T>
+class MpscQueue
+{
+private:
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;
+    alignas(CACHE_LINE_SIZE) size_t tail;
+    alignas(CACHE_LINE_SIZE) std::unique_ptr<Slot[]> slots;
+    size_t mask;
+
+public:
+    explicit MpscQueue(size_t cap);
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    bool push(T &&item);
+    size_t push_batch(T *items, size_t len);
+    bool pop(T &item);
+    size_t pop_batch(T *items, size_t len);
+
+    bool empty() const;
+    size_t capacity() const { return mask + 1; }
+};
+
+// eventfd-backed wakeup for a consumer that blocks when its queue runs dry.
+// The consumer arms the notifier, re-checks its queue and only then waits;
+// producers pay for a write() only when the consumer is actually armed.
+class EventNotifier
+{
+private:
+    int fd;
+    alignas(CACHE_LINE_SIZE) std::atomic<bool> armed;
+
+public:
+    EventNotifier();
+    ~EventNotifier();
+
+    EventNotifier(const EventNotifier &) = delete;
+    EventNotifier &operator=(const EventNotifier &) = delete;
+
+    int get_fd() const { return fd; }
+    void arm();
+    void notify();
+    void wake();
+    void wait();
+    void drain();
+};
+
+static inline size_t round_up_power_of_two(size_t value)
+{
+    size_t result = 1;
+    while (result < value)
+    {
+        result <<= 1;
+    }
+    return result;
+}
+
+template <typename T>
+SpscQueue<T>::SpscQueue(size_t cap)
+    : head(0), cached_tail(0), tail(0), cached_head(0),
+      slots(new T[round_up_power_of_two(cap < 2 ? 2 : cap)]),
+      mask(round_up_power_of_two(cap < 2 ? 2 : cap) - 1)
+{
+}
+
+template <typename T>
+bool SpscQueue<T>::push(T &&item)
+{
+    return push_batch(&item, 1) == 1;
+}
+
+template <typename T>
+size_t SpscQueue<T>::push_batch(T *items, size_t len)
+{
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t free_slots = capacity() - (h - cached_tail);
+    if (free_slots < len)
+    {
+        cached_tail = tail.load(std::memory_order_acquire);
+        free_slots = capacity() - (h - cached_tail);
+    }
+    size_t count = len < free_slots ? len : free_slots;
+    for (size_t i = 0; i < count; ++i)
+    {
+        slots[(h + i) & mask] = std::move(items[i]);
+    }
+    if (count > 0)
+    {
+        head.store(h + count, std::memory_order_release);
+    }
+    return count;
+}
+
+template <typename T>
+bool SpscQueue<T>::pop(T &item)
+{
+    return pop_batch(&item, 1) == 1;
+}
+
+template <typename T>
+size_t SpscQueue<T>::pop_batch(T *items, size_t len)
+{
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t ready = cached_head - t;
+    if (ready < len)
+    {
+        cached_head = head.load(std::memory_order_acquire);
+        ready = cached_head - t;
+    }
+    size_t count = len < ready ? len : ready;
+    for (size_t i = 0; i < count; ++i)
+    {
+        items[i] = std::move(slots[(t + i) & mask]);
+    }
+    if (count > 0)
+    {
+        tail.store(t + count, std::memory_order_release);
+    }
+    return count;
+}
+
+template <typename T>
+size_t SpscQueue<T>::size_approx() const
+{
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+template <typename T>
+bool SpscQueue<T>::empty() const
+{
+    return size_approx() == 0;
+}
+
+template <typename T>
+MpscQueue<T>::MpscQueue(size_t cap)
+    : head(0), tail(0),
+      slots(new Slot[round_up_power_of_two(cap < 2 ? 2 : cap)]),
+      mask(round_up_power_of_two(cap < 2 ? 2 : cap) - 1)
+{
+    for (size_t i = 0; i <= mask; ++i)
+    {
+        slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+bool MpscQueue<T>::push(T &&item)
+{
+    return push_batch(&item, 1) == 1;
+}
+
+template <typename T>
+size_t MpscQueue<T>::push_batch(T *items, size_t len)
+{
+    size_t h = head.load(std::memory_order_relaxed);
+    while (true)
+    {
+        size_t count = 0;
+        while (count < len && slots[(h + count) & mask].seq.load(std::memory_order_acquire) == h + count)
+        {
+            count++;
+        }
+        if (count == 0)
+        {
+            size_t current = head.load(std::memory_order_relaxed);
+            if (current == h)
+            {
+                return 0;
+            }
+            h = current;
+            continue;
+        }
+        if (head.compare_exchange_weak(h, h + count, std::memory_order_relaxed))
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                Slot &slot = slots[(h + i) & mask];
+                slot.value = std::move(items[i]);
+                slot.seq.store(h + i + 1, std::memory_order_release);
+            }
+            return count;
+        }
+    }
+}
+
+template <typename T>
+bool MpscQueue<T>::pop(T &item)
+{
+    return pop_batch(&item, 1) == 1;
+}
+
+template <typename T>
+size_t MpscQueue<T>::pop_batch(T *items, size_t len)
+{
+    size_t count = 0;
+    while (count < len)
+    {
+        Slot &slot = slots[tail & mask];
+        if (slot.seq.load(std::memory_order_acquire) != tail + 1)
+        {
+            break;
+        }
+        items[count++] = std::move(slot.value);
+        slot.seq.store(tail + mask + 1, std::memory_order_release);
+        tail++;
+    }
+    return count;
+}
+
+template <typename T>
+bool MpscQueue<T>::empty() const
+{
+    return slots[tail & mask].seq.load(std::memory_order_acquire) != tail + 1;
+}
+
+#endif // RING_QUEUE_H
@@ -3,7 +3,24 @@
 
 #include "common.h"
 #include "circular_buffer.h"
+#include "topic_history.h"
+#include "topic_match.h"
+#include "pattern_registry.h"
+#include "udp_message.h"
+#include "ring_queue.h"
+#include "subscription_index.h"
+#include "server_stats.h"
+#include "metrics_endpoint.h"
+#include "shm_ring.h"
+#include "stage_latency.h"
+#include "spin_poll.h"
+#include <atomic>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
 #include <set>
 #include <vector>
 #include <string>
@@ -14,26 +31,376 @@
 #include <climits>
 
 #define MAX_CLIENTS 100
+#define INGEST_QUEUE_SIZE 65536
+#define SEND_QUEUE_SIZE 16384
+#define PIPELINE_BATCH 32
+#define INGEST_RECV_TIMEOUT_MS 100
+#define REACTOR_QUEUE_SIZE 16384
+#define MAX_REACTORS 64
+#define DEFAULT_BATCH_DELAY_US 1000
+#define DEFAULT_BATCH_BYTES 65536
+#define MAX_BATCH_DELAY_US 1000000
+#define MAX_BATCH_BYTES (1 << 20)
+#define DEFAULT_LAG_SHED_BYTES (4 << 20)
+#define DEFAULT_LAG_SPOOL_BYTES (16 << 20)
+#define DEFAULT_LAG_DISCONNECT_BYTES (64 << 20)
+#define DEFAULT_LAG_SHED_MS 2000
+#define DEFAULT_LAG_SPOOL_MS 5000
+#define DEFAULT_LAG_DISCONNECT_MS 30000
+#define LAG_CHECK_INTERVAL_MS 100
+#define LAG_REFILL_BYTES (256 << 10)
+#define MAX_RATE_LIMIT 1000000
+#define MAX_RATE_BURST 1024
+#define MAX_SAMPLE_MS 3600000
+#define MAX_GROUP_NAME_SIZE 32
+// Event loop poll set: [0] TCP listener, [1] UDP socket (or a wakeup fd),
+// [2] stdin, [3] Unix stream listener, [4] Unix datagram socket; unused
+// entries hold fd -1. Subscriber connections follow.
+#define FIRST_CLIENT_POLL_INDEX 5
+
+struct ClientRecord;
+class BrokerTransport;
+
+// Coalescing bounds of one subscription; frames wait at most `delay_us` and
+// are flushed early once `max_bytes` have accumulated.
+struct BatchWindow
+{
+    uint64_t delay_us = 0;
+    size_t max_bytes = 0;
+};
+
+// Delivery limit of one subscription, a token bucket per matched topic:
+// max_rate=N refills N tokens a second up to `burst`, sample_ms=T is one token
+// every T ms with a burst of 1. A frame that finds no token replaces the
+// topic's pending one and goes out as soon as a token is back.
+struct RateLimit
+{
+    double tokens_per_us = 0; // 0 when the subscription is not limited
+    double burst = 1;
+};
+
+// Token bucket of one topic for one subscriber and the newest frame waiting
+// for a token, empty when none is.
+struct ThrottledTopic
+{
+    std::string pattern;
+    double tokens = 0;
+    int64_t refilled_us = 0;
+    std::vector<char> latest;
+    bool timer_armed = false;
+};
+
+// Escalation levels of a subscriber whose socket cannot keep up. Each level
+// keeps the restrictions of the ones before it.
+enum LagState
+{
+    LAG_HEALTHY,
+    LAG_SHEDDING,  // non-SF traffic is dropped
+    LAG_SPOOLING,  // SF traffic goes to stored_messages instead of the socket
+    LAG_DISCONNECT // closed at the end of the loop iteration
+};
+
+// Per-level limits on queued bytes and on the age of the oldest queued frame,
+// indexed by LagState - 1. Zero disables that limit.
+struct LagThresholds
+{
+    size_t bytes[3] = {DEFAULT_LAG_SHED_BYTES, DEFAULT_LAG_SPOOL_BYTES, DEFAULT_LAG_DISCONNECT_BYTES};
+    size_t ms[3] = {DEFAULT_LAG_SHED_MS, DEFAULT_LAG_SPOOL_MS, DEFAULT_LAG_DISCONNECT_MS};
+};
+
+struct SlowConsumerStats
+{
+    StatCounter shedding;
+    StatCounter spooling;
+    StatCounter disconnects;
+    StatCounter recoveries;
+    StatCounter shed_messages;
+    StatCounter spooled_messages;
+};
+
+// Bytes the kernel did not accept yet, with the time they were queued.
+// `sf_packets` are the plain SF frames encoded into `data`, stored again if
+// the connection goes before they are written.
+struct QueuedFrame
+{
+    std::vector<char> data;
+    int64_t queued_at;
+    std::vector<std::vector<char>> sf_packets;
+};
 
 struct Subscriber
 {
     int socket = -1;
     char id[MAX_ID_SIZE + 1];
-    std::map<std::string, bool> topics;
+    SubscriptionList topics; // IDs in ServerContext::patterns
     std::vector<std::vector<char>> stored_messages;
     bool connected = false;
     CircularBuffer<char> command_buffer;
+    ClientRecord *record = nullptr;
+    uint64_t connection = 0;
+    std::map<std::string, BatchWindow> windows;
+    std::map<std::string, ContentFilter> filters; // only patterns with a where= predicate
+    std::map<std::string, RateLimit> rate_limits; // only patterns with max_rate= or sample_ms=
+    std::map<std::string, ThrottledTopic> throttled; // per matched topic, this connection only
+    std::vector<char> outbound;
+    std::vector<std::vector<char>> outbound_sf; // SF frames among those in `outbound`
+    int64_t flush_deadline = 0;
+    uint64_t batch_serial = 0;
+    std::deque<QueuedFrame> backlog;
+    size_t backlog_offset = 0;
+    size_t backlog_bytes = 0;
+    LagState lag_state = LAG_HEALTHY;
+    bool batch_frames = false; // negotiated with "frames batch"
+    bool turn_pending = false;
+    WireDictionary dictionary; // per connection, enabled with "frames ... dict"
+    int shm_slot = -1;         // local reader of the shared-memory ring, "transport shm"
+    std::set<std::string> groups; // keys of its shared subscriptions in ServerContext::groups
 
     Subscriber() : command_buffer(CIRCULAR_BUFFER_SIZE) {}
 };
 
-struct UdpMessage
+// How a shared subscription picks the member that takes a message.
+enum GroupPolicy
+{
+    GROUP_ROUND_ROBIN,
+    GROUP_LEAST_QUEUED,
+    GROUP_HASH_TOPIC // one member per topic keeps its order
+};
+
+struct GroupMember
+{
+    Subscriber *sub;
+    bool sf;
+};
+
+// Shared subscription "subscribe <pattern> <SF> group=<name>": every message
+// matching the pattern goes to one connected member only. While none is
+// connected the messages are kept for the group if any member asked for SF.
+struct SharedGroup
+{
+    std::string name;
+    PatternId pattern;
+    GroupPolicy policy = GROUP_ROUND_ROBIN;
+    std::vector<GroupMember> members; // in joining order
+    size_t cursor = 0;
+    std::vector<std::vector<char>> stored_messages;
+    uint64_t delivered = 0;
+};
+
+struct ServerConfig
+{
+    int port = 0;
+    size_t history_depth = DEFAULT_HISTORY_DEPTH;
+    size_t history_memory = DEFAULT_HISTORY_MEMORY_LIMIT;
+    size_t pipeline_senders = 0;
+    size_t ingest_threads = 1;
+    size_t reactors = 0;
+    size_t spin_us = 0;
+    size_t busy_poll_us = 0;
+    int pin_cpu = -1;
+    LagThresholds lag;
+    std::string metrics_address;
+    std::string shm_path;
+    size_t shm_bytes = SHM_RING_DEFAULT_BYTES;
+    std::string unix_stream_path; // subscribers over AF_UNIX, "--unix"
+    std::string unix_dgram_path;  // publishers over AF_UNIX, "--unix-dgram"
+};
+
+struct SubscribeOptions
+{
+    size_t history = 0;
+    BatchWindow window;
+    ContentFilter filter;
+    RateLimit rate_limit;
+    std::string group;
+    GroupPolicy policy = GROUP_ROUND_ROBIN;
+    bool policy_set = false;
+};
+
+// Pending flush of a subscriber's outbound batch, or with `topic` set the
+// release of a rate-limited topic (then `serial` is the connection). Timers
+// are never removed; one whose serial no longer matches the subscriber's is
+// simply skipped.
+struct FlushTimer
+{
+    int64_t deadline;
+    uint64_t serial;
+    std::string id;
+    std::string topic;
+
+    bool operator>(const FlushTimer &other) const { return deadline > other.deadline; }
+};
+
+using FlushTimers = std::priority_queue<FlushTimer, std::vector<FlushTimer>, std::greater<FlushTimer>>;
+
+using PollFds = std::vector<struct pollfd>;
+using SubscribersMap = std::map<std::string, Subscriber>;
+using SocketToIdMap = std::map<int, std::string>;
+
+// A parsed datagram and its forward packet, shared by every send stage that
+// has to deliver it; the last stage to release it frees it. `sf_targets` is
+// filled by the match stage with offline SF subscribers for the event loop.
+struct PipelineMessage
+{
+    UdpMessage msg;
+    std::vector<char> packet;
+    std::vector<std::string> sf_targets;
+    std::atomic<uint32_t> refs{1};
+    uint64_t queued_at = 0;
+    uint64_t history_seq = 0; // reactor mode: history sequence right after this message
+};
+
+enum SendKind
+{
+    SEND_PACKET,
+    SEND_OPEN,
+    SEND_CLOSE
+};
+
+// Work item for a send stage. Sockets are tagged with a connection number so
+// that packets matched against a stale snapshot are dropped instead of being
+// written to a descriptor that has since been closed or reused.
+struct SendDescriptor
+{
+    SendKind kind = SEND_PACKET;
+    int socket = -1;
+    uint64_t connection = 0;
+    PipelineMessage *message = nullptr;
+    uint64_t queued_at = 0;
+};
+
+struct SendStage
+{
+    MpscQueue<SendDescriptor> queue;
+    EventNotifier notifier;
+    std::atomic<bool> stop{false};
+    std::thread thread;
+    ServerStats stats;
+    StageLatency latency;
+
+    SendStage() : queue(SEND_QUEUE_SIZE) {}
+};
+
+// Counters and histograms owned by one ingest thread.
+struct IngestStage
+{
+    int socket = -1; // the UDP socket, or the Unix datagram one
+    ServerStats stats;
+    StageLatency latency;
+};
+
+// Staged mode: ingest threads receive and serialize datagrams, the match stage
+// resolves them against a snapshot of the subscription index, and send stages
+// own all writes to the subscriber sockets assigned to them. The event loop
+// keeps command parsing, publishes index versions and gets every message back
+// on `completed` for history and SF bookkeeping.
+struct Pipeline
+{
+    MpscQueue<PipelineMessage *> ingest_queue;
+    EventNotifier match_notifier;
+    SpscQueue<PipelineMessage *> completed;
+    EventNotifier completion_notifier;
+    SubscriptionIndex index;
+    std::atomic<bool> stop{false};
+    std::atomic<bool> stop_match{false};
+    std::vector<std::thread> ingest_threads;
+    std::thread match_thread;
+    std::vector<std::unique_ptr<SendStage>> senders;
+    std::vector<std::unique_ptr<IngestStage>> ingest_stages;
+    ServerStats match_stats;
+    StageLatency match_latency;
+    TopicCounters topics;
+
+    Pipeline() : ingest_queue(INGEST_QUEUE_SIZE), completed(INGEST_QUEUE_SIZE) {}
+};
+
+struct ReactorPool;
+
+// Reactor mode keeps a single history, the listener's: the listener records
+// every message once, and reactors replay from it under the lock.
+struct SharedHistory
+{
+    std::mutex lock;
+    TopicHistory *store = nullptr;
+};
+
+struct ServerContext
+{
+    PatternRegistry patterns;
+    SubscribersMap subscribers;
+    PollFds poll_fds;
+    SocketToIdMap socket_to_id;
+    TopicHistory history;
+    Pipeline *pipeline = nullptr;
+    ReactorPool *reactors = nullptr;
+    SharedHistory *shared_history = nullptr; // set in reactors, which keep no history of their own
+    uint64_t history_seen = 0;               // history sequence of the last fanned-out message handled
+    uint64_t next_connection = 0;
+    SpinPolicy spin;
+    int busy_poll_us = 0;
+    FlushTimers flush_timers;
+    std::vector<Subscriber *> turn_pending;
+    LagThresholds lag;
+    SlowConsumerStats slow;
+    std::set<std::string> backlogged;
+    ServerStats stats;
+    TopicCounters topics;
+    StageLatency latency;
+    LatencyReport latency_baseline;
+    std::string console_input;
+    BrokerTransport *transport = nullptr; // null writes to the subscriber sockets
+    ShmRing *shm = nullptr;
+    std::map<std::string, SharedGroup> groups; // by "<name> <pattern>"
+    // Members of a group must all be seen by one matcher, so the pipeline
+    // and reactor modes have no shared subscriptions.
+    bool shared_groups;
+
+    explicit ServerContext(const ServerConfig &config)
+        : history(config.history_depth, config.history_memory), spin(config.spin_us * 1000),
+          busy_poll_us(static_cast<int>(config.busy_poll_us)), lag(config.lag),
+          shared_groups(config.pipeline_senders == 0 && config.reactors == 0) {}
+};
+
+// Listener-side view of a client in reactor mode. The client always goes back
+// to the reactor that holds its subscriptions; `connected` is cleared by that
+// reactor when the connection goes away.
+struct ClientRecord
+{
+    size_t reactor = 0;
+    std::atomic<bool> connected{false};
+};
+
+// A connection whose ID handshake has been completed by the listener.
+struct Handoff
+{
+    int socket = -1;
+    std::string id;
+    struct sockaddr_in addr;
+    ClientRecord *record = nullptr;
+};
+
+// A connection-owning event loop. It owns the subscriber slots, sockets and
+// command parsing of its clients and receives fan-out work from the listener.
+struct Reactor
+{
+    SpscQueue<Handoff> handoffs;
+    SpscQueue<PipelineMessage *> fanout;
+    EventNotifier notifier;
+    std::atomic<bool> stop{false};
+    std::unique_ptr<ServerContext> ctx;
+    int cpu = -1;
+    std::thread thread;
+
+    explicit Reactor(const ServerConfig &config)
+        : handoffs(MAX_CLIENTS), fanout(REACTOR_QUEUE_SIZE), ctx(new ServerContext(config)) {}
+};
+
+struct ReactorPool
 {
-    char topic[TOPIC_SIZE + 1];
-    uint8_t type;
-    char content[MAX_CONTENT_SIZE + 1];
-    struct sockaddr_in sender_addr;
-    int content_len;
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    std::map<std::string, std::unique_ptr<ClientRecord>> registry;
+    std::vector<size_t> assigned;
+    SharedHistory history;
 };
 
 #endif // SERVER_H
\ No newline at end of file
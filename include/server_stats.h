@@ -0,0 +1,106 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include "common.h"
+#include "ring_queue.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define TOPIC_STATS_SLOTS 4096
+#define TOPIC_STATS_MAX_PROBE 32
+#define DEFAULT_TOP_TOPICS 10
+
+enum StatId
+{
+    STAT_DATAGRAMS_RECEIVED,
+    STAT_DATAGRAMS_PARSED,
+    STAT_DATAGRAMS_REJECTED,
+    STAT_MESSAGES_MATCHED,
+    STAT_MESSAGES_FILTERED,
+    STAT_MESSAGES_SUPPRESSED,
+    STAT_BYTES_SENT,
+    STAT_SEND_FAILURES,
+    STAT_SF_ENQUEUED,
+    STAT_SF_REPLAYED,
+    STAT_CONNECTIONS_ACCEPTED,
+    STAT_CONNECTIONS_REFUSED,
+    STAT_DISCONNECTIONS,
+    STAT_COUNT
+};
+
+// Levels that go up and down, kept current by the thread that owns the state.
+enum GaugeId
+{
+    GAUGE_SUBSCRIBERS_CONNECTED,
+    GAUGE_SF_MESSAGES,
+    GAUGE_SF_BYTES,
+    GAUGE_QUEUED_BYTES,
+    GAUGE_COUNT
+};
+
+extern const char *const STAT_NAMES[STAT_COUNT];
+extern const char *const GAUGE_NAMES[GAUGE_COUNT];
+
+// A counter with exactly one writing thread. The increment is a relaxed load
+// and store rather than a locked read-modify-write, so it costs the same as a
+// plain integer on the hot path; the console thread may read it at any time.
+class StatCounter
+{
+private:
+    std::atomic<uint64_t> value{0};
+
+public:
+    void add(uint64_t n = 1) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    void sub(uint64_t n = 1) { value.store(value.load(std::memory_order_relaxed) - n, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// One block per writing thread (event loop, reactor or pipeline stage); the
+// console adds the blocks up when asked.
+struct alignas(CACHE_LINE_SIZE) ServerStats
+{
+    StatCounter counters[STAT_COUNT];
+    StatCounter gauges[GAUGE_COUNT];
+
+    void add(StatId id, uint64_t n = 1) { counters[id].add(n); }
+    uint64_t get(StatId id) const { return counters[id].get(); }
+    void raise(GaugeId id, uint64_t n = 1) { gauges[id].add(n); }
+    void lower(GaugeId id, uint64_t n = 1) { gauges[id].sub(n); }
+    void accumulate_into(uint64_t (&totals)[STAT_COUNT]) const;
+    void accumulate_gauges_into(uint64_t (&totals)[GAUGE_COUNT]) const;
+};
+
+// Per-topic publish counts in a fixed open-addressing table, so recording a
+// message never allocates. A topic that finds no free slot within the probe
+// limit is counted as "other". Single writer, any number of readers.
+class TopicCounters
+{
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> hash{0};
+        char topic[TOPIC_SIZE + 1];
+        StatCounter count;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    StatCounter overflow;
+    StatCounter used;
+
+public:
+    TopicCounters();
+
+    TopicCounters(const TopicCounters &) = delete;
+    TopicCounters &operator=(const TopicCounters &) = delete;
+
+    void record(const char *topic);
+    std::vector<std::pair<std::string, uint64_t>> top(size_t n) const;
+    size_t distinct() const { return used.get(); }
+    uint64_t other() const { return overflow.get(); }
+};
+
+#endif // SERVER_STATS_H
@@ -0,0 +1,103 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include "common.h"
+#include "ring_queue.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define SHM_RING_SLOTS 64
+#define SHM_RING_DEFAULT_BYTES (16 << 20)
+#define SHM_RING_MIN_BYTES (1 << 16)
+#define SHM_RING_MAX_BYTES (1 << 30)
+#define SHM_RING_MAGIC 0x4d485350u // "PSHM"
+#define SHM_RECORD_HEADER_SIZE 16
+#define SHM_MAX_FRAME_SIZE (4 * BUFFER_SIZE)
+// A reader treats a record as lost once the writer is this close to reaching
+// it again: the writer may be filling one record and a wrap padding ahead of
+// the position it has published.
+#define SHM_REWRITE_MARGIN (2 * (SHM_RECORD_HEADER_SIZE + SHM_MAX_FRAME_SIZE + 16))
+#define SHM_SPIN_ROUNDS 2000
+#define SHM_ATTACH_TIMEOUT_MS 2000
+#define SHM_WAIT_MS 100
+
+// Local subscriber slot. The broker writes the client ID and the ring position
+// its frames start at, then publishes a new generation.
+struct ShmSlot
+{
+    std::atomic<uint64_t> generation;
+    std::atomic<uint64_t> start_pos;
+    char id[MAX_ID_SIZE + 1];
+};
+
+// Start of the shared mapping; the ring data follows the header. The writer
+// and every reader keep their hot fields on separate cache lines.
+struct ShmRingHeader
+{
+    uint32_t magic;
+    uint32_t slot_count;
+    uint64_t capacity;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> write_pos;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> wake_seq;
+    std::atomic<uint32_t> waiters;
+    alignas(CACHE_LINE_SIZE) ShmSlot slots[SHM_RING_SLOTS];
+};
+
+// Broadcast ring in a shared-memory file for subscribers on the broker host.
+// The single writer appends every forwarded frame once, tagged with the bitmap
+// of local slots it is meant for; each reader walks the ring at its own pace
+// with plain loads and keeps the frames carrying its bit. A reader that falls
+// a whole ring behind skips to the newest data and counts the overrun. Idle
+// readers sleep on a futex the writer only touches while someone waits.
+class ShmRing
+{
+private:
+    ShmRingHeader *header = nullptr;
+    char *data = nullptr;
+    size_t mapped_bytes = 0;
+    std::string owned_path; // unlinked on close by the creator
+    bool slot_used[SHM_RING_SLOTS] = {};
+
+    // Reader side
+    int slot = -1;
+    uint64_t read_pos = 0;
+    uint64_t overrun_count = 0;
+
+    bool map_file(int fd, size_t bytes);
+
+public:
+    ShmRing() = default;
+    ~ShmRing();
+
+    ShmRing(const ShmRing &) = delete;
+    ShmRing &operator=(const ShmRing &) = delete;
+
+    // Writer side, one thread only.
+    bool create(const std::string &path, size_t capacity);
+    // Appends one frame for the readers in `mask`; fails for frames over
+    // SHM_MAX_FRAME_SIZE.
+    bool publish(const char *frame, size_t len, uint64_t mask);
+    // Returns the slot now holding `id`, or -1 when all are taken.
+    int assign_slot(const std::string &id);
+    void release_slot(int index);
+
+    // Reader side. `attach` maps an existing ring, `wait_for_slot` blocks
+    // until the broker assigned one to `id`.
+    bool attach(const std::string &path);
+    bool wait_for_slot(const std::string &id, int timeout_ms);
+    // Appends the plain frames meant for this reader to `frames`; returns how
+    // many were taken.
+    size_t read(std::vector<char> &frames);
+    // Sleeps until the writer publishes or `timeout_ms` passes.
+    void wait(int timeout_ms);
+    uint64_t overruns() const { return overrun_count; }
+
+    void close();
+    bool is_open() const { return header != nullptr; }
+};
+
+bool valid_shm_capacity(size_t capacity);
+
+#endif // SHM_RING_H
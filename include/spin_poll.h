@@ -0,0 +1,31 @@
+#ifndef SPIN_POLL_H
+#define SPIN_POLL_H
+
+#include <cstdint>
+#include <poll.h>
+
+#define MAX_SPIN_US 1000000
+#define SPIN_SHRINK_FLOOR 16
+
+// Spin-then-block state for one event loop. `budget_ns` is the configured
+// ceiling; `window_ns` is what the next idle period will actually spin. A
+// spin that ends with an event restores the full budget, one that runs out
+// halves the window (down to budget / SPIN_SHRINK_FLOOR), so a quiet feed
+// stops burning a core while a busy one keeps skipping scheduler wakeups.
+struct SpinPolicy
+{
+    uint64_t budget_ns = 0;
+    uint64_t window_ns = 0;
+    uint64_t hits = 0;
+    uint64_t blocks = 0;
+
+    SpinPolicy() = default;
+    explicit SpinPolicy(uint64_t budget) : budget_ns(budget), window_ns(budget) {}
+};
+
+// poll() with the timeout semantics of poll(); only an infinite wait spins.
+int spin_poll(struct pollfd *fds, nfds_t nfds, int timeout, SpinPolicy &policy);
+bool enable_busy_poll(int socket, int usec);
+bool pin_thread_to_cpu(int cpu);
+
+#endif // SPIN_POLL_H
@@ -0,0 +1,132 @@
+#ifndef STAGE_LATENCY_H
+#define STAGE_LATENCY_H
+
+#include "server_stats.h"
+#include <cstdint>
+#include <ostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Build with STAGE_LATENCY=0 to compile the histograms out: stage_clock()
+// then returns a constant and StageLatency::record() is empty, so the calls
+// left in the hot path fold away.
+
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+enum LatencyStage
+{
+    STAGE_RECEIVE,
+    STAGE_PARSE,
+    STAGE_MATCH,
+    STAGE_SERIALIZE,
+    STAGE_QUEUE,
+    STAGE_SEND,
+    STAGE_COUNT
+};
+
+extern const char *const STAGE_NAMES[STAGE_COUNT];
+
+inline uint64_t read_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline uint64_t stage_clock()
+{
+#ifdef STAGE_LATENCY
+    return read_tsc();
+#else
+    return 0;
+#endif
+}
+
+// Nanoseconds per clock tick, measured against steady_clock since startup.
+double tsc_ns_per_tick();
+
+// Bucket of a tick count: exact below LATENCY_SUB_BUCKETS, then
+// LATENCY_SUB_BUCKETS buckets per power of two (about 12% wide).
+inline size_t latency_bucket(uint64_t ticks)
+{
+    if (ticks < LATENCY_SUB_BUCKETS)
+    {
+        return static_cast<size_t>(ticks);
+    }
+    int msb = 63 - __builtin_clzll(ticks);
+    size_t sub = static_cast<size_t>(ticks >> (msb - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+    return static_cast<size_t>(msb - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS + sub;
+}
+
+uint64_t latency_bucket_floor(size_t bucket);
+
+struct HistogramSnapshot
+{
+    uint64_t counts[LATENCY_BUCKETS] = {};
+    uint64_t total = 0;
+    uint64_t sum = 0;
+
+    void subtract(const HistogramSnapshot &other);
+    uint64_t percentile(double fraction) const;
+    uint64_t max() const;
+    uint64_t count_at_most(uint64_t ticks) const;
+};
+
+struct LatencyReport
+{
+    HistogramSnapshot stages[STAGE_COUNT];
+
+    void subtract(const LatencyReport &other);
+};
+
+// Log-bucketed histogram in clock ticks with one writing thread.
+class LatencyHistogram
+{
+private:
+    StatCounter counts[LATENCY_BUCKETS];
+    StatCounter sum;
+
+public:
+    void record(uint64_t ticks)
+    {
+        counts[latency_bucket(ticks)].add();
+        sum.add(ticks);
+    }
+    void accumulate_into(HistogramSnapshot &snapshot) const;
+};
+
+// Histograms for every stage, one block per recording thread.
+struct alignas(CACHE_LINE_SIZE) StageLatency
+{
+#ifdef STAGE_LATENCY
+    LatencyHistogram stages[STAGE_COUNT];
+#endif
+
+    // Records the time since `start` (a stage_clock() value).
+    void record(LatencyStage stage, uint64_t start)
+    {
+#ifdef STAGE_LATENCY
+        uint64_t now = read_tsc();
+        stages[stage].record(now > start ? now - start : 0);
+#else
+        (void)stage;
+        (void)start;
+#endif
+    }
+    void accumulate_into(LatencyReport &report) const;
+};
+
+// Prints count, mean and percentiles per stage in nanoseconds.
+void print_stage_latency(std::ostream &out, const LatencyReport &report);
+// Writes one Prometheus histogram, labelled by stage, in seconds.
+void print_prometheus_latency(std::ostream &out, const char *name, const LatencyReport &report);
+
+#endif // STAGE_LATENCY_H
@@ -0,0 +1,119 @@
+#ifndef SUBSCRIPTION_INDEX_H
+#define SUBSCRIPTION_INDEX_H
+
+#include "content_filter.h"
+#include "ring_queue.h"
+#include "udp_message.h"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#define MAX_INDEX_READERS 16
+
+// Immutable view of one subscriber as seen by the matchers.
+struct IndexedSubscriber
+{
+    std::string id;
+    int socket = -1;
+    uint64_t connection = 0;
+    std::vector<std::vector<std::string>> patterns;
+    std::vector<bool> sf;
+    std::vector<ContentFilter> filters;
+};
+
+struct IndexMatch
+{
+    const IndexedSubscriber *subscriber;
+    bool sf;
+};
+
+class SubscriptionSnapshot
+{
+private:
+    std::vector<const IndexedSubscriber *> subscribers;
+    uint64_t version;
+
+    friend class SubscriptionIndex;
+
+public:
+    SubscriptionSnapshot() : version(0) {}
+
+    // Returns how many subscribers had matching patterns whose predicates all
+    // rejected `msg`.
+    size_t match(const std::vector<std::string> &t_segs, const UdpMessage &msg, std::vector<IndexMatch> &out) const;
+    uint64_t get_version() const { return version; }
+    size_t size() const { return subscribers.size(); }
+};
+
+// Read-mostly subscription index. A single writer stages changes and publishes
+// them as a new immutable snapshot; readers pin the current snapshot with an
+// epoch announcement and never block or retry. Snapshots share the entries of
+// unchanged subscribers, and replaced ones are freed once no reader can still
+// see them.
+class SubscriptionIndex
+{
+private:
+    struct alignas(CACHE_LINE_SIZE) ReaderSlot
+    {
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<bool> used{false};
+    };
+
+    struct WriterEntry
+    {
+        int socket = -1;
+        uint64_t connection = 0;
+        std::map<std::string, bool> topics;
+        std::map<std::string, ContentFilter> filters;
+        size_t position = 0;
+        bool dirty = false;
+    };
+
+    struct Retired
+    {
+        uint64_t epoch;
+        const SubscriptionSnapshot *snapshot;
+        std::vector<const IndexedSubscriber *> entries;
+    };
+
+    alignas(CACHE_LINE_SIZE) std::atomic<const SubscriptionSnapshot *> current;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> global_epoch;
+    ReaderSlot readers[MAX_INDEX_READERS];
+
+    std::map<std::string, WriterEntry> entries;
+    std::vector<std::map<std::string, WriterEntry>::iterator> dirty_entries;
+    std::vector<Retired> retired;
+    uint64_t published_versions;
+    uint64_t reclaimed_snapshots;
+
+    WriterEntry &entry_for(const std::string &id);
+    void reclaim();
+
+public:
+    SubscriptionIndex();
+    ~SubscriptionIndex();
+
+    SubscriptionIndex(const SubscriptionIndex &) = delete;
+    SubscriptionIndex &operator=(const SubscriptionIndex &) = delete;
+
+    // Reader side, safe from any registered thread.
+    int register_reader();
+    void unregister_reader(int slot);
+    const SubscriptionSnapshot *read_lock(int slot);
+    void read_unlock(int slot);
+
+    // Writer side, a single thread only.
+    void subscribe(const std::string &id, const std::string &pattern, bool sf, const ContentFilter &filter);
+    void unsubscribe(const std::string &id, const std::string &pattern);
+    void set_connection(const std::string &id, int socket, uint64_t connection);
+    bool publish();
+
+    bool pending() const { return !dirty_entries.empty(); }
+    uint64_t versions() const { return published_versions; }
+    uint64_t reclaimed() const { return reclaimed_snapshots; }
+    size_t retired_count() const { return retired.size(); }
+};
+
+#endif // SUBSCRIPTION_INDEX_H
@@ -0,0 +1,91 @@
+#ifndef TOPIC_HISTORY_H
+#define TOPIC_HISTORY_H
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define DEFAULT_HISTORY_DEPTH 16
+#define DEFAULT_HISTORY_MEMORY_LIMIT (16 * 1024 * 1024)
+#define MAX_HISTORY_REPLAY 1024
+#define MAX_HISTORY_DEPTH MAX_HISTORY_REPLAY
+
+// Keeps the last `depth` serialized packets of every topic seen on the UDP side,
+// so that a fresh subscriber can be brought up to date without waiting for the
+// next publication. Memory is capped globally: when the cap is hit the oldest
+// packet in the whole store is evicted, regardless of its topic. The cap
+// covers the trie and the rings too, since publishers pick topic names
+// freely: rings grow as their topic gets packets, and a ring left empty by
+// eviction goes away together with the trie nodes only it needed.
+class TopicHistory
+{
+private:
+    struct Entry
+    {
+        uint64_t seq = 0;
+        std::vector<char> packet;
+    };
+
+    struct Ring
+    {
+        std::string topic;
+        std::vector<Entry> slots; // grows up to `depth`
+        size_t head = 0;
+        size_t count = 0;
+        size_t refs = 0;       // EvictionRefs pointing here, live or stale
+        bool detached = false; // out of the trie, freed with its last ref
+    };
+
+    struct Node
+    {
+        std::map<std::string, std::unique_ptr<Node>> children;
+        std::unique_ptr<Ring> ring;
+    };
+
+    struct EvictionRef
+    {
+        Ring *ring;
+        uint64_t seq;
+    };
+
+    Node root;
+    std::deque<EvictionRef> insertion_order;
+    size_t depth;
+    size_t memory_limit;
+    size_t memory_used;
+    size_t entry_count;
+    size_t topic_count;
+    uint64_t next_seq;
+
+    Ring *find_or_create_ring(const std::string &topic);
+    void grow_ring(Ring &ring);
+    void evict_front(Ring &ring);
+    void remove_ring(Ring &ring);
+    void release_ref(Ring *ring);
+    void enforce_memory_limit();
+    void collect_matching(const Node &node, const std::vector<std::string> &p_segs, size_t index,
+                          std::vector<const Ring *> &out) const;
+
+public:
+    TopicHistory(size_t depth, size_t memory_limit);
+
+    ~TopicHistory();
+
+    TopicHistory(const TopicHistory &) = delete;
+    TopicHistory &operator=(const TopicHistory &) = delete;
+
+    void record(const std::string &topic, std::vector<char> &&packet);
+    // Packets recorded from `before_seq` on are left out of the replay.
+    std::vector<const std::vector<char> *> replay(const std::string &pattern, size_t last_n,
+                                                  uint64_t before_seq = UINT64_MAX) const;
+
+    bool enabled() const { return depth > 0 && memory_limit > 0; }
+    size_t bytes_used() const { return memory_used; }
+    size_t topics() const { return topic_count; }
+    uint64_t next_sequence() const { return next_seq; }
+};
+
+#endif // TOPIC_HISTORY_H
@@ -0,0 +1,29 @@
+#ifndef TOPIC_MATCH_H
+#define TOPIC_MATCH_H
+
+#include <string>
+#include <vector>
+
+#define MATCH_STACK_SEGMENTS 64
+
+std::vector<std::string> split_topic(const std::string &topic);
+bool segments_match(const std::vector<std::string> &t_segs, const std::vector<std::string> &p_segs);
+bool topic_matches(const std::string &topic, const std::string &pattern);
+
+// One pattern of a subscriber, in the order the matcher tries them.
+struct CoverageEntry
+{
+    std::vector<std::string> segments;
+    bool sf = false;
+    bool filtered = false; // has a where= predicate
+    bool plain = true;     // no predicate, batch window or rate limit
+};
+
+// True when every topic matched by `inner` is matched by `outer` as well.
+// Conservative: false may still be returned for some covered pairs.
+bool pattern_covers(const std::vector<std::string> &outer, const std::vector<std::string> &inner);
+// Marks the patterns the matcher can leave out without changing which
+// pattern takes a message, other than for a stronger SF.
+std::vector<bool> find_covered_patterns(const std::vector<CoverageEntry> &entries);
+
+#endif // TOPIC_MATCH_H
@@ -0,0 +1,40 @@
+#ifndef UDP_MESSAGE_H
+#define UDP_MESSAGE_H
+
+#include "common.h"
+#include <unordered_map>
+#include <vector>
+
+struct UdpMessage
+{
+    char topic[TOPIC_SIZE + 1];
+    uint8_t type;
+    char content[MAX_CONTENT_SIZE + 1];
+    struct sockaddr_in sender_addr;
+    int content_len;
+};
+
+// Splits a publisher datagram into topic, type and content. Fails only when
+// the datagram is too short to carry a type byte.
+bool parse_udp_datagram(const char *buffer, int bytes_received, UdpMessage &udp_msg);
+
+// Builds the length-prefixed frame the subscribers receive.
+std::vector<char> serialize_forward_message(const UdpMessage &msg);
+
+// Senders (6 raw address bytes) and topics already defined on one subscriber
+// connection, with the IDs the subscriber assigned them in the same order.
+struct WireDictionary
+{
+    bool enabled = false;
+    std::unordered_map<std::string, uint32_t> senders;
+    std::unordered_map<std::string, uint32_t> topics;
+};
+
+// Repacks a run of forward frames into batch frames of at most
+// MAX_BATCH_FRAME_SIZE bytes and appends them to `out`. A frame that would be
+// alone in its batch is appended unchanged, unless `dictionary` is given: then
+// every message goes out as a batch entry and names the senders and topics of
+// the dictionary by ID, defining the new ones. Returns the number of messages.
+size_t pack_batch_frames(const char *frames, size_t len, std::vector<char> &out, WireDictionary *dictionary);
+
+#endif // UDP_MESSAGE_H
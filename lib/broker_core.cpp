@@ -0,0 +1,1460 @@
+#include "broker_core.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+static void parse_and_execute_command(ServerContext &ctx, Subscriber &sub, const std::string &command_line);
+static bool parse_subscribe_options(std::stringstream &ss, SubscribeOptions &options);
+static void send_topic_history(ServerContext &ctx, Subscriber &sub, const std::string &pattern, size_t last_n);
+static bool deliver_to_subscriber(ServerContext &ctx, Subscriber &sub, const std::vector<char> &packet, PipelineMessage *shared, const BatchWindow *window,
+                                  bool sf);
+static bool flush_subscriber_batch(ServerContext &ctx, Subscriber &sub);
+static bool write_to_subscriber(ServerContext &ctx, Subscriber &sub, const std::vector<char> &packet);
+static bool admit_throttled(ServerContext &ctx, Subscriber &sub, const RateLimit &limit, const std::string &pattern,
+                            const std::string &topic, const std::vector<char> &packet);
+static void release_throttled(ServerContext &ctx, Subscriber &sub, const std::string &topic);
+static void refill_tokens(const RateLimit &limit, ThrottledTopic &state, int64_t now);
+static void drop_throttled(Subscriber &sub, const std::string &pattern);
+static void store_throttled_sf(ServerContext &ctx, Subscriber &sub);
+static void update_covered_patterns(ServerContext &ctx, Subscriber &sub);
+static bool parse_group_policy(const std::string &value, GroupPolicy &policy);
+static void join_group(ServerContext &ctx, Subscriber &sub, const std::string &pattern, bool sf,
+                       const SubscribeOptions &options);
+static void leave_group(ServerContext &ctx, Subscriber &sub, const std::string &key);
+static GroupMember *pick_group_member(SharedGroup &group, const std::string &topic);
+static void send_group_stored_messages(ServerContext &ctx, Subscriber &sub);
+static uint64_t hand_to_subscriber(ServerContext &ctx, Subscriber &sub, const std::string *pattern, const std::string &topic,
+                                   bool sf_enabled, const std::vector<char> &packet, PipelineMessage *shared,
+                                   uint64_t &local_mask);
+static void publish_local(ServerContext &ctx, Subscriber &sub, const std::vector<char> &packet);
+static void drop_stored_messages(ServerContext &ctx, Subscriber &sub, size_t count);
+static size_t send_stored_messages(ServerContext &ctx, Subscriber &sub);
+static void register_connection(ServerContext &ctx, Subscriber &sub);
+static void queue_backlog(ServerContext &ctx, Subscriber &sub, const char *data, size_t len);
+static void set_poll_events(ServerContext &ctx, int client_socket, short events);
+static void fan_out_to_reactors(ReactorPool &pool, const UdpMessage &msg, std::vector<char> &&serialized_packet);
+static ssize_t transport_send(ServerContext &ctx, int client_socket, const char *data, size_t len);
+static int64_t monotonic_us();
+
+void process_datagram(ServerContext &ctx, const char *buffer, int bytes_received, const struct sockaddr_in &sender_addr)
+{
+    UdpMessage udp_msg;
+    uint64_t start = stage_clock();
+    if (!parse_udp_datagram(buffer, bytes_received, udp_msg))
+    {
+        ctx.stats.add(STAT_DATAGRAMS_REJECTED);
+        return;
+    }
+    ctx.latency.record(STAGE_PARSE, start);
+    ctx.stats.add(STAT_DATAGRAMS_PARSED);
+    ctx.topics.record(udp_msg.topic);
+    udp_msg.sender_addr = sender_addr;
+
+    start = stage_clock();
+    std::vector<char> serialized_packet = serialize_forward_message(udp_msg);
+    ctx.latency.record(STAGE_SERIALIZE, start);
+    if (ctx.reactors)
+    {
+        fan_out_to_reactors(*ctx.reactors, udp_msg, std::move(serialized_packet));
+        return;
+    }
+    distribute_udp_message(ctx, udp_msg, serialized_packet, nullptr);
+    ctx.history.record(udp_msg.topic, std::move(serialized_packet));
+}
+
+Subscriber &connect_subscriber(ServerContext &ctx, const std::string &client_id, int client_socket)
+{
+    auto it = ctx.subscribers.find(client_id);
+    bool known = it != ctx.subscribers.end();
+    Subscriber &sub = known ? it->second : ctx.subscribers[client_id];
+    if (!known)
+    {
+        strncpy(sub.id, client_id.c_str(), MAX_ID_SIZE);
+        sub.id[MAX_ID_SIZE] = '\0';
+    }
+    sub.socket = client_socket;
+    sub.connected = true;
+    sub.batch_frames = false;
+    sub.dictionary = WireDictionary();
+    store_throttled_sf(ctx, sub);
+    sub.shm_slot = -1;
+    sub.command_buffer.reset();
+    ctx.stats.add(STAT_CONNECTIONS_ACCEPTED);
+    ctx.stats.raise(GAUGE_SUBSCRIBERS_CONNECTED);
+    ctx.socket_to_id[client_socket] = client_id;
+    register_connection(ctx, sub);
+    if (known)
+    {
+        drop_stored_messages(ctx, sub, send_stored_messages(ctx, sub));
+        send_group_stored_messages(ctx, sub);
+    }
+    return sub;
+}
+
+bool process_commands_from_buffer(ServerContext &ctx, Subscriber &sub)
+{
+    ssize_t newline_offset;
+    while ((newline_offset = sub.command_buffer.find('\n')) >= 0)
+    {
+        std::string command_line = sub.command_buffer.substr(0, newline_offset);
+        sub.command_buffer.consume(newline_offset + 1);
+        command_line.erase(0, command_line.find_first_not_of(" \t\r\n"));
+        command_line.erase(command_line.find_last_not_of(" \t\r\n") + 1);
+        if (!command_line.empty())
+        {
+            parse_and_execute_command(ctx, sub, command_line);
+        }
+    }
+    return true;
+}
+
+static void parse_and_execute_command(ServerContext &ctx, Subscriber &sub, const std::string &command_line)
+{
+    std::stringstream ss(command_line);
+    std::string command_verb;
+    ss >> command_verb;
+
+    if (command_verb == "subscribe")
+    {
+        std::string topic;
+        int sf = -1;
+        SubscribeOptions options;
+        if (ss >> topic >> sf && (sf == 0 || sf == 1) && parse_subscribe_options(ss, options))
+        {
+            if (topic.length() <= TOPIC_SIZE && !options.group.empty())
+            {
+                join_group(ctx, sub, topic, sf == 1, options);
+            }
+            else if (topic.length() <= TOPIC_SIZE && ctx.pipeline && options.rate_limit.tokens_per_us > 0)
+            {
+                // The send stages deliver straight from the index, past the
+                // per-subscriber token buckets.
+                std::cerr << "ERROR: max_rate= and sample_ms= need the event loop (no --pipeline)." << std::endl;
+            }
+            else if (topic.length() <= TOPIC_SIZE)
+            {
+                sub.topics.set(ctx.patterns, topic, sf == 1);
+                if (options.window.delay_us > 0)
+                {
+                    sub.windows[topic] = options.window;
+                }
+                else
+                {
+                    sub.windows.erase(topic);
+                }
+                if (options.filter.op != FILTER_ALL)
+                {
+                    sub.filters[topic] = options.filter;
+                }
+                else
+                {
+                    sub.filters.erase(topic);
+                }
+                drop_throttled(sub, topic);
+                if (options.rate_limit.tokens_per_us > 0)
+                {
+                    sub.rate_limits[topic] = options.rate_limit;
+                }
+                else
+                {
+                    sub.rate_limits.erase(topic);
+                }
+                update_covered_patterns(ctx, sub);
+                if (ctx.pipeline)
+                {
+                    ctx.pipeline->index.subscribe(sub.id, topic, sf == 1, options.filter);
+                }
+                if (options.history > 0)
+                {
+                    send_topic_history(ctx, sub, topic, options.history);
+                }
+            }
+            else
+            {
+                std::cerr << "ERROR: Topic too long (max " << TOPIC_SIZE << " characters)." << std::endl;
+            }
+        }
+    }
+
+    else if (command_verb == "frames")
+    {
+        // The dictionary keeps the IDs it already handed out: only a new
+        // connection starts it over, the same way the subscriber does.
+        std::string mode;
+        std::string encoding;
+        if (ss >> mode && (mode == "batch" || mode == "single") && (!(ss >> encoding) || encoding == "dict") &&
+            ss.peek() == EOF)
+        {
+            flush_subscriber_batch(ctx, sub);
+            sub.batch_frames = mode == "batch";
+            sub.dictionary.enabled = encoding == "dict";
+        }
+        else
+        {
+            std::cerr << "ERROR: Usage: frames batch|single [dict]" << std::endl;
+        }
+    }
+
+    else if (command_verb == "transport")
+    {
+        // A subscriber on the broker host reads its frames from the shared
+        // ring from here on; what was already queued goes out over TCP first.
+        std::string kind;
+        if (ss >> kind && kind == "shm" && ss.peek() == EOF)
+        {
+            if (!ctx.shm)
+            {
+                std::cerr << "ERROR: Shared-memory transport is not enabled (--shm)." << std::endl;
+            }
+            else if (sub.shm_slot < 0)
+            {
+                flush_subscriber_batch(ctx, sub);
+                sub.shm_slot = ctx.shm->assign_slot(sub.id);
+                if (sub.shm_slot < 0)
+                {
+                    std::cerr << "ERROR: All " << SHM_RING_SLOTS << " shared-memory slots are taken." << std::endl;
+                }
+            }
+        }
+        else
+        {
+            std::cerr << "ERROR: Usage: transport shm" << std::endl;
+        }
+    }
+
+    else if (command_verb == "unsubscribe")
+    {
+        std::string topic;
+        std::string group_option;
+        if (ss >> topic && ss >> group_option && group_option.compare(0, 6, "group=") == 0 && ss.peek() == EOF)
+        {
+            leave_group(ctx, sub, group_option.substr(6) + " " + topic);
+        }
+        else if (!group_option.empty())
+        {
+            std::cerr << "ERROR: Usage: unsubscribe <topic> [group=NAME]" << std::endl;
+        }
+        else if (!topic.empty())
+        {
+            if (topic.length() <= TOPIC_SIZE)
+            {
+                sub.topics.erase(ctx.patterns, topic);
+                sub.windows.erase(topic);
+                sub.filters.erase(topic);
+                sub.rate_limits.erase(topic);
+                drop_throttled(sub, topic);
+                update_covered_patterns(ctx, sub);
+                if (ctx.pipeline)
+                {
+                    ctx.pipeline->index.unsubscribe(sub.id, topic);
+                }
+            }
+            else
+            {
+                std::cerr << "ERROR: Topic too long (max " << TOPIC_SIZE << " characters)." << std::endl;
+            }
+        }
+    }
+
+    else
+    {
+        std::cerr << "ERROR: Unknown command." << std::endl;
+    }
+}
+
+static bool parse_subscribe_options(std::stringstream &ss, SubscribeOptions &options)
+{
+    size_t delay_us = 0;
+    size_t batch_bytes = 0;
+    size_t max_rate = 0;
+    size_t burst = 0;
+    size_t sample_ms = 0;
+    std::string token;
+    while (ss >> token)
+    {
+        size_t eq = token.find('=');
+        if (eq == std::string::npos)
+        {
+            std::cerr << "ERROR: Malformed subscribe option " << token << "." << std::endl;
+            return false;
+        }
+        std::string key = token.substr(0, eq);
+        std::string value = token.substr(eq + 1);
+        if (key == "last")
+        {
+            if (!parse_size_value(value, options.history) || options.history > MAX_HISTORY_REPLAY)
+            {
+                std::cerr << "ERROR: Invalid history length (max " << MAX_HISTORY_REPLAY << ")." << std::endl;
+                return false;
+            }
+        }
+        else if (key == "delay_us")
+        {
+            if (!parse_size_value(value, delay_us) || delay_us == 0 || delay_us > MAX_BATCH_DELAY_US)
+            {
+                std::cerr << "ERROR: Invalid batching delay (1-" << MAX_BATCH_DELAY_US << " us)." << std::endl;
+                return false;
+            }
+        }
+        else if (key == "batch_bytes")
+        {
+            if (!parse_size_value(value, batch_bytes) || batch_bytes == 0 || batch_bytes > MAX_BATCH_BYTES)
+            {
+                std::cerr << "ERROR: Invalid batch size (1-" << MAX_BATCH_BYTES << " bytes)." << std::endl;
+                return false;
+            }
+        }
+        else if (key == "max_rate")
+        {
+            if (!parse_size_value(value, max_rate) || max_rate == 0 || max_rate > MAX_RATE_LIMIT)
+            {
+                std::cerr << "ERROR: Invalid rate limit (1-" << MAX_RATE_LIMIT << " messages/s)." << std::endl;
+                return false;
+            }
+        }
+        else if (key == "burst")
+        {
+            if (!parse_size_value(value, burst) || burst == 0 || burst > MAX_RATE_BURST)
+            {
+                std::cerr << "ERROR: Invalid burst (1-" << MAX_RATE_BURST << " messages)." << std::endl;
+                return false;
+            }
+        }
+        else if (key == "sample_ms")
+        {
+            if (!parse_size_value(value, sample_ms) || sample_ms == 0 || sample_ms > MAX_SAMPLE_MS)
+            {
+                std::cerr << "ERROR: Invalid sampling period (1-" << MAX_SAMPLE_MS << " ms)." << std::endl;
+                return false;
+            }
+        }
+        else if (key == "where")
+        {
+            if (!parse_content_filter(value, options.filter))
+            {
+                std::cerr << "ERROR: Invalid predicate " << value << " (TYPE or TYPE<op>VALUE)." << std::endl;
+                return false;
+            }
+        }
+        else if (key == "group")
+        {
+            if (value.empty() || value.size() > MAX_GROUP_NAME_SIZE)
+            {
+                std::cerr << "ERROR: Invalid group name (1-" << MAX_GROUP_NAME_SIZE << " characters)." << std::endl;
+                return false;
+            }
+            options.group = value;
+        }
+        else if (key == "policy")
+        {
+            if (!parse_group_policy(value, options.policy))
+            {
+                std::cerr << "ERROR: Invalid group policy " << value << " (rr, least or hash)." << std::endl;
+                return false;
+            }
+            options.policy_set = true;
+        }
+        else
+        {
+            std::cerr << "ERROR: Unknown subscribe option " << key << "." << std::endl;
+            return false;
+        }
+    }
+    // A shared subscription carries no per-subscriber options: the member
+    // taking a message changes from one message to the next.
+    if (!options.group.empty() && (options.history > 0 || delay_us > 0 || batch_bytes > 0 || max_rate > 0 ||
+                                   burst > 0 || sample_ms > 0 || options.filter.op != FILTER_ALL))
+    {
+        std::cerr << "ERROR: group= only combines with policy=." << std::endl;
+        return false;
+    }
+    if (options.policy_set && options.group.empty())
+    {
+        std::cerr << "ERROR: policy= needs group=." << std::endl;
+        return false;
+    }
+    if (delay_us > 0 || batch_bytes > 0)
+    {
+        options.window.delay_us = delay_us > 0 ? delay_us : DEFAULT_BATCH_DELAY_US;
+        options.window.max_bytes = batch_bytes > 0 ? batch_bytes : DEFAULT_BATCH_BYTES;
+    }
+    if ((max_rate > 0 && sample_ms > 0) || (burst > 0 && max_rate == 0))
+    {
+        std::cerr << "ERROR: Use either max_rate=[burst=] or sample_ms=." << std::endl;
+        return false;
+    }
+    if (max_rate > 0)
+    {
+        options.rate_limit.tokens_per_us = max_rate / 1e6;
+        options.rate_limit.burst = burst > 0 ? burst : 1;
+    }
+    else if (sample_ms > 0)
+    {
+        options.rate_limit.tokens_per_us = 1.0 / (sample_ms * 1000.0);
+        options.rate_limit.burst = 1;
+    }
+    return true;
+}
+
+static void send_topic_history(ServerContext &ctx, Subscriber &sub, const std::string &pattern, size_t last_n)
+{
+    // Frames already waiting in a batch are older than the replayed ones.
+    flush_subscriber_batch(ctx, sub);
+    std::vector<const std::vector<char> *> packets;
+    std::vector<std::vector<char>> copies;
+    if (ctx.shared_history)
+    {
+        // Messages this reactor has not taken off its fan-out queue yet will
+        // reach the new subscription live, so they are not replayed.
+        std::lock_guard<std::mutex> guard(ctx.shared_history->lock);
+        for (const std::vector<char> *packet : ctx.shared_history->store->replay(pattern, last_n, ctx.history_seen))
+        {
+            copies.push_back(*packet);
+        }
+        for (const std::vector<char> &packet : copies)
+        {
+            packets.push_back(&packet);
+        }
+    }
+    else
+    {
+        packets = ctx.history.replay(pattern, last_n);
+    }
+    for (const std::vector<char> *packet : packets)
+    {
+        if (!send_to_subscriber(ctx, sub, *packet, nullptr, false))
+        {
+            if (errno != EPIPE && errno != ECONNRESET)
+            {
+                perror("WARN: send history message failed");
+            }
+            break;
+        }
+    }
+}
+
+void distribute_udp_message(ServerContext &ctx, const UdpMessage &msg, const std::vector<char> &serialized_packet, PipelineMessage *shared)
+{
+    // Time spent handing frames to subscribers is charged to the send stage,
+    // so it is shifted out of the match sample.
+    uint64_t start = stage_clock();
+    std::string topic_str(msg.topic);
+    uint64_t local_mask = 0;
+    // Each distinct pattern is tested once; its other subscribers reuse the result.
+    ctx.patterns.begin_message(topic_str);
+    for (auto &pair : ctx.subscribers)
+    {
+        Subscriber &sub = pair.second;
+        // A pattern whose predicate rejects the message does not count as a
+        // match; another matching pattern of the subscriber may still take it.
+        bool filtered = false;
+        for (const PatternSubscription &subscription : sub.topics)
+        {
+            if (!subscription.covered && ctx.patterns.matches(subscription.id))
+            {
+                const std::string &pattern = ctx.patterns.text(subscription.id);
+                bool sf_enabled = subscription.sf;
+                if (!sub.filters.empty())
+                {
+                    auto filter_it = sub.filters.find(pattern);
+                    if (filter_it != sub.filters.end() &&
+                        !content_filter_accepts(filter_it->second, msg.type, msg.content, msg.content_len))
+                    {
+                        filtered = true;
+                        continue;
+                    }
+                }
+                filtered = false;
+                ctx.stats.add(STAT_MESSAGES_MATCHED);
+                start += hand_to_subscriber(ctx, sub, &pattern, topic_str, sf_enabled, serialized_packet, shared,
+                                            local_mask);
+                break;
+            }
+        }
+        if (filtered)
+        {
+            ctx.stats.add(STAT_MESSAGES_FILTERED);
+        }
+    }
+    // A shared subscription takes each matching message once for the whole
+    // group, next to whatever its members get from their own patterns.
+    for (auto &pair : ctx.groups)
+    {
+        SharedGroup &group = pair.second;
+        if (!ctx.patterns.matches(group.pattern))
+        {
+            continue;
+        }
+        ctx.stats.add(STAT_MESSAGES_MATCHED);
+        GroupMember *member = pick_group_member(group, topic_str);
+        if (member)
+        {
+            start += hand_to_subscriber(ctx, *member->sub, nullptr, topic_str, member->sf, serialized_packet, shared,
+                                        local_mask);
+            group.delivered++;
+            continue;
+        }
+        for (const GroupMember &candidate : group.members)
+        {
+            if (candidate.sf)
+            {
+                group.stored_messages.push_back(serialized_packet);
+                ctx.stats.add(STAT_SF_ENQUEUED);
+                ctx.stats.raise(GAUGE_SF_MESSAGES);
+                ctx.stats.raise(GAUGE_SF_BYTES, serialized_packet.size());
+                break;
+            }
+        }
+    }
+    // Every local subscriber of this message shares one copy in the ring.
+    if (local_mask != 0)
+    {
+        uint64_t delivery_start = stage_clock();
+        ctx.shm->publish(serialized_packet.data(), serialized_packet.size(), local_mask);
+        ctx.stats.add(STAT_BYTES_SENT, serialized_packet.size());
+        ctx.latency.record(STAGE_SEND, delivery_start);
+        start += stage_clock() - delivery_start;
+    }
+    ctx.latency.record(STAGE_MATCH, start);
+}
+
+// Hands one matched message to `sub` according to its lag state: shed, spool,
+// keep for a disconnected SF subscriber or deliver. `pattern` names the
+// subscription for its window and rate limit; a shared subscription has none.
+// Returns the ticks spent sending, which the caller keeps out of the match
+// sample.
+static uint64_t hand_to_subscriber(ServerContext &ctx, Subscriber &sub, const std::string *pattern, const std::string &topic,
+                                   bool sf_enabled, const std::vector<char> &packet, PipelineMessage *shared,
+                                   uint64_t &local_mask)
+{
+    if (sub.connected && sub.lag_state != LAG_HEALTHY && !sf_enabled)
+    {
+        ctx.slow.shed_messages.add();
+    }
+    else if (sub.connected && sub.lag_state >= LAG_SPOOLING)
+    {
+        store_for_later(ctx, sub, packet);
+        ctx.slow.spooled_messages.add();
+    }
+    else if (sub.connected)
+    {
+        if (pattern && !sub.rate_limits.empty())
+        {
+            auto limit_it = sub.rate_limits.find(*pattern);
+            if (limit_it != sub.rate_limits.end() &&
+                !admit_throttled(ctx, sub, limit_it->second, *pattern, topic, packet))
+            {
+                return 0;
+            }
+        }
+        if (sub.shm_slot >= 0)
+        {
+            local_mask |= uint64_t(1) << sub.shm_slot;
+            return 0;
+        }
+        const BatchWindow *window = nullptr;
+        if (pattern && !sub.windows.empty())
+        {
+            auto window_it = sub.windows.find(*pattern);
+            window = window_it != sub.windows.end() ? &window_it->second : nullptr;
+        }
+        uint64_t delivery_start = stage_clock();
+        if (!deliver_to_subscriber(ctx, sub, packet, shared, window, sf_enabled))
+        {
+            if (errno != EPIPE && errno != ECONNRESET)
+            {
+                perror("WARN: send_all to subscriber failed");
+            }
+        }
+        return stage_clock() - delivery_start;
+    }
+    else if (sf_enabled)
+    {
+        store_for_later(ctx, sub, packet);
+    }
+    return 0;
+}
+
+bool send_to_subscriber(ServerContext &ctx, Subscriber &sub, const std::vector<char> &packet, PipelineMessage *shared, bool sf)
+{
+    if (ctx.pipeline)
+    {
+        PipelineMessage *message = shared;
+        if (message)
+        {
+            message->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            message = new PipelineMessage();
+            message->packet = packet;
+        }
+        enqueue_send(*ctx.pipeline, SEND_PACKET, sub.socket, sub.connection, message);
+        return true;
+    }
+    if (sub.shm_slot >= 0)
+    {
+        publish_local(ctx, sub, packet);
+        return true;
+    }
+    size_t queued = sub.backlog.size();
+    bool sent;
+    if (sub.dictionary.enabled)
+    {
+        std::vector<char> encoded;
+        encoded.reserve(packet.size());
+        pack_batch_frames(packet.data(), packet.size(), encoded, &sub.dictionary);
+        sent = write_to_subscriber(ctx, sub, encoded);
+    }
+    else
+    {
+        sent = write_to_subscriber(ctx, sub, packet);
+    }
+    // A write queues at most one backlog entry, holding what the socket left.
+    if (sf && sub.backlog.size() > queued)
+    {
+        sub.backlog.back().sf_packets.push_back(packet);
+    }
+    return sent;
+}
+
+// Frames are encoded for this connection by now, so they are written in the
+// order they were encoded: a dictionary definition always precedes its uses.
+static bool write_to_subscriber(ServerContext &ctx, Subscriber &sub, const std::vector<char> &packet)
+{
+    // Never block the loop on one subscriber: whatever the socket does not
+    // take now waits in its backlog and goes out on POLLOUT.
+    if (!sub.backlog.empty())
+    {
+        queue_backlog(ctx, sub, packet.data(), packet.size());
+        return true;
+    }
+    uint64_t start = stage_clock();
+    size_t total = 0;
+    while (total < packet.size())
+    {
+        ssize_t sent = transport_send(ctx, sub.socket, packet.data() + total, packet.size() - total);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            ctx.stats.add(STAT_BYTES_SENT, total);
+            ctx.stats.add(STAT_SEND_FAILURES);
+            return false;
+        }
+        total += sent;
+    }
+    ctx.latency.record(STAGE_SEND, start);
+    ctx.stats.add(STAT_BYTES_SENT, total);
+    if (total < packet.size())
+    {
+        queue_backlog(ctx, sub, packet.data() + total, packet.size() - total);
+    }
+    return true;
+}
+
+// Sends right away unless the matched subscription has a batching window, in
+// which case the frame joins the subscriber's outbound batch. An immediate
+// frame flushes the batch first so the subscriber still sees publish order.
+// A subscriber that negotiated batch frames collects its immediate frames
+// too, until the end of the loop turn. Pipeline mode sends from the send
+// stages and never batches.
+static bool deliver_to_subscriber(ServerContext &ctx, Subscriber &sub, const std::vector<char> &packet, PipelineMessage *shared, const BatchWindow *window,
+                                  bool sf)
+{
+    if (ctx.pipeline || sub.shm_slot >= 0 || (!window && !sub.batch_frames))
+    {
+        if (!sub.outbound.empty() && !flush_subscriber_batch(ctx, sub))
+        {
+            return false;
+        }
+        return send_to_subscriber(ctx, sub, packet, shared, sf);
+    }
+
+    if (window)
+    {
+        int64_t deadline = monotonic_us() + window->delay_us;
+        if (sub.outbound.empty() || deadline < sub.flush_deadline)
+        {
+            sub.flush_deadline = deadline;
+            ctx.flush_timers.push({deadline, sub.batch_serial, sub.id, std::string()});
+        }
+    }
+    else if (!sub.turn_pending)
+    {
+        sub.turn_pending = true;
+        ctx.turn_pending.push_back(&sub);
+    }
+    sub.outbound.insert(sub.outbound.end(), packet.begin(), packet.end());
+    if (sf)
+    {
+        sub.outbound_sf.push_back(packet);
+    }
+    ctx.stats.raise(GAUGE_QUEUED_BYTES, packet.size());
+    if (sub.outbound.size() >= (window ? window->max_bytes : DEFAULT_BATCH_BYTES))
+    {
+        return flush_subscriber_batch(ctx, sub);
+    }
+    return true;
+}
+
+static bool flush_subscriber_batch(ServerContext &ctx, Subscriber &sub)
+{
+    if (sub.outbound.empty())
+    {
+        return true;
+    }
+    ctx.stats.lower(GAUGE_QUEUED_BYTES, sub.outbound.size());
+    size_t queued = sub.backlog.size();
+    bool sent;
+    if (sub.batch_frames)
+    {
+        std::vector<char> packed;
+        packed.reserve(sub.outbound.size());
+        pack_batch_frames(sub.outbound.data(), sub.outbound.size(), packed,
+                          sub.dictionary.enabled ? &sub.dictionary : nullptr);
+        sent = write_to_subscriber(ctx, sub, packed);
+    }
+    else
+    {
+        sent = send_to_subscriber(ctx, sub, sub.outbound, nullptr, false);
+    }
+    if (!sub.outbound_sf.empty() && sub.backlog.size() > queued)
+    {
+        sub.backlog.back().sf_packets = std::move(sub.outbound_sf);
+    }
+    sub.outbound_sf.clear();
+    sub.outbound.clear();
+    sub.batch_serial++;
+    return sent;
+}
+
+int next_timer_timeout(const ServerContext &ctx, int poll_timeout)
+{
+    if (poll_timeout == 0)
+    {
+        return poll_timeout;
+    }
+    if (!ctx.flush_timers.empty())
+    {
+        int64_t wait_us = ctx.flush_timers.top().deadline - monotonic_us();
+        int flush_timeout = wait_us <= 0 ? 0 : static_cast<int>((wait_us + 999) / 1000);
+        poll_timeout = poll_timeout < 0 ? flush_timeout : std::min(poll_timeout, flush_timeout);
+    }
+    if (!ctx.backlogged.empty() && (poll_timeout < 0 || poll_timeout > LAG_CHECK_INTERVAL_MS))
+    {
+        poll_timeout = LAG_CHECK_INTERVAL_MS;
+    }
+    return poll_timeout;
+}
+
+void run_flush_timers(ServerContext &ctx)
+{
+    if (ctx.flush_timers.empty())
+    {
+        return;
+    }
+    int64_t now = monotonic_us();
+    while (!ctx.flush_timers.empty() && ctx.flush_timers.top().deadline <= now)
+    {
+        FlushTimer timer = ctx.flush_timers.top();
+        ctx.flush_timers.pop();
+        auto it = ctx.subscribers.find(timer.id);
+        if (it == ctx.subscribers.end() || !it->second.connected)
+        {
+            continue;
+        }
+        if (!timer.topic.empty())
+        {
+            if (it->second.connection == timer.serial)
+            {
+                release_throttled(ctx, it->second, timer.topic);
+            }
+            continue;
+        }
+        if (it->second.batch_serial != timer.serial)
+        {
+            continue;
+        }
+        if (!flush_subscriber_batch(ctx, it->second) && errno != EPIPE && errno != ECONNRESET)
+        {
+            perror("WARN: flushing batch to subscriber failed");
+        }
+    }
+    // Released rate-limited frames join the turn batches, which the loop has
+    // already flushed for this turn.
+    flush_turn_batches(ctx);
+}
+
+void flush_turn_batches(ServerContext &ctx)
+{
+    for (Subscriber *sub : ctx.turn_pending)
+    {
+        sub->turn_pending = false;
+        if (!flush_subscriber_batch(ctx, *sub) && errno != EPIPE && errno != ECONNRESET)
+        {
+            perror("WARN: flushing batch to subscriber failed");
+        }
+    }
+    ctx.turn_pending.clear();
+}
+
+// Takes a token from the topic's bucket when one is there and nothing older is
+// waiting. Otherwise the frame becomes the topic's pending value, replacing
+// (and suppressing) the previous one, and a timer releases it.
+static bool admit_throttled(ServerContext &ctx, Subscriber &sub, const RateLimit &limit, const std::string &pattern,
+                            const std::string &topic, const std::vector<char> &packet)
+{
+    int64_t now = monotonic_us();
+    auto inserted = sub.throttled.emplace(topic, ThrottledTopic());
+    ThrottledTopic &state = inserted.first->second;
+    if (inserted.second)
+    {
+        state.pattern = pattern;
+        state.tokens = limit.burst;
+        state.refilled_us = now;
+    }
+    refill_tokens(limit, state, now);
+    if (state.latest.empty() && state.tokens >= 1.0)
+    {
+        state.tokens -= 1.0;
+        return true;
+    }
+    if (!state.latest.empty())
+    {
+        ctx.stats.add(STAT_MESSAGES_SUPPRESSED);
+    }
+    state.latest = packet;
+    if (!state.timer_armed)
+    {
+        state.timer_armed = true;
+        int64_t wait_us = static_cast<int64_t>(std::ceil((1.0 - state.tokens) / limit.tokens_per_us));
+        ctx.flush_timers.push({now + std::max<int64_t>(wait_us, 0), sub.connection, sub.id, topic});
+    }
+    return false;
+}
+
+// Sends the pending value of a topic once its bucket has a token again, with
+// the same lag handling a fresh frame would get.
+static void release_throttled(ServerContext &ctx, Subscriber &sub, const std::string &topic)
+{
+    auto it = sub.throttled.find(topic);
+    if (it == sub.throttled.end())
+    {
+        return;
+    }
+    ThrottledTopic &state = it->second;
+    state.timer_armed = false;
+    auto limit_it = sub.rate_limits.find(state.pattern);
+    if (state.latest.empty() || limit_it == sub.rate_limits.end())
+    {
+        return;
+    }
+    int64_t now = monotonic_us();
+    refill_tokens(limit_it->second, state, now);
+    if (state.tokens < 1.0)
+    {
+        state.timer_armed = true;
+        int64_t wait_us = static_cast<int64_t>(std::ceil((1.0 - state.tokens) / limit_it->second.tokens_per_us));
+        ctx.flush_timers.push({now + wait_us, sub.connection, sub.id, topic});
+        return;
+    }
+    state.tokens -= 1.0;
+    std::vector<char> packet;
+    packet.swap(state.latest);
+
+    const PatternSubscription *subscription = sub.topics.find(ctx.patterns, state.pattern);
+    bool sf_enabled = subscription && subscription->sf;
+    if (sub.lag_state != LAG_HEALTHY && !sf_enabled)
+    {
+        ctx.slow.shed_messages.add();
+        return;
+    }
+    if (sub.lag_state >= LAG_SPOOLING)
+    {
+        store_for_later(ctx, sub, packet);
+        ctx.slow.spooled_messages.add();
+        return;
+    }
+    auto window_it = sub.windows.find(state.pattern);
+    const BatchWindow *window = window_it != sub.windows.end() ? &window_it->second : nullptr;
+    if (!deliver_to_subscriber(ctx, sub, packet, nullptr, window, sf_enabled) && errno != EPIPE && errno != ECONNRESET)
+    {
+        perror("WARN: send_all to subscriber failed");
+    }
+}
+
+static void refill_tokens(const RateLimit &limit, ThrottledTopic &state, int64_t now)
+{
+    state.tokens = std::min(limit.burst, state.tokens + (now - state.refilled_us) * limit.tokens_per_us);
+    state.refilled_us = now;
+}
+
+// Frames for one local subscriber (history, stored SF messages, released
+// rate-limited values) go into the ring one record per frame.
+static void publish_local(ServerContext &ctx, Subscriber &sub, const std::vector<char> &packet)
+{
+    size_t offset = 0;
+    while (offset + sizeof(uint32_t) <= packet.size())
+    {
+        uint32_t net_len;
+        memcpy(&net_len, packet.data() + offset, sizeof(net_len));
+        size_t frame_len = sizeof(net_len) + (ntohl(net_len) & ~BATCH_FRAME_FLAG);
+        if (!ctx.shm->publish(packet.data() + offset, frame_len, uint64_t(1) << sub.shm_slot))
+        {
+            ctx.stats.add(STAT_SEND_FAILURES);
+        }
+        else
+        {
+            ctx.stats.add(STAT_BYTES_SENT, frame_len);
+        }
+        offset += frame_len;
+    }
+}
+
+// A changed or removed limit starts its topics over; their pending values are
+// dropped along with them.
+static void drop_throttled(Subscriber &sub, const std::string &pattern)
+{
+    for (auto it = sub.throttled.begin(); it != sub.throttled.end();)
+    {
+        if (it->second.pattern == pattern)
+        {
+            it = sub.throttled.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+// Runs after every change to the subscriber's patterns or their options, so
+// a pattern left out while another one covered it is matched again as soon
+// as that one goes.
+static void update_covered_patterns(ServerContext &ctx, Subscriber &sub)
+{
+    std::vector<CoverageEntry> entries;
+    entries.reserve(sub.topics.size());
+    for (const PatternSubscription &subscription : sub.topics)
+    {
+        const std::string &pattern = ctx.patterns.text(subscription.id);
+        CoverageEntry entry;
+        entry.segments = split_topic(pattern);
+        entry.sf = subscription.sf;
+        entry.filtered = sub.filters.count(pattern) > 0;
+        entry.plain = !entry.filtered && !sub.windows.count(pattern) && !sub.rate_limits.count(pattern);
+        entries.push_back(std::move(entry));
+    }
+    std::vector<bool> covered = find_covered_patterns(entries);
+    for (size_t i = 0; i < covered.size(); ++i)
+    {
+        sub.topics.set_covered(i, covered[i]);
+    }
+}
+
+static bool parse_group_policy(const std::string &value, GroupPolicy &policy)
+{
+    if (value == "rr")
+    {
+        policy = GROUP_ROUND_ROBIN;
+    }
+    else if (value == "least")
+    {
+        policy = GROUP_LEAST_QUEUED;
+    }
+    else if (value == "hash")
+    {
+        policy = GROUP_HASH_TOPIC;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Joining again changes the member's SF flag; policy= given by any member
+// sets the policy for the whole group.
+static void join_group(ServerContext &ctx, Subscriber &sub, const std::string &pattern, bool sf,
+                       const SubscribeOptions &options)
+{
+    if (!ctx.shared_groups)
+    {
+        std::cerr << "ERROR: Shared subscriptions need the single event loop (no --pipeline or --reactors)." << std::endl;
+        return;
+    }
+    std::string key = options.group + " " + pattern;
+    auto it = ctx.groups.find(key);
+    if (it == ctx.groups.end())
+    {
+        it = ctx.groups.emplace(key, SharedGroup()).first;
+        it->second.name = options.group;
+        it->second.pattern = ctx.patterns.acquire(pattern);
+    }
+    SharedGroup &group = it->second;
+    if (options.policy_set)
+    {
+        group.policy = options.policy;
+    }
+    for (GroupMember &member : group.members)
+    {
+        if (member.sub == &sub)
+        {
+            member.sf = sf;
+            return;
+        }
+    }
+    group.members.push_back({&sub, sf});
+    sub.groups.insert(key);
+}
+
+static void leave_group(ServerContext &ctx, Subscriber &sub, const std::string &key)
+{
+    auto it = ctx.groups.find(key);
+    if (it == ctx.groups.end() || !sub.groups.erase(key))
+    {
+        return;
+    }
+    SharedGroup &group = it->second;
+    for (size_t i = 0; i < group.members.size(); ++i)
+    {
+        if (group.members[i].sub == &sub)
+        {
+            group.members.erase(group.members.begin() + i);
+            if (group.cursor > i)
+            {
+                group.cursor--;
+            }
+            break;
+        }
+    }
+    if (!group.members.empty())
+    {
+        return;
+    }
+    size_t bytes = 0;
+    for (const std::vector<char> &stored_packet : group.stored_messages)
+    {
+        bytes += stored_packet.size();
+    }
+    ctx.stats.lower(GAUGE_SF_MESSAGES, group.stored_messages.size());
+    ctx.stats.lower(GAUGE_SF_BYTES, bytes);
+    ctx.patterns.release(group.pattern);
+    ctx.groups.erase(it);
+}
+
+// Only connected members take messages. For rr and least one that is not
+// lagging is preferred: a message handed to a lagging member would be shed
+// or spooled while another member could take it right away. hash stays on
+// the topic's member while it is connected, lagging or not, since moving
+// the topic to another member and back would reorder it; only a
+// disconnected member passes its topics on to the next connected one.
+static GroupMember *pick_group_member(SharedGroup &group, const std::string &topic)
+{
+    size_t count = group.members.size();
+    if (group.policy == GROUP_HASH_TOPIC)
+    {
+        size_t first = std::hash<std::string>()(topic) % count;
+        for (size_t step = 0; step < count; ++step)
+        {
+            GroupMember &member = group.members[(first + step) % count];
+            if (member.sub->connected)
+            {
+                return &member;
+            }
+        }
+        return nullptr;
+    }
+    size_t first = group.cursor % count;
+    GroupMember *chosen = nullptr;
+    size_t chosen_at = 0;
+    size_t chosen_queued = 0;
+    for (size_t step = 0; step < count; ++step)
+    {
+        size_t at = (first + step) % count;
+        GroupMember &member = group.members[at];
+        if (!member.sub->connected)
+        {
+            continue;
+        }
+        bool healthy = member.sub->lag_state == LAG_HEALTHY;
+        size_t queued = member.sub->backlog_bytes + member.sub->outbound.size();
+        bool better = !chosen || (healthy && chosen->sub->lag_state != LAG_HEALTHY) ||
+                      (group.policy == GROUP_LEAST_QUEUED && healthy == (chosen->sub->lag_state == LAG_HEALTHY) &&
+                       queued < chosen_queued);
+        if (better)
+        {
+            chosen = &member;
+            chosen_at = at;
+            chosen_queued = queued;
+            if (group.policy == GROUP_ROUND_ROBIN && healthy)
+            {
+                break;
+            }
+        }
+    }
+    if (chosen)
+    {
+        group.cursor = chosen_at + 1;
+    }
+    return chosen;
+}
+
+// Messages a group kept while none of its members was connected go to the
+// first member that comes back. Whatever a failed send leaves stays with the
+// group for the next member.
+static void send_group_stored_messages(ServerContext &ctx, Subscriber &sub)
+{
+    for (const std::string &key : sub.groups)
+    {
+        SharedGroup &group = ctx.groups.at(key);
+        size_t count = 0;
+        size_t bytes = 0;
+        bool sent = true;
+        while (sent && count < group.stored_messages.size())
+        {
+            const std::vector<char> &stored_packet = group.stored_messages[count];
+            sent = send_to_subscriber(ctx, sub, stored_packet, nullptr, true);
+            if (!sent)
+            {
+                if (errno != EPIPE && errno != ECONNRESET)
+                {
+                    perror("WARN: send stored group message failed during reconnect");
+                }
+                break;
+            }
+            bytes += stored_packet.size();
+            count++;
+            ctx.stats.add(STAT_SF_REPLAYED);
+        }
+        group.stored_messages.erase(group.stored_messages.begin(), group.stored_messages.begin() + count);
+        ctx.stats.lower(GAUGE_SF_MESSAGES, count);
+        ctx.stats.lower(GAUGE_SF_BYTES, bytes);
+        if (!sent)
+        {
+            return;
+        }
+    }
+}
+
+void store_for_later(ServerContext &ctx, Subscriber &sub, const std::vector<char> &packet)
+{
+    sub.stored_messages.push_back(packet);
+    ctx.stats.add(STAT_SF_ENQUEUED);
+    ctx.stats.raise(GAUGE_SF_MESSAGES);
+    ctx.stats.raise(GAUGE_SF_BYTES, packet.size());
+}
+
+// SF frames of a backlog entry the socket had already started on may have
+// reached the subscriber whole; they are stored again all the same, so a
+// dropped connection repeats a message rather than losing one.
+void keep_unsent_sf(ServerContext &ctx, Subscriber &sub)
+{
+    std::vector<std::vector<char>> unsent;
+    for (QueuedFrame &frame : sub.backlog)
+    {
+        for (std::vector<char> &packet : frame.sf_packets)
+        {
+            unsent.push_back(std::move(packet));
+        }
+    }
+    for (std::vector<char> &packet : sub.outbound_sf)
+    {
+        unsent.push_back(std::move(packet));
+    }
+    sub.outbound_sf.clear();
+    size_t bytes = 0;
+    for (const std::vector<char> &packet : unsent)
+    {
+        bytes += packet.size();
+    }
+    // Whatever was spooled meanwhile is newer than the backlog.
+    sub.stored_messages.insert(sub.stored_messages.begin(), std::make_move_iterator(unsent.begin()),
+                               std::make_move_iterator(unsent.end()));
+    ctx.stats.add(STAT_SF_ENQUEUED, unsent.size());
+    ctx.stats.raise(GAUGE_SF_MESSAGES, unsent.size());
+    ctx.stats.raise(GAUGE_SF_BYTES, bytes);
+    store_throttled_sf(ctx, sub);
+}
+
+// The rate-limit state belongs to one connection, but the newest value it
+// held back for an SF subscription is still owed: it is stored with the
+// rest and replayed on reconnect.
+static void store_throttled_sf(ServerContext &ctx, Subscriber &sub)
+{
+    for (auto &pair : sub.throttled)
+    {
+        ThrottledTopic &state = pair.second;
+        const PatternSubscription *subscription = sub.topics.find(ctx.patterns, state.pattern);
+        if (!state.latest.empty() && subscription && subscription->sf)
+        {
+            store_for_later(ctx, sub, state.latest);
+        }
+    }
+    sub.throttled.clear();
+}
+
+static void drop_stored_messages(ServerContext &ctx, Subscriber &sub, size_t count)
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        bytes += sub.stored_messages[i].size();
+    }
+    sub.stored_messages.erase(sub.stored_messages.begin(), sub.stored_messages.begin() + count);
+    ctx.stats.lower(GAUGE_SF_MESSAGES, count);
+    ctx.stats.lower(GAUGE_SF_BYTES, bytes);
+}
+
+// Returns how many stored messages went out; the rest stay stored for the
+// next reconnect.
+static size_t send_stored_messages(ServerContext &ctx, Subscriber &sub)
+{
+    size_t count = 0;
+    for (const std::vector<char> &stored_packet : sub.stored_messages)
+    {
+        if (!send_to_subscriber(ctx, sub, stored_packet, nullptr, true))
+        {
+            if (errno != EPIPE && errno != ECONNRESET)
+            {
+                perror("WARN: send stored message failed during reconnect");
+            }
+            break;
+        }
+        count++;
+        ctx.stats.add(STAT_SF_REPLAYED);
+    }
+    return count;
+}
+
+static void register_connection(ServerContext &ctx, Subscriber &sub)
+{
+    sub.connection = ++ctx.next_connection;
+    if (ctx.pipeline)
+    {
+        enqueue_send(*ctx.pipeline, SEND_OPEN, sub.socket, sub.connection, nullptr);
+        ctx.pipeline->index.set_connection(sub.id, sub.socket, sub.connection);
+    }
+}
+
+static void queue_backlog(ServerContext &ctx, Subscriber &sub, const char *data, size_t len)
+{
+    if (sub.backlog.empty())
+    {
+        set_poll_events(ctx, sub.socket, POLLIN | POLLOUT);
+        ctx.backlogged.insert(sub.id);
+    }
+    sub.backlog.push_back({std::vector<char>(data, data + len), monotonic_us(), {}});
+    sub.backlog_bytes += len;
+    ctx.stats.raise(GAUGE_QUEUED_BYTES, len);
+    update_lag_state(ctx, sub);
+}
+
+bool drain_backlog(ServerContext &ctx, Subscriber &sub, struct pollfd &pfd)
+{
+    while (!sub.backlog.empty())
+    {
+        const std::vector<char> &data = sub.backlog.front().data;
+        ssize_t sent = transport_send(ctx, sub.socket, data.data() + sub.backlog_offset, data.size() - sub.backlog_offset);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return true;
+            }
+            ctx.stats.add(STAT_SEND_FAILURES);
+            return false;
+        }
+        ctx.stats.add(STAT_BYTES_SENT, sent);
+        sub.backlog_offset += sent;
+        sub.backlog_bytes -= sent;
+        ctx.stats.lower(GAUGE_QUEUED_BYTES, sent);
+        if (sub.backlog_offset == data.size())
+        {
+            sub.backlog.pop_front();
+            sub.backlog_offset = 0;
+        }
+    }
+
+    pfd.events = POLLIN;
+    ctx.backlogged.erase(sub.id);
+    // Hand the spool back a slice at a time, staying in spooling mode so new
+    // SF traffic keeps queueing behind it in order.
+    while (sub.lag_state == LAG_SPOOLING && sub.backlog.empty() && !sub.stored_messages.empty())
+    {
+        size_t refill = 0;
+        size_t count = 0;
+        bool sent = true;
+        while (count < sub.stored_messages.size() && refill < LAG_REFILL_BYTES)
+        {
+            refill += sub.stored_messages[count].size();
+            sent = send_to_subscriber(ctx, sub, sub.stored_messages[count], nullptr, true);
+            if (!sent)
+            {
+                break;
+            }
+            count++;
+        }
+        drop_stored_messages(ctx, sub, count);
+        ctx.stats.add(STAT_SF_REPLAYED, count);
+        if (!sent)
+        {
+            return false;
+        }
+    }
+    if (!sub.backlog.empty())
+    {
+        return true;
+    }
+    if (sub.lag_state != LAG_HEALTHY && sub.lag_state != LAG_DISCONNECT)
+    {
+        std::cerr << "WARN: Subscriber " << sub.id << " caught up; resuming normal delivery." << std::endl;
+        sub.lag_state = LAG_HEALTHY;
+        ctx.slow.recoveries.add();
+    }
+    return true;
+}
+
+void update_lag_state(ServerContext &ctx, Subscriber &sub)
+{
+    if (sub.backlog.empty() || sub.lag_state == LAG_DISCONNECT)
+    {
+        return;
+    }
+    size_t age_ms = static_cast<size_t>((monotonic_us() - sub.backlog.front().queued_at) / 1000);
+    LagState level = LAG_HEALTHY;
+    for (int stage = LAG_SHEDDING; stage <= LAG_DISCONNECT; ++stage)
+    {
+        size_t bytes_limit = ctx.lag.bytes[stage - 1];
+        size_t ms_limit = ctx.lag.ms[stage - 1];
+        if ((bytes_limit > 0 && sub.backlog_bytes >= bytes_limit) || (ms_limit > 0 && age_ms >= ms_limit))
+        {
+            level = static_cast<LagState>(stage);
+        }
+    }
+    if (level <= sub.lag_state)
+    {
+        return;
+    }
+
+    sub.lag_state = level;
+    std::cerr << "WARN: Subscriber " << sub.id << " is lagging (" << sub.backlog_bytes << " bytes queued, oldest "
+              << age_ms << " ms); ";
+    if (level == LAG_SHEDDING)
+    {
+        ctx.slow.shedding.add();
+        std::cerr << "dropping non-SF messages." << std::endl;
+    }
+    else if (level == LAG_SPOOLING)
+    {
+        ctx.slow.spooling.add();
+        std::cerr << "spooling SF messages." << std::endl;
+    }
+    else
+    {
+        std::cerr << "disconnecting." << std::endl;
+    }
+}
+
+static void set_poll_events(ServerContext &ctx, int client_socket, short events)
+{
+    for (size_t i = FIRST_CLIENT_POLL_INDEX; i < ctx.poll_fds.size(); ++i)
+    {
+        if (ctx.poll_fds[i].fd == client_socket)
+        {
+            ctx.poll_fds[i].events = events;
+            return;
+        }
+    }
+}
+
+void enqueue_send(Pipeline &pipeline, SendKind kind, int client_socket, uint64_t connection, PipelineMessage *message)
+{
+    SendStage &stage = *pipeline.senders[client_socket % pipeline.senders.size()];
+    SendDescriptor desc;
+    desc.kind = kind;
+    desc.socket = client_socket;
+    desc.connection = connection;
+    desc.message = message;
+    desc.queued_at = stage_clock();
+    while (!stage.queue.push(std::move(desc)))
+    {
+        stage.notifier.notify();
+        std::this_thread::yield();
+    }
+    stage.notifier.notify();
+}
+
+void release_pipeline_message(PipelineMessage *message)
+{
+    if (message->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        delete message;
+    }
+}
+
+static void fan_out_to_reactors(ReactorPool &pool, const UdpMessage &msg, std::vector<char> &&serialized_packet)
+{
+    PipelineMessage *message = new PipelineMessage();
+    message->msg = msg;
+    message->packet = std::move(serialized_packet);
+    message->refs.store(pool.reactors.size(), std::memory_order_relaxed);
+    message->queued_at = stage_clock();
+    if (pool.history.store->enabled())
+    {
+        std::lock_guard<std::mutex> guard(pool.history.lock);
+        pool.history.store->record(msg.topic, std::vector<char>(message->packet));
+        message->history_seq = pool.history.store->next_sequence();
+    }
+    for (std::unique_ptr<Reactor> &reactor : pool.reactors)
+    {
+        PipelineMessage *item = message;
+        while (!reactor->fanout.push(std::move(item)))
+        {
+            reactor->notifier.notify();
+            std::this_thread::yield();
+        }
+        reactor->notifier.notify();
+    }
+}
+
+bool parse_size_value(const std::string &value, size_t &out)
+{
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+    {
+        return false;
+    }
+    errno = 0;
+    unsigned long long parsed = strtoull(value.c_str(), NULL, 10);
+    if (errno != 0)
+    {
+        return false;
+    }
+    out = static_cast<size_t>(parsed);
+    return true;
+}
+
+static int64_t monotonic_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static ssize_t transport_send(ServerContext &ctx, int client_socket, const char *data, size_t len)
+{
+    if (ctx.transport)
+    {
+        return ctx.transport->send(client_socket, data, len);
+    }
+    return send(client_socket, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
@@ -1,6 +1,8 @@
 #include "common.h"
 #include <cstdio>
 #include <cstdlib>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
 void error(const char *msg)
 {
@@ -33,3 +35,45 @@ ssize_t send_all(int sockfd, const void *buf, size_t len, int flags)
     }
     return total;
 }
+
+void raise_fd_limit()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+        {
+            perror("WARN: setrlimit RLIMIT_NOFILE failed");
+        }
+    }
+}
+
+bool make_unix_address(const std::string &path, struct sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    {
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+bool bind_unix_socket(int sock, const std::string &path)
+{
+    struct sockaddr_un addr;
+    if (!make_unix_address(path, addr))
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    // A socket file left behind by an earlier run would make bind fail.
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(path.c_str());
+    }
+    return bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+}
@@ -0,0 +1,157 @@
+#include "content_filter.h"
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+
+static bool decode_number(uint8_t type, const char *content, size_t content_len, double &value);
+static bool compare(FilterOp op, double left, double right);
+
+bool parse_content_filter(const std::string &spec, ContentFilter &filter)
+{
+    static const char *const TYPE_NAMES[] = {"INT", "SHORT_REAL", "FLOAT", "STRING"};
+
+    size_t op_start = spec.find_first_of("<>=!^");
+    std::string type_name = spec.substr(0, op_start);
+    bool known_type = false;
+    for (uint8_t type = 0; type < 4; ++type)
+    {
+        if (type_name == TYPE_NAMES[type])
+        {
+            filter.type = type;
+            known_type = true;
+        }
+    }
+    if (!known_type)
+    {
+        return false;
+    }
+    if (op_start == std::string::npos)
+    {
+        filter.op = FILTER_TYPE;
+        return true;
+    }
+
+    // Two-character operators first, so "<=" is not read as "<" and "=...".
+    static const struct
+    {
+        const char *token;
+        FilterOp op;
+    } OPERATORS[] = {{"==", FILTER_EQ}, {"!=", FILTER_NE}, {"<=", FILTER_LE}, {">=", FILTER_GE},
+                     {"^=", FILTER_PREFIX}, {"<", FILTER_LT}, {">", FILTER_GT}};
+    size_t value_start = std::string::npos;
+    for (const auto &candidate : OPERATORS)
+    {
+        if (spec.compare(op_start, strlen(candidate.token), candidate.token) == 0)
+        {
+            filter.op = candidate.op;
+            value_start = op_start + strlen(candidate.token);
+            break;
+        }
+    }
+    if (value_start == std::string::npos)
+    {
+        return false;
+    }
+    std::string value = spec.substr(value_start);
+
+    if (filter.type == 3)
+    {
+        filter.text = value;
+        return filter.op == FILTER_EQ || filter.op == FILTER_NE || filter.op == FILTER_PREFIX;
+    }
+    if (filter.op == FILTER_PREFIX || value.empty())
+    {
+        return false;
+    }
+    char *end = nullptr;
+    filter.number = strtod(value.c_str(), &end);
+    return *end == '\0';
+}
+
+bool content_filter_accepts(const ContentFilter &filter, uint8_t type, const char *content, size_t content_len)
+{
+    if (filter.op == FILTER_ALL)
+    {
+        return true;
+    }
+    if (type != filter.type)
+    {
+        return false;
+    }
+    if (filter.op == FILTER_TYPE)
+    {
+        return true;
+    }
+    if (type == 3)
+    {
+        if (filter.op == FILTER_PREFIX)
+        {
+            return content_len >= filter.text.size() && memcmp(content, filter.text.data(), filter.text.size()) == 0;
+        }
+        bool equal = content_len == filter.text.size() && memcmp(content, filter.text.data(), content_len) == 0;
+        return filter.op == FILTER_EQ ? equal : !equal;
+    }
+    double value;
+    return decode_number(type, content, content_len, value) && compare(filter.op, value, filter.number);
+}
+
+// Same layouts the subscriber prints. The FLOAT mantissa is divided by an
+// exact power of ten, so "FLOAT==25.5" matches the reading 255 / 10^1.
+static bool decode_number(uint8_t type, const char *content, size_t content_len, double &value)
+{
+    if (type == 1)
+    {
+        if (content_len < 2)
+        {
+            return false;
+        }
+        uint16_t net_value;
+        memcpy(&net_value, content, sizeof(net_value));
+        value = ntohs(net_value) / 100.0;
+        return true;
+    }
+
+    size_t needed = type == 0 ? 5 : 6;
+    if (content_len < needed || static_cast<uint8_t>(content[0]) > 1)
+    {
+        return false;
+    }
+    uint32_t net_value;
+    memcpy(&net_value, content + 1, sizeof(net_value));
+    value = ntohl(net_value);
+    if (type == 2)
+    {
+        double divisor = 1.0;
+        for (uint8_t power = static_cast<uint8_t>(content[5]); power > 0; --power)
+        {
+            divisor *= 10.0;
+        }
+        value /= divisor;
+    }
+    if (content[0] == 1)
+    {
+        value = -value;
+    }
+    return true;
+}
+
+static bool compare(FilterOp op, double left, double right)
+{
+    switch (op)
+    {
+    case FILTER_EQ:
+        return left == right;
+    case FILTER_NE:
+        return left != right;
+    case FILTER_LT:
+        return left < right;
+    case FILTER_LE:
+        return left <= right;
+    case FILTER_GT:
+        return left > right;
+    case FILTER_GE:
+        return left >= right;
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,509 @@
+#include "edge_relay.h"
+#include "topic_match.h"
+#include <fcntl.h>
+
+static void append_forward_frame(std::vector<char> &out, const char *sender_ip, uint16_t sender_port,
+                                 const std::string &topic, uint8_t udp_type, const char *content_data,
+                                 uint16_t content_len);
+
+EdgeRelay::EdgeRelay(int upstream_socket) : upstream(upstream_socket), upstream_buffer(CIRCULAR_BUFFER_SIZE) {}
+
+EdgeRelay::~EdgeRelay()
+{
+    for (auto &pair : clients)
+    {
+        close(pair.first);
+    }
+    if (listener >= 0)
+    {
+        close(listener);
+    }
+    if (!unix_path.empty())
+    {
+        unlink(unix_path.c_str());
+    }
+}
+
+bool EdgeRelay::listen_on(const std::string &address)
+{
+    bool is_unix = address.compare(0, strlen(UNIX_ADDRESS_PREFIX), UNIX_ADDRESS_PREFIX) == 0;
+    int bound;
+    if (is_unix)
+    {
+        std::string path = address.substr(strlen(UNIX_ADDRESS_PREFIX));
+        struct sockaddr_un addr;
+        if (!make_unix_address(path, addr))
+        {
+            std::cerr << "ERROR: Invalid Unix socket path for the relay." << std::endl;
+            return false;
+        }
+        listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0)
+        {
+            perror("ERROR opening the relay socket");
+            return false;
+        }
+        bound = bind_unix_socket(listener, path) ? 0 : -1;
+        if (bound == 0)
+        {
+            unix_path = path;
+        }
+    }
+    else
+    {
+        int port = atoi(address.c_str());
+        if (port <= 0 || port > 65535 || address.find_first_not_of("0123456789") != std::string::npos)
+        {
+            std::cerr << "ERROR: Invalid relay address (expected a port or unix:PATH)." << std::endl;
+            return false;
+        }
+        listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0)
+        {
+            perror("ERROR opening the relay socket");
+            return false;
+        }
+        int enable = 1;
+        if (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0)
+        {
+            perror("WARN: setsockopt SO_REUSEADDR failed");
+        }
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = INADDR_ANY;
+        bound = bind(listener, (struct sockaddr *)&addr, sizeof(addr));
+        listener_tcp = true;
+    }
+    if (bound < 0 || listen(listener, RELAY_LISTEN_BACKLOG) < 0)
+    {
+        perror("ERROR binding the relay socket");
+        return false;
+    }
+    std::cerr << "Relay accepting subscribers on " << address << std::endl;
+    return true;
+}
+
+void EdgeRelay::run()
+{
+    std::vector<struct pollfd> poll_fds;
+    while (running)
+    {
+        poll_fds.clear();
+        poll_fds.push_back({STDIN_FILENO, POLLIN, 0}); // [0] Standard input
+        poll_fds.push_back({upstream, POLLIN, 0});     // [1] Broker connection
+        poll_fds.push_back({listener, POLLIN, 0});     // [2] Local listener
+        for (const auto &pair : clients)
+        {
+            short events = pair.second.outbound.empty() ? POLLIN : POLLIN | POLLOUT;
+            poll_fds.push_back({pair.first, events, 0});
+        }
+        if (poll(poll_fds.data(), poll_fds.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            error("ERROR on poll");
+        }
+
+        if (poll_fds[0].revents & (POLLIN | POLLHUP))
+        {
+            handle_console();
+        }
+        if (poll_fds[1].revents & (POLLIN | POLLERR | POLLHUP))
+        {
+            read_upstream();
+        }
+        if (poll_fds[2].revents & POLLIN)
+        {
+            accept_client();
+        }
+        for (size_t i = 3; i < poll_fds.size(); ++i)
+        {
+            int sock = poll_fds[i].fd;
+            short revents = poll_fds[i].revents;
+            auto it = clients.find(sock);
+            if (revents == 0 || it == clients.end())
+            {
+                continue;
+            }
+            bool keep = true;
+            if ((revents & (POLLERR | POLLNVAL)) || ((revents & POLLHUP) && !(revents & POLLIN)))
+            {
+                keep = false;
+            }
+            if (keep && (revents & POLLOUT))
+            {
+                keep = flush_client(sock, it->second);
+            }
+            if (keep && (revents & POLLIN))
+            {
+                keep = read_client(sock, it->second);
+            }
+            if (!keep)
+            {
+                remove_client(sock);
+            }
+        }
+
+        // Everything one read from the broker produced leaves in one send per
+        // local subscriber. remove_client() erases from flush_pending, so the
+        // loop walks a copy taken out of it.
+        std::set<int> pending;
+        pending.swap(flush_pending);
+        for (int sock : pending)
+        {
+            auto it = clients.find(sock);
+            if (it != clients.end() && !flush_client(sock, it->second))
+            {
+                remove_client(sock);
+            }
+        }
+    }
+}
+
+void EdgeRelay::handle(const char *sender_ip, uint16_t sender_port, const std::string &topic, uint8_t udp_type,
+                       const char *content_data, uint16_t content_len)
+{
+    stats.messages++;
+    const std::vector<int> &targets = route(topic);
+    if (targets.empty())
+    {
+        return;
+    }
+    std::vector<char> frame;
+    append_forward_frame(frame, sender_ip, sender_port, topic, udp_type, content_data, content_len);
+    for (int sock : targets)
+    {
+        RelayClient &client = clients[sock];
+        client.outbound.insert(client.outbound.end(), frame.begin(), frame.end());
+        flush_pending.insert(sock);
+        stats.deliveries++;
+    }
+}
+
+void EdgeRelay::accept_client()
+{
+    int sock = accept(listener, NULL, NULL);
+    if (sock < 0)
+    {
+        perror("WARN: accept failed");
+        return;
+    }
+    if (listener_tcp)
+    {
+        int flag = 1;
+        if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(int)) < 0)
+        {
+            perror("WARN: setsockopt TCP_NODELAY failed");
+        }
+    }
+    clients[sock];
+}
+
+// The ID comes first, NUL terminated, then newline separated commands, as on
+// the broker.
+bool EdgeRelay::read_client(int sock, RelayClient &client)
+{
+    char buffer[BUFFER_SIZE];
+    ssize_t bytes_received = recv(sock, buffer, sizeof(buffer), 0);
+    if (bytes_received <= 0)
+    {
+        if (bytes_received < 0 && errno != ECONNRESET && errno != EINTR && errno != EPIPE)
+        {
+            perror("WARN: recv from relay client failed");
+        }
+        if (!client.id.empty())
+        {
+            std::cout << "Client " << client.id << " disconnected from the relay." << std::endl;
+        }
+        return false;
+    }
+    if (!client.commands.write(buffer, bytes_received))
+    {
+        std::cerr << "ERROR: Relay client command buffer overflow. Disconnecting." << std::endl;
+        return false;
+    }
+    if (client.id.empty())
+    {
+        ssize_t terminator = client.commands.find('\0');
+        if (terminator < 0)
+        {
+            return client.commands.bytes_available() <= MAX_ID_SIZE;
+        }
+        std::string id = client.commands.substr(0, terminator);
+        client.commands.consume(terminator + 1);
+        if (id.empty() || id.size() > MAX_ID_SIZE || id.find_first_of("\n\r") != std::string::npos)
+        {
+            return false;
+        }
+        if (connected_ids.count(id))
+        {
+            std::cout << "Client " << id << " already connected." << std::endl;
+            return false;
+        }
+        client.id = id;
+        connected_ids.insert(id);
+        std::cout << "New client " << id << " connected to the relay." << std::endl;
+    }
+    ssize_t newline;
+    while ((newline = client.commands.find('\n')) >= 0)
+    {
+        std::string line = client.commands.substr(0, newline);
+        client.commands.consume(newline + 1);
+        line.erase(0, line.find_first_not_of(" \t\r"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (!line.empty())
+        {
+            execute_command(client, line);
+        }
+    }
+    return true;
+}
+
+// Local subscriptions are plain: an SF flag of 1 and options such as last=,
+// where= or max_rate= would need per-client state upstream, and the relay
+// forgets a client's patterns when it disconnects. Such a subscribe is
+// refused rather than served with a weaker guarantee than it asked for.
+void EdgeRelay::execute_command(RelayClient &client, const std::string &line)
+{
+    std::stringstream ss(line);
+    std::string verb;
+    std::string pattern;
+    ss >> verb >> pattern;
+    if (verb == "subscribe" && !pattern.empty() && pattern.size() <= TOPIC_SIZE)
+    {
+        std::string sf;
+        std::string extra;
+        ss >> sf;
+        std::getline(ss, extra);
+        if ((sf != "" && sf != "0") || extra.find_first_not_of(" \t") != std::string::npos)
+        {
+            std::cerr << "ERROR: The relay does not support SF or subscribe options; " << client.id
+                      << " is not subscribed to " << pattern << "." << std::endl;
+        }
+        else
+        {
+            subscribe(client, pattern);
+        }
+    }
+    else if (verb == "unsubscribe" && !pattern.empty())
+    {
+        unsubscribe(client, pattern);
+    }
+    else if (verb == "frames" || verb == "transport")
+    {
+        // The relay always sends plain frames over the connection.
+    }
+    else
+    {
+        std::cerr << "ERROR: Unknown relay client command: " << line << std::endl;
+    }
+}
+
+void EdgeRelay::subscribe(RelayClient &client, const std::string &pattern)
+{
+    if (!client.patterns.insert(pattern).second)
+    {
+        return;
+    }
+    routes.clear();
+    if (upstream_refs[pattern]++ == 0)
+    {
+        send_upstream("subscribe " + pattern + " 0\n");
+    }
+}
+
+void EdgeRelay::unsubscribe(RelayClient &client, const std::string &pattern)
+{
+    if (client.patterns.erase(pattern) == 0)
+    {
+        return;
+    }
+    routes.clear();
+    auto it = upstream_refs.find(pattern);
+    if (it != upstream_refs.end() && --it->second == 0)
+    {
+        upstream_refs.erase(it);
+        send_upstream("unsubscribe " + pattern + "\n");
+    }
+}
+
+void EdgeRelay::send_upstream(const std::string &command)
+{
+    if (send_all(upstream, command.c_str(), command.size(), MSG_NOSIGNAL) < 0)
+    {
+        std::cerr << "ERROR: Lost the broker connection." << std::endl;
+        running = false;
+    }
+}
+
+void EdgeRelay::read_upstream()
+{
+    char buffer[BUFFER_SIZE];
+    ssize_t bytes_received = recv(upstream, buffer, std::min(sizeof(buffer), upstream_buffer.space_available()), 0);
+    if (bytes_received < 0 && (errno == EINTR || errno == EAGAIN))
+    {
+        return;
+    }
+    if (bytes_received <= 0)
+    {
+        std::cerr << "ERROR: Server connection error/hangup." << std::endl;
+        running = false;
+        return;
+    }
+    upstream_buffer.write(buffer, bytes_received);
+    deserialize_and_process_message(upstream_buffer, *this, dictionary);
+}
+
+const std::vector<int> &EdgeRelay::route(const std::string &topic)
+{
+    auto it = routes.find(topic);
+    if (it != routes.end())
+    {
+        return it->second;
+    }
+    if (routes.size() >= RELAY_ROUTE_CACHE_SIZE)
+    {
+        routes.clear();
+    }
+    std::vector<int> &targets = routes[topic];
+    for (const auto &pair : clients)
+    {
+        for (const std::string &pattern : pair.second.patterns)
+        {
+            if (topic_matches(topic, pattern))
+            {
+                targets.push_back(pair.first);
+                break;
+            }
+        }
+    }
+    return targets;
+}
+
+// A local subscriber that lets RELAY_MAX_BACKLOG_BYTES pile up is dropped
+// rather than held in memory; the others are not slowed by it.
+bool EdgeRelay::flush_client(int sock, RelayClient &client)
+{
+    size_t sent = 0;
+    while (sent < client.outbound.size())
+    {
+        ssize_t n = send(sock, client.outbound.data() + sent, client.outbound.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            return false;
+        }
+        sent += n;
+    }
+    stats.bytes_out += sent;
+    client.outbound.erase(client.outbound.begin(), client.outbound.begin() + sent);
+    if (client.outbound.size() > RELAY_MAX_BACKLOG_BYTES)
+    {
+        std::cerr << "WARN: Relay client " << client.id << " fell " << client.outbound.size()
+                  << " bytes behind. Disconnecting." << std::endl;
+        stats.dropped_clients++;
+        return false;
+    }
+    return true;
+}
+
+void EdgeRelay::remove_client(int sock)
+{
+    auto it = clients.find(sock);
+    if (it == clients.end())
+    {
+        return;
+    }
+    std::set<std::string> patterns = it->second.patterns;
+    for (const std::string &pattern : patterns)
+    {
+        unsubscribe(it->second, pattern);
+    }
+    connected_ids.erase(it->second.id);
+    clients.erase(it);
+    flush_pending.erase(sock);
+    routes.clear();
+    close(sock);
+}
+
+void EdgeRelay::handle_console()
+{
+    char buffer[BUFFER_SIZE];
+    ssize_t bytes_read = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (bytes_read < 0 && errno == EINTR)
+    {
+        return;
+    }
+    if (bytes_read <= 0)
+    {
+        running = false;
+        return;
+    }
+    console_input.append(buffer, bytes_read);
+    size_t newline;
+    while (running && (newline = console_input.find('\n')) != std::string::npos)
+    {
+        std::string line = console_input.substr(0, newline);
+        console_input.erase(0, newline + 1);
+        if (line == "exit")
+        {
+            running = false;
+        }
+        else if (line == "stats")
+        {
+            std::cout << "relay clients=" << connected_ids.size() << " upstream_patterns=" << upstream_refs.size()
+                      << " messages=" << stats.messages << " deliveries=" << stats.deliveries
+                      << " bytes_out=" << stats.bytes_out << " dropped_clients=" << stats.dropped_clients << std::endl;
+        }
+        else if (!line.empty())
+        {
+            std::cerr << "ERROR: Unknown relay command. Use 'stats' or 'exit'." << std::endl;
+        }
+    }
+}
+
+// Same layout as serialize_forward_message on the broker.
+static void append_forward_frame(std::vector<char> &out, const char *sender_ip, uint16_t sender_port,
+                                 const std::string &topic, uint8_t udp_type, const char *content_data,
+                                 uint16_t content_len)
+{
+    uint8_t topic_len = static_cast<uint8_t>(std::min(topic.size(), (size_t)TOPIC_SIZE));
+    uint32_t payload_len = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t) + topic_len + sizeof(uint8_t) +
+                           sizeof(uint16_t) + content_len;
+    uint32_t net_len = htonl(payload_len);
+    struct in_addr ip_addr;
+    if (inet_pton(AF_INET, sender_ip, &ip_addr) != 1)
+    {
+        ip_addr.s_addr = 0;
+    }
+    uint16_t net_port = htons(sender_port);
+    uint16_t net_content_len = htons(content_len);
+
+    size_t offset = out.size();
+    out.resize(offset + sizeof(net_len) + payload_len);
+    char *p = out.data() + offset;
+    memcpy(p, &net_len, sizeof(net_len));
+    p += sizeof(net_len);
+    memcpy(p, &ip_addr.s_addr, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+    memcpy(p, &net_port, sizeof(net_port));
+    p += sizeof(net_port);
+    *p++ = static_cast<char>(topic_len);
+    memcpy(p, topic.data(), topic_len);
+    p += topic_len;
+    *p++ = static_cast<char>(udp_type);
+    memcpy(p, &net_content_len, sizeof(net_content_len));
+    p += sizeof(net_content_len);
+    memcpy(p, content_data, content_len);
+}
@@ -0,0 +1,144 @@
+#include "latency_stamp.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+static bool parse_hex(const char *text, size_t digits, uint64_t &value);
+static void print_line(std::ostream &out, const std::string &topic, std::vector<int64_t> &samples,
+                       uint64_t lost, uint64_t reordered, uint64_t unstamped);
+
+int64_t latency_clock_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void write_latency_stamp(char *content, uint32_t stream, uint64_t sequence, int64_t sent_ns)
+{
+    char text[LATENCY_STAMP_SIZE + 1];
+    snprintf(text, sizeof(text), LATENCY_STAMP_PREFIX "%08x:%016llx:%016llx", stream, (unsigned long long)sequence,
+             (unsigned long long)sent_ns);
+    memcpy(content, text, LATENCY_STAMP_SIZE);
+}
+
+bool read_latency_stamp(const char *content, size_t content_len, LatencyStamp &stamp)
+{
+    const size_t prefix_len = strlen(LATENCY_STAMP_PREFIX);
+    if (content_len < LATENCY_STAMP_SIZE || memcmp(content, LATENCY_STAMP_PREFIX, prefix_len) != 0)
+    {
+        return false;
+    }
+    uint64_t stream;
+    uint64_t sent_ns;
+    const char *fields = content + prefix_len;
+    if (!parse_hex(fields, 8, stream) || fields[8] != ':' || !parse_hex(fields + 9, 16, stamp.sequence) ||
+        fields[25] != ':' || !parse_hex(fields + 26, 16, sent_ns))
+    {
+        return false;
+    }
+    stamp.stream = static_cast<uint32_t>(stream);
+    stamp.sent_ns = static_cast<int64_t>(sent_ns);
+    return true;
+}
+
+void LatencyTracker::record(const std::string &topic, const char *content, size_t content_len, int64_t arrival_ns)
+{
+    TopicState &state = topics[topic];
+    LatencyStamp stamp;
+    if (!read_latency_stamp(content, content_len, stamp))
+    {
+        state.unstamped++;
+        return;
+    }
+    state.samples.push_back(arrival_ns - stamp.sent_ns);
+
+    auto inserted = state.streams.emplace(stamp.stream, StreamState());
+    StreamState &stream = inserted.first->second;
+    if (inserted.second)
+    {
+        stream.first = stamp.sequence;
+        stream.highest = stamp.sequence;
+    }
+    else if (stamp.sequence < stream.highest)
+    {
+        state.reordered++;
+        stream.first = std::min(stream.first, stamp.sequence);
+    }
+    else
+    {
+        stream.highest = stamp.sequence;
+    }
+    stream.received++;
+}
+
+void LatencyTracker::print_summary(std::ostream &out)
+{
+    std::vector<int64_t> all_samples;
+    uint64_t all_lost = 0;
+    uint64_t all_reordered = 0;
+    uint64_t all_unstamped = 0;
+    for (auto &entry : topics)
+    {
+        TopicState &state = entry.second;
+        uint64_t lost = 0;
+        for (const auto &stream : state.streams)
+        {
+            uint64_t expected = stream.second.highest - stream.second.first + 1;
+            if (expected > stream.second.received)
+            {
+                lost += expected - stream.second.received;
+            }
+        }
+        all_samples.insert(all_samples.end(), state.samples.begin(), state.samples.end());
+        all_lost += lost;
+        all_reordered += state.reordered;
+        all_unstamped += state.unstamped;
+        print_line(out, entry.first, state.samples, lost, state.reordered, state.unstamped);
+    }
+    print_line(out, "ALL", all_samples, all_lost, all_reordered, all_unstamped);
+}
+
+static bool parse_hex(const char *text, size_t digits, uint64_t &value)
+{
+    value = 0;
+    for (size_t i = 0; i < digits; ++i)
+    {
+        char c = text[i];
+        int digit;
+        if (c >= '0' && c <= '9')
+        {
+            digit = c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            digit = c - 'a' + 10;
+        }
+        else
+        {
+            return false;
+        }
+        value = (value << 4) | digit;
+    }
+    return true;
+}
+
+static void print_line(std::ostream &out, const std::string &topic, std::vector<int64_t> &samples,
+                       uint64_t lost, uint64_t reordered, uint64_t unstamped)
+{
+    char line[256];
+    if (samples.empty())
+    {
+        snprintf(line, sizeof(line), "topic=%s received=0 lost=%llu reordered=%llu unstamped=%llu",
+                 topic.c_str(), (unsigned long long)lost, (unsigned long long)reordered, (unsigned long long)unstamped);
+        out << line << "\n";
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    snprintf(line, sizeof(line),
+             "topic=%s received=%zu lost=%llu reordered=%llu unstamped=%llu p50_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f",
+             topic.c_str(), n, (unsigned long long)lost, (unsigned long long)reordered, (unsigned long long)unstamped,
+             samples[n / 2] / 1000.0, samples[n * 99 / 100] / 1000.0, samples[n * 999 / 1000] / 1000.0,
+             samples.back() / 1000.0);
+    out << line << "\n";
+}
@@ -0,0 +1,279 @@
+#include "metrics_endpoint.h"
+#include "common.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static bool parse_metrics_port(const std::string &address, int &port);
+static std::string http_response(const char *status, const std::string &body);
+static int64_t monotonic_ms();
+
+bool MetricsEndpoint::valid_address(const std::string &address)
+{
+    if (address.compare(0, strlen(UNIX_ADDRESS_PREFIX), UNIX_ADDRESS_PREFIX) == 0)
+    {
+        size_t path_len = address.size() - strlen(UNIX_ADDRESS_PREFIX);
+        return path_len > 0 && path_len < sizeof(((struct sockaddr_un *)0)->sun_path);
+    }
+    int port;
+    return parse_metrics_port(address, port);
+}
+
+MetricsEndpoint::~MetricsEndpoint()
+{
+    for (Connection &conn : connections)
+    {
+        close(conn.socket);
+    }
+    if (listener >= 0)
+    {
+        close(listener);
+    }
+    if (!unix_path.empty())
+    {
+        unlink(unix_path.c_str());
+    }
+}
+
+bool MetricsEndpoint::open(const std::string &address)
+{
+    int port = 0;
+    bool is_unix = address.compare(0, strlen(UNIX_ADDRESS_PREFIX), UNIX_ADDRESS_PREFIX) == 0;
+    if (!is_unix && !parse_metrics_port(address, port))
+    {
+        std::cerr << "ERROR: Invalid metrics address " << address << "." << std::endl;
+        return false;
+    }
+
+    listener = socket(is_unix ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+    {
+        perror("WARN: metrics socket failed");
+        return false;
+    }
+    int bound;
+    if (is_unix)
+    {
+        std::string path = address.substr(strlen(UNIX_ADDRESS_PREFIX));
+        bound = bind_unix_socket(listener, path) ? 0 : -1;
+        if (bound == 0)
+        {
+            unix_path = path;
+        }
+    }
+    else
+    {
+        int enable = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bound = bind(listener, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    if (bound < 0 || listen(listener, MAX_METRICS_CONNECTIONS) < 0)
+    {
+        perror("WARN: metrics listener setup failed");
+        close(listener);
+        listener = -1;
+        return false;
+    }
+    return true;
+}
+
+void MetricsEndpoint::add_poll_fds(std::vector<struct pollfd> &fds)
+{
+    poll_base = fds.size();
+    fds.push_back({listener, POLLIN, 0});
+    for (const Connection &conn : connections)
+    {
+        fds.push_back({conn.socket, static_cast<short>(conn.response.empty() ? POLLIN : POLLOUT), 0});
+    }
+}
+
+int MetricsEndpoint::next_timeout(int poll_timeout) const
+{
+    if (connections.empty() || poll_timeout == 0)
+    {
+        return poll_timeout;
+    }
+    int64_t now_ms = monotonic_ms();
+    for (const Connection &conn : connections)
+    {
+        int64_t wait_ms = conn.deadline_ms - now_ms + 1;
+        int deadline_timeout = wait_ms <= 0 ? 0 : static_cast<int>(wait_ms);
+        poll_timeout = poll_timeout < 0 ? deadline_timeout : std::min(poll_timeout, deadline_timeout);
+    }
+    return poll_timeout;
+}
+
+void MetricsEndpoint::handle_events(const std::vector<struct pollfd> &fds, const std::function<std::string()> &render)
+{
+    size_t polled = connections.size();
+    for (size_t i = 0; i < polled && poll_base + 1 + i < fds.size(); ++i)
+    {
+        short revents = fds[poll_base + 1 + i].revents;
+        Connection &conn = connections[i];
+        if (revents & (POLLERR | POLLNVAL))
+        {
+            conn.done = true;
+        }
+        else if (revents & POLLOUT)
+        {
+            write_response(conn);
+        }
+        else if (revents & (POLLIN | POLLHUP))
+        {
+            read_request(conn, render);
+        }
+    }
+    int64_t now_ms = monotonic_ms();
+    for (size_t i = connections.size(); i > 0; --i)
+    {
+        if (connections[i - 1].done || connections[i - 1].deadline_ms < now_ms)
+        {
+            close(connections[i - 1].socket);
+            connections.erase(connections.begin() + (i - 1));
+        }
+    }
+    if (poll_base < fds.size() && (fds[poll_base].revents & POLLIN))
+    {
+        accept_connections();
+    }
+}
+
+void MetricsEndpoint::accept_connections()
+{
+    while (true)
+    {
+        int client = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                perror("WARN: metrics accept failed");
+            }
+            return;
+        }
+        if (connections.size() >= MAX_METRICS_CONNECTIONS)
+        {
+            close(client);
+            continue;
+        }
+        Connection conn;
+        conn.socket = client;
+        conn.deadline_ms = monotonic_ms() + METRICS_CONNECTION_TIMEOUT_MS;
+        connections.push_back(std::move(conn));
+    }
+}
+
+void MetricsEndpoint::read_request(Connection &conn, const std::function<std::string()> &render)
+{
+    char buffer[1024];
+    while (true)
+    {
+        ssize_t n = recv(conn.socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        if (n <= 0)
+        {
+            conn.done = true;
+            return;
+        }
+        conn.request.append(buffer, n);
+        if (conn.request.find("\r\n\r\n") != std::string::npos || conn.request.find("\n\n") != std::string::npos)
+        {
+            break;
+        }
+        if (conn.request.size() > MAX_METRICS_REQUEST)
+        {
+            conn.done = true;
+            return;
+        }
+    }
+
+    std::string method = conn.request.substr(0, conn.request.find(' '));
+    size_t path_start = method.size() + 1;
+    size_t path_end = conn.request.find_first_of(" ?\r\n", path_start);
+    std::string path = path_start < conn.request.size() ? conn.request.substr(path_start, path_end - path_start) : "";
+    if (method != "GET")
+    {
+        conn.response = http_response("405 Method Not Allowed", "only GET is supported\n");
+    }
+    else if (path != "/metrics" && path != "/")
+    {
+        conn.response = http_response("404 Not Found", "try /metrics\n");
+    }
+    else
+    {
+        conn.response = http_response("200 OK", render());
+    }
+    write_response(conn);
+}
+
+void MetricsEndpoint::write_response(Connection &conn)
+{
+    while (conn.sent < conn.response.size())
+    {
+        ssize_t n = send(conn.socket, conn.response.data() + conn.sent, conn.response.size() - conn.sent,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                conn.done = true;
+            }
+            return;
+        }
+        conn.sent += n;
+        conn.deadline_ms = monotonic_ms() + METRICS_CONNECTION_TIMEOUT_MS;
+    }
+    conn.done = true;
+}
+
+static bool parse_metrics_port(const std::string &address, int &port)
+{
+    char *end = NULL;
+    long value = strtol(address.c_str(), &end, 10);
+    if (address.empty() || *end != '\0' || value <= 0 || value > 65535)
+    {
+        return false;
+    }
+    port = static_cast<int>(value);
+    return true;
+}
+
+static std::string http_response(const char *status, const std::string &body)
+{
+    std::string response = std::string("HTTP/1.0 ") + status + "\r\n" +
+                           "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n" +
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n" +
+                           "Connection: close\r\n\r\n";
+    response += body;
+    return response;
+}
+
+static int64_t monotonic_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,165 @@
+#include "pattern_registry.h"
+#include "topic_match.h"
+
+static bool canonical_topic(const std::string &topic);
+
+PatternId PatternRegistry::acquire(const std::string &pattern)
+{
+    auto it = ids.find(pattern);
+    if (it != ids.end())
+    {
+        entries[it->second].refs++;
+        return it->second;
+    }
+    PatternId id;
+    if (!free_ids.empty())
+    {
+        id = free_ids.back();
+        free_ids.pop_back();
+    }
+    else
+    {
+        id = static_cast<PatternId>(entries.size());
+        entries.emplace_back();
+    }
+    Entry &entry = entries[id];
+    entry.text = pattern;
+    std::vector<std::string> segments = split_topic(pattern);
+    entry.literal = canonical_topic(pattern);
+    for (const std::string &segment : segments)
+    {
+        entry.literal = entry.literal && segment != "+" && segment != "*";
+    }
+    if (!entry.literal)
+    {
+        entry.segments = std::move(segments);
+    }
+    entry.refs = 1;
+    entry.serial = 0;
+    ids.emplace(std::string_view(entry.text), id);
+    return id;
+}
+
+void PatternRegistry::release(PatternId id)
+{
+    Entry &entry = entries[id];
+    if (--entry.refs > 0)
+    {
+        return;
+    }
+    ids.erase(entry.text);
+    entry.text.clear();
+    entry.text.shrink_to_fit();
+    entry.segments.clear();
+    entry.segments.shrink_to_fit();
+    free_ids.push_back(id);
+}
+
+PatternId PatternRegistry::find(const std::string &pattern) const
+{
+    auto it = ids.find(pattern);
+    return it != ids.end() ? it->second : PATTERN_NONE;
+}
+
+void PatternRegistry::begin_message(const std::string &message_topic)
+{
+    topic = message_topic;
+    topic_literal = canonical_topic(message_topic);
+    topic_split = false;
+    message_serial++;
+}
+
+bool PatternRegistry::matches(PatternId id)
+{
+    Entry &entry = entries[id];
+    if (entry.serial != message_serial)
+    {
+        entry.serial = message_serial;
+        if (entry.literal && topic_literal)
+        {
+            entry.matched = entry.text == topic;
+        }
+        else
+        {
+            if (!topic_split)
+            {
+                topic_segments = split_topic(topic);
+                topic_split = true;
+            }
+            // Literal patterns are only split again for an odd topic such as "a//b".
+            entry.matched = entry.literal ? segments_match(topic_segments, split_topic(entry.text))
+                                          : segments_match(topic_segments, entry.segments);
+        }
+        evaluation_count++;
+    }
+    return entry.matched;
+}
+
+size_t SubscriptionList::lower_bound(const PatternRegistry &registry, const std::string &pattern) const
+{
+    size_t low = 0;
+    size_t high = items.size();
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (registry.text(items[mid].id) < pattern)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+void SubscriptionList::set(PatternRegistry &registry, const std::string &pattern, bool sf)
+{
+    size_t pos = lower_bound(registry, pattern);
+    if (pos < items.size() && registry.text(items[pos].id) == pattern)
+    {
+        items[pos].sf = sf;
+        return;
+    }
+    items.insert(items.begin() + pos, {registry.acquire(pattern), sf, false});
+}
+
+bool SubscriptionList::erase(PatternRegistry &registry, const std::string &pattern)
+{
+    size_t pos = lower_bound(registry, pattern);
+    if (pos == items.size() || registry.text(items[pos].id) != pattern)
+    {
+        return false;
+    }
+    registry.release(items[pos].id);
+    items.erase(items.begin() + pos);
+    return true;
+}
+
+const PatternSubscription *SubscriptionList::find(const PatternRegistry &registry, const std::string &pattern) const
+{
+    size_t pos = lower_bound(registry, pattern);
+    if (pos == items.size() || registry.text(items[pos].id) != pattern)
+    {
+        return nullptr;
+    }
+    return &items[pos];
+}
+
+size_t SubscriptionList::covered_count() const
+{
+    size_t count = 0;
+    for (const PatternSubscription &item : items)
+    {
+        count += item.covered;
+    }
+    return count;
+}
+
+// split_topic() drops a trailing empty segment, so "a/b/" and "a/b" match
+// each other; string equality only agrees with it without empty segments.
+static bool canonical_topic(const std::string &topic)
+{
+    return !topic.empty() && topic.back() != '/' && topic.find("//") == std::string::npos;
+}
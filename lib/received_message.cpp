@@ -0,0 +1,480 @@
+#include "received_message.h"
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <arpa/inet.h>
+
+static void read_buffered_frames(CircularBuffer<char> &data_buffer, std::ostream &out, LatencyTracker *tracker,
+                                 ReceivedMessageHandler *handler, WireDictionaryTable &dictionary);
+static void process_plain_frame(const char *payload_data_ptr, size_t total_payload_len, std::ostream &out,
+                                LatencyTracker *tracker, ReceivedMessageHandler *handler, int64_t arrival_ns);
+static void process_batch_frame(const char *payload, size_t payload_len, std::ostream &out, LatencyTracker *tracker,
+                                ReceivedMessageHandler *handler, int64_t arrival_ns, WireDictionaryTable &dictionary);
+static uint32_t read_varint(const char *&entry, const char *entry_end);
+
+std::string format_received_message(const std::string &sender_ip, uint16_t sender_port,
+                                    const std::string &topic, uint8_t udp_type,
+                                    const char *content_data, uint16_t content_len)
+{
+    std::stringstream result_ss;
+    result_ss << sender_ip << ":" << sender_port << " - ";
+    result_ss << topic << " - ";
+    switch (udp_type)
+    {
+    case 0:
+    {
+        if (content_len < 5)
+        {
+            result_ss << "INT - INVALID DATA";
+            break;
+        }
+        uint8_t sign = content_data[0];
+        uint32_t net_val;
+        memcpy(&net_val, content_data + 1, 4);
+        int val = ntohl(net_val);
+        if (sign == 1)
+        {
+            val = -val;
+        }
+        else if (sign != 0)
+        {
+            result_ss << "INT - INVALID SIGN";
+            break;
+        }
+        result_ss << "INT - " << val;
+        break;
+    }
+    case 1:
+    {
+        if (content_len < 2)
+        {
+            result_ss << "SHORT_REAL - INVALID DATA";
+            break;
+        }
+        uint16_t net_val;
+        memcpy(&net_val, content_data, 2);
+        float val = ntohs(net_val) / 100.0f;
+        if (val == static_cast<int>(val))
+        {
+            result_ss << "SHORT_REAL - " << static_cast<int>(val);
+        }
+        else
+        {
+            result_ss << "SHORT_REAL - " << std::fixed << std::setprecision(2) << val;
+            result_ss.unsetf(std::ios_base::floatfield);
+        }
+        break;
+    }
+    case 2:
+    {
+        if (content_len < 6)
+        {
+            result_ss << "FLOAT - INVALID DATA";
+            break;
+        }
+        uint8_t sign = content_data[0];
+        uint32_t net_val;
+        memcpy(&net_val, content_data + 1, 4);
+        uint8_t power = content_data[5];
+        double val = ntohl(net_val);
+        double p10 = 1.0;
+        for (int p = 0; p < power; ++p)
+        {
+            p10 /= 10.0;
+        }
+        val *= p10;
+        if (sign == 1)
+        {
+            val = -val;
+        }
+        else if (sign != 0)
+        {
+            result_ss << "FLOAT - INVALID SIGN";
+            break;
+        }
+        std::stringstream ss_float;
+        ss_float << std::fixed << std::setprecision(power) << val;
+        std::string fs = ss_float.str();
+        if (power > 0)
+        {
+            size_t dp = fs.find('.');
+            if (dp != std::string::npos)
+            {
+                size_t lnz = fs.find_last_not_of('0');
+                if (lnz == dp)
+                {
+                    fs.erase(dp);
+                }
+                else if (lnz > dp)
+                {
+                    fs.erase(lnz + 1);
+                }
+            }
+        }
+        else
+        {
+            if (val == static_cast<long long>(val))
+            {
+                fs = std::to_string(static_cast<long long>(val));
+            }
+        }
+        result_ss << "FLOAT - " << fs;
+        break;
+    }
+    case 3:
+    {
+        std::string str(content_data, content_len);
+        result_ss << "STRING - " << str;
+        break;
+    }
+    default:
+        result_ss << "UNKNOWN TYPE (" << (int)udp_type << ")";
+    }
+    return result_ss.str();
+}
+
+void deserialize_and_process_message(CircularBuffer<char> &data_buffer, std::ostream &out, LatencyTracker *tracker,
+                                     WireDictionaryTable &dictionary)
+{
+    read_buffered_frames(data_buffer, out, tracker, nullptr, dictionary);
+}
+
+void deserialize_and_process_message(CircularBuffer<char> &data_buffer, ReceivedMessageHandler &handler,
+                                     WireDictionaryTable &dictionary)
+{
+    read_buffered_frames(data_buffer, std::cout, nullptr, &handler, dictionary);
+}
+
+void process_forward_frames(const char *data, size_t len, std::ostream &out, LatencyTracker *tracker,
+                            WireDictionaryTable &dictionary)
+{
+    const size_t length_prefix_size = sizeof(uint32_t);
+    int64_t arrival_ns = tracker ? latency_clock_ns() : 0;
+    size_t offset = 0;
+    while (len - offset >= length_prefix_size)
+    {
+        uint32_t net_total_msg_len;
+        memcpy(&net_total_msg_len, data + offset, length_prefix_size);
+        uint32_t prefix = ntohl(net_total_msg_len);
+        bool batch = (prefix & BATCH_FRAME_FLAG) != 0;
+        uint32_t total_payload_len = prefix & ~BATCH_FRAME_FLAG;
+        if (total_payload_len == 0 || total_payload_len > len - offset - length_prefix_size)
+        {
+            std::cerr << "ERROR: Invalid payload length: " << total_payload_len << ". Dropping frames." << std::endl;
+            return;
+        }
+        const char *payload = data + offset + length_prefix_size;
+        if (batch)
+        {
+            process_batch_frame(payload, total_payload_len, out, tracker, nullptr, arrival_ns, dictionary);
+        }
+        else
+        {
+            process_plain_frame(payload, total_payload_len, out, tracker, nullptr, arrival_ns);
+        }
+        offset += length_prefix_size + total_payload_len;
+    }
+}
+
+static void read_buffered_frames(CircularBuffer<char> &data_buffer, std::ostream &out, LatencyTracker *tracker,
+                                 ReceivedMessageHandler *handler, WireDictionaryTable &dictionary)
+{
+    const size_t length_prefix_size = sizeof(uint32_t);
+    int64_t arrival_ns = tracker ? latency_clock_ns() : 0;
+    while (true)
+    {
+        if (data_buffer.bytes_available() < length_prefix_size)
+        {
+            break;
+        }
+        
+        uint32_t net_total_msg_len;
+        data_buffer.peek(reinterpret_cast<char *>(&net_total_msg_len), 0, length_prefix_size);
+        uint32_t prefix = ntohl(net_total_msg_len);
+        bool batch = (prefix & BATCH_FRAME_FLAG) != 0;
+        uint32_t total_payload_len = prefix & ~BATCH_FRAME_FLAG;
+
+        if (total_payload_len == 0 || total_payload_len > (batch ? MAX_BATCH_FRAME_SIZE : 4 * BUFFER_SIZE))
+        {
+            std::cerr << "ERROR: Invalid payload length: " << total_payload_len << ". Clearing buffer." << std::endl;
+            data_buffer.reset();
+            break;
+        }
+
+        size_t total_packet_len = length_prefix_size + total_payload_len;
+
+        if (data_buffer.bytes_available() < total_packet_len)
+        {
+            break;
+        }
+
+        std::vector<char> full_packet_data(total_packet_len);
+        size_t actual_read = data_buffer.read(full_packet_data.data(), total_packet_len);
+
+        if (actual_read != total_packet_len)
+        {
+            std::cerr << "ERROR: Failed reading full packet. Expected " << total_packet_len << " got " << actual_read << ". Resetting buffer." << std::endl;
+            data_buffer.reset();
+            break;
+        }
+
+        const char *payload_data_ptr = full_packet_data.data() + length_prefix_size;
+        if (batch)
+        {
+            process_batch_frame(payload_data_ptr, total_payload_len, out, tracker, handler, arrival_ns, dictionary);
+            continue;
+        }
+        process_plain_frame(payload_data_ptr, total_payload_len, out, tracker, handler, arrival_ns);
+    }
+}
+
+// Parses one plain forward frame field by field, checking every length
+// against what is left of the payload.
+static void process_plain_frame(const char *payload_data_ptr, size_t total_payload_len, std::ostream &out,
+                                LatencyTracker *tracker, ReceivedMessageHandler *handler, int64_t arrival_ns)
+{
+    size_t current_offset = 0;
+    std::string sender_ip_str = "INVALID_IP";
+    uint16_t sender_port = 0;
+    std::string topic;
+    uint8_t udp_type = 255;
+    uint16_t content_len = 0;
+    const char *content_data_ptr = nullptr;
+
+    try
+    {
+        if (current_offset + sizeof(uint32_t) > total_payload_len)
+        {
+            throw std::runtime_error("Payload too small for IP");
+        }
+
+        uint32_t net_ip;
+        memcpy(&net_ip, payload_data_ptr + current_offset, sizeof(uint32_t));
+        current_offset += sizeof(uint32_t);
+        struct in_addr ip_addr;
+        ip_addr.s_addr = net_ip;
+        char ip_buffer[INET_ADDRSTRLEN];
+
+        if (inet_ntop(AF_INET, &ip_addr, ip_buffer, INET_ADDRSTRLEN))
+        {
+            sender_ip_str = ip_buffer;
+        }
+
+        if (current_offset + sizeof(uint16_t) > total_payload_len)
+        {
+            throw std::runtime_error("Payload too small for Port");
+        }
+
+        uint16_t net_port;
+        memcpy(&net_port, payload_data_ptr + current_offset, sizeof(uint16_t));
+        sender_port = ntohs(net_port);
+        current_offset += sizeof(uint16_t);
+
+        if (current_offset + sizeof(uint8_t) > total_payload_len)
+        {
+            throw std::runtime_error("Payload too small for Topic Len");
+        }
+
+        uint8_t topic_len;
+        memcpy(&topic_len, payload_data_ptr + current_offset, sizeof(uint8_t));
+        current_offset += sizeof(uint8_t);
+
+        if (topic_len > total_payload_len - current_offset)
+        {
+            throw std::runtime_error("Topic length exceeds remaining payload");
+        }
+
+        topic.assign(payload_data_ptr + current_offset, topic_len);
+        current_offset += topic_len;
+
+        if (current_offset + sizeof(uint8_t) > total_payload_len)
+        {
+            throw std::runtime_error("Payload too small for UDP Type");
+        }
+
+        memcpy(&udp_type, payload_data_ptr + current_offset, sizeof(uint8_t));
+        current_offset += sizeof(uint8_t);
+
+        if (current_offset + sizeof(uint16_t) > total_payload_len)
+        {
+            throw std::runtime_error("Payload too small for Content Len");
+        }
+
+        uint16_t net_content_len;
+        memcpy(&net_content_len, payload_data_ptr + current_offset, sizeof(uint16_t));
+        content_len = ntohs(net_content_len);
+        current_offset += sizeof(uint16_t);
+
+        if (content_len > total_payload_len - current_offset)
+        {
+            throw std::runtime_error("Content length exceeds remaining payload");
+        }
+        
+        content_data_ptr = payload_data_ptr + current_offset;
+
+        if (handler)
+        {
+            handler->handle(sender_ip_str.c_str(), sender_port, topic, udp_type, content_data_ptr, content_len);
+            return;
+        }
+        if (tracker)
+        {
+            tracker->record(topic, content_data_ptr, content_len, arrival_ns);
+            return;
+        }
+
+        std::string formatted_output = format_received_message(sender_ip_str, sender_port, topic, udp_type, content_data_ptr, content_len);
+        out << formatted_output << std::endl;
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cerr << "ERROR: Deserialization failed - " << e.what() << ". Skipping packet." << std::endl;
+    }
+}
+
+// Decodes every entry of a batch frame in one pass over the frame. Sender and
+// topic are kept from the entry that last carried or named them.
+static void process_batch_frame(const char *payload, size_t payload_len, std::ostream &out, LatencyTracker *tracker,
+                                ReceivedMessageHandler *handler, int64_t arrival_ns, WireDictionaryTable &dictionary)
+{
+    const size_t sender_size = sizeof(uint32_t) + sizeof(uint16_t);
+    char ip_buffer[INET_ADDRSTRLEN] = "INVALID_IP";
+    uint16_t sender_port = 0;
+    std::string topic;
+    bool have_sender = false;
+    bool have_topic = false;
+    size_t offset = 0;
+
+    try
+    {
+        while (offset < payload_len)
+        {
+            if (payload_len - offset < sizeof(uint16_t))
+            {
+                throw std::runtime_error("Batch frame too small for entry length");
+            }
+            uint16_t net_entry_len;
+            memcpy(&net_entry_len, payload + offset, sizeof(uint16_t));
+            size_t entry_len = ntohs(net_entry_len);
+            offset += sizeof(uint16_t);
+            if (entry_len == 0 || entry_len > payload_len - offset)
+            {
+                throw std::runtime_error("Batch entry length exceeds frame");
+            }
+            const char *entry = payload + offset;
+            const char *entry_end = entry + entry_len;
+            offset += entry_len;
+
+            uint8_t flags = static_cast<uint8_t>(*entry++);
+            if (flags & BATCH_SENDER_ID)
+            {
+                uint32_t id = read_varint(entry, entry_end);
+                if (id >= dictionary.senders.size())
+                {
+                    throw std::runtime_error("Batch entry names an undefined sender");
+                }
+                strcpy(ip_buffer, dictionary.senders[id].first.c_str());
+                sender_port = dictionary.senders[id].second;
+                have_sender = true;
+            }
+            else if (!(flags & BATCH_SAME_SENDER))
+            {
+                if (static_cast<size_t>(entry_end - entry) < sender_size)
+                {
+                    throw std::runtime_error("Batch entry too small for sender");
+                }
+                struct in_addr ip_addr;
+                memcpy(&ip_addr.s_addr, entry, sizeof(uint32_t));
+                if (!inet_ntop(AF_INET, &ip_addr, ip_buffer, INET_ADDRSTRLEN))
+                {
+                    strcpy(ip_buffer, "INVALID_IP");
+                }
+                uint16_t net_port;
+                memcpy(&net_port, entry + sizeof(uint32_t), sizeof(uint16_t));
+                sender_port = ntohs(net_port);
+                entry += sender_size;
+                have_sender = true;
+                if (flags & BATCH_DEFINE_SENDER)
+                {
+                    dictionary.senders.emplace_back(ip_buffer, sender_port);
+                }
+            }
+            else if (!have_sender)
+            {
+                throw std::runtime_error("Batch entry repeats a missing sender");
+            }
+
+            if (flags & BATCH_TOPIC_ID)
+            {
+                uint32_t id = read_varint(entry, entry_end);
+                if (id >= dictionary.topics.size())
+                {
+                    throw std::runtime_error("Batch entry names an undefined topic");
+                }
+                topic = dictionary.topics[id];
+                have_topic = true;
+            }
+            else if (!(flags & BATCH_SAME_TOPIC))
+            {
+                if (entry == entry_end || static_cast<uint8_t>(*entry) > entry_end - entry - 1)
+                {
+                    throw std::runtime_error("Batch entry topic length exceeds entry");
+                }
+                uint8_t topic_len = static_cast<uint8_t>(*entry++);
+                topic.assign(entry, topic_len);
+                entry += topic_len;
+                have_topic = true;
+                if (flags & BATCH_DEFINE_TOPIC)
+                {
+                    dictionary.topics.push_back(topic);
+                }
+            }
+            else if (!have_topic)
+            {
+                throw std::runtime_error("Batch entry repeats a missing topic");
+            }
+
+            if (entry == entry_end)
+            {
+                throw std::runtime_error("Batch entry too small for UDP Type");
+            }
+            uint8_t udp_type = static_cast<uint8_t>(*entry++);
+            uint16_t content_len = static_cast<uint16_t>(entry_end - entry);
+            if (handler)
+            {
+                handler->handle(ip_buffer, sender_port, topic, udp_type, entry, content_len);
+                continue;
+            }
+            if (tracker)
+            {
+                tracker->record(topic, entry, content_len, arrival_ns);
+                continue;
+            }
+            out << format_received_message(ip_buffer, sender_port, topic, udp_type, entry, content_len) << '\n';
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cerr << "ERROR: Deserialization failed - " << e.what() << ". Skipping rest of batch." << std::endl;
+    }
+    out.flush();
+}
+
+static uint32_t read_varint(const char *&entry, const char *entry_end)
+{
+    uint32_t value = 0;
+    for (int shift = 0; shift < 32; shift += 7)
+    {
+        if (entry == entry_end)
+        {
+            throw std::runtime_error("Batch entry too small for dictionary ID");
+        }
+        uint8_t byte = static_cast<uint8_t>(*entry++);
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return value;
+        }
+    }
+    throw std::runtime_error("Dictionary ID too long");
+}
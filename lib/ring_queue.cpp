@@ -0,0 +1,59 @@
+#include "ring_queue.h"
+#include "common.h"
+#include <sys/eventfd.h>
+
+EventNotifier::EventNotifier() : fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), armed(false)
+{
+    if (fd < 0)
+    {
+        error("ERROR creating eventfd");
+    }
+}
+
+EventNotifier::~EventNotifier()
+{
+    close(fd);
+}
+
+void EventNotifier::arm()
+{
+    armed.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void EventNotifier::notify()
+{
+    // Orders the producer's queue store before the armed check; pairs with
+    // the fence in arm() so a consumer going to sleep is never missed.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (armed.load(std::memory_order_relaxed) && armed.exchange(false, std::memory_order_acq_rel))
+    {
+        wake();
+    }
+}
+
+void EventNotifier::wake()
+{
+    uint64_t one = 1;
+    while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR)
+    {
+    }
+}
+
+void EventNotifier::wait()
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+    {
+    }
+    drain();
+}
+
+void EventNotifier::drain()
+{
+    uint64_t value;
+    while (read(fd, &value, sizeof(value)) < 0 && errno == EINTR)
+    {
+    }
+    armed.store(false, std::memory_order_relaxed);
+}
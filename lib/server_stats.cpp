@@ -0,0 +1,107 @@
+#include "server_stats.h"
+#include <algorithm>
+#include <cstring>
+
+const char *const STAT_NAMES[STAT_COUNT] = {
+    "datagrams_received",
+    "datagrams_parsed",
+    "datagrams_rejected",
+    "messages_matched",
+    "messages_filtered",
+    "messages_suppressed",
+    "bytes_sent",
+    "send_failures",
+    "sf_enqueued",
+    "sf_replayed",
+    "connections_accepted",
+    "connections_refused",
+    "disconnections",
+};
+
+const char *const GAUGE_NAMES[GAUGE_COUNT] = {
+    "subscribers_connected",
+    "sf_messages",
+    "sf_bytes",
+    "queued_bytes",
+};
+
+static uint64_t hash_topic(const char *topic, size_t len);
+
+void ServerStats::accumulate_into(uint64_t (&totals)[STAT_COUNT]) const
+{
+    for (int i = 0; i < STAT_COUNT; ++i)
+    {
+        totals[i] += counters[i].get();
+    }
+}
+
+void ServerStats::accumulate_gauges_into(uint64_t (&totals)[GAUGE_COUNT]) const
+{
+    for (int i = 0; i < GAUGE_COUNT; ++i)
+    {
+        totals[i] += gauges[i].get();
+    }
+}
+
+TopicCounters::TopicCounters() : slots(new Slot[TOPIC_STATS_SLOTS])
+{
+}
+
+void TopicCounters::record(const char *topic)
+{
+    size_t len = strnlen(topic, TOPIC_SIZE);
+    uint64_t hash = hash_topic(topic, len);
+    for (size_t probe = 0; probe < TOPIC_STATS_MAX_PROBE; ++probe)
+    {
+        Slot &slot = slots[(hash + probe) % TOPIC_STATS_SLOTS];
+        uint64_t slot_hash = slot.hash.load(std::memory_order_relaxed);
+        if (slot_hash == 0)
+        {
+            memcpy(slot.topic, topic, len);
+            slot.topic[len] = '\0';
+            slot.count.add();
+            // Publish the name before the hash so readers never see a half
+            // written slot.
+            slot.hash.store(hash, std::memory_order_release);
+            used.add();
+            return;
+        }
+        if (slot_hash == hash && strncmp(slot.topic, topic, TOPIC_SIZE) == 0)
+        {
+            slot.count.add();
+            return;
+        }
+    }
+    overflow.add();
+}
+
+std::vector<std::pair<std::string, uint64_t>> TopicCounters::top(size_t n) const
+{
+    std::vector<std::pair<std::string, uint64_t>> result;
+    for (size_t i = 0; i < TOPIC_STATS_SLOTS; ++i)
+    {
+        if (slots[i].hash.load(std::memory_order_acquire) != 0)
+        {
+            result.emplace_back(slots[i].topic, slots[i].count.get());
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const std::pair<std::string, uint64_t> &a, const std::pair<std::string, uint64_t> &b)
+              { return a.second != b.second ? a.second > b.second : a.first < b.first; });
+    if (result.size() > n)
+    {
+        result.resize(n);
+    }
+    return result;
+}
+
+static uint64_t hash_topic(const char *topic, size_t len)
+{
+    // FNV-1a; zero marks an empty slot, so it is never returned.
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash ^= static_cast<unsigned char>(topic[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash | 1;
+}
@@ -0,0 +1,291 @@
+#include "shm_ring.h"
+#include <chrono>
+#include <climits>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+
+#define SHM_RECORD_PAD 0x1u
+
+// Every record starts 16-byte aligned, so the space left before the end of
+// the ring always fits at least a padding header.
+struct ShmRecord
+{
+    uint32_t len;
+    uint32_t flags;
+    uint64_t mask;
+};
+
+static_assert(sizeof(ShmRecord) == SHM_RECORD_HEADER_SIZE, "record header layout");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared counters must be lock-free");
+
+static size_t record_size(size_t len);
+static long futex(std::atomic<uint32_t> *addr, int op, uint32_t value, const struct timespec *timeout);
+
+bool valid_shm_capacity(size_t capacity)
+{
+    return capacity >= SHM_RING_MIN_BYTES && capacity <= SHM_RING_MAX_BYTES && (capacity & (capacity - 1)) == 0;
+}
+
+ShmRing::~ShmRing()
+{
+    close();
+}
+
+bool ShmRing::create(const std::string &path, size_t capacity)
+{
+    if (!valid_shm_capacity(capacity))
+    {
+        return false;
+    }
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+    {
+        return false;
+    }
+    size_t bytes = sizeof(ShmRingHeader) + capacity;
+    if (ftruncate(fd, static_cast<off_t>(bytes)) < 0 || !map_file(fd, bytes))
+    {
+        ::close(fd);
+        unlink(path.c_str());
+        return false;
+    }
+    ::close(fd);
+    owned_path = path;
+    // The file starts zeroed; the magic goes in last so a reader never
+    // accepts a half-initialised header.
+    header->slot_count = SHM_RING_SLOTS;
+    header->capacity = capacity;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SHM_RING_MAGIC;
+    return true;
+}
+
+bool ShmRing::attach(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    bool mapped = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) > sizeof(ShmRingHeader) &&
+                  map_file(fd, static_cast<size_t>(st.st_size));
+    ::close(fd);
+    if (!mapped)
+    {
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->magic != SHM_RING_MAGIC || header->slot_count != SHM_RING_SLOTS ||
+        !valid_shm_capacity(header->capacity) || sizeof(ShmRingHeader) + header->capacity != mapped_bytes)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool ShmRing::map_file(int fd, size_t bytes)
+{
+    void *mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+    header = static_cast<ShmRingHeader *>(mapping);
+    data = static_cast<char *>(mapping) + sizeof(ShmRingHeader);
+    mapped_bytes = bytes;
+    return true;
+}
+
+void ShmRing::close()
+{
+    if (header)
+    {
+        munmap(header, mapped_bytes);
+        header = nullptr;
+        data = nullptr;
+        mapped_bytes = 0;
+    }
+    if (!owned_path.empty())
+    {
+        unlink(owned_path.c_str());
+        owned_path.clear();
+    }
+}
+
+bool ShmRing::publish(const char *frame, size_t len, uint64_t mask)
+{
+    if (len > SHM_MAX_FRAME_SIZE)
+    {
+        return false;
+    }
+    uint64_t capacity = header->capacity;
+    uint64_t pos = header->write_pos.load(std::memory_order_relaxed);
+    size_t total = record_size(len);
+    uint64_t offset = pos & (capacity - 1);
+    if (capacity - offset < total)
+    {
+        ShmRecord pad = {0, SHM_RECORD_PAD, 0};
+        memcpy(data + offset, &pad, sizeof(pad));
+        pos += capacity - offset;
+        offset = 0;
+    }
+    ShmRecord record = {static_cast<uint32_t>(len), 0, mask};
+    memcpy(data + offset, &record, sizeof(record));
+    memcpy(data + offset + sizeof(record), frame, len);
+
+    // Pairs with the reader announcing itself in `waiters` before it checks
+    // write_pos one last time and sleeps.
+    header->write_pos.store(pos + total, std::memory_order_seq_cst);
+    if (header->waiters.load(std::memory_order_seq_cst) > 0)
+    {
+        header->wake_seq.fetch_add(1, std::memory_order_seq_cst);
+        futex(&header->wake_seq, FUTEX_WAKE, INT_MAX, nullptr);
+    }
+    return true;
+}
+
+// The slot is written under a generation seqlock: odd while it changes, even
+// once it is stable again.
+int ShmRing::assign_slot(const std::string &id)
+{
+    for (int index = 0; index < SHM_RING_SLOTS; ++index)
+    {
+        if (slot_used[index])
+        {
+            continue;
+        }
+        slot_used[index] = true;
+        ShmSlot &entry = header->slots[index];
+        entry.generation.fetch_add(1, std::memory_order_acq_rel);
+        memset(entry.id, 0, sizeof(entry.id));
+        strncpy(entry.id, id.c_str(), MAX_ID_SIZE);
+        entry.start_pos.store(header->write_pos.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        entry.generation.fetch_add(1, std::memory_order_release);
+        return index;
+    }
+    return -1;
+}
+
+void ShmRing::release_slot(int index)
+{
+    if (index < 0 || index >= SHM_RING_SLOTS || !slot_used[index])
+    {
+        return;
+    }
+    slot_used[index] = false;
+    ShmSlot &entry = header->slots[index];
+    entry.generation.fetch_add(1, std::memory_order_acq_rel);
+    memset(entry.id, 0, sizeof(entry.id));
+    entry.generation.fetch_add(1, std::memory_order_release);
+}
+
+bool ShmRing::wait_for_slot(const std::string &id, int timeout_ms)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        for (int index = 0; index < SHM_RING_SLOTS; ++index)
+        {
+            ShmSlot &entry = header->slots[index];
+            uint64_t before = entry.generation.load(std::memory_order_acquire);
+            if (before == 0 || before % 2 != 0)
+            {
+                continue;
+            }
+            char slot_id[MAX_ID_SIZE + 1];
+            memcpy(slot_id, entry.id, sizeof(slot_id));
+            uint64_t start = entry.start_pos.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (entry.generation.load(std::memory_order_relaxed) != before)
+            {
+                continue;
+            }
+            slot_id[MAX_ID_SIZE] = '\0';
+            if (id == slot_id)
+            {
+                slot = index;
+                read_pos = start;
+                return true;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+size_t ShmRing::read(std::vector<char> &frames)
+{
+    uint64_t capacity = header->capacity;
+    uint64_t mine = uint64_t(1) << slot;
+    uint64_t write = header->write_pos.load(std::memory_order_acquire);
+    size_t taken = 0;
+    while (read_pos != write)
+    {
+        if (write - read_pos > capacity - SHM_REWRITE_MARGIN)
+        {
+            overrun_count++;
+            read_pos = write;
+            break;
+        }
+        uint64_t offset = read_pos & (capacity - 1);
+        ShmRecord record;
+        memcpy(&record, data + offset, sizeof(record));
+        size_t kept = frames.size();
+        uint64_t advance = capacity - offset;
+        bool for_us = false;
+        if (!(record.flags & SHM_RECORD_PAD) && record.len <= SHM_MAX_FRAME_SIZE)
+        {
+            advance = record_size(record.len);
+            for_us = (record.mask & mine) != 0;
+            if (for_us)
+            {
+                const char *frame = data + offset + sizeof(record);
+                frames.insert(frames.end(), frame, frame + record.len);
+            }
+        }
+
+        // Seqlock-style check: had the writer come around to this record
+        // while it was copied, write_pos now shows it.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t latest = header->write_pos.load(std::memory_order_relaxed);
+        if (latest - read_pos > capacity - SHM_REWRITE_MARGIN)
+        {
+            frames.resize(kept);
+            overrun_count++;
+            read_pos = latest;
+            break;
+        }
+        read_pos += advance;
+        taken += for_us;
+    }
+    return taken;
+}
+
+void ShmRing::wait(int timeout_ms)
+{
+    header->waiters.fetch_add(1, std::memory_order_seq_cst);
+    uint32_t seq = header->wake_seq.load(std::memory_order_seq_cst);
+    if (header->write_pos.load(std::memory_order_seq_cst) == read_pos)
+    {
+        struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+        futex(&header->wake_seq, FUTEX_WAIT, seq, &timeout);
+    }
+    header->waiters.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+static size_t record_size(size_t len)
+{
+    return (SHM_RECORD_HEADER_SIZE + len + 15) & ~static_cast<size_t>(15);
+}
+
+// Not FUTEX_PRIVATE: the word lives in a mapping shared between processes.
+static long futex(std::atomic<uint32_t> *addr, int op, uint32_t value, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), op, value, timeout, nullptr, 0);
+}
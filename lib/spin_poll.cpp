@@ -0,0 +1,57 @@
+#include "spin_poll.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+using Clock = std::chrono::steady_clock;
+
+int spin_poll(struct pollfd *fds, nfds_t nfds, int timeout, SpinPolicy &policy)
+{
+    if (policy.budget_ns == 0 || timeout != -1)
+    {
+        return poll(fds, nfds, timeout);
+    }
+
+    auto deadline = Clock::now() + std::chrono::nanoseconds(policy.window_ns);
+    do
+    {
+        int ready = poll(fds, nfds, 0);
+        if (ready != 0)
+        {
+            policy.window_ns = policy.budget_ns;
+            policy.hits++;
+            return ready;
+        }
+    } while (Clock::now() < deadline);
+
+    policy.window_ns = std::max(policy.window_ns / 2, policy.budget_ns / SPIN_SHRINK_FLOOR);
+    policy.blocks++;
+    return poll(fds, nfds, -1);
+}
+
+bool enable_busy_poll(int socket, int usec)
+{
+#ifdef SO_BUSY_POLL
+    if (setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0)
+    {
+        perror("WARN: setsockopt SO_BUSY_POLL failed");
+        return false;
+    }
+    return true;
+#else
+    (void)socket;
+    (void)usec;
+    return false;
+#endif
+}
+
+bool pin_thread_to_cpu(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
@@ -0,0 +1,166 @@
+#include "stage_latency.h"
+#include <chrono>
+#include <iomanip>
+#include <thread>
+
+#define TSC_CALIBRATION_MIN_NS 10000000
+
+// Histogram bounds exported to Prometheus, in nanoseconds.
+static const uint64_t PROMETHEUS_BOUNDS_NS[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+                                                250000, 500000, 1000000, 2500000, 5000000, 10000000, 100000000, 1000000000};
+
+const char *const STAGE_NAMES[STAGE_COUNT] = {
+    "receive",
+    "parse",
+    "match",
+    "serialize",
+    "queue",
+    "send",
+};
+
+using Clock = std::chrono::steady_clock;
+
+static const Clock::time_point calibration_start = Clock::now();
+static const uint64_t calibration_start_tsc = read_tsc();
+
+double tsc_ns_per_tick()
+{
+    auto elapsed = Clock::now() - calibration_start;
+    if (elapsed < std::chrono::nanoseconds(TSC_CALIBRATION_MIN_NS))
+    {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(TSC_CALIBRATION_MIN_NS) - elapsed);
+    }
+    uint64_t ticks = read_tsc() - calibration_start_tsc;
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - calibration_start).count();
+    return ticks > 0 ? ns / ticks : 1.0;
+}
+
+uint64_t latency_bucket_floor(size_t bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    int msb = static_cast<int>(bucket / LATENCY_SUB_BUCKETS) + LATENCY_SUB_BITS - 1;
+    uint64_t sub = bucket % LATENCY_SUB_BUCKETS;
+    return (LATENCY_SUB_BUCKETS + sub) << (msb - LATENCY_SUB_BITS);
+}
+
+void HistogramSnapshot::subtract(const HistogramSnapshot &other)
+{
+    for (size_t i = 0; i < LATENCY_BUCKETS; ++i)
+    {
+        counts[i] -= other.counts[i];
+    }
+    total -= other.total;
+    sum -= other.sum;
+}
+
+uint64_t HistogramSnapshot::percentile(double fraction) const
+{
+    if (total == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(fraction * total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; ++i)
+    {
+        seen += counts[i];
+        if (seen > rank)
+        {
+            return latency_bucket_floor(i);
+        }
+    }
+    return max();
+}
+
+uint64_t HistogramSnapshot::max() const
+{
+    for (size_t i = LATENCY_BUCKETS; i > 0; --i)
+    {
+        if (counts[i - 1] > 0)
+        {
+            return i < LATENCY_BUCKETS ? latency_bucket_floor(i) - 1 : latency_bucket_floor(i - 1);
+        }
+    }
+    return 0;
+}
+
+uint64_t HistogramSnapshot::count_at_most(uint64_t ticks) const
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i + 1 < LATENCY_BUCKETS && latency_bucket_floor(i + 1) - 1 <= ticks; ++i)
+    {
+        count += counts[i];
+    }
+    return count;
+}
+
+void LatencyReport::subtract(const LatencyReport &other)
+{
+    for (int i = 0; i < STAGE_COUNT; ++i)
+    {
+        stages[i].subtract(other.stages[i]);
+    }
+}
+
+void LatencyHistogram::accumulate_into(HistogramSnapshot &snapshot) const
+{
+    for (size_t i = 0; i < LATENCY_BUCKETS; ++i)
+    {
+        uint64_t count = counts[i].get();
+        snapshot.counts[i] += count;
+        snapshot.total += count;
+    }
+    snapshot.sum += sum.get();
+}
+
+void StageLatency::accumulate_into(LatencyReport &report) const
+{
+#ifdef STAGE_LATENCY
+    for (int i = 0; i < STAGE_COUNT; ++i)
+    {
+        stages[i].accumulate_into(report.stages[i]);
+    }
+#else
+    (void)report;
+#endif
+}
+
+void print_stage_latency(std::ostream &out, const LatencyReport &report)
+{
+    double ns_per_tick = tsc_ns_per_tick();
+    auto ns = [ns_per_tick](uint64_t ticks)
+    { return static_cast<uint64_t>(ticks * ns_per_tick); };
+
+    out << std::left << std::setw(12) << "stage" << std::right << std::setw(12) << "count" << std::setw(10) << "mean_ns"
+        << std::setw(10) << "p50_ns" << std::setw(10) << "p90_ns" << std::setw(10) << "p99_ns" << std::setw(10) << "p999_ns"
+        << std::setw(12) << "max_ns" << std::endl;
+    for (int i = 0; i < STAGE_COUNT; ++i)
+    {
+        const HistogramSnapshot &h = report.stages[i];
+        out << std::left << std::setw(12) << STAGE_NAMES[i] << std::right << std::setw(12) << h.total
+            << std::setw(10) << (h.total > 0 ? ns(h.sum / h.total) : 0) << std::setw(10) << ns(h.percentile(0.5))
+            << std::setw(10) << ns(h.percentile(0.9)) << std::setw(10) << ns(h.percentile(0.99))
+            << std::setw(10) << ns(h.percentile(0.999)) << std::setw(12) << ns(h.max()) << std::endl;
+    }
+}
+
+void print_prometheus_latency(std::ostream &out, const char *name, const LatencyReport &report)
+{
+    double ns_per_tick = tsc_ns_per_tick();
+    out << "# TYPE " << name << " histogram\n";
+    for (int i = 0; i < STAGE_COUNT; ++i)
+    {
+        const HistogramSnapshot &h = report.stages[i];
+        for (uint64_t bound_ns : PROMETHEUS_BOUNDS_NS)
+        {
+            out << name << "_bucket{stage=\"" << STAGE_NAMES[i] << "\",le=\"" << bound_ns / 1e9 << "\"} "
+                << h.count_at_most(static_cast<uint64_t>(bound_ns / ns_per_tick)) << "\n";
+        }
+        out << name << "_bucket{stage=\"" << STAGE_NAMES[i] << "\",le=\"+Inf\"} " << h.total << "\n";
+        out << name << "_sum{stage=\"" << STAGE_NAMES[i] << "\"} " << h.sum * ns_per_tick / 1e9 << "\n";
+        out << name << "_count{stage=\"" << STAGE_NAMES[i] << "\"} " << h.total << "\n";
+    }
+}
@@ -0,0 +1,235 @@
+#include "subscription_index.h"
+#include "topic_match.h"
+#include <stdexcept>
+
+size_t SubscriptionSnapshot::match(const std::vector<std::string> &t_segs, const UdpMessage &msg,
+                                   std::vector<IndexMatch> &out) const
+{
+    size_t filtered = 0;
+    for (const IndexedSubscriber *sub : subscribers)
+    {
+        bool rejected = false;
+        for (size_t i = 0; i < sub->patterns.size(); ++i)
+        {
+            if (segments_match(t_segs, sub->patterns[i]))
+            {
+                if (!content_filter_accepts(sub->filters[i], msg.type, msg.content, msg.content_len))
+                {
+                    rejected = true;
+                    continue;
+                }
+                rejected = false;
+                out.push_back({sub, sub->sf[i]});
+                break;
+            }
+        }
+        filtered += rejected;
+    }
+    return filtered;
+}
+
+SubscriptionIndex::SubscriptionIndex()
+    : current(new SubscriptionSnapshot()), global_epoch(1), published_versions(0), reclaimed_snapshots(0)
+{
+}
+
+SubscriptionIndex::~SubscriptionIndex()
+{
+    const SubscriptionSnapshot *snapshot = current.load();
+    for (const IndexedSubscriber *sub : snapshot->subscribers)
+    {
+        delete sub;
+    }
+    delete snapshot;
+    for (Retired &item : retired)
+    {
+        for (const IndexedSubscriber *sub : item.entries)
+        {
+            delete sub;
+        }
+        delete item.snapshot;
+    }
+}
+
+int SubscriptionIndex::register_reader()
+{
+    for (int i = 0; i < MAX_INDEX_READERS; ++i)
+    {
+        bool expected = false;
+        if (readers[i].used.compare_exchange_strong(expected, true))
+        {
+            return i;
+        }
+    }
+    throw std::runtime_error("SubscriptionIndex: too many readers");
+}
+
+void SubscriptionIndex::unregister_reader(int slot)
+{
+    readers[slot].epoch.store(0, std::memory_order_release);
+    readers[slot].used.store(false, std::memory_order_release);
+}
+
+const SubscriptionSnapshot *SubscriptionIndex::read_lock(int slot)
+{
+    // Announce the epoch before loading the snapshot; the writer only frees a
+    // snapshot retired before the oldest announced epoch.
+    readers[slot].epoch.store(global_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    return current.load(std::memory_order_seq_cst);
+}
+
+void SubscriptionIndex::read_unlock(int slot)
+{
+    readers[slot].epoch.store(0, std::memory_order_release);
+}
+
+SubscriptionIndex::WriterEntry &SubscriptionIndex::entry_for(const std::string &id)
+{
+    auto it = entries.find(id);
+    if (it == entries.end())
+    {
+        it = entries.emplace(id, WriterEntry()).first;
+        it->second.position = entries.size() - 1;
+    }
+    if (!it->second.dirty)
+    {
+        it->second.dirty = true;
+        dirty_entries.push_back(it);
+    }
+    return it->second;
+}
+
+void SubscriptionIndex::subscribe(const std::string &id, const std::string &pattern, bool sf, const ContentFilter &filter)
+{
+    WriterEntry &entry = entry_for(id);
+    entry.topics[pattern] = sf;
+    if (filter.op == FILTER_ALL)
+    {
+        entry.filters.erase(pattern);
+    }
+    else
+    {
+        entry.filters[pattern] = filter;
+    }
+}
+
+void SubscriptionIndex::unsubscribe(const std::string &id, const std::string &pattern)
+{
+    WriterEntry &entry = entry_for(id);
+    entry.topics.erase(pattern);
+    entry.filters.erase(pattern);
+}
+
+void SubscriptionIndex::set_connection(const std::string &id, int socket, uint64_t connection)
+{
+    WriterEntry &entry = entry_for(id);
+    entry.socket = socket;
+    entry.connection = connection;
+}
+
+bool SubscriptionIndex::publish()
+{
+    if (dirty_entries.empty())
+    {
+        reclaim();
+        return false;
+    }
+
+    const SubscriptionSnapshot *old_snapshot = current.load(std::memory_order_relaxed);
+    SubscriptionSnapshot *snapshot = new SubscriptionSnapshot(*old_snapshot);
+    snapshot->version = old_snapshot->version + 1;
+
+    Retired item;
+    item.snapshot = old_snapshot;
+    for (auto it : dirty_entries)
+    {
+        WriterEntry &entry = it->second;
+        IndexedSubscriber *sub = new IndexedSubscriber();
+        sub->id = it->first;
+        sub->socket = entry.socket;
+        sub->connection = entry.connection;
+        // Covered patterns never take a message, so the snapshot leaves them out.
+        std::vector<CoverageEntry> coverage;
+        for (const auto &topic : entry.topics)
+        {
+            CoverageEntry pattern;
+            pattern.segments = split_topic(topic.first);
+            pattern.sf = topic.second;
+            pattern.filtered = entry.filters.count(topic.first) > 0;
+            pattern.plain = !pattern.filtered;
+            coverage.push_back(std::move(pattern));
+        }
+        std::vector<bool> covered = find_covered_patterns(coverage);
+        size_t index = 0;
+        for (const auto &topic : entry.topics)
+        {
+            if (covered[index])
+            {
+                index++;
+                continue;
+            }
+            sub->patterns.push_back(std::move(coverage[index++].segments));
+            sub->sf.push_back(topic.second);
+            auto filter_it = entry.filters.find(topic.first);
+            sub->filters.push_back(filter_it != entry.filters.end() ? filter_it->second : ContentFilter());
+        }
+
+        if (entry.position < snapshot->subscribers.size())
+        {
+            item.entries.push_back(snapshot->subscribers[entry.position]);
+            snapshot->subscribers[entry.position] = sub;
+        }
+        else
+        {
+            snapshot->subscribers.push_back(sub);
+        }
+        entry.dirty = false;
+    }
+    dirty_entries.clear();
+
+    current.store(snapshot, std::memory_order_seq_cst);
+    item.epoch = global_epoch.fetch_add(1, std::memory_order_seq_cst);
+    retired.push_back(std::move(item));
+    published_versions++;
+
+    reclaim();
+    return true;
+}
+
+void SubscriptionIndex::reclaim()
+{
+    if (retired.empty())
+    {
+        return;
+    }
+
+    uint64_t oldest_active = UINT64_MAX;
+    for (ReaderSlot &reader : readers)
+    {
+        uint64_t epoch = reader.epoch.load(std::memory_order_seq_cst);
+        if (epoch != 0 && epoch < oldest_active)
+        {
+            oldest_active = epoch;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); ++i)
+    {
+        Retired &item = retired[i];
+        if (item.epoch < oldest_active)
+        {
+            for (const IndexedSubscriber *sub : item.entries)
+            {
+                delete sub;
+            }
+            delete item.snapshot;
+            reclaimed_snapshots++;
+        }
+        else
+        {
+            retired[kept++] = std::move(item);
+        }
+    }
+    retired.resize(kept);
+}
@@ -0,0 +1,259 @@
+#include "topic_history.h"
+#include "topic_match.h"
+#include <algorithm>
+#include <utility>
+
+// Slots are counted with their ring, so an entry adds its packet and the
+// reference in the eviction queue. A trie node also costs its slot in the
+// parent's map.
+#define HISTORY_ENTRY_OVERHEAD sizeof(EvictionRef)
+#define HISTORY_NODE_OVERHEAD (sizeof(Node) + 64)
+
+TopicHistory::TopicHistory(size_t depth, size_t memory_limit)
+    : depth(depth), memory_limit(memory_limit), memory_used(0), entry_count(0), topic_count(0), next_seq(0)
+{
+}
+
+TopicHistory::~TopicHistory()
+{
+    // Detached rings are only reachable through their remaining references.
+    for (const EvictionRef &ref : insertion_order)
+    {
+        if (ref.ring->detached && --ref.ring->refs == 0)
+        {
+            delete ref.ring;
+        }
+    }
+}
+
+TopicHistory::Ring *TopicHistory::find_or_create_ring(const std::string &topic)
+{
+    Node *node = &root;
+    for (const std::string &seg : split_topic(topic))
+    {
+        std::unique_ptr<Node> &child = node->children[seg];
+        if (!child)
+        {
+            child.reset(new Node());
+            memory_used += HISTORY_NODE_OVERHEAD + seg.size();
+        }
+        node = child.get();
+    }
+    if (!node->ring)
+    {
+        node->ring.reset(new Ring());
+        node->ring->topic = topic;
+        memory_used += sizeof(Ring) + topic.size();
+        topic_count++;
+    }
+    return node->ring.get();
+}
+
+// Doubles the ring up to `depth`, turning it first so the oldest entry sits
+// in slot 0 and the new slots follow the newest one.
+void TopicHistory::grow_ring(Ring &ring)
+{
+    std::rotate(ring.slots.begin(), ring.slots.begin() + ring.head, ring.slots.end());
+    ring.head = 0;
+    size_t capacity = ring.slots.capacity();
+    ring.slots.resize(std::min(depth, std::max<size_t>(1, ring.slots.size() * 2)));
+    memory_used += (ring.slots.capacity() - capacity) * sizeof(Entry);
+}
+
+void TopicHistory::evict_front(Ring &ring)
+{
+    Entry &entry = ring.slots[ring.head];
+    memory_used -= entry.packet.size() + HISTORY_ENTRY_OVERHEAD;
+    std::vector<char>().swap(entry.packet);
+    ring.head = (ring.head + 1) % ring.slots.size();
+    ring.count--;
+    entry_count--;
+}
+
+// Takes an empty ring out of the trie, along with the nodes left with
+// neither a ring nor children. Stale references may still point at the
+// ring, in which case it is freed by the last of them.
+void TopicHistory::remove_ring(Ring &ring)
+{
+    std::vector<std::string> segments = split_topic(ring.topic);
+    std::vector<Node *> path{&root};
+    for (const std::string &seg : segments)
+    {
+        path.push_back(path.back()->children.at(seg).get());
+    }
+    Ring *owned = path.back()->ring.release();
+    memory_used -= sizeof(Ring) + owned->topic.size() + owned->slots.capacity() * sizeof(Entry);
+    topic_count--;
+    if (owned->refs == 0)
+    {
+        delete owned;
+    }
+    else
+    {
+        owned->detached = true;
+        std::vector<Entry>().swap(owned->slots);
+    }
+    for (size_t i = segments.size(); i > 0 && !path[i]->ring && path[i]->children.empty(); --i)
+    {
+        memory_used -= HISTORY_NODE_OVERHEAD + segments[i - 1].size();
+        path[i - 1]->children.erase(segments[i - 1]);
+    }
+}
+
+void TopicHistory::release_ref(Ring *ring)
+{
+    if (--ring->refs == 0 && ring->detached)
+    {
+        delete ring;
+    }
+}
+
+void TopicHistory::enforce_memory_limit()
+{
+    while (memory_used > memory_limit && !insertion_order.empty())
+    {
+        EvictionRef ref = insertion_order.front();
+        insertion_order.pop_front();
+        Ring *ring = ref.ring;
+        if (ring->count > 0 && ring->slots[ring->head].seq == ref.seq)
+        {
+            evict_front(*ring);
+            if (ring->count == 0)
+            {
+                remove_ring(*ring);
+            }
+        }
+        release_ref(ring);
+    }
+
+    // Entries pushed out of a full ring leave stale references behind; drop
+    // them once they outnumber the live ones so the queue stays bounded.
+    if (insertion_order.size() > 2 * entry_count + depth)
+    {
+        std::deque<EvictionRef> live;
+        for (const EvictionRef &ref : insertion_order)
+        {
+            const Ring &ring = *ref.ring;
+            if (ring.count == 0 || ref.seq < ring.slots[ring.head].seq)
+            {
+                release_ref(ref.ring);
+            }
+            else
+            {
+                live.push_back(ref);
+            }
+        }
+        insertion_order.swap(live);
+    }
+}
+
+void TopicHistory::record(const std::string &topic, std::vector<char> &&packet)
+{
+    if (!enabled() || packet.size() + HISTORY_ENTRY_OVERHEAD > memory_limit)
+    {
+        return;
+    }
+
+    Ring &ring = *find_or_create_ring(topic);
+    if (ring.count == depth)
+    {
+        evict_front(ring);
+    }
+    else if (ring.count == ring.slots.size())
+    {
+        grow_ring(ring);
+    }
+
+    Entry &entry = ring.slots[(ring.head + ring.count) % ring.slots.size()];
+    entry.seq = next_seq++;
+    entry.packet = std::move(packet);
+    ring.count++;
+    ring.refs++;
+    entry_count++;
+    memory_used += entry.packet.size() + HISTORY_ENTRY_OVERHEAD;
+    insertion_order.push_back({&ring, entry.seq});
+
+    enforce_memory_limit();
+}
+
+void TopicHistory::collect_matching(const Node &node, const std::vector<std::string> &p_segs, size_t index,
+                                    std::vector<const Ring *> &out) const
+{
+    if (index == p_segs.size())
+    {
+        if (node.ring && node.ring->count > 0)
+        {
+            out.push_back(node.ring.get());
+        }
+        return;
+    }
+
+    const std::string &p_seg = p_segs[index];
+    if (p_seg == "+")
+    {
+        for (const auto &child : node.children)
+        {
+            collect_matching(*child.second, p_segs, index + 1, out);
+        }
+    }
+    else if (p_seg == "*")
+    {
+        collect_matching(node, p_segs, index + 1, out);
+        for (const auto &child : node.children)
+        {
+            collect_matching(*child.second, p_segs, index, out);
+        }
+    }
+    else
+    {
+        auto it = node.children.find(p_seg);
+        if (it != node.children.end())
+        {
+            collect_matching(*it->second, p_segs, index + 1, out);
+        }
+    }
+}
+
+std::vector<const std::vector<char> *> TopicHistory::replay(const std::string &pattern, size_t last_n,
+                                                            uint64_t before_seq) const
+{
+    std::vector<const std::vector<char> *> packets;
+    if (!enabled() || last_n == 0)
+    {
+        return packets;
+    }
+
+    std::vector<const Ring *> rings;
+    collect_matching(root, split_topic(pattern), 0, rings);
+    std::sort(rings.begin(), rings.end());
+    rings.erase(std::unique(rings.begin(), rings.end()), rings.end());
+
+    std::vector<std::pair<uint64_t, const std::vector<char> *>> ordered;
+    for (const Ring *ring : rings)
+    {
+        size_t end = ring->count;
+        while (end > 0 && ring->slots[(ring->head + end - 1) % ring->slots.size()].seq >= before_seq)
+        {
+            end--;
+        }
+        size_t take = std::min(last_n, end);
+        for (size_t i = end - take; i < end; ++i)
+        {
+            const Entry &entry = ring->slots[(ring->head + i) % ring->slots.size()];
+            ordered.push_back({entry.seq, &entry.packet});
+        }
+    }
+
+    // Replay in publication order across all matched topics.
+    std::sort(ordered.begin(), ordered.end(),
+              [](const std::pair<uint64_t, const std::vector<char> *> &a,
+                 const std::pair<uint64_t, const std::vector<char> *> &b)
+              { return a.first < b.first; });
+
+    packets.reserve(ordered.size());
+    for (const auto &item : ordered)
+    {
+        packets.push_back(item.second);
+    }
+    return packets;
+}
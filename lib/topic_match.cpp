@@ -0,0 +1,142 @@
+#include "topic_match.h"
+#include <algorithm>
+#include <sstream>
+
+std::vector<std::string> split_topic(const std::string &topic)
+{
+    std::vector<std::string> segs;
+    std::string segment;
+    std::stringstream ss(topic);
+    while (getline(ss, segment, '/'))
+    {
+        segs.push_back(segment);
+    }
+    return segs;
+}
+
+bool segments_match(const std::vector<std::string> &t_segs, const std::vector<std::string> &p_segs)
+{
+    size_t N = t_segs.size();
+    size_t M = p_segs.size();
+    // Topics are at most TOPIC_SIZE bytes, so short patterns fit the stack rows;
+    // the heap is only touched for pathological pattern lengths.
+    bool stack_rows[2][MATCH_STACK_SEGMENTS + 1];
+    bool *prev_dp = stack_rows[0];
+    bool *curr_dp = stack_rows[1];
+    std::vector<char> heap_rows;
+    if (M > MATCH_STACK_SEGMENTS)
+    {
+        heap_rows.resize(2 * (M + 1));
+        prev_dp = reinterpret_cast<bool *>(heap_rows.data());
+        curr_dp = prev_dp + M + 1;
+    }
+    std::fill(prev_dp, prev_dp + M + 1, false);
+    std::fill(curr_dp, curr_dp + M + 1, false);
+    prev_dp[0] = true;
+    for (size_t j = 1; j <= M; ++j)
+    {
+        if (p_segs[j - 1] == "*")
+        {
+            prev_dp[j] = prev_dp[j - 1];
+        }
+    }
+
+    for (size_t i = 1; i <= N; ++i)
+    {
+        curr_dp[0] = false;
+        const std::string &t_seg = t_segs[i - 1];
+        for (size_t j = 1; j <= M; ++j)
+        {
+            const std::string &p_seg = p_segs[j - 1];
+            if (p_seg == "+")
+            {
+                curr_dp[j] = prev_dp[j - 1];
+            }
+            else if (p_seg == "*")
+            {
+                curr_dp[j] = curr_dp[j - 1] || prev_dp[j];
+            }
+            else
+            {
+                curr_dp[j] = (p_seg == t_seg) && prev_dp[j - 1];
+            }
+        }
+        std::swap(prev_dp, curr_dp);
+    }
+    return prev_dp[M];
+}
+
+bool topic_matches(const std::string &topic, const std::string &pattern)
+{
+    return segments_match(split_topic(topic), split_topic(pattern));
+}
+
+bool pattern_covers(const std::vector<std::string> &outer, const std::vector<std::string> &inner)
+{
+    // covered[j] after row i: inner[0..i) is covered by outer[0..j). Only a *
+    // of `outer` can take a wildcard segment of `inner` that stands for more
+    // than one topic segment.
+    size_t M = outer.size();
+    std::vector<char> prev(M + 1, 0);
+    std::vector<char> curr(M + 1, 0);
+    prev[0] = 1;
+    for (size_t j = 1; j <= M; ++j)
+    {
+        prev[j] = prev[j - 1] && outer[j - 1] == "*";
+    }
+    for (const std::string &in_seg : inner)
+    {
+        curr[0] = 0;
+        for (size_t j = 1; j <= M; ++j)
+        {
+            const std::string &out_seg = outer[j - 1];
+            if (out_seg == "*")
+            {
+                curr[j] = curr[j - 1] || prev[j];
+            }
+            else if (out_seg == "+")
+            {
+                curr[j] = prev[j - 1] && in_seg != "*";
+            }
+            else
+            {
+                curr[j] = prev[j - 1] && in_seg == out_seg;
+            }
+        }
+        std::swap(prev, curr);
+    }
+    return prev[M];
+}
+
+// The first matching pattern whose predicate accepts a message takes it, so
+// a pattern is never used when an earlier one without a predicate covers it.
+// A plain pattern can also go when the next pattern still in the list covers
+// it, is plain too and stores at least as much: that one takes its messages.
+std::vector<bool> find_covered_patterns(const std::vector<CoverageEntry> &entries)
+{
+    size_t n = entries.size();
+    std::vector<bool> covered(n, false);
+    for (size_t i = 1; i < n; ++i)
+    {
+        for (size_t j = 0; j < i && !covered[i]; ++j)
+        {
+            covered[i] = !entries[j].filtered && pattern_covers(entries[j].segments, entries[i].segments);
+        }
+    }
+    size_t next = n;
+    for (size_t i = n; i-- > 0;)
+    {
+        if (covered[i])
+        {
+            continue;
+        }
+        if (next < n && entries[i].plain && entries[next].plain && entries[next].sf >= entries[i].sf &&
+            pattern_covers(entries[next].segments, entries[i].segments))
+        {
+            covered[i] = true;
+            continue;
+        }
+        next = i;
+    }
+    return covered;
+}
@@ -0,0 +1,241 @@
+#include "udp_message.h"
+#include <algorithm>
+#include <arpa/inet.h>
+
+static size_t varint_size(uint32_t value);
+static void append_varint(std::vector<char> &out, uint32_t value);
+
+bool parse_udp_datagram(const char *buffer, int bytes_received, UdpMessage &udp_msg)
+{
+    memset(&udp_msg, 0, sizeof(UdpMessage));
+    int topic_len_to_copy = std::min(bytes_received, TOPIC_SIZE);
+    memcpy(udp_msg.topic, buffer, topic_len_to_copy);
+    udp_msg.topic[std::min(topic_len_to_copy, TOPIC_SIZE)] = '\0';
+
+    if (bytes_received < (TOPIC_SIZE + 1))
+    {
+        return false;
+    }
+    udp_msg.type = (uint8_t)buffer[TOPIC_SIZE];
+
+    udp_msg.content_len = bytes_received - (TOPIC_SIZE + 1);
+    if (udp_msg.content_len < 0)
+    {
+        udp_msg.content_len = 0;
+    }
+
+    if (udp_msg.content_len > 0)
+    {
+        int content_len_to_copy = std::min(udp_msg.content_len, MAX_CONTENT_SIZE);
+        memcpy(udp_msg.content, buffer + TOPIC_SIZE + 1, content_len_to_copy);
+        udp_msg.content[content_len_to_copy] = '\0';
+        udp_msg.content_len = content_len_to_copy;
+    }
+    else
+    {
+        udp_msg.content[0] = '\0';
+    }
+    return true;
+}
+
+std::vector<char> serialize_forward_message(const UdpMessage &msg)
+{
+    std::vector<char> payload_buffer;
+    payload_buffer.reserve(sizeof(uint32_t) + sizeof(uint16_t) + 1 + TOPIC_SIZE + 1 + sizeof(uint16_t) + MAX_CONTENT_SIZE + 10);
+
+    uint32_t net_ip = msg.sender_addr.sin_addr.s_addr;
+    const char *ip_bytes = reinterpret_cast<const char *>(&net_ip);
+    payload_buffer.insert(payload_buffer.end(), ip_bytes, ip_bytes + sizeof(net_ip));
+
+    uint16_t net_port = msg.sender_addr.sin_port;
+    const char *port_bytes = reinterpret_cast<const char *>(&net_port);
+    payload_buffer.insert(payload_buffer.end(), port_bytes, port_bytes + sizeof(net_port));
+
+    size_t topic_actual_len = strnlen(msg.topic, TOPIC_SIZE);
+    uint8_t topic_len_byte = static_cast<uint8_t>(topic_actual_len);
+    payload_buffer.push_back(topic_len_byte);
+    payload_buffer.insert(payload_buffer.end(), msg.topic, msg.topic + topic_len_byte);
+
+    payload_buffer.push_back(msg.type);
+
+    uint16_t content_len_16 = static_cast<uint16_t>(msg.content_len);
+    uint16_t net_content_len = htons(content_len_16);
+    const char *content_len_bytes = reinterpret_cast<const char *>(&net_content_len);
+    payload_buffer.insert(payload_buffer.end(), content_len_bytes, content_len_bytes + sizeof(net_content_len));
+
+    if (msg.content_len > 0)
+    {
+        payload_buffer.insert(payload_buffer.end(), msg.content, msg.content + msg.content_len);
+    }
+
+    std::vector<char> final_packet;
+    uint32_t total_payload_len_32 = static_cast<uint32_t>(payload_buffer.size());
+    uint32_t net_total_payload_len = htonl(total_payload_len_32);
+    const char *total_len_bytes = reinterpret_cast<const char *>(&net_total_payload_len);
+
+    final_packet.reserve(sizeof(net_total_payload_len) + payload_buffer.size());
+    final_packet.insert(final_packet.end(), total_len_bytes, total_len_bytes + sizeof(net_total_payload_len));
+    final_packet.insert(final_packet.end(), payload_buffer.begin(), payload_buffer.end());
+
+    return final_packet;
+}
+
+size_t pack_batch_frames(const char *frames, size_t len, std::vector<char> &out, WireDictionary *dictionary)
+{
+    const size_t prefix_size = sizeof(uint32_t);
+    const size_t sender_size = sizeof(uint32_t) + sizeof(uint16_t);
+    std::string sender_key;
+    std::string topic_key;
+    size_t messages = 0;
+    size_t offset = 0;
+    while (offset < len)
+    {
+        // Each pass packs one batch frame, starting right after its prefix.
+        size_t frame_start = out.size();
+        size_t first_frame = offset;
+        size_t entries = 0;
+        const char *prev_sender = nullptr;
+        const char *prev_topic = nullptr;
+        uint8_t prev_topic_len = 0;
+        out.resize(frame_start + prefix_size);
+        while (offset < len)
+        {
+            uint32_t net_len;
+            memcpy(&net_len, frames + offset, prefix_size);
+            const char *payload = frames + offset + prefix_size;
+            size_t payload_len = ntohl(net_len);
+            const char *sender = payload;
+            uint8_t topic_len = static_cast<uint8_t>(payload[sender_size]);
+            const char *topic = payload + sender_size + 1;
+            uint8_t type = static_cast<uint8_t>(topic[topic_len]);
+            const char *content = topic + topic_len + 1 + sizeof(uint16_t);
+            size_t content_len = payload_len - (content - payload);
+
+            // Nothing is added to the dictionary before the entry is known to
+            // fit: an entry moved to the next frame decides again there.
+            uint8_t flags = 0;
+            uint32_t sender_id = 0;
+            uint32_t topic_id = 0;
+            size_t sender_field = sender_size;
+            size_t topic_field = 1 + topic_len;
+            if (prev_sender && memcmp(prev_sender, sender, sender_size) == 0)
+            {
+                flags |= BATCH_SAME_SENDER;
+                sender_field = 0;
+            }
+            else if (dictionary)
+            {
+                sender_key.assign(sender, sender_size);
+                auto found = dictionary->senders.find(sender_key);
+                if (found != dictionary->senders.end())
+                {
+                    flags |= BATCH_SENDER_ID;
+                    sender_id = found->second;
+                    sender_field = varint_size(sender_id);
+                }
+                else if (dictionary->senders.size() < MAX_DICTIONARY_ENTRIES)
+                {
+                    flags |= BATCH_DEFINE_SENDER;
+                }
+            }
+            if (prev_topic && prev_topic_len == topic_len && memcmp(prev_topic, topic, topic_len) == 0)
+            {
+                flags |= BATCH_SAME_TOPIC;
+                topic_field = 0;
+            }
+            else if (dictionary)
+            {
+                topic_key.assign(topic, topic_len);
+                auto found = dictionary->topics.find(topic_key);
+                if (found != dictionary->topics.end())
+                {
+                    flags |= BATCH_TOPIC_ID;
+                    topic_id = found->second;
+                    topic_field = varint_size(topic_id);
+                }
+                else if (dictionary->topics.size() < MAX_DICTIONARY_ENTRIES)
+                {
+                    flags |= BATCH_DEFINE_TOPIC;
+                }
+            }
+            size_t entry_len = 1 + sender_field + topic_field + 1 + content_len;
+            if (entries > 0 && out.size() + sizeof(uint16_t) + entry_len - frame_start > MAX_BATCH_FRAME_SIZE)
+            {
+                break;
+            }
+
+            uint16_t net_entry_len = htons(static_cast<uint16_t>(entry_len));
+            const char *entry_len_bytes = reinterpret_cast<const char *>(&net_entry_len);
+            out.insert(out.end(), entry_len_bytes, entry_len_bytes + sizeof(net_entry_len));
+            out.push_back(static_cast<char>(flags));
+            if (flags & BATCH_SENDER_ID)
+            {
+                append_varint(out, sender_id);
+            }
+            else if (!(flags & BATCH_SAME_SENDER))
+            {
+                out.insert(out.end(), sender, sender + sender_size);
+            }
+            if (flags & BATCH_TOPIC_ID)
+            {
+                append_varint(out, topic_id);
+            }
+            else if (!(flags & BATCH_SAME_TOPIC))
+            {
+                out.push_back(static_cast<char>(topic_len));
+                out.insert(out.end(), topic, topic + topic_len);
+            }
+            out.push_back(static_cast<char>(type));
+            out.insert(out.end(), content, content + content_len);
+            if (flags & BATCH_DEFINE_SENDER)
+            {
+                dictionary->senders.emplace(sender_key, static_cast<uint32_t>(dictionary->senders.size()));
+            }
+            if (flags & BATCH_DEFINE_TOPIC)
+            {
+                dictionary->topics.emplace(topic_key, static_cast<uint32_t>(dictionary->topics.size()));
+            }
+
+            prev_sender = sender;
+            prev_topic = topic;
+            prev_topic_len = topic_len;
+            offset += prefix_size + payload_len;
+            entries++;
+        }
+
+        if (entries == 1 && !dictionary)
+        {
+            out.resize(frame_start);
+            out.insert(out.end(), frames + first_frame, frames + offset);
+        }
+        else
+        {
+            uint32_t net_frame_len = htonl(BATCH_FRAME_FLAG | static_cast<uint32_t>(out.size() - frame_start - prefix_size));
+            memcpy(out.data() + frame_start, &net_frame_len, prefix_size);
+        }
+        messages += entries;
+    }
+    return messages;
+}
+
+// Dictionary IDs go out as LEB128: seven bits per byte, low bits first.
+static size_t varint_size(uint32_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static void append_varint(std::vector<char> &out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
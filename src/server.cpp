@@ -1,55 +1,75 @@
-#include "server.h"
+#include "broker_core.h"
 #include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <csignal>
 #include <vector>
 #include <arpa/inet.h>
-
-using PollFds = std::vector<struct pollfd>;
-using SubscribersMap = std::map<std::string, Subscriber>;
-using SocketToIdMap = std::map<int, std::string>;
-
+#include <sys/socket.h>
 
 struct ServerSockets
 {
     int tcp = -1;
     int udp = -1;
+    int unix_stream = -1; // same protocols as tcp/udp, for clients on this host
+    int unix_dgram = -1;
+    std::string unix_stream_path;
+    std::string unix_dgram_path;
 };
 
+static bool parse_arguments(int argc, char *argv[], ServerConfig &config);
+static bool parse_threshold_list(const std::string &value, size_t (&out)[3]);
 static ServerSockets setup_server_sockets(int port);
+static bool open_unix_sockets(ServerSockets &sockets, const ServerConfig &config);
+static int open_unix_socket(const std::string &path, int type);
 static void close_server_sockets(const ServerSockets &sockets);
-static void initialize_poll_fds(PollFds &poll_fds, const ServerSockets &sockets);
-static void handle_stdin(bool &running);
-static void handle_new_connection(int listener_socket, PollFds &poll_fds, SubscribersMap &subscribers, SocketToIdMap &socket_to_id);
-static void handle_udp_message(int udp_socket, SubscribersMap &subscribers);
-static void handle_client_activity(PollFds &poll_fds, SubscribersMap &subscribers, SocketToIdMap &socket_to_id);
+static void initialize_poll_fds(PollFds &poll_fds, const ServerSockets &sockets, const Pipeline *pipeline);
+static void handle_stdin(ServerContext &ctx, bool &running);
+static void execute_console_command(ServerContext &ctx, const std::string &line, bool &running);
+static void collect_stats(const ServerContext &ctx, uint64_t (&totals)[STAT_COUNT], uint64_t (&gauges)[GAUGE_COUNT]);
+static uint64_t slow_consumer_total(const ServerContext &ctx, StatCounter SlowConsumerStats::*field);
+static void print_stats(const ServerContext &ctx);
+static void print_subscribers(const ServerContext &ctx);
+static void print_top_topics(const ServerContext &ctx, size_t count);
+static void print_sf_status(const ServerContext &ctx);
+static void print_groups(const ServerContext &ctx);
+static void collect_latency(const ServerContext &ctx, LatencyReport &report);
+static void print_latency(ServerContext &ctx, bool reset);
+static std::string render_metrics(const ServerContext &ctx);
+static void handle_new_connection(int listener_socket, ServerContext &ctx, bool local);
+static void handle_udp_message(int udp_socket, ServerContext &ctx);
+static void mark_local_sender(const struct msghdr &header, struct sockaddr_in &sender);
+static void handle_client_activity(ServerContext &ctx);
 static bool receive_client_id(int client_socket, std::string &client_id_str);
-static void handle_reconnection(Subscriber &sub, int new_socket, const struct sockaddr_in &client_addr, PollFds &poll_fds, SocketToIdMap &socket_to_id);
-static void handle_new_client(const std::string &client_id, int client_socket, const struct sockaddr_in &client_addr, PollFds &poll_fds, SubscribersMap &subscribers, SocketToIdMap &socket_to_id);
-static void send_stored_messages(Subscriber &sub);
-static void handle_client_disconnection(int client_socket, size_t poll_index, const std::string &client_id, PollFds &poll_fds, SubscribersMap &subscribers, SocketToIdMap &socket_to_id);
-static bool process_commands_from_buffer(Subscriber &sub);
-static void parse_and_execute_command(Subscriber &sub, const std::string &command_line);
-static bool parse_udp_datagram(const char *buffer, int bytes_received, UdpMessage &udp_msg);
-static std::vector<char> serialize_forward_message(const UdpMessage &msg);
-static void distribute_udp_message(const UdpMessage &msg, const std::vector<char> &serialized_packet, SubscribersMap &subscribers);
-static bool topic_matches(const std::string &topic, const std::string &pattern);
+static void handle_reconnection(ServerContext &ctx, Subscriber &sub, int new_socket, const struct sockaddr_in &client_addr);
+static void handle_new_client(ServerContext &ctx, const std::string &client_id, int client_socket, const struct sockaddr_in &client_addr);
+static void handle_client_disconnection(ServerContext &ctx, int client_socket, size_t poll_index, const std::string &client_id);
+static void close_client_socket(ServerContext &ctx, int client_socket, uint64_t connection);
+static void run_lag_checks(ServerContext &ctx);
+static void start_pipeline(Pipeline &pipeline, const ServerConfig &config, const ServerSockets &sockets);
+static void stop_pipeline(Pipeline &pipeline);
+static void run_ingest_stage(Pipeline *pipeline, IngestStage *stage);
+static void run_match_stage(Pipeline *pipeline);
+static void run_send_stage(SendStage *stage);
+static void drain_completed_queue(ServerContext &ctx);
+static void start_reactors(ReactorPool &pool, const ServerConfig &config);
+static void stop_reactors(ReactorPool &pool);
+static void run_reactor(Reactor *reactor);
+static void hand_off_connection(ServerContext &ctx, const std::string &client_id, int client_socket, const struct sockaddr_in &client_addr);
+static void process_handoffs(Reactor &reactor);
+static void drain_fanout_queue(Reactor &reactor);
 
 int main(int argc, char *argv[])
 {
     setvbuf(stdout, NULL, _IONBF, BUFSIZ);
-    if (argc != 2)
+    ServerConfig config;
+    if (!parse_arguments(argc, argv, config))
     {
-        std::cerr << "Usage: " << argv[0] << " <PORT>" << std::endl;
-        return 1;
-    }
-    int port = atoi(argv[1]);
-    if (port <= 0 || port > 65535)
-    {
-        std::cerr << "ERROR: Invalid port number." << std::endl;
         return 1;
     }
+    int port = config.port;
+    raise_fd_limit();
 
     ServerSockets sockets = setup_server_sockets(port);
     if (sockets.tcp < 0 || sockets.udp < 0)
@@ -62,16 +82,91 @@ int main(int argc, char *argv[])
         error("ERROR on listen");
     }
     std::cerr << "Server started on port " << port << std::endl;
+    if (!open_unix_sockets(sockets, config))
+    {
+        close_server_sockets(sockets);
+        return 1;
+    }
 
-    SubscribersMap subscribers;
-    PollFds poll_fds;
-    SocketToIdMap socket_to_id;
-    initialize_poll_fds(poll_fds, sockets);
+    if (config.pin_cpu >= 0 && !pin_thread_to_cpu(config.pin_cpu))
+    {
+        std::cerr << "WARN: Could not pin the event loop to CPU " << config.pin_cpu << "." << std::endl;
+    }
+
+    ServerContext ctx(config);
+    if (ctx.busy_poll_us > 0 && !enable_busy_poll(sockets.udp, ctx.busy_poll_us))
+    {
+        ctx.busy_poll_us = 0;
+    }
+    Pipeline pipeline;
+    if (config.pipeline_senders > 0)
+    {
+        start_pipeline(pipeline, config, sockets);
+        ctx.pipeline = &pipeline;
+    }
+    ReactorPool reactor_pool;
+    if (config.reactors > 0)
+    {
+        reactor_pool.history.store = &ctx.history;
+        start_reactors(reactor_pool, config);
+        ctx.reactors = &reactor_pool;
+    }
+    MetricsEndpoint metrics;
+    if (!config.metrics_address.empty())
+    {
+        if (!metrics.open(config.metrics_address))
+        {
+            close_server_sockets(sockets);
+            return 1;
+        }
+        std::cerr << "Metrics endpoint on " << config.metrics_address << std::endl;
+    }
+    ShmRing shm;
+    if (!config.shm_path.empty())
+    {
+        if (!shm.create(config.shm_path, config.shm_bytes))
+        {
+            perror("ERROR creating the shared-memory ring");
+            close_server_sockets(sockets);
+            return 1;
+        }
+        ctx.shm = &shm;
+        std::cerr << "Shared-memory ring at " << config.shm_path << " (" << config.shm_bytes << " bytes)" << std::endl;
+    }
+    initialize_poll_fds(ctx.poll_fds, sockets, ctx.pipeline);
+    PollFds &poll_fds = ctx.poll_fds;
 
     bool running = true;
     while (running)
     {
-        int poll_count = poll(poll_fds.data(), poll_fds.size(), -1);
+        int poll_timeout = -1;
+        if (ctx.pipeline)
+        {
+            ctx.pipeline->completion_notifier.arm();
+            if (!ctx.pipeline->completed.empty())
+            {
+                poll_timeout = 0;
+            }
+        }
+        poll_timeout = next_timer_timeout(ctx, poll_timeout);
+        // Scrape connections ride at the end of the poll set only for the
+        // duration of the call, so the client code never sees them.
+        size_t loop_fds = poll_fds.size();
+        if (metrics.is_open())
+        {
+            metrics.add_poll_fds(poll_fds);
+            poll_timeout = metrics.next_timeout(poll_timeout);
+        }
+        int poll_count = spin_poll(poll_fds.data(), poll_fds.size(), poll_timeout, ctx.spin);
+        if (metrics.is_open())
+        {
+            if (poll_count >= 0)
+            {
+                metrics.handle_events(poll_fds, [&ctx]()
+                                      { return render_metrics(ctx); });
+            }
+            poll_fds.resize(loop_fds);
+        }
         if (poll_count < 0)
         {
             if (errno == EINTR)
@@ -83,7 +178,7 @@ int main(int argc, char *argv[])
 
         if (poll_fds.size() > 2 && poll_fds[2].revents & POLLIN)
         {
-            handle_stdin(running);
+            handle_stdin(ctx, running);
             if (!running)
             {
                 break;
@@ -91,79 +186,240 @@ int main(int argc, char *argv[])
         }
         if (poll_fds.size() > 0 && poll_fds[0].revents & POLLIN)
         {
-            handle_new_connection(sockets.tcp, poll_fds, subscribers, socket_to_id);
+            handle_new_connection(sockets.tcp, ctx, false);
         }
-        if (poll_fds.size() > 1 && poll_fds[1].revents & POLLIN)
+        if (poll_fds.size() > 3 && poll_fds[3].revents & POLLIN)
         {
-            handle_udp_message(sockets.udp, subscribers);
+            handle_new_connection(sockets.unix_stream, ctx, true);
+        }
+        if (ctx.pipeline)
+        {
+            if (poll_fds[1].revents & POLLIN)
+            {
+                ctx.pipeline->completion_notifier.drain();
+            }
+            drain_completed_queue(ctx);
+        }
+        else if (poll_fds.size() > 1 && poll_fds[1].revents & POLLIN)
+        {
+            handle_udp_message(sockets.udp, ctx);
+        }
+        if (!ctx.pipeline && poll_fds.size() > 4 && poll_fds[4].revents & POLLIN)
+        {
+            handle_udp_message(sockets.unix_dgram, ctx);
+        }
+        handle_client_activity(ctx);
+        flush_turn_batches(ctx);
+        run_flush_timers(ctx);
+        run_lag_checks(ctx);
+        if (ctx.pipeline)
+        {
+            ctx.pipeline->index.publish();
         }
-        handle_client_activity(poll_fds, subscribers, socket_to_id);
 
         for (auto &pfd_entry : poll_fds)
         {
             pfd_entry.revents = 0;
         }
     }
+    if (ctx.pipeline)
+    {
+        stop_pipeline(pipeline);
+    }
+    if (ctx.reactors)
+    {
+        stop_reactors(reactor_pool);
+    }
     close_server_sockets(sockets);
     return 0;
 }
 
-static bool topic_matches(const std::string &topic, const std::string &pattern)
+static bool parse_arguments(int argc, char *argv[], ServerConfig &config)
 {
-    std::vector<std::string> t_segs, p_segs;
-    std::string segment;
-    std::stringstream ss_t(topic);
-    while (getline(ss_t, segment, '/'))
+    if (argc < 2)
     {
-        t_segs.push_back(segment);
+        std::cerr << "Usage: " << argv[0] << " <PORT> [--history-depth N] [--history-memory BYTES]"
+                  << " [--pipeline SEND_STAGES] [--ingest-threads N] [--reactors N]"
+                  << " [--spin-us N] [--busy-poll-us N] [--pin-cpu CPU]"
+                  << " [--lag-bytes SHED,SPOOL,DISCONNECT] [--lag-ms SHED,SPOOL,DISCONNECT]"
+                  << " [--metrics PORT|unix:PATH] [--shm PATH] [--shm-bytes BYTES]"
+                  << " [--unix PATH] [--unix-dgram PATH]" << std::endl;
+        return false;
     }
-    std::stringstream ss_p(pattern);
-    while (getline(ss_p, segment, '/'))
+    config.port = atoi(argv[1]);
+    if (config.port <= 0 || config.port > 65535)
     {
-        p_segs.push_back(segment);
+        std::cerr << "ERROR: Invalid port number." << std::endl;
+        return false;
     }
 
-    size_t N = t_segs.size();
-    size_t M = p_segs.size();
-    std::vector<bool> prev_dp(M + 1, false);
-    std::vector<bool> curr_dp(M + 1, false);
-    prev_dp[0] = true;
-    for (size_t j = 1; j <= M; ++j)
+    for (int i = 2; i < argc; ++i)
     {
-        if (p_segs[j - 1] == "*")
+        std::string option = argv[i];
+        if (i + 1 >= argc)
         {
-            prev_dp[j] = prev_dp[j - 1];
+            std::cerr << "ERROR: Missing value for option " << option << "." << std::endl;
+            return false;
         }
-    }
-
-    for (size_t i = 1; i <= N; ++i)
-    {
-        curr_dp[0] = false;
-        for (size_t j = 1; j <= M; ++j)
+        std::string value = argv[++i];
+        if (option == "--history-depth")
         {
-            const std::string &p_seg = p_segs[j - 1];
-            const std::string &t_seg = t_segs[i - 1];
-            if (p_seg == "+")
+            if (!parse_size_value(value, config.history_depth) || config.history_depth > MAX_HISTORY_DEPTH)
             {
-                curr_dp[j] = prev_dp[j - 1];
+                std::cerr << "ERROR: Invalid history depth (max " << MAX_HISTORY_DEPTH << ")." << std::endl;
+                return false;
             }
-            else if (p_seg == "*")
+        }
+        else if (option == "--history-memory")
+        {
+            if (!parse_size_value(value, config.history_memory))
             {
-                curr_dp[j] = curr_dp[j - 1] || prev_dp[j];
+                std::cerr << "ERROR: Invalid history memory limit." << std::endl;
+                return false;
             }
-            else
+        }
+        else if (option == "--pipeline")
+        {
+            if (!parse_size_value(value, config.pipeline_senders) || config.pipeline_senders > MAX_CLIENTS)
+            {
+                std::cerr << "ERROR: Invalid number of send stages." << std::endl;
+                return false;
+            }
+        }
+        else if (option == "--ingest-threads")
+        {
+            if (!parse_size_value(value, config.ingest_threads) || config.ingest_threads == 0 || config.ingest_threads > 64)
             {
-                curr_dp[j] = (p_seg == t_seg) && prev_dp[j - 1];
+                std::cerr << "ERROR: Invalid number of ingest threads." << std::endl;
+                return false;
             }
         }
-        prev_dp = curr_dp;
+        else if (option == "--reactors")
+        {
+            if (!parse_size_value(value, config.reactors) || config.reactors > MAX_REACTORS)
+            {
+                std::cerr << "ERROR: Invalid number of reactors (max " << MAX_REACTORS << ")." << std::endl;
+                return false;
+            }
+        }
+        else if (option == "--spin-us")
+        {
+            if (!parse_size_value(value, config.spin_us) || config.spin_us > MAX_SPIN_US)
+            {
+                std::cerr << "ERROR: Invalid spin budget (max " << MAX_SPIN_US << " us)." << std::endl;
+                return false;
+            }
+        }
+        else if (option == "--busy-poll-us")
+        {
+            if (!parse_size_value(value, config.busy_poll_us) || config.busy_poll_us > MAX_SPIN_US)
+            {
+                std::cerr << "ERROR: Invalid busy poll time." << std::endl;
+                return false;
+            }
+        }
+        else if (option == "--pin-cpu")
+        {
+            size_t cpu;
+            if (!parse_size_value(value, cpu) || cpu >= CPU_SETSIZE)
+            {
+                std::cerr << "ERROR: Invalid CPU index." << std::endl;
+                return false;
+            }
+            config.pin_cpu = static_cast<int>(cpu);
+        }
+        else if (option == "--lag-bytes")
+        {
+            if (!parse_threshold_list(value, config.lag.bytes))
+            {
+                std::cerr << "ERROR: Invalid lag byte thresholds (expected SHED,SPOOL,DISCONNECT)." << std::endl;
+                return false;
+            }
+        }
+        else if (option == "--lag-ms")
+        {
+            if (!parse_threshold_list(value, config.lag.ms))
+            {
+                std::cerr << "ERROR: Invalid lag age thresholds (expected SHED,SPOOL,DISCONNECT)." << std::endl;
+                return false;
+            }
+        }
+        else if (option == "--metrics")
+        {
+            if (!MetricsEndpoint::valid_address(value))
+            {
+                std::cerr << "ERROR: Invalid metrics address (expected a port or unix:PATH)." << std::endl;
+                return false;
+            }
+            config.metrics_address = value;
+        }
+        else if (option == "--shm")
+        {
+            config.shm_path = value;
+        }
+        else if (option == "--shm-bytes")
+        {
+            if (!parse_size_value(value, config.shm_bytes) || !valid_shm_capacity(config.shm_bytes))
+            {
+                std::cerr << "ERROR: Invalid ring size (a power of two, " << SHM_RING_MIN_BYTES << "-" << SHM_RING_MAX_BYTES
+                          << " bytes)." << std::endl;
+                return false;
+            }
+        }
+        else if (option == "--unix" || option == "--unix-dgram")
+        {
+            struct sockaddr_un addr;
+            if (!make_unix_address(value, addr))
+            {
+                std::cerr << "ERROR: Invalid Unix socket path for " << option << "." << std::endl;
+                return false;
+            }
+            (option == "--unix" ? config.unix_stream_path : config.unix_dgram_path) = value;
+        }
+        else
+        {
+            std::cerr << "ERROR: Unknown option " << option << "." << std::endl;
+            return false;
+        }
+    }
+    if (config.pipeline_senders > 0 && config.reactors > 0)
+    {
+        std::cerr << "ERROR: --pipeline and --reactors cannot be combined." << std::endl;
+        return false;
+    }
+    if (!config.shm_path.empty() && (config.pipeline_senders > 0 || config.reactors > 0))
+    {
+        std::cerr << "ERROR: --shm needs the single event loop (no --pipeline or --reactors)." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool parse_threshold_list(const std::string &value, size_t (&out)[3])
+{
+    std::stringstream ss(value);
+    std::string field;
+    size_t parsed[3];
+    size_t count = 0;
+    while (getline(ss, field, ','))
+    {
+        if (count == 3 || !parse_size_value(field, parsed[count]))
+        {
+            return false;
+        }
+        count++;
     }
-    return prev_dp[M];
+    if (count != 3)
+    {
+        return false;
+    }
+    std::copy(parsed, parsed + 3, out);
+    return true;
 }
 
 static ServerSockets setup_server_sockets(int port)
 {
-    ServerSockets sockets = {-1, -1};
+    ServerSockets sockets;
     int enable = 1;
     struct sockaddr_in server_addr;
     sockets.tcp = socket(AF_INET, SOCK_STREAM, 0);
@@ -206,45 +462,421 @@ static ServerSockets setup_server_sockets(int port)
     }
     return sockets;
 }
+
+// The Unix sockets carry the same byte streams and datagrams as the TCP
+// listener and the UDP socket; only the kernel path underneath is shorter.
+static bool open_unix_sockets(ServerSockets &sockets, const ServerConfig &config)
+{
+    if (!config.unix_stream_path.empty())
+    {
+        sockets.unix_stream = open_unix_socket(config.unix_stream_path, SOCK_STREAM);
+        if (sockets.unix_stream < 0 || listen(sockets.unix_stream, MAX_CLIENTS) < 0)
+        {
+            perror("ERROR opening the Unix stream listener");
+            return false;
+        }
+        sockets.unix_stream_path = config.unix_stream_path;
+        std::cerr << "Subscribers also accepted on unix:" << config.unix_stream_path << std::endl;
+    }
+    if (!config.unix_dgram_path.empty())
+    {
+        sockets.unix_dgram = open_unix_socket(config.unix_dgram_path, SOCK_DGRAM);
+        if (sockets.unix_dgram < 0)
+        {
+            perror("ERROR opening the Unix datagram socket");
+            return false;
+        }
+        sockets.unix_dgram_path = config.unix_dgram_path;
+        std::cerr << "Datagrams also accepted on unix:" << config.unix_dgram_path << std::endl;
+    }
+    return true;
+}
+
+static int open_unix_socket(const std::string &path, int type)
+{
+    int sock = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    if (!bind_unix_socket(sock, path))
+    {
+        int saved = errno;
+        close(sock);
+        errno = saved;
+        return -1;
+    }
+    return sock;
+}
+
 static void close_server_sockets(const ServerSockets &sockets)
 {
     if (sockets.tcp >= 0)
     {
         close(sockets.tcp);
     }
-    if (sockets.udp >= 0)
+    if (sockets.udp >= 0)
+    {
+        close(sockets.udp);
+    }
+    if (sockets.unix_stream >= 0)
+    {
+        close(sockets.unix_stream);
+    }
+    if (sockets.unix_dgram >= 0)
+    {
+        close(sockets.unix_dgram);
+    }
+    if (!sockets.unix_stream_path.empty())
+    {
+        unlink(sockets.unix_stream_path.c_str());
+    }
+    if (!sockets.unix_dgram_path.empty())
+    {
+        unlink(sockets.unix_dgram_path.c_str());
+    }
+}
+
+static void initialize_poll_fds(PollFds &poll_fds, const ServerSockets &sockets, const Pipeline *pipeline)
+{
+    poll_fds.clear();
+    poll_fds.push_back({sockets.tcp, POLLIN, 0}); // [0] TCP listener
+    if (pipeline)
+    {
+        poll_fds.push_back({pipeline->completion_notifier.get_fd(), POLLIN, 0}); // [1] Matched messages wakeup
+    }
+    else
+    {
+        poll_fds.push_back({sockets.udp, POLLIN, 0}); // [1] UDP socket
+    }
+    poll_fds.push_back({STDIN_FILENO, POLLIN, 0}); // [2] Standard input
+    poll_fds.push_back({sockets.unix_stream, POLLIN, 0}); // [3] Unix stream listener
+    // [4] Unix datagram socket; in pipeline mode an ingest stage reads it.
+    poll_fds.push_back({pipeline ? -1 : sockets.unix_dgram, POLLIN, 0});
+}
+
+// Reads stdin directly rather than through stdio, so several commands that
+// arrive in one read are all executed instead of waiting in a FILE buffer
+// that poll() cannot see.
+static void handle_stdin(ServerContext &ctx, bool &running)
+{
+    char buffer[BUFFER_SIZE];
+    ssize_t bytes_read = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (bytes_read < 0 && errno == EINTR)
+    {
+        return;
+    }
+    if (bytes_read <= 0)
+    {
+        if (!ctx.console_input.empty())
+        {
+            execute_console_command(ctx, ctx.console_input, running);
+        }
+        running = false;
+        return;
+    }
+    ctx.console_input.append(buffer, bytes_read);
+    size_t newline;
+    while (running && (newline = ctx.console_input.find('\n')) != std::string::npos)
+    {
+        std::string line = ctx.console_input.substr(0, newline);
+        ctx.console_input.erase(0, newline + 1);
+        execute_console_command(ctx, line, running);
+    }
+}
+
+static void execute_console_command(ServerContext &ctx, const std::string &line, bool &running)
+{
+    std::stringstream ss(line);
+    std::string command;
+    ss >> command;
+    if (command == "exit")
+    {
+        running = false;
+    }
+    else if (command == "stats")
+    {
+        print_stats(ctx);
+    }
+    else if (command == "subscribers")
+    {
+        print_subscribers(ctx);
+    }
+    else if (command == "topics")
+    {
+        std::string what;
+        size_t count = DEFAULT_TOP_TOPICS;
+        ss >> what;
+        if (what != "top" || (!(ss >> count) && !ss.eof()))
+        {
+            std::cerr << "ERROR: Usage: topics top [N]" << std::endl;
+            return;
+        }
+        print_top_topics(ctx, count);
+    }
+    else if (command == "sf")
+    {
+        print_sf_status(ctx);
+    }
+    else if (command == "groups")
+    {
+        print_groups(ctx);
+    }
+    else if (command == "latency")
+    {
+        std::string what;
+        ss >> what;
+        if (!what.empty() && what != "reset")
+        {
+            std::cerr << "ERROR: Usage: latency [reset]" << std::endl;
+            return;
+        }
+        print_latency(ctx, what == "reset");
+    }
+    else if (!command.empty())
+    {
+        std::cerr << "ERROR: Unknown command '" << command << "'. Use exit, stats, subscribers, topics top [N], sf, groups or latency [reset]." << std::endl;
+    }
+}
+
+static void collect_stats(const ServerContext &ctx, uint64_t (&totals)[STAT_COUNT], uint64_t (&gauges)[GAUGE_COUNT])
+{
+    std::fill(std::begin(totals), std::end(totals), 0);
+    std::fill(std::begin(gauges), std::end(gauges), 0);
+    ctx.stats.accumulate_into(totals);
+    ctx.stats.accumulate_gauges_into(gauges);
+    if (ctx.pipeline)
+    {
+        for (const std::unique_ptr<IngestStage> &stage : ctx.pipeline->ingest_stages)
+        {
+            stage->stats.accumulate_into(totals);
+        }
+        ctx.pipeline->match_stats.accumulate_into(totals);
+        for (const std::unique_ptr<SendStage> &stage : ctx.pipeline->senders)
+        {
+            stage->stats.accumulate_into(totals);
+        }
+    }
+    if (ctx.reactors)
+    {
+        for (const std::unique_ptr<Reactor> &reactor : ctx.reactors->reactors)
+        {
+            reactor->ctx->stats.accumulate_into(totals);
+            reactor->ctx->stats.accumulate_gauges_into(gauges);
+        }
+    }
+}
+
+static uint64_t slow_consumer_total(const ServerContext &ctx, StatCounter SlowConsumerStats::*field)
+{
+    uint64_t total = (ctx.slow.*field).get();
+    if (ctx.reactors)
+    {
+        for (const std::unique_ptr<Reactor> &reactor : ctx.reactors->reactors)
+        {
+            total += (reactor->ctx->slow.*field).get();
+        }
+    }
+    return total;
+}
+
+static void print_stats(const ServerContext &ctx)
+{
+    uint64_t totals[STAT_COUNT];
+    uint64_t gauges[GAUGE_COUNT];
+    collect_stats(ctx, totals, gauges);
+    for (int i = 0; i < STAT_COUNT; ++i)
+    {
+        std::cout << std::left << std::setw(24) << STAT_NAMES[i] << totals[i] << std::endl;
+    }
+    for (int i = 0; i < GAUGE_COUNT; ++i)
+    {
+        std::cout << std::left << std::setw(24) << GAUGE_NAMES[i] << gauges[i] << std::endl;
+    }
+    uint64_t parsed = totals[STAT_DATAGRAMS_PARSED];
+    std::cout << std::left << std::setw(24) << "fanout_avg" << std::fixed << std::setprecision(2)
+              << (parsed > 0 ? static_cast<double>(totals[STAT_MESSAGES_MATCHED]) / parsed : 0.0) << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::left << std::setw(24) << "slow_consumers"
+              << "shedding=" << slow_consumer_total(ctx, &SlowConsumerStats::shedding)
+              << " spooling=" << slow_consumer_total(ctx, &SlowConsumerStats::spooling)
+              << " disconnects=" << slow_consumer_total(ctx, &SlowConsumerStats::disconnects)
+              << " recoveries=" << slow_consumer_total(ctx, &SlowConsumerStats::recoveries)
+              << " shed_messages=" << slow_consumer_total(ctx, &SlowConsumerStats::shed_messages)
+              << " spooled_messages=" << slow_consumer_total(ctx, &SlowConsumerStats::spooled_messages) << std::endl;
+}
+
+static void print_subscribers(const ServerContext &ctx)
+{
+    if (ctx.reactors)
+    {
+        for (const auto &pair : ctx.reactors->registry)
+        {
+            std::cout << pair.first << " " << (pair.second->connected.load(std::memory_order_acquire) ? "connected" : "offline")
+                      << " reactor=" << pair.second->reactor << std::endl;
+        }
+        return;
+    }
+    static const char *const lag_names[] = {"healthy", "shedding", "spooling", "disconnect"};
+    for (const auto &pair : ctx.subscribers)
+    {
+        const Subscriber &sub = pair.second;
+        std::cout << pair.first << " " << (sub.connected ? "connected" : "offline") << " topics=" << sub.topics.size()
+                  << " covered=" << sub.topics.covered_count() << " sf_pending=" << sub.stored_messages.size() << " backlog_bytes=" << sub.backlog_bytes
+                  << " lag=" << lag_names[sub.lag_state] << std::endl;
+    }
+}
+
+static void print_top_topics(const ServerContext &ctx, size_t count)
+{
+    const TopicCounters &topics = ctx.pipeline ? ctx.pipeline->topics : ctx.topics;
+    for (const auto &entry : topics.top(count))
+    {
+        std::cout << std::left << std::setw(TOPIC_SIZE + 2) << entry.first << entry.second << std::endl;
+    }
+    std::cout << "distinct_topics " << topics.distinct() << " other " << topics.other() << std::endl;
+}
+
+static void print_sf_status(const ServerContext &ctx)
+{
+    uint64_t totals[STAT_COUNT];
+    uint64_t gauges[GAUGE_COUNT];
+    collect_stats(ctx, totals, gauges);
+    std::cout << "sf_enqueued " << totals[STAT_SF_ENQUEUED] << " sf_replayed " << totals[STAT_SF_REPLAYED]
+              << " sf_pending " << gauges[GAUGE_SF_MESSAGES] << " sf_bytes " << gauges[GAUGE_SF_BYTES] << std::endl;
+    if (ctx.reactors)
+    {
+        return;
+    }
+    for (const auto &pair : ctx.subscribers)
+    {
+        const Subscriber &sub = pair.second;
+        if (sub.stored_messages.empty())
+        {
+            continue;
+        }
+        size_t bytes = 0;
+        for (const std::vector<char> &packet : sub.stored_messages)
+        {
+            bytes += packet.size();
+        }
+        std::cout << pair.first << " " << (sub.connected ? "connected" : "offline") << " messages=" << sub.stored_messages.size()
+                  << " bytes=" << bytes << std::endl;
+    }
+}
+
+static void print_groups(const ServerContext &ctx)
+{
+    static const char *const policy_names[] = {"rr", "least", "hash"};
+    for (const auto &pair : ctx.groups)
+    {
+        const SharedGroup &group = pair.second;
+        size_t connected = 0;
+        for (const GroupMember &member : group.members)
+        {
+            connected += member.sub->connected;
+        }
+        std::cout << group.name << " " << ctx.patterns.text(group.pattern) << " policy=" << policy_names[group.policy]
+                  << " members=" << group.members.size() << " connected=" << connected << " delivered=" << group.delivered
+                  << " sf_pending=" << group.stored_messages.size() << std::endl;
+    }
+}
+
+static void collect_latency(const ServerContext &ctx, LatencyReport &report)
+{
+    ctx.latency.accumulate_into(report);
+    if (ctx.pipeline)
+    {
+        for (const std::unique_ptr<IngestStage> &stage : ctx.pipeline->ingest_stages)
+        {
+            stage->latency.accumulate_into(report);
+        }
+        ctx.pipeline->match_latency.accumulate_into(report);
+        for (const std::unique_ptr<SendStage> &stage : ctx.pipeline->senders)
+        {
+            stage->latency.accumulate_into(report);
+        }
+    }
+    if (ctx.reactors)
     {
-        close(sockets.udp);
+        for (const std::unique_ptr<Reactor> &reactor : ctx.reactors->reactors)
+        {
+            reactor->ctx->latency.accumulate_into(report);
+        }
     }
 }
 
-static void initialize_poll_fds(PollFds &poll_fds, const ServerSockets &sockets)
+// The histograms only ever grow; a reset records the current counts as a
+// baseline that later dumps subtract, so the writers are never touched.
+static void print_latency(ServerContext &ctx, bool reset)
 {
-    poll_fds.clear();
-    poll_fds.push_back({sockets.tcp, POLLIN, 0});  // [0] TCP listener
-    poll_fds.push_back({sockets.udp, POLLIN, 0});  // [1] UDP socket
-    poll_fds.push_back({STDIN_FILENO, POLLIN, 0}); // [2] Standard input
+#ifndef STAGE_LATENCY
+    std::cerr << "ERROR: Stage latency histograms are compiled out (build with STAGE_LATENCY=1)." << std::endl;
+    return;
+#endif
+    LatencyReport report;
+    collect_latency(ctx, report);
+    if (reset)
+    {
+        ctx.latency_baseline = report;
+        std::cout << "latency histograms reset" << std::endl;
+        return;
+    }
+    report.subtract(ctx.latency_baseline);
+    print_stage_latency(std::cout, report);
 }
 
-static void handle_stdin(bool &running)
+// Prometheus text exposition. Histograms are cumulative since startup; the
+// console's "latency reset" baseline does not apply here.
+static std::string render_metrics(const ServerContext &ctx)
 {
-    char buffer[BUFFER_SIZE];
-    memset(buffer, 0, BUFFER_SIZE);
-    if (fgets(buffer, BUFFER_SIZE - 1, stdin) != NULL)
+    static const struct
     {
-        buffer[strcspn(buffer, "\n")] = 0;
-        if (strcmp(buffer, "exit") == 0)
-        {
-            running = false;
-        }
+        const char *name;
+        StatCounter SlowConsumerStats::*field;
+    } slow_counters[] = {
+        {"slow_consumer_shedding", &SlowConsumerStats::shedding},
+        {"slow_consumer_spooling", &SlowConsumerStats::spooling},
+        {"slow_consumer_disconnects", &SlowConsumerStats::disconnects},
+        {"slow_consumer_recoveries", &SlowConsumerStats::recoveries},
+        {"shed_messages", &SlowConsumerStats::shed_messages},
+        {"spooled_messages", &SlowConsumerStats::spooled_messages},
+    };
+
+    uint64_t totals[STAT_COUNT];
+    uint64_t gauges[GAUGE_COUNT];
+    collect_stats(ctx, totals, gauges);
+    std::ostringstream out;
+    for (int i = 0; i < STAT_COUNT; ++i)
+    {
+        out << "# TYPE broker_" << STAT_NAMES[i] << "_total counter\n"
+            << "broker_" << STAT_NAMES[i] << "_total " << totals[i] << "\n";
     }
-    else
+    for (const auto &counter : slow_counters)
     {
-        running = false;
+        out << "# TYPE broker_" << counter.name << "_total counter\n"
+            << "broker_" << counter.name << "_total " << slow_consumer_total(ctx, counter.field) << "\n";
     }
+    for (int i = 0; i < GAUGE_COUNT; ++i)
+    {
+        out << "# TYPE broker_" << GAUGE_NAMES[i] << " gauge\n"
+            << "broker_" << GAUGE_NAMES[i] << " " << gauges[i] << "\n";
+    }
+    size_t known = ctx.reactors ? ctx.reactors->registry.size() : ctx.subscribers.size();
+    const TopicCounters &topics = ctx.pipeline ? ctx.pipeline->topics : ctx.topics;
+    out << "# TYPE broker_subscribers_known gauge\nbroker_subscribers_known " << known << "\n";
+    out << "# TYPE broker_topics_distinct gauge\nbroker_topics_distinct " << topics.distinct() << "\n";
+#ifdef STAGE_LATENCY
+    LatencyReport report;
+    collect_latency(ctx, report);
+    print_prometheus_latency(out, "broker_stage_latency_seconds", report);
+#endif
+    return out.str();
 }
 
-static void handle_new_connection(int listener_socket, PollFds &poll_fds, SubscribersMap &subscribers, SocketToIdMap &socket_to_id)
+// A client on the Unix listener (`local`) is reported as 127.0.0.1:0, the
+// address its messages would carry as a publisher.
+static void handle_new_connection(int listener_socket, ServerContext &ctx, bool local)
 {
     struct sockaddr_in client_addr;
     socklen_t client_len = sizeof(client_addr);
@@ -254,71 +886,120 @@ static void handle_new_connection(int listener_socket, PollFds &poll_fds, Subscr
         perror("WARN: accept failed");
         return;
     }
-    int flag = 1;
-    if (setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &flag,
-                   sizeof(int)) < 0)
+    if (local)
+    {
+        memset(&client_addr, 0, sizeof(client_addr));
+        client_addr.sin_family = AF_INET;
+        client_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    }
+    else
     {
-        perror("WARN: setsockopt TCP_NODELAY failed");
+        int flag = 1;
+        if (setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &flag,
+                       sizeof(int)) < 0)
+        {
+            perror("WARN: setsockopt TCP_NODELAY failed");
+        }
+        if (ctx.busy_poll_us > 0)
+        {
+            enable_busy_poll(client_socket, ctx.busy_poll_us);
+        }
     }
 
     std::string client_id_str;
     if (!receive_client_id(client_socket, client_id_str))
     {
+        ctx.stats.add(STAT_CONNECTIONS_REFUSED);
         close(client_socket);
         return;
     }
+    if (ctx.reactors)
+    {
+        hand_off_connection(ctx, client_id_str, client_socket, client_addr);
+        return;
+    }
 
-    auto it = subscribers.find(client_id_str);
-    if (it != subscribers.end())
+    auto it = ctx.subscribers.find(client_id_str);
+    if (it != ctx.subscribers.end())
     {
         if (it->second.connected)
         {
             std::cout << "Client " << client_id_str << " already connected." << std::endl;
             fflush(stdout);
+            ctx.stats.add(STAT_CONNECTIONS_REFUSED);
             close(client_socket);
         }
         else
         {
-            handle_reconnection(it->second, client_socket, client_addr, poll_fds, socket_to_id);
+            handle_reconnection(ctx, it->second, client_socket, client_addr);
         }
     }
     else
     {
-        handle_new_client(client_id_str, client_socket, client_addr, poll_fds, subscribers, socket_to_id);
+        handle_new_client(ctx, client_id_str, client_socket, client_addr);
     }
 }
 
-static void handle_udp_message(int udp_socket, SubscribersMap &subscribers)
+// Takes every datagram already queued, up to PIPELINE_BATCH, so that the
+// messages of one loop turn can leave for a subscriber in one batch frame.
+static void handle_udp_message(int udp_socket, ServerContext &ctx)
 {
-    char buffer[BUFFER_SIZE];
-    UdpMessage udp_msg;
-    struct sockaddr_in udp_sender_addr;
-    socklen_t udp_sender_len = sizeof(udp_sender_addr);
-    memset(buffer, 0, BUFFER_SIZE);
-    int bytes_received = recvfrom(udp_socket, buffer, BUFFER_SIZE - 1, 0, (struct sockaddr *)&udp_sender_addr, &udp_sender_len);
-    if (bytes_received <= 0)
+    char buffers[PIPELINE_BATCH][BUFFER_SIZE];
+    struct sockaddr_in senders[PIPELINE_BATCH];
+    struct iovec iovecs[PIPELINE_BATCH];
+    struct mmsghdr msgs[PIPELINE_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < PIPELINE_BATCH; ++i)
+    {
+        iovecs[i].iov_base = buffers[i];
+        iovecs[i].iov_len = BUFFER_SIZE - 1;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &senders[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(senders[i]);
+    }
+    uint64_t start = stage_clock();
+    int received = recvmmsg(udp_socket, msgs, PIPELINE_BATCH, MSG_DONTWAIT, NULL);
+    if (received <= 0)
     {
-        if (bytes_received < 0)
+        if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
         {
-            perror("WARN: recvfrom UDP failed");
+            perror("WARN: recvmmsg UDP failed");
         }
         return;
     }
-
-    if (!parse_udp_datagram(buffer, bytes_received, udp_msg))
+    ctx.latency.record(STAGE_RECEIVE, start);
+    for (int i = 0; i < received; ++i)
     {
-        return;
+        if (msgs[i].msg_len == 0)
+        {
+            continue;
+        }
+        ctx.stats.add(STAT_DATAGRAMS_RECEIVED);
+        mark_local_sender(msgs[i].msg_hdr, senders[i]);
+        process_datagram(ctx, buffers[i], msgs[i].msg_len, senders[i]);
     }
-    udp_msg.sender_addr = udp_sender_addr;
+}
 
-    std::vector<char> serialized_packet = serialize_forward_message(udp_msg);
-    distribute_udp_message(udp_msg, serialized_packet, subscribers);
+// A datagram from the Unix socket has no IP sender (or none at all when the
+// publisher never bound its socket); the frame names it as 127.0.0.1:0.
+static void mark_local_sender(const struct msghdr &header, struct sockaddr_in &sender)
+{
+    if (header.msg_namelen < sizeof(sender) || sender.sin_family != AF_INET)
+    {
+        memset(&sender, 0, sizeof(sender));
+        sender.sin_family = AF_INET;
+        sender.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    }
 }
 
-static void handle_client_activity(PollFds &poll_fds, SubscribersMap &subscribers, SocketToIdMap &socket_to_id)
+static void handle_client_activity(ServerContext &ctx)
 {
+    PollFds &poll_fds = ctx.poll_fds;
+    SubscribersMap &subscribers = ctx.subscribers;
+    SocketToIdMap &socket_to_id = ctx.socket_to_id;
     char recv_tmp_buffer[BUFFER_SIZE];
-    for (int i = poll_fds.size() - 1; i >= 3; --i)
+    for (int i = poll_fds.size() - 1; i >= FIRST_CLIENT_POLL_INDEX; --i)
     {
         if (i >= (int)poll_fds.size())
         {
@@ -349,8 +1030,10 @@ static void handle_client_activity(PollFds &poll_fds, SubscribersMap &subscriber
         }
         Subscriber &sub = sub_it->second;
 
+        // A Unix socket reports the peer's close as POLLHUP next to the data
+        // it sent last; those commands are read before the hangup is handled.
         bool client_disconnected = false;
-        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+        if ((pfd.revents & (POLLERR | POLLNVAL)) || ((pfd.revents & POLLHUP) && !(pfd.revents & POLLIN)))
         {
             if (sub.connected)
             {
@@ -359,6 +1042,13 @@ static void handle_client_activity(PollFds &poll_fds, SubscribersMap &subscriber
             }
             client_disconnected = true;
         }
+        else if ((pfd.revents & POLLOUT) && !drain_backlog(ctx, sub, pfd))
+        {
+            if (errno != EPIPE && errno != ECONNRESET)
+            {
+                perror("WARN: send backlog to subscriber failed");
+            }
+        }
         else if (pfd.revents & POLLIN)
         {
             memset(recv_tmp_buffer, 0, BUFFER_SIZE);
@@ -385,7 +1075,7 @@ static void handle_client_activity(PollFds &poll_fds, SubscribersMap &subscriber
                     fflush(stderr);
                     client_disconnected = true;
                 }
-                else if (!process_commands_from_buffer(sub))
+                else if (!process_commands_from_buffer(ctx, sub))
                 {
                     std::cerr << "ERROR: Client " << client_id_str << " failed processing commands. Disconnecting." << std::endl;
                     fflush(stderr);
@@ -396,7 +1086,7 @@ static void handle_client_activity(PollFds &poll_fds, SubscribersMap &subscriber
 
         if (client_disconnected)
         {
-            handle_client_disconnection(client_socket, i, client_id_str, poll_fds, subscribers, socket_to_id);
+            handle_client_disconnection(ctx, client_socket, i, client_id_str);
         }
     }
 }
@@ -405,11 +1095,19 @@ static bool receive_client_id(int client_socket, std::string &client_id_str)
 {
     char buffer[BUFFER_SIZE];
     memset(buffer, 0, BUFFER_SIZE);
-    int bytes_received = recv(client_socket, buffer, MAX_ID_SIZE + 1, 0);
+    int bytes_received = recv(client_socket, buffer, MAX_ID_SIZE + 1, MSG_PEEK);
     if (bytes_received <= 0)
     {
         return false;
     }
+    // Only the ID and its terminator are taken; a command the client sent
+    // right behind it stays queued on the socket for the event loop.
+    const char *terminator = static_cast<const char *>(memchr(buffer, '\0', bytes_received));
+    size_t id_bytes = terminator ? terminator - buffer + 1 : bytes_received;
+    if (recv(client_socket, buffer, id_bytes, 0) != static_cast<ssize_t>(id_bytes))
+    {
+        return false;
+    }
     buffer[std::min(bytes_received, MAX_ID_SIZE)] = '\0';
     if (strcspn(buffer, "\n\r\0") != strlen(buffer))
     {
@@ -423,63 +1121,67 @@ static bool receive_client_id(int client_socket, std::string &client_id_str)
     return true;
 }
 
-static void handle_reconnection(Subscriber &sub, int new_socket, const struct sockaddr_in &client_addr, PollFds &poll_fds, SocketToIdMap &socket_to_id)
+static void handle_reconnection(ServerContext &ctx, Subscriber &sub, int new_socket, const struct sockaddr_in &client_addr)
 {
     char client_ip_str[INET_ADDRSTRLEN];
     inet_ntop(AF_INET, &client_addr.sin_addr, client_ip_str, INET_ADDRSTRLEN);
     std::cout << "New client " << sub.id << " connected from " << client_ip_str << ":" << ntohs(client_addr.sin_port) << "." << std::endl;
     fflush(stdout);
-    sub.socket = new_socket;
-    sub.connected = true;
-    sub.command_buffer.reset();
-    poll_fds.push_back({new_socket, POLLIN, 0});
-    socket_to_id[new_socket] = sub.id;
-    send_stored_messages(sub);
-    sub.stored_messages.clear();
+    ctx.poll_fds.push_back({new_socket, POLLIN, 0});
+    connect_subscriber(ctx, sub.id, new_socket);
 }
 
-static void handle_new_client(const std::string &client_id, int client_socket, const struct sockaddr_in &client_addr, PollFds &poll_fds, SubscribersMap &subscribers, SocketToIdMap &socket_to_id)
+static void handle_new_client(ServerContext &ctx, const std::string &client_id, int client_socket, const struct sockaddr_in &client_addr)
 {
     char client_ip_str[INET_ADDRSTRLEN];
     inet_ntop(AF_INET, &client_addr.sin_addr, client_ip_str, INET_ADDRSTRLEN);
     std::cout << "New client " << client_id << " connected from " << client_ip_str << ":" << ntohs(client_addr.sin_port) << "." << std::endl;
     fflush(stdout);
-    Subscriber &new_sub = subscribers[client_id];
-    strncpy(new_sub.id, client_id.c_str(), MAX_ID_SIZE);
-    new_sub.id[MAX_ID_SIZE] = '\0';
-    new_sub.socket = client_socket;
-    new_sub.connected = true;
-    poll_fds.push_back({client_socket, POLLIN, 0});
-    socket_to_id[client_socket] = client_id;
+    ctx.poll_fds.push_back({client_socket, POLLIN, 0});
+    connect_subscriber(ctx, client_id, client_socket);
 }
 
-static void send_stored_messages(Subscriber &sub)
+static void handle_client_disconnection(ServerContext &ctx, int client_socket, size_t poll_index, const std::string &client_id)
 {
-    for (const std::vector<char> &stored_packet : sub.stored_messages)
+    PollFds &poll_fds = ctx.poll_fds;
+    auto sub_it = ctx.subscribers.find(client_id);
+    close_client_socket(ctx, client_socket, sub_it != ctx.subscribers.end() ? sub_it->second.connection : 0);
+    ctx.stats.add(STAT_DISCONNECTIONS);
+    if (sub_it != ctx.subscribers.end())
     {
-        ssize_t sent = send_all(sub.socket, stored_packet.data(), stored_packet.size(), MSG_NOSIGNAL);
-        if (sent < 0 || (size_t)sent != stored_packet.size())
+        if (ctx.pipeline)
         {
-            if (errno != EPIPE && errno != ECONNRESET)
-            {
-                perror("WARN: send stored message failed during reconnect");
-            }
-            break;
+            ctx.pipeline->index.set_connection(client_id, -1, 0);
         }
-    }
-}
-
-static void handle_client_disconnection(int client_socket, size_t poll_index, const std::string &client_id, PollFds &poll_fds, SubscribersMap &subscribers, SocketToIdMap &socket_to_id)
-{
-    close(client_socket);
-    auto sub_it = subscribers.find(client_id);
-    if (sub_it != subscribers.end())
-    {
+        if (sub_it->second.connected)
+        {
+            ctx.stats.lower(GAUGE_SUBSCRIBERS_CONNECTED);
+        }
+        ctx.stats.lower(GAUGE_QUEUED_BYTES, sub_it->second.outbound.size() + sub_it->second.backlog_bytes);
+        keep_unsent_sf(ctx, sub_it->second);
         sub_it->second.connected = false;
         sub_it->second.socket = -1;
         sub_it->second.command_buffer.reset();
+        sub_it->second.outbound.clear();
+        sub_it->second.batch_serial++;
+        sub_it->second.backlog.clear();
+        sub_it->second.backlog_offset = 0;
+        sub_it->second.backlog_bytes = 0;
+        sub_it->second.lag_state = LAG_HEALTHY;
+        sub_it->second.dictionary = WireDictionary();
+        sub_it->second.throttled.clear();
+        if (sub_it->second.shm_slot >= 0)
+        {
+            ctx.shm->release_slot(sub_it->second.shm_slot);
+            sub_it->second.shm_slot = -1;
+        }
+        ctx.backlogged.erase(client_id);
+        if (sub_it->second.record)
+        {
+            sub_it->second.record->connected.store(false, std::memory_order_release);
+        }
     }
-    socket_to_id.erase(client_socket);
+    ctx.socket_to_id.erase(client_socket);
 
     if (poll_index < poll_fds.size() && poll_fds[poll_index].fd == client_socket)
     {
@@ -487,7 +1189,7 @@ static void handle_client_disconnection(int client_socket, size_t poll_index, co
     }
     else
     {
-        auto pfd_it = std::find_if(poll_fds.begin() + 3, poll_fds.end(), [client_socket](const struct pollfd &p)
+        auto pfd_it = std::find_if(poll_fds.begin() + FIRST_CLIENT_POLL_INDEX, poll_fds.end(), [client_socket](const struct pollfd &p)
                                    { return p.fd == client_socket; });
         if (pfd_it != poll_fds.end())
         {
@@ -496,172 +1198,517 @@ static void handle_client_disconnection(int client_socket, size_t poll_index, co
     }
 }
 
-static bool process_commands_from_buffer(Subscriber &sub)
+static void close_client_socket(ServerContext &ctx, int client_socket, uint64_t connection)
+{
+    if (ctx.pipeline)
+    {
+        // The send stage may still hold packets for this socket; it closes the
+        // descriptor after them so the number cannot be reused underneath it.
+        shutdown(client_socket, SHUT_RDWR);
+        enqueue_send(*ctx.pipeline, SEND_CLOSE, client_socket, connection, nullptr);
+    }
+    else
+    {
+        close(client_socket);
+    }
+}
+
+static void run_lag_checks(ServerContext &ctx)
+{
+    if (ctx.backlogged.empty())
+    {
+        return;
+    }
+    std::vector<std::string> lagging(ctx.backlogged.begin(), ctx.backlogged.end());
+    for (const std::string &id : lagging)
+    {
+        auto it = ctx.subscribers.find(id);
+        if (it == ctx.subscribers.end())
+        {
+            ctx.backlogged.erase(id);
+            continue;
+        }
+        Subscriber &sub = it->second;
+        update_lag_state(ctx, sub);
+        if (sub.lag_state == LAG_DISCONNECT)
+        {
+            ctx.slow.disconnects.add();
+            std::cout << "Client " << id << " disconnected." << std::endl;
+            fflush(stdout);
+            handle_client_disconnection(ctx, sub.socket, ctx.poll_fds.size(), id);
+        }
+    }
+}
+
+static void start_pipeline(Pipeline &pipeline, const ServerConfig &config, const ServerSockets &sockets)
 {
-    ssize_t newline_offset;
-    while ((newline_offset = sub.command_buffer.find('\n')) >= 0)
+    struct timeval timeout = {0, INGEST_RECV_TIMEOUT_MS * 1000};
+    for (int sock : {sockets.udp, sockets.unix_dgram})
     {
-        std::string command_line = sub.command_buffer.substr(0, newline_offset);
-        sub.command_buffer.consume(newline_offset + 1);
-        command_line.erase(0, command_line.find_first_not_of(" \t\r\n"));
-        command_line.erase(command_line.find_last_not_of(" \t\r\n") + 1);
-        if (!command_line.empty())
+        if (sock >= 0 && setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
         {
-            parse_and_execute_command(sub, command_line);
+            perror("WARN: setsockopt SO_RCVTIMEO failed");
         }
     }
-    return true;
+
+    for (size_t i = 0; i < config.pipeline_senders; ++i)
+    {
+        pipeline.senders.emplace_back(new SendStage());
+        SendStage *stage = pipeline.senders.back().get();
+        stage->thread = std::thread(run_send_stage, stage);
+    }
+    pipeline.match_thread = std::thread(run_match_stage, &pipeline);
+    // The Unix datagram socket gets one ingest thread of its own.
+    size_t stages = config.ingest_threads + (sockets.unix_dgram >= 0 ? 1 : 0);
+    for (size_t i = 0; i < stages; ++i)
+    {
+        pipeline.ingest_stages.emplace_back(new IngestStage());
+        pipeline.ingest_stages.back()->socket = i < config.ingest_threads ? sockets.udp : sockets.unix_dgram;
+        pipeline.ingest_threads.emplace_back(run_ingest_stage, &pipeline, pipeline.ingest_stages.back().get());
+    }
+    std::cerr << "Pipeline mode: " << config.ingest_threads << " ingest thread(s), 1 match stage, "
+              << config.pipeline_senders << " send stage(s)" << std::endl;
+}
+
+static void stop_pipeline(Pipeline &pipeline)
+{
+    pipeline.stop.store(true);
+    for (std::thread &thread : pipeline.ingest_threads)
+    {
+        thread.join();
+    }
+    pipeline.stop_match.store(true);
+    pipeline.match_notifier.wake();
+    pipeline.match_thread.join();
+    PipelineMessage *leftover;
+    while (pipeline.ingest_queue.pop(leftover))
+    {
+        release_pipeline_message(leftover);
+    }
+    while (pipeline.completed.pop(leftover))
+    {
+        release_pipeline_message(leftover);
+    }
+    for (std::unique_ptr<SendStage> &stage : pipeline.senders)
+    {
+        stage->stop.store(true);
+        stage->notifier.wake();
+        stage->thread.join();
+    }
 }
 
-static void parse_and_execute_command(Subscriber &sub, const std::string &command_line)
+static void run_ingest_stage(Pipeline *pipeline, IngestStage *stage)
 {
-    std::stringstream ss(command_line);
-    std::string command_verb;
-    ss >> command_verb;
+    char buffers[PIPELINE_BATCH][BUFFER_SIZE];
+    struct sockaddr_in senders[PIPELINE_BATCH];
+    struct iovec iovecs[PIPELINE_BATCH];
+    struct mmsghdr msgs[PIPELINE_BATCH];
+    PipelineMessage *batch[PIPELINE_BATCH];
 
-    if (command_verb == "subscribe")
+    while (!pipeline->stop.load(std::memory_order_relaxed))
     {
-        std::string topic;
-        int sf = -1;
-        if (ss >> topic >> sf && (sf == 0 || sf == 1) && ss.peek() == EOF)
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < PIPELINE_BATCH; ++i)
+        {
+            iovecs[i].iov_base = buffers[i];
+            iovecs[i].iov_len = BUFFER_SIZE - 1;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &senders[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(senders[i]);
+        }
+
+        // Only a receive that finds data waiting is timed; the blocking retry
+        // would charge idle time to the receive stage.
+        uint64_t start = stage_clock();
+        int received = recvmmsg(stage->socket, msgs, PIPELINE_BATCH, MSG_DONTWAIT, NULL);
+        if (received > 0)
+        {
+            stage->latency.record(STAGE_RECEIVE, start);
+        }
+        else if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            received = recvmmsg(stage->socket, msgs, PIPELINE_BATCH, MSG_WAITFORONE, NULL);
+        }
+        if (received <= 0)
         {
-            if (topic.length() <= TOPIC_SIZE)
+            if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
             {
-                sub.topics[topic] = (sf == 1);
+                perror("WARN: recvmmsg UDP failed");
             }
-            else
+            continue;
+        }
+        stage->stats.add(STAT_DATAGRAMS_RECEIVED, received);
+
+        size_t count = 0;
+        for (int i = 0; i < received; ++i)
+        {
+            PipelineMessage *message = new PipelineMessage();
+            start = stage_clock();
+            if (!parse_udp_datagram(buffers[i], msgs[i].msg_len, message->msg))
+            {
+                stage->stats.add(STAT_DATAGRAMS_REJECTED);
+                delete message;
+                continue;
+            }
+            stage->latency.record(STAGE_PARSE, start);
+            stage->stats.add(STAT_DATAGRAMS_PARSED);
+            mark_local_sender(msgs[i].msg_hdr, senders[i]);
+            message->msg.sender_addr = senders[i];
+            start = stage_clock();
+            message->packet = serialize_forward_message(message->msg);
+            stage->latency.record(STAGE_SERIALIZE, start);
+            batch[count++] = message;
+        }
+
+        uint64_t queued_at = stage_clock();
+        for (size_t i = 0; i < count; ++i)
+        {
+            batch[i]->queued_at = queued_at;
+        }
+
+        size_t pushed = 0;
+        while (pushed < count)
+        {
+            size_t n = pipeline->ingest_queue.push_batch(batch + pushed, count - pushed);
+            pushed += n;
+            pipeline->match_notifier.notify();
+            if (n == 0)
             {
-                std::cerr << "ERROR: Topic too long (max " << TOPIC_SIZE << " characters)." << std::endl;
+                std::this_thread::yield();
             }
         }
     }
+}
 
-    else if (command_verb == "unsubscribe")
+static void run_match_stage(Pipeline *pipeline)
+{
+    int reader = pipeline->index.register_reader();
+    PipelineMessage *batch[PIPELINE_BATCH];
+    std::vector<IndexMatch> matches;
+    while (true)
     {
-        std::string topic;
-        if (ss >> topic && ss.peek() == EOF)
+        size_t count = pipeline->ingest_queue.pop_batch(batch, PIPELINE_BATCH);
+        if (count == 0)
         {
-            if (topic.length() <= TOPIC_SIZE)
+            if (pipeline->stop_match.load())
+            {
+                break;
+            }
+            pipeline->match_notifier.arm();
+            if (pipeline->ingest_queue.empty() && !pipeline->stop_match.load())
             {
-                sub.topics.erase(topic);
+                pipeline->match_notifier.wait();
             }
-            else
+            continue;
+        }
+
+        const SubscriptionSnapshot *snapshot = pipeline->index.read_lock(reader);
+        for (size_t i = 0; i < count; ++i)
+        {
+            PipelineMessage *message = batch[i];
+            pipeline->match_latency.record(STAGE_QUEUE, message->queued_at);
+            uint64_t start = stage_clock();
+            matches.clear();
+            size_t filtered = snapshot->match(split_topic(message->msg.topic), message->msg, matches);
+            pipeline->match_latency.record(STAGE_MATCH, start);
+            pipeline->match_stats.add(STAT_MESSAGES_FILTERED, filtered);
+            pipeline->topics.record(message->msg.topic);
+            pipeline->match_stats.add(STAT_MESSAGES_MATCHED, matches.size());
+            for (const IndexMatch &match : matches)
+            {
+                const IndexedSubscriber *sub = match.subscriber;
+                if (sub->socket >= 0)
+                {
+                    message->refs.fetch_add(1, std::memory_order_relaxed);
+                    enqueue_send(*pipeline, SEND_PACKET, sub->socket, sub->connection, message);
+                }
+                else if (match.sf)
+                {
+                    message->sf_targets.push_back(sub->id);
+                }
+            }
+        }
+        pipeline->index.read_unlock(reader);
+
+        size_t pushed = 0;
+        while (pushed < count)
+        {
+            size_t n = pipeline->completed.push_batch(batch + pushed, count - pushed);
+            pushed += n;
+            pipeline->completion_notifier.notify();
+            if (n == 0)
             {
-                std::cerr << "ERROR: Topic too long (max " << TOPIC_SIZE << " characters)." << std::endl;
+                std::this_thread::yield();
             }
         }
     }
+    pipeline->index.unregister_reader(reader);
+}
 
-    else
+static void run_send_stage(SendStage *stage)
+{
+    SendDescriptor batch[PIPELINE_BATCH];
+    std::map<int, uint64_t> live_connections;
+    while (true)
     {
-        std::cerr << "ERROR: Unknown command." << std::endl;
+        size_t count = stage->queue.pop_batch(batch, PIPELINE_BATCH);
+        if (count == 0)
+        {
+            if (stage->stop.load())
+            {
+                break;
+            }
+            stage->notifier.arm();
+            if (stage->queue.empty() && !stage->stop.load())
+            {
+                stage->notifier.wait();
+            }
+            continue;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            SendDescriptor &desc = batch[i];
+            auto live = live_connections.find(desc.socket);
+            bool current = live != live_connections.end() && live->second == desc.connection;
+            if (desc.kind == SEND_OPEN)
+            {
+                live_connections[desc.socket] = desc.connection;
+                continue;
+            }
+            if (desc.kind == SEND_CLOSE)
+            {
+                if (current)
+                {
+                    close(desc.socket);
+                    live_connections.erase(live);
+                }
+                continue;
+            }
+            stage->latency.record(STAGE_QUEUE, desc.queued_at);
+            if (current)
+            {
+                const std::vector<char> &packet = desc.message->packet;
+                uint64_t start = stage_clock();
+                ssize_t sent = send_all(desc.socket, packet.data(), packet.size(), MSG_NOSIGNAL);
+                stage->latency.record(STAGE_SEND, start);
+                if (sent > 0)
+                {
+                    stage->stats.add(STAT_BYTES_SENT, sent);
+                }
+                if (sent < 0 || (size_t)sent != packet.size())
+                {
+                    stage->stats.add(STAT_SEND_FAILURES);
+                    if (errno != EPIPE && errno != ECONNRESET)
+                    {
+                        perror("WARN: send stage failed to send to subscriber");
+                    }
+                }
+            }
+            release_pipeline_message(desc.message);
+        }
     }
 }
 
-static bool parse_udp_datagram(const char *buffer, int bytes_received, UdpMessage &udp_msg)
+static void drain_completed_queue(ServerContext &ctx)
 {
-    memset(&udp_msg, 0, sizeof(UdpMessage));
-    int topic_len_to_copy = std::min(bytes_received, TOPIC_SIZE);
-    memcpy(udp_msg.topic, buffer, topic_len_to_copy);
-    udp_msg.topic[std::min(topic_len_to_copy, TOPIC_SIZE)] = '\0';
-
-    if (bytes_received < (TOPIC_SIZE + 1))
+    PipelineMessage *batch[PIPELINE_BATCH];
+    size_t count;
+    while ((count = ctx.pipeline->completed.pop_batch(batch, PIPELINE_BATCH)) > 0)
     {
-        return false;
+        for (size_t i = 0; i < count; ++i)
+        {
+            PipelineMessage *message = batch[i];
+            for (const std::string &id : message->sf_targets)
+            {
+                auto it = ctx.subscribers.find(id);
+                if (it == ctx.subscribers.end())
+                {
+                    continue;
+                }
+                Subscriber &sub = it->second;
+                if (sub.connected)
+                {
+                    send_to_subscriber(ctx, sub, message->packet, message, false);
+                }
+                else
+                {
+                    store_for_later(ctx, sub, message->packet);
+                }
+            }
+            if (ctx.history.enabled())
+            {
+                ctx.history.record(message->msg.topic, std::vector<char>(message->packet));
+            }
+            release_pipeline_message(message);
+        }
     }
-    udp_msg.type = (uint8_t)buffer[TOPIC_SIZE];
+}
+
+static void start_reactors(ReactorPool &pool, const ServerConfig &config)
+{
+    // The history lives with the listener, which sees every message once;
+    // the reactors only replay from it.
+    ServerConfig reactor_config = config;
+    reactor_config.history_memory = 0;
 
-    udp_msg.content_len = bytes_received - (TOPIC_SIZE + 1);
-    if (udp_msg.content_len < 0)
+    pool.assigned.assign(config.reactors, 0);
+    for (size_t i = 0; i < config.reactors; ++i)
     {
-        udp_msg.content_len = 0;
+        pool.reactors.emplace_back(new Reactor(reactor_config));
+        Reactor *reactor = pool.reactors.back().get();
+        if (config.pin_cpu >= 0)
+        {
+            // The event loop keeps pin_cpu; reactors take the CPUs after it.
+            reactor->cpu = (config.pin_cpu + 1 + i) % std::max(1u, std::thread::hardware_concurrency());
+        }
+        reactor->ctx->shared_history = &pool.history;
+        reactor->ctx->poll_fds.push_back({-1, 0, 0});                             // [0] unused (listener)
+        reactor->ctx->poll_fds.push_back({reactor->notifier.get_fd(), POLLIN, 0}); // [1] Handoff/fan-out wakeup
+        reactor->ctx->poll_fds.push_back({-1, 0, 0});                             // [2] unused (stdin)
+        reactor->ctx->poll_fds.push_back({-1, 0, 0});                             // [3] unused (Unix listener)
+        reactor->ctx->poll_fds.push_back({-1, 0, 0});                             // [4] unused (Unix datagrams)
+        reactor->thread = std::thread(run_reactor, reactor);
     }
+    std::cerr << "Reactor mode: " << config.reactors << " connection thread(s)" << std::endl;
+}
 
-    if (udp_msg.content_len > 0)
+static void stop_reactors(ReactorPool &pool)
+{
+    for (std::unique_ptr<Reactor> &reactor : pool.reactors)
     {
-        int content_len_to_copy = std::min(udp_msg.content_len, MAX_CONTENT_SIZE);
-        memcpy(udp_msg.content, buffer + TOPIC_SIZE + 1, content_len_to_copy);
-        udp_msg.content[content_len_to_copy] = '\0';
-        udp_msg.content_len = content_len_to_copy;
+        reactor->stop.store(true);
+        reactor->notifier.wake();
     }
-    else
+    for (std::unique_ptr<Reactor> &reactor : pool.reactors)
     {
-        udp_msg.content[0] = '\0';
+        reactor->thread.join();
+        PipelineMessage *leftover;
+        while (reactor->fanout.pop(leftover))
+        {
+            release_pipeline_message(leftover);
+        }
+        Handoff handoff;
+        while (reactor->handoffs.pop(handoff))
+        {
+            close(handoff.socket);
+        }
     }
-    return true;
 }
 
-static std::vector<char> serialize_forward_message(const UdpMessage &msg)
+static void run_reactor(Reactor *reactor)
 {
-    std::vector<char> payload_buffer;
-    payload_buffer.reserve(sizeof(uint32_t) + sizeof(uint16_t) + 1 + TOPIC_SIZE + 1 + sizeof(uint16_t) + MAX_CONTENT_SIZE + 10);
-
-    uint32_t net_ip = msg.sender_addr.sin_addr.s_addr;
-    const char *ip_bytes = reinterpret_cast<const char *>(&net_ip);
-    payload_buffer.insert(payload_buffer.end(), ip_bytes, ip_bytes + sizeof(net_ip));
-
-    uint16_t net_port = msg.sender_addr.sin_port;
-    const char *port_bytes = reinterpret_cast<const char *>(&net_port);
-    payload_buffer.insert(payload_buffer.end(), port_bytes, port_bytes + sizeof(net_port));
-
-    size_t topic_actual_len = strnlen(msg.topic, TOPIC_SIZE);
-    uint8_t topic_len_byte = static_cast<uint8_t>(topic_actual_len);
-    payload_buffer.push_back(topic_len_byte);
-    payload_buffer.insert(payload_buffer.end(), msg.topic, msg.topic + topic_len_byte);
+    ServerContext &ctx = *reactor->ctx;
+    if (reactor->cpu >= 0 && !pin_thread_to_cpu(reactor->cpu))
+    {
+        std::cerr << "WARN: Could not pin reactor to CPU " << reactor->cpu << "." << std::endl;
+    }
+    while (!reactor->stop.load(std::memory_order_relaxed))
+    {
+        int poll_timeout = -1;
+        reactor->notifier.arm();
+        if (!reactor->handoffs.empty() || !reactor->fanout.empty() || reactor->stop.load())
+        {
+            poll_timeout = 0;
+        }
+        poll_timeout = next_timer_timeout(ctx, poll_timeout);
+        int poll_count = spin_poll(ctx.poll_fds.data(), ctx.poll_fds.size(), poll_timeout, ctx.spin);
+        if (poll_count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            error("ERROR on reactor poll");
+        }
 
-    payload_buffer.push_back(msg.type);
+        if (ctx.poll_fds[1].revents & POLLIN)
+        {
+            reactor->notifier.drain();
+        }
+        process_handoffs(*reactor);
+        drain_fanout_queue(*reactor);
+        handle_client_activity(ctx);
+        flush_turn_batches(ctx);
+        run_flush_timers(ctx);
+        run_lag_checks(ctx);
 
-    uint16_t content_len_16 = static_cast<uint16_t>(msg.content_len);
-    uint16_t net_content_len = htons(content_len_16);
-    const char *content_len_bytes = reinterpret_cast<const char *>(&net_content_len);
-    payload_buffer.insert(payload_buffer.end(), content_len_bytes, content_len_bytes + sizeof(net_content_len));
+        for (auto &pfd_entry : ctx.poll_fds)
+        {
+            pfd_entry.revents = 0;
+        }
+    }
+}
 
-    if (msg.content_len > 0)
+static void hand_off_connection(ServerContext &ctx, const std::string &client_id, int client_socket, const struct sockaddr_in &client_addr)
+{
+    ReactorPool &pool = *ctx.reactors;
+    std::unique_ptr<ClientRecord> &record = pool.registry[client_id];
+    if (!record)
     {
-        payload_buffer.insert(payload_buffer.end(), msg.content, msg.content + msg.content_len);
+        record.reset(new ClientRecord());
+        size_t least_loaded = std::min_element(pool.assigned.begin(), pool.assigned.end()) - pool.assigned.begin();
+        record->reactor = least_loaded;
+        pool.assigned[least_loaded]++;
     }
+    else if (record->connected.load(std::memory_order_acquire))
+    {
+        std::cout << "Client " << client_id << " already connected." << std::endl;
+        fflush(stdout);
+        ctx.stats.add(STAT_CONNECTIONS_REFUSED);
+        close(client_socket);
+        return;
+    }
+    record->connected.store(true, std::memory_order_release);
 
-    std::vector<char> final_packet;
-    uint32_t total_payload_len_32 = static_cast<uint32_t>(payload_buffer.size());
-    uint32_t net_total_payload_len = htonl(total_payload_len_32);
-    const char *total_len_bytes = reinterpret_cast<const char *>(&net_total_payload_len);
-
-    final_packet.reserve(sizeof(net_total_payload_len) + payload_buffer.size());
-    final_packet.insert(final_packet.end(), total_len_bytes, total_len_bytes + sizeof(net_total_payload_len));
-    final_packet.insert(final_packet.end(), payload_buffer.begin(), payload_buffer.end());
+    Reactor &reactor = *pool.reactors[record->reactor];
+    Handoff handoff;
+    handoff.socket = client_socket;
+    handoff.id = client_id;
+    handoff.addr = client_addr;
+    handoff.record = record.get();
+    while (!reactor.handoffs.push(std::move(handoff)))
+    {
+        reactor.notifier.notify();
+        std::this_thread::yield();
+    }
+    reactor.notifier.notify();
+}
 
-    return final_packet;
+static void process_handoffs(Reactor &reactor)
+{
+    ServerContext &ctx = *reactor.ctx;
+    Handoff handoff;
+    while (reactor.handoffs.pop(handoff))
+    {
+        auto it = ctx.subscribers.find(handoff.id);
+        if (it != ctx.subscribers.end())
+        {
+            handle_reconnection(ctx, it->second, handoff.socket, handoff.addr);
+        }
+        else
+        {
+            handle_new_client(ctx, handoff.id, handoff.socket, handoff.addr);
+        }
+        ctx.subscribers[handoff.id].record = handoff.record;
+    }
 }
 
-static void distribute_udp_message(const UdpMessage &msg, const std::vector<char> &serialized_packet, SubscribersMap &subscribers)
+static void drain_fanout_queue(Reactor &reactor)
 {
-    std::string topic_str(msg.topic);
-    for (auto &pair : subscribers)
+    ServerContext &ctx = *reactor.ctx;
+    PipelineMessage *batch[PIPELINE_BATCH];
+    size_t count;
+    while ((count = reactor.fanout.pop_batch(batch, PIPELINE_BATCH)) > 0)
     {
-        Subscriber &sub = pair.second;
-        for (const auto &topic_pair : sub.topics)
+        for (size_t i = 0; i < count; ++i)
         {
-            const std::string &pattern = topic_pair.first;
-            bool sf_enabled = topic_pair.second;
-            if (topic_matches(topic_str, pattern))
-            {
-                if (sub.connected)
-                {
-                    ssize_t sent = send_all(sub.socket, serialized_packet.data(), serialized_packet.size(), MSG_NOSIGNAL);
-                    if (sent < 0 || (size_t)sent != serialized_packet.size())
-                    {
-                        if (errno != EPIPE && errno != ECONNRESET)
-                        {
-                            perror("WARN: send_all to subscriber failed");
-                        }
-                    }
-                }
-                else if (sf_enabled)
-                {
-                    sub.stored_messages.push_back(serialized_packet);
-                }
-                break;
-            }
+            PipelineMessage *message = batch[i];
+            ctx.latency.record(STAGE_QUEUE, message->queued_at);
+            distribute_udp_message(ctx, message->msg, message->packet, nullptr);
+            ctx.history_seen = message->history_seq;
+            release_pipeline_message(message);
         }
     }
-}
\ No newline at end of file
+}
@@ -1,5 +1,9 @@
 #include "circular_buffer.h"
 #include "common.h"
+#include "edge_relay.h"
+#include "latency_stamp.h"
+#include "received_message.h"
+#include "shm_ring.h"
 #include <cstdio>
 #include <cstdlib>
 #include <arpa/inet.h>
@@ -9,19 +13,28 @@
 #include <limits>
 #include <sstream>
 #include <stdexcept>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
-static bool parse_arguments(int argc, char *argv[], std::string &client_id, std::string &server_ip, int &server_port);
+static bool parse_arguments(int argc, char *argv[], std::string &client_id, std::string &server_ip, int &server_port,
+                            bool &measure, bool &batch_frames, bool &dictionary, std::string &shm_path,
+                            std::string &relay_address);
 static int setup_and_connect(const std::string &server_ip, int server_port);
-static bool send_client_id(int client_socket, const std::string &client_id);
+static bool send_client_id(int client_socket, const std::string &client_id, bool batch_frames, bool dictionary);
+static bool attach_shared_ring(int client_socket, const std::string &client_id, const std::string &shm_path, ShmRing &ring);
+static void read_shared_ring(ShmRing &ring, LatencyTracker *tracker, const std::atomic<bool> &stop);
 static void initialize_poll_fds(std::vector<struct pollfd> &poll_fds, int client_socket);
 static void handle_user_input(int client_socket, bool &running);
 static ssize_t receive_server_data(int client_socket, CircularBuffer<char> &server_buffer);
-static std::string format_received_message(const std::string &sender_ip, uint16_t sender_port,
-                                           const std::string &topic, uint8_t udp_type,
-                                           const char *content_data, uint16_t content_len);
-static void deserialize_and_process_message(CircularBuffer<char> &server_buffer);
-static void handle_server_message(int client_socket, CircularBuffer<char> &server_buffer, bool &running);
-static void subscriber_loop(int client_socket, std::vector<struct pollfd> &poll_fds);
+static void handle_server_message(int client_socket, CircularBuffer<char> &server_buffer, bool &running,
+                                  LatencyTracker *tracker, WireDictionaryTable &dictionary);
+static void subscriber_loop(int client_socket, std::vector<struct pollfd> &poll_fds, LatencyTracker *tracker, ShmRing *ring);
+static int run_relay(int client_socket, const std::string &relay_address);
+
+// Once a shared-memory reader runs, it and the main thread take turns on
+// stdout and the latency tracker.
+static std::mutex output_mutex;
 
 int main(int argc, char *argv[])
 {
@@ -30,15 +43,33 @@ int main(int argc, char *argv[])
     std::string client_id;
     std::string server_ip;
     int server_port;
-
-    if (!parse_arguments(argc, argv, client_id, server_ip, server_port))
+    bool measure = false;
+    bool batch_frames = false;
+    bool dictionary = false;
+    std::string shm_path;
+    std::string relay_address;
+
+    if (!parse_arguments(argc, argv, client_id, server_ip, server_port, measure, batch_frames, dictionary, shm_path,
+                         relay_address))
     {
         return 1;
     }
 
     int client_socket = setup_and_connect(server_ip, server_port);
 
-    if (!send_client_id(client_socket, client_id))
+    if (!send_client_id(client_socket, client_id, batch_frames, dictionary))
+    {
+        close(client_socket);
+        return 1;
+    }
+
+    if (!relay_address.empty())
+    {
+        return run_relay(client_socket, relay_address);
+    }
+
+    ShmRing ring;
+    if (!shm_path.empty() && !attach_shared_ring(client_socket, client_id, shm_path, ring))
     {
         close(client_socket);
         return 1;
@@ -47,17 +78,68 @@ int main(int argc, char *argv[])
     std::vector<struct pollfd> poll_fds(2);
 
     initialize_poll_fds(poll_fds, client_socket);
-    subscriber_loop(client_socket, poll_fds);
+    LatencyTracker tracker;
+    subscriber_loop(client_socket, poll_fds, measure ? &tracker : nullptr, ring.is_open() ? &ring : nullptr);
     close(client_socket);
 
+    if (measure)
+    {
+        tracker.print_summary(std::cout);
+    }
+
     return 0;
 }
 
-static bool parse_arguments(int argc, char *argv[], std::string &client_id, std::string &server_ip, int &server_port)
+static bool parse_arguments(int argc, char *argv[], std::string &client_id, std::string &server_ip, int &server_port,
+                            bool &measure, bool &batch_frames, bool &dictionary, std::string &shm_path,
+                            std::string &relay_address)
 {
-    if (argc != 4)
+    // --measure replaces the printing of every message with latency, loss
+    // and reordering figures for loadgen --stamp traffic, shown on exit.
+    // --batch-frames lets the server pack the messages of a turn into batch frames.
+    // --dictionary has senders and topics sent once and named by ID after that.
+    // --shm PATH takes the messages from the broker's shared-memory ring
+    // instead of the TCP connection; the broker must run on this host.
+    // --relay PORT|unix:PATH turns the subscriber into an edge relay that
+    // local subscribers connect to instead of the broker.
+    bool options_valid = argc >= 4;
+    for (int i = 4; i < argc && options_valid; ++i)
+    {
+        std::string option = argv[i];
+        if (option == "--measure")
+        {
+            measure = true;
+        }
+        else if (option == "--batch-frames")
+        {
+            batch_frames = true;
+        }
+        else if (option == "--dictionary")
+        {
+            dictionary = true;
+        }
+        else if (option == "--shm" && i + 1 < argc)
+        {
+            shm_path = argv[++i];
+        }
+        else if (option == "--relay" && i + 1 < argc)
+        {
+            relay_address = argv[++i];
+        }
+        else
+        {
+            options_valid = false;
+        }
+    }
+    if (!relay_address.empty() && (measure || !shm_path.empty()))
     {
-        std::cerr << "Usage: " << argv[0] << " <ID_CLIENT> <IP_SERVER> <PORT_SERVER>" << std::endl;
+        std::cerr << "ERROR: --relay cannot be combined with --measure or --shm." << std::endl;
+        return false;
+    }
+    if (!options_valid)
+    {
+        std::cerr << "Usage: " << argv[0] << " <ID_CLIENT> <IP_SERVER|unix:PATH> <PORT_SERVER> [--measure] [--batch-frames] [--dictionary]"
+                  << " [--shm PATH] [--relay PORT|unix:PATH]" << std::endl;
         return false;
     }
     
@@ -72,7 +154,9 @@ static bool parse_arguments(int argc, char *argv[], std::string &client_id, std:
     server_ip = argv[2];
     server_port = atoi(argv[3]);
     
-    if (server_port <= 0 || server_port > 65535)
+    // With unix:PATH as the server address the port is not used.
+    bool is_unix = server_ip.compare(0, strlen(UNIX_ADDRESS_PREFIX), UNIX_ADDRESS_PREFIX) == 0;
+    if (!is_unix && (server_port <= 0 || server_port > 65535))
     {
         std::cerr << "ERROR: Invalid server port." << std::endl;
         return false;
@@ -83,6 +167,27 @@ static bool parse_arguments(int argc, char *argv[], std::string &client_id, std:
 
 static int setup_and_connect(const std::string &server_ip, int server_port)
 {
+    if (server_ip.compare(0, strlen(UNIX_ADDRESS_PREFIX), UNIX_ADDRESS_PREFIX) == 0)
+    {
+        struct sockaddr_un server_addr;
+        if (!make_unix_address(server_ip.substr(strlen(UNIX_ADDRESS_PREFIX)), server_addr))
+        {
+            std::cerr << "ERROR: Invalid Unix socket path." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        int client_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (client_socket < 0)
+        {
+            error("ERROR opening socket");
+        }
+        if (connect(client_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+        {
+            close(client_socket);
+            error("ERROR connecting to server");
+        }
+        return client_socket;
+    }
+
     int client_socket = socket(AF_INET, SOCK_STREAM, 0);
     
     if (client_socket < 0)
@@ -117,17 +222,78 @@ static int setup_and_connect(const std::string &server_ip, int server_port)
     return client_socket;
 }
 
-static bool send_client_id(int client_socket, const std::string &client_id)
+static bool send_client_id(int client_socket, const std::string &client_id, bool batch_frames, bool dictionary)
 {
     if (send_all(client_socket, client_id.c_str(), client_id.length() + 1, 0) < 0)
     {
         std::cerr << "ERROR sending client ID failed." << std::endl;
         return false;
     }
+
+    // The dictionary lives as long as this connection: a reconnect starts
+    // with empty tables on both sides.
+    const std::string frames_cmd = std::string("frames ") + (batch_frames ? "batch" : "single") +
+                                   (dictionary ? " dict" : "") + "\n";
+    if ((batch_frames || dictionary) && send_all(client_socket, frames_cmd.c_str(), frames_cmd.size(), 0) < 0)
+    {
+        std::cerr << "ERROR negotiating frame encoding failed." << std::endl;
+        return false;
+    }
     
     return true;
 }
 
+// The ring is attached before asking for it, so a mapping that does not
+// belong to a broker never changes how the connection delivers.
+static bool attach_shared_ring(int client_socket, const std::string &client_id, const std::string &shm_path, ShmRing &ring)
+{
+    if (!ring.attach(shm_path))
+    {
+        std::cerr << "ERROR: Cannot attach the shared-memory ring " << shm_path << "." << std::endl;
+        return false;
+    }
+    const std::string transport_cmd = "transport shm\n";
+    if (send_all(client_socket, transport_cmd.c_str(), transport_cmd.size(), 0) < 0)
+    {
+        std::cerr << "ERROR negotiating the shared-memory transport failed." << std::endl;
+        return false;
+    }
+    if (!ring.wait_for_slot(client_id, SHM_ATTACH_TIMEOUT_MS))
+    {
+        std::cerr << "ERROR: The server assigned no shared-memory slot (all taken, or no --shm)." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Spins for a while after the last frame, since a burst usually continues,
+// then sleeps on the ring's futex.
+static void read_shared_ring(ShmRing &ring, LatencyTracker *tracker, const std::atomic<bool> &stop)
+{
+    std::vector<char> frames;
+    WireDictionaryTable dictionary; // ring frames are never dictionary encoded
+    int idle_rounds = 0;
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        frames.clear();
+        if (ring.read(frames) > 0)
+        {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            process_forward_frames(frames.data(), frames.size(), std::cout, tracker, dictionary);
+            idle_rounds = 0;
+        }
+        else if (++idle_rounds >= SHM_SPIN_ROUNDS)
+        {
+            ring.wait(SHM_WAIT_MS);
+        }
+    }
+    if (ring.overruns() > 0)
+    {
+        std::cerr << "WARN: Fell a whole shared-memory ring behind " << ring.overruns()
+                  << " times; the frames in between were lost." << std::endl;
+    }
+}
+
 static void initialize_poll_fds(std::vector<struct pollfd> &poll_fds, int client_socket)
 {
     poll_fds[0].fd = STDIN_FILENO;
@@ -138,10 +304,17 @@ static void initialize_poll_fds(std::vector<struct pollfd> &poll_fds, int client
     poll_fds[1].revents = 0;
 }
 
-static void subscriber_loop(int client_socket, std::vector<struct pollfd> &poll_fds)
+static void subscriber_loop(int client_socket, std::vector<struct pollfd> &poll_fds, LatencyTracker *tracker, ShmRing *ring)
 {
     CircularBuffer<char> server_buffer(CIRCULAR_BUFFER_SIZE);
+    WireDictionaryTable dictionary;
     bool running = true;
+    std::atomic<bool> stop_reader(false);
+    std::thread reader;
+    if (ring)
+    {
+        reader = std::thread(read_shared_ring, std::ref(*ring), tracker, std::cref(stop_reader));
+    }
 
     while (running)
     {
@@ -168,12 +341,12 @@ static void subscriber_loop(int client_socket, std::vector<struct pollfd> &poll_
 
         if (!disconnected && (poll_fds[1].revents & POLLIN))
         {
-            handle_server_message(client_socket, server_buffer, running);
+            handle_server_message(client_socket, server_buffer, running, tracker, dictionary);
         }
 
         else if (disconnected)
         {
-            handle_server_message(client_socket, server_buffer, running);
+            handle_server_message(client_socket, server_buffer, running, tracker, dictionary);
             if (running)
             {
                 std::cerr << "ERROR: Server connection error/hangup." << std::endl;
@@ -186,6 +359,12 @@ static void subscriber_loop(int client_socket, std::vector<struct pollfd> &poll_
             pfd.revents = 0;
         }
     }
+
+    if (reader.joinable())
+    {
+        stop_reader.store(true);
+        reader.join();
+    }
 }
 
 
@@ -229,8 +408,34 @@ static void handle_user_input(int client_socket, bool &running)
     {
         std::string topic;
         int sf_val = 0;
-        
-        if (ss >> topic && ss.peek() == EOF)
+        std::string options;
+        bool options_valid = true;
+
+        if (ss >> topic)
+        {
+            std::string option;
+            bool first_option = true;
+            while (ss >> option)
+            {
+                // An optional bare 0/1 right after the topic is the SF flag.
+                if (first_option && (option == "0" || option == "1"))
+                {
+                    sf_val = option == "1";
+                    first_option = false;
+                    continue;
+                }
+                first_option = false;
+                size_t eq = option.find('=');
+                if (eq == 0 || eq == std::string::npos || eq + 1 == option.size())
+                {
+                    options_valid = false;
+                    break;
+                }
+                options += " " + option;
+            }
+        }
+
+        if (!topic.empty() && options_valid)
         {
             if (topic.length() > TOPIC_SIZE)
             {
@@ -238,13 +443,14 @@ static void handle_user_input(int client_socket, bool &running)
             }
             else
             {
-                std::string cmd = "subscribe " + topic + " " + std::to_string(sf_val) + "\n";
+                std::string cmd = "subscribe " + topic + " " + std::to_string(sf_val) + options + "\n";
                 if (send_all(client_socket, cmd.c_str(), cmd.size(), 0) < 0)
                 {
                     running = false;
                 }
                 else
                 {
+                    std::lock_guard<std::mutex> lock(output_mutex);
                     std::cout << "Subscribed to topic." << std::endl;
                 }
             }
@@ -252,19 +458,17 @@ static void handle_user_input(int client_socket, bool &running)
 
         else
         {
-            std::cerr << "Usage: subscribe <topic>" << std::endl;
-
-            if (!ss.eof())
-            {
-                ss.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-            }
+            std::cerr << "Usage: subscribe <topic> [SF] [last=N] [delay_us=US] [batch_bytes=N] [where=TYPE[<op>VALUE]]"
+                      << " [max_rate=N [burst=K] | sample_ms=T] [group=NAME [policy=rr|least|hash]]" << std::endl;
         }
     }
 
     else if (command_verb == "unsubscribe")
     {
         std::string topic;
-        if (ss >> topic && ss.eof())
+        std::string group;
+        // A shared subscription is left by naming its group.
+        if (ss >> topic && (ss.eof() || (ss >> group && group.compare(0, 6, "group=") == 0 && group.size() > 6 && ss.eof())))
         {
             if (topic.length() > TOPIC_SIZE)
             {
@@ -272,20 +476,21 @@ static void handle_user_input(int client_socket, bool &running)
             }
             else
             {
-                std::string cmd = "unsubscribe " + topic + "\n";
+                std::string cmd = "unsubscribe " + topic + (group.empty() ? "" : " " + group) + "\n";
                 if (send_all(client_socket, cmd.c_str(), cmd.size(), 0) < 0)
                 {
                     running = false;
                 }
                 else
                 {
+                    std::lock_guard<std::mutex> lock(output_mutex);
                     std::cout << "Unsubscribed from topic." << std::endl;
                 }
             }
         }
         else
         {
-            std::cerr << "Usage: unsubscribe <topic>" << std::endl;
+            std::cerr << "Usage: unsubscribe <topic> [group=NAME]" << std::endl;
         }
     }
 
@@ -326,256 +531,8 @@ static ssize_t receive_server_data(int client_socket, CircularBuffer<char> &buff
     return bytes_received;
 }
 
-static std::string format_received_message(const std::string &sender_ip, uint16_t sender_port,
-                                           const std::string &topic, uint8_t udp_type,
-                                           const char *content_data, uint16_t content_len)
-{
-    std::stringstream result_ss;
-    result_ss << sender_ip << ":" << sender_port << " - ";
-    result_ss << topic << " - ";
-    switch (udp_type)
-    {
-    case 0:
-    {
-        if (content_len < 5)
-        {
-            result_ss << "INT - INVALID DATA";
-            break;
-        }
-        uint8_t sign = content_data[0];
-        uint32_t net_val;
-        memcpy(&net_val, content_data + 1, 4);
-        int val = ntohl(net_val);
-        if (sign == 1)
-        {
-            val = -val;
-        }
-        else if (sign != 0)
-        {
-            result_ss << "INT - INVALID SIGN";
-            break;
-        }
-        result_ss << "INT - " << val;
-        break;
-    }
-    case 1:
-    {
-        if (content_len < 2)
-        {
-            result_ss << "SHORT_REAL - INVALID DATA";
-            break;
-        }
-        uint16_t net_val;
-        memcpy(&net_val, content_data, 2);
-        float val = ntohs(net_val) / 100.0f;
-        if (val == static_cast<int>(val))
-        {
-            result_ss << "SHORT_REAL - " << static_cast<int>(val);
-        }
-        else
-        {
-            result_ss << "SHORT_REAL - " << std::fixed << std::setprecision(2) << val;
-            result_ss.unsetf(std::ios_base::floatfield);
-        }
-        break;
-    }
-    case 2:
-    {
-        if (content_len < 6)
-        {
-            result_ss << "FLOAT - INVALID DATA";
-            break;
-        }
-        uint8_t sign = content_data[0];
-        uint32_t net_val;
-        memcpy(&net_val, content_data + 1, 4);
-        uint8_t power = content_data[5];
-        double val = ntohl(net_val);
-        double p10 = 1.0;
-        for (int p = 0; p < power; ++p)
-        {
-            p10 /= 10.0;
-        }
-        val *= p10;
-        if (sign == 1)
-        {
-            val = -val;
-        }
-        else if (sign != 0)
-        {
-            result_ss << "FLOAT - INVALID SIGN";
-            break;
-        }
-        std::stringstream ss_float;
-        ss_float << std::fixed << std::setprecision(power) << val;
-        std::string fs = ss_float.str();
-        if (power > 0)
-        {
-            size_t dp = fs.find('.');
-            if (dp != std::string::npos)
-            {
-                size_t lnz = fs.find_last_not_of('0');
-                if (lnz == dp)
-                {
-                    fs.erase(dp);
-                }
-                else if (lnz > dp)
-                {
-                    fs.erase(lnz + 1);
-                }
-            }
-        }
-        else
-        {
-            if (val == static_cast<long long>(val))
-            {
-                fs = std::to_string(static_cast<long long>(val));
-            }
-        }
-        result_ss << "FLOAT - " << fs;
-        break;
-    }
-    case 3:
-    {
-        std::string str(content_data, content_len);
-        result_ss << "STRING - " << str;
-        break;
-    }
-    default:
-        result_ss << "UNKNOWN TYPE (" << (int)udp_type << ")";
-    }
-    return result_ss.str();
-}
-
-static void deserialize_and_process_message(CircularBuffer<char> &data_buffer)
-{
-    const size_t length_prefix_size = sizeof(uint32_t);
-    while (true)
-    {
-        if (data_buffer.bytes_available() < length_prefix_size)
-        {
-            break;
-        }
-        
-        uint32_t net_total_msg_len;
-        data_buffer.peek(reinterpret_cast<char *>(&net_total_msg_len), 0, length_prefix_size);
-        uint32_t total_payload_len = ntohl(net_total_msg_len);
-
-        if (total_payload_len == 0 || total_payload_len > 4 * BUFFER_SIZE)
-        {
-            std::cerr << "ERROR: Invalid payload length: " << total_payload_len << ". Clearing buffer." << std::endl;
-            data_buffer.reset();
-            break;
-        }
-
-        size_t total_packet_len = length_prefix_size + total_payload_len;
-
-        if (data_buffer.bytes_available() < total_packet_len)
-        {
-            break;
-        }
-
-        std::vector<char> full_packet_data(total_packet_len);
-        size_t actual_read = data_buffer.read(full_packet_data.data(), total_packet_len);
-
-        if (actual_read != total_packet_len)
-        {
-            std::cerr << "ERROR: Failed reading full packet. Expected " << total_packet_len << " got " << actual_read << ". Resetting buffer." << std::endl;
-            data_buffer.reset();
-            break;
-        }
-
-        const char *payload_data_ptr = full_packet_data.data() + length_prefix_size;
-        size_t current_offset = 0;
-        std::string sender_ip_str = "INVALID_IP";
-        uint16_t sender_port = 0;
-        std::string topic;
-        uint8_t udp_type = 255;
-        uint16_t content_len = 0;
-        const char *content_data_ptr = nullptr;
-
-        try
-        {
-            if (current_offset + sizeof(uint32_t) > total_payload_len)
-            {
-                throw std::runtime_error("Payload too small for IP");
-            }
-
-            uint32_t net_ip;
-            memcpy(&net_ip, payload_data_ptr + current_offset, sizeof(uint32_t));
-            current_offset += sizeof(uint32_t);
-            struct in_addr ip_addr;
-            ip_addr.s_addr = net_ip;
-            char ip_buffer[INET_ADDRSTRLEN];
-
-            if (inet_ntop(AF_INET, &ip_addr, ip_buffer, INET_ADDRSTRLEN))
-            {
-                sender_ip_str = ip_buffer;
-            }
-
-            if (current_offset + sizeof(uint16_t) > total_payload_len)
-            {
-                throw std::runtime_error("Payload too small for Port");
-            }
-
-            uint16_t net_port;
-            memcpy(&net_port, payload_data_ptr + current_offset, sizeof(uint16_t));
-            sender_port = ntohs(net_port);
-            current_offset += sizeof(uint16_t);
-
-            if (current_offset + sizeof(uint8_t) > total_payload_len)
-            {
-                throw std::runtime_error("Payload too small for Topic Len");
-            }
-
-            uint8_t topic_len;
-            memcpy(&topic_len, payload_data_ptr + current_offset, sizeof(uint8_t));
-            current_offset += sizeof(uint8_t);
-
-            if (topic_len > total_payload_len - current_offset)
-            {
-                throw std::runtime_error("Topic length exceeds remaining payload");
-            }
-
-            topic.assign(payload_data_ptr + current_offset, topic_len);
-            current_offset += topic_len;
-
-            if (current_offset + sizeof(uint8_t) > total_payload_len)
-            {
-                throw std::runtime_error("Payload too small for UDP Type");
-            }
-
-            memcpy(&udp_type, payload_data_ptr + current_offset, sizeof(uint8_t));
-            current_offset += sizeof(uint8_t);
-
-            if (current_offset + sizeof(uint16_t) > total_payload_len)
-            {
-                throw std::runtime_error("Payload too small for Content Len");
-            }
-
-            uint16_t net_content_len;
-            memcpy(&net_content_len, payload_data_ptr + current_offset, sizeof(uint16_t));
-            content_len = ntohs(net_content_len);
-            current_offset += sizeof(uint16_t);
-
-            if (content_len > total_payload_len - current_offset)
-            {
-                throw std::runtime_error("Content length exceeds remaining payload");
-            }
-            
-            content_data_ptr = payload_data_ptr + current_offset;
-
-            std::string formatted_output = format_received_message(sender_ip_str, sender_port, topic, udp_type, content_data_ptr, content_len);
-            std::cout << formatted_output << std::endl;
-        }
-        catch (const std::runtime_error &e)
-        {
-            std::cerr << "ERROR: Deserialization failed - " << e.what() << ". Skipping packet." << std::endl;
-        }
-    }
-}
-
-static void handle_server_message(int client_socket, CircularBuffer<char> &server_data_buffer, bool &running)
+static void handle_server_message(int client_socket, CircularBuffer<char> &server_data_buffer, bool &running,
+                                  LatencyTracker *tracker, WireDictionaryTable &dictionary)
 {
     ssize_t bytes_received = receive_server_data(client_socket, server_data_buffer);
     if (bytes_received < 0)
@@ -588,5 +545,24 @@ static void handle_server_message(int client_socket, CircularBuffer<char> &serve
         running = false;
         return;
     }
-    deserialize_and_process_message(server_data_buffer);
+    std::lock_guard<std::mutex> lock(output_mutex);
+    deserialize_and_process_message(server_data_buffer, std::cout, tracker, dictionary);
+}
+
+static int run_relay(int client_socket, const std::string &relay_address)
+{
+    EdgeRelay relay(client_socket);
+    if (!relay.listen_on(relay_address))
+    {
+        close(client_socket);
+        return 1;
+    }
+    relay.run();
+    close(client_socket);
+
+    const RelayStats &stats = relay.get_stats();
+    std::cout << "relay messages=" << stats.messages << " deliveries=" << stats.deliveries
+              << " bytes_out=" << stats.bytes_out << " dropped_clients=" << stats.dropped_clients
+              << " upstream_patterns=" << relay.upstream_patterns() << std::endl;
+    return 0;
 }